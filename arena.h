@@ -0,0 +1,137 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "types.h"
+
+// STL
+#include <assert.h>
+#include <new>
+#include <utility>
+
+namespace stacklang {
+
+// Bump pointer allocator. Everything allocated is freed at once when the
+// arena is released or destroyed; destructors aren't run.
+class Arena {
+public:
+	Arena(int64 block_size = 64*1024) : block_size_(block_size) {
+		assert(block_size_ > 0);
+	}
+	Arena(const Arena& other) = delete;
+	Arena(Arena&& other)
+		: block_size_(other.block_size_),
+		  head_(other.head_),
+		  pos_(other.pos_),
+		  end_(other.end_),
+		  bytes_(other.bytes_) {
+		other.head_ = nullptr;
+		other.pos_ = nullptr;
+		other.end_ = nullptr;
+		other.bytes_ = 0;
+	}
+	~Arena() {
+		Release();
+	}
+	Arena& operator=(const Arena& other) = delete;
+
+	// align must be a power of two
+	void* Allocate(int64 size, int64 align) {
+		char* aligned = Align(pos_, align);
+		if(pos_ == nullptr || aligned + size > end_) {
+			NewBlock(size + align);
+			aligned = Align(pos_, align);
+		}
+		pos_ = aligned + size;
+		bytes_ += size;
+		return aligned;
+	}
+
+	template<typename T, typename... Args>
+	T* New(Args&&... args) {
+		return new(Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	// Frees every block. Pointers into the arena are invalid after.
+	void Release() {
+		while(head_) {
+			Block* prev = head_->prev;
+			delete[] (char*)head_;
+			head_ = prev;
+		}
+		pos_ = nullptr;
+		end_ = nullptr;
+		bytes_ = 0;
+	}
+
+	// Takes over other's blocks, which are freed along with this arena's.
+	// Allocation continues in this arena's current block.
+	void Adopt(Arena&& other) {
+		if(other.head_ == nullptr) {
+			return;
+		}
+		if(head_ == nullptr) {
+			head_ = other.head_;
+			pos_ = other.pos_;
+			end_ = other.end_;
+		} else {
+			Block* oldest = other.head_;
+			while(oldest->prev) {
+				oldest = oldest->prev;
+			}
+			oldest->prev = head_->prev;
+			head_->prev = other.head_;
+		}
+		bytes_ += other.bytes_;
+		other.head_ = nullptr;
+		other.pos_ = nullptr;
+		other.end_ = nullptr;
+		other.bytes_ = 0;
+	}
+
+	// Total size of allocations, not counting alignment
+	int64 BytesAllocated()const {
+		return bytes_;
+	}
+
+	bool Owns(const void* p)const {
+		for(Block* block = head_;block;block = block->prev) {
+			const char* begin = (const char*)(block + 1);
+			if(p >= begin && p < begin + block->size) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	// Followed by its storage
+	struct Block {
+		Block* prev;
+		int64 size;
+	};
+
+	static char* Align(char* p, int64 align) {
+		return (char*)((int64(p) + align - 1) & ~(align - 1));
+	}
+
+	void NewBlock(int64 min_size) {
+		// Large allocations get a block of their own
+		const int64 size = min_size > block_size_ ? min_size : block_size_;
+		auto* block = (Block*)new char[sizeof(Block) + size];
+		block->prev = head_;
+		block->size = size;
+		head_ = block;
+		pos_ = (char*)(block + 1);
+		end_ = pos_ + size;
+	}
+
+	int64 block_size_;
+	Block* head_ = nullptr;
+	char* pos_ = nullptr;
+	char* end_ = nullptr;
+	int64 bytes_ = 0;
+};
+
+};  // stacklang
+
+#endif//ARENA_H
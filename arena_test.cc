@@ -0,0 +1,124 @@
+#include "arena.h"
+
+#include <cstdio>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+struct Node {
+	Node(int64 value, Node* next) : value(value), next(next) {}
+	int64 value;
+	Node* next;
+};
+
+void TestNew() {
+	fprintf(stderr, "--- TestNew ---\n");
+	Arena arena;
+	Node* list = nullptr;
+	for(int64 i=0;i<10000;++i) {
+		list = arena.New<Node>(i, list);
+	}
+	int64 sum = 0;
+	int64 count = 0;
+	for(Node* node = list;node;node = node->next) {
+		sum += node->value;
+		++count;
+	}
+	ExpectEq(count, 10000);
+	ExpectEq(sum, 9999 * 10000 / 2);
+	ExpectEq(arena.BytesAllocated(), 10000 * sizeof(Node));
+	Expect(arena.Owns(list));
+	Node outside(0, nullptr);
+	Expect(!arena.Owns(&outside));
+}
+
+void TestAlignment() {
+	fprintf(stderr, "--- TestAlignment ---\n");
+	Arena arena(/*block_size=*/64);
+	for(int64 i=0;i<100;++i) {
+		arena.Allocate(1, 1);
+		void* p = arena.Allocate(8, 16);
+		ExpectEq(int64(p) % 16, 0);
+	}
+}
+
+void TestLargeAllocation() {
+	fprintf(stderr, "--- TestLargeAllocation ---\n");
+	Arena arena(/*block_size=*/64);
+	char* big = (char*)arena.Allocate(1000, 1);
+	big[999] = 1;
+	Expect(arena.Owns(big + 999));
+}
+
+void TestRelease() {
+	fprintf(stderr, "--- TestRelease ---\n");
+	Arena arena;
+	Node* node = arena.New<Node>(1, nullptr);
+	arena.Release();
+	ExpectEq(arena.BytesAllocated(), 0);
+	Expect(!arena.Owns(node));
+	// Usable after release
+	node = arena.New<Node>(2, nullptr);
+	ExpectEq(node->value, 2);
+}
+
+void TestMove() {
+	fprintf(stderr, "--- TestMove ---\n");
+	Arena arena;
+	Node* node = arena.New<Node>(1, nullptr);
+	Arena moved(std::move(arena));
+	Expect(moved.Owns(node));
+	Expect(!arena.Owns(node));
+}
+
+void TestAdopt() {
+	fprintf(stderr, "--- TestAdopt ---\n");
+	Arena arena(/*block_size=*/64);
+	Node* mine = arena.New<Node>(1, nullptr);
+	Arena other(/*block_size=*/64);
+	Node* theirs = nullptr;
+	for(int64 i=0;i<10;++i) {
+		theirs = other.New<Node>(i, theirs);
+	}
+	arena.Adopt(std::move(other));
+	Expect(arena.Owns(mine));
+	Expect(arena.Owns(theirs));
+	Expect(!other.Owns(theirs));
+	ExpectEq(arena.BytesAllocated(), 11 * sizeof(Node));
+	ExpectEq(other.BytesAllocated(), 0);
+	// Still allocates after what it had
+	Node* next = arena.New<Node>(2, mine);
+	Expect(arena.Owns(next));
+
+	Arena empty;
+	empty.Adopt(std::move(arena));
+	Expect(empty.Owns(mine));
+	Expect(empty.Owns(theirs));
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestNew();
+	stacklang::TestAlignment();
+	stacklang::TestLargeAllocation();
+	stacklang::TestRelease();
+	stacklang::TestMove();
+	stacklang::TestAdopt();
+	return 0;
+}
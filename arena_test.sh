@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z  ./arena_test.cc -o /tmp/arena_test
+/tmp/arena_test
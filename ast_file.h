@@ -0,0 +1,910 @@
+#ifndef AST_FILE_H
+#define AST_FILE_H
+
+#include "string.h"
+#include "vector.h"
+#include "buffer.h"
+#include "hash_map.h"
+#include "arena.h"
+#include "utils.h"
+#include "parser.h"
+
+// STL
+#include <assert.h>
+#include <cstring>
+#include <stdint.h>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace stacklang {
+namespace compiler {
+
+// Binary image of a namespace and every node reachable from it, which can
+// be mapped and read in place.
+//
+// References are offsets from the start of the image, 0 for null, so
+// nothing needs fixing up after loading. Names are stored once each.
+// Every node is an AstRecord followed by the offsets of its children,
+// which depend on the kind:
+//   Namespace       decls... | nested namespaces...       split[0] = #decls
+//   ReturnStmt      value
+//   VarDecl         type, init params...                  flags = init type
+//   TemplateParam                                         flags = param kind
+//   TypedefDecl     base
+//   FuncDecl        return type, template params... | params... | body...
+//                   flags = is prototype
+//   StructDecl      template params... | inner decls...   flags = is class
+//   UsingDecl       base, template params...
+//   DeclRef         decl, template args...
+//   Literal         value
+//   MemberExpr      base                                  name = member,
+//                                                         flags = ->
+//   UnaryOp         sub                                   name = op,
+//                                                         flags = postfix
+//   CastExpr        sub, to type                          flags = cast type
+//   ParenExpr       sub
+//   BinaryOp        left, right                           name = op
+//   FuncCall        callee, args...
+//   CtorCall        type, args...
+//   DeclRefType     decl ref
+//   IntegerValue                                          value
+//   TemplateArg     type, int value
+// Types which are also Decls are stored once, as Stmts.
+// Kinds are the in-memory enums, so kAstFileVersion changes with them.
+
+const uint32_t kAstFileMagic = 0x5453414b;  // "KAST"
+const uint32_t kAstFileVersion = 1;
+
+enum AstCategory : uint8_t {
+	AstCategory_Null,
+	AstCategory_Namespace,
+	AstCategory_Stmt,
+	// Only types which aren't Decls
+	AstCategory_Type,
+	AstCategory_Value,
+	AstCategory_TemplateArg,
+};
+
+struct AstFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	// Of the whole image
+	uint32_t size;
+	// Namespace record
+	uint32_t root;
+};
+
+struct AstRecord {
+	AstCategory category;
+	// StmtKind, TypeKind or ValueKind
+	uint8_t kind;
+	uint16_t flags;
+	// Offset of an AstString, 0 if none
+	uint32_t name;
+	uint64_t loc;
+	uint64_t value;
+	// Ends of the first groups of children, where a kind has groups
+	uint32_t split[2];
+	uint32_t count;
+	// Followed by count child offsets
+};
+
+struct AstString {
+	uint32_t len;
+	// Followed by len chars and a 0
+};
+
+// 12 bits of file, 32 of line and 20 of column. Unknown or too large
+// parts read back as unknown.
+uint64_t PackLoc(LocationRef loc) {
+	auto pack = [](int64 value, int64 bits) -> uint64_t {
+		const uint64_t unknown = (uint64_t(1) << bits) - 1;
+		return value < unknown ? value : unknown;
+	};
+	return (pack(loc.fileno, 12) << 52) | (pack(loc.lineno, 32) << 20) | pack(loc.colno, 20);
+}
+
+LocationRef UnpackLoc(uint64_t packed) {
+	auto unpack = [](uint64_t field, int64 bits) -> int64 {
+		const uint64_t unknown = (uint64_t(1) << bits) - 1;
+		return field == unknown ? -1 : field;
+	};
+	return LocationRef{.fileno = unpack(packed >> 52, 12),
+					   .lineno = unpack((packed >> 20) & 0xffffffff, 32),
+					   .colno = unpack(packed & 0xfffff, 20)};
+}
+
+// A record, read in place
+class AstNode {
+public:
+	AstNode() {}
+	AstNode(const char* image, uint32_t offset) : image_(image), offset_(offset) { }
+
+	bool IsNull()const {
+		return offset_ == 0;
+	}
+	uint32_t Offset()const {
+		return offset_;
+	}
+	AstCategory GetCategory()const {
+		return Record()->category;
+	}
+	int64 GetKind()const {
+		return Record()->kind;
+	}
+	int64 GetFlags()const {
+		return Record()->flags;
+	}
+	// "" if none
+	string GetName()const {
+		if(Record()->name == 0) {
+			return "";
+		}
+		auto* str = (const AstString*)(image_ + Record()->name);
+		return string((const char*)(str + 1), str->len);
+	}
+	LocationRef GetLoc()const {
+		return UnpackLoc(Record()->loc);
+	}
+	int64 GetValue()const {
+		return Record()->value;
+	}
+	int64 GetSplit(int64 index)const {
+		return Record()->split[index];
+	}
+	int64 ChildCount()const {
+		return Record()->count;
+	}
+	// Null node for null children
+	AstNode Child(int64 index)const {
+		assert(index < ChildCount());
+		return AstNode(image_, ((const uint32_t*)(Record() + 1))[index]);
+	}
+
+private:
+	const AstRecord* Record()const {
+		assert(offset_ != 0);
+		return (const AstRecord*)(image_ + offset_);
+	}
+
+	const char* image_ = nullptr;
+	uint32_t offset_ = 0;
+};
+
+// A complete image, in memory or mapped from a file
+class AstImage {
+public:
+	// data must outlive the image
+	AstImage(const char* data, int64 size) throws(Status) : data_(data), size_(size) {
+		Validate() throws();
+	}
+	AstImage(const AstImage& other) = delete;
+	AstImage(AstImage&& other)
+		: data_(other.data_), size_(other.size_), mapped_(other.mapped_) {
+		other.data_ = nullptr;
+		other.size_ = 0;
+		other.mapped_ = false;
+	}
+	~AstImage() {
+		if(mapped_) {
+			munmap((void*)data_, size_);
+		}
+	}
+	AstImage& operator=(const AstImage& other) = delete;
+
+	// Maps the file read only. Names of nodes loaded from the image point
+	// into the mapping, so the image must outlive them.
+	static AstImage Map(string path) throws(Status) {
+		int fd = open(string(path).c_str(), O_RDONLY);
+		if(fd < 0) {
+			throw Status{.message = string("Couldn't open ") + path};
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size < off_t(sizeof(AstFileHeader))) {
+			close(fd);
+			throw Status{.message = string("Not an AST file ") + path};
+		}
+		void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(data == MAP_FAILED) {
+			throw Status{.message = string("Couldn't map ") + path};
+		}
+		AstImage image((const char*)data, st.st_size, /*mapped=*/true);
+		image.Validate() throws();
+		return image;
+	}
+
+	AstNode Root()const {
+		return AstNode(data_, ((const AstFileHeader*)data_)->root);
+	}
+	const char* data()const {
+		return data_;
+	}
+	int64 len()const {
+		return size_;
+	}
+
+	// Throws unless the record at offset, its name and its child offsets
+	// are within the image, so a node read from a corrupt image can't read
+	// outside it. The children themselves are checked when they're read.
+	void CheckRecord(uint32_t offset)const throws(Status) {
+		// size_ is unsigned, so it's compared before being subtracted from
+		if(offset < sizeof(AstFileHeader) || offset % alignof(AstRecord) != 0 ||
+		   size_ < sizeof(AstRecord) || offset > size_ - sizeof(AstRecord)) {
+			throw Status{.message = "Corrupt AST image"};
+		}
+		auto* record = (const AstRecord*)(data_ + offset);
+		const int64 room = (size_ - offset - sizeof(AstRecord)) / sizeof(uint32_t);
+		if(record->category == AstCategory_Null || record->category > AstCategory_TemplateArg ||
+		   record->count > room || record->split[0] > record->count ||
+		   record->split[1] > record->count) {
+			throw Status{.message = "Corrupt AST image"};
+		}
+		if(record->name != 0) {
+			const uint32_t name = record->name;
+			if(name < sizeof(AstFileHeader) || name % alignof(AstString) != 0 ||
+			   size_ < sizeof(AstString) + 1 || name > size_ - sizeof(AstString) - 1 ||
+			   ((const AstString*)(data_ + name))->len > size_ - name - sizeof(AstString) - 1) {
+				throw Status{.message = "Corrupt AST image"};
+			}
+		}
+		auto* children = (const uint32_t*)(record + 1);
+		for(uint32_t i=0;i<record->count;++i) {
+			if(children[i] >= size_) {
+				throw Status{.message = "Corrupt AST image"};
+			}
+		}
+	}
+
+private:
+	AstImage(const char* data, int64 size, bool mapped)
+		: data_(data), size_(size), mapped_(mapped) { }
+
+	void Validate()const throws(Status) {
+		auto* header = (const AstFileHeader*)data_;
+		if(size_ < sizeof(AstFileHeader) || header->magic != kAstFileMagic) {
+			throw Status{.message = "Not an AST image"};
+		}
+		if(header->version != kAstFileVersion) {
+			throw Status{.message = "AST image is from another version"};
+		}
+		if(header->size != size_ || header->root == 0 || header->root >= size_) {
+			throw Status{.message = "Truncated AST image"};
+		}
+	}
+
+	const char* data_;
+	int64 size_;
+	bool mapped_ = false;
+};
+
+namespace internal {
+
+// Assigns each node a record as it's first referenced, and fills in its
+// children afterwards, so deep trees don't recurse
+class AstWriter {
+public:
+	AstWriter() {
+		Allocate(sizeof(AstFileHeader), 8);
+	}
+
+	buffer<char> Write(const Namespace& ns) {
+		const uint32_t root = RefNamespace(&ns);
+		while(!pending_.empty()) {
+			Pending pending = pending_.pop_back();
+			for(int64 i=0;i<pending.children.len();++i) {
+				const uint32_t child = Ref(pending.children[i]);
+				memcpy(data_.data() + pending.record + sizeof(AstRecord) + i * sizeof(uint32_t),
+					   &child, sizeof(child));
+			}
+		}
+		AstFileHeader header{.magic = kAstFileMagic,
+							 .version = kAstFileVersion,
+							 .size = uint32_t(data_.len()),
+							 .root = root};
+		memcpy(data_.data(), &header, sizeof(header));
+		return std::move(data_);
+	}
+
+private:
+	struct Child {
+		AstCategory category;
+		const void* node;
+		TemplateArg arg;
+	};
+
+	struct Pending {
+		uint32_t record;
+		vector<Child> children;
+	};
+
+	int64 Allocate(int64 size, int64 align) {
+		int64 offset = data_.len();
+		offset = (offset + align - 1) & ~(align - 1);
+		// resize alone reserves exactly what's asked for
+		if(offset + size > data_.capacity()) {
+			data_.reserve((offset + size) * 2);
+		}
+		// Zero fills, including padding, so images are reproducible
+		data_.resize(offset + size);
+		return offset;
+	}
+
+	uint32_t Intern(string s) {
+		if(const uint32_t* found = strings_.find(s)) {
+			return *found;
+		}
+		const uint32_t len = s.len();
+		const int64 offset = Allocate(sizeof(AstString) + len + 1, alignof(AstString));
+		memcpy(data_.data() + offset, &len, sizeof(len));
+		memcpy(data_.data() + offset + sizeof(AstString), s.data(), len);
+		// Not by the copy, which moves as the image grows. Names outlive
+		// the Write they're interned in.
+		strings_.set(s, offset);
+		return offset;
+	}
+
+	uint32_t Ref(Child child) {
+		switch(child.category) {
+			case AstCategory_Namespace:
+				return RefNamespace((const Namespace*)child.node);
+			case AstCategory_Stmt:
+				return RefStmt((const Stmt*)child.node);
+			case AstCategory_Type:
+				return RefType((const Type*)child.node);
+			case AstCategory_Value:
+				return RefValue((const Value*)child.node);
+			case AstCategory_TemplateArg:
+				return RefTemplateArg(child.arg);
+			default:
+				return 0;
+		}
+	}
+
+	// New record whose children are filled in later
+	uint32_t NewRecord(const void* node, AstRecord record, vector<Child> children) {
+		record.count = children.len();
+		const int64 offset = Allocate(sizeof(AstRecord) + children.len() * sizeof(uint32_t), 8);
+		memcpy(data_.data() + offset, &record, sizeof(record));
+		if(node) {
+			records_.set(node, offset);
+		}
+		pending_.push_back(Pending{.record = uint32_t(offset), .children = children});
+		return offset;
+	}
+
+	static Child StmtChild(const Stmt* stmt) {
+		return Child{.category = AstCategory_Stmt, .node = stmt};
+	}
+	static Child TypeChild(const Type* type) {
+		return Child{.category = AstCategory_Type, .node = type};
+	}
+
+	uint32_t RefNamespace(const Namespace* ns) {
+		if(const uint32_t* found = records_.find(ns)) {
+			return *found;
+		}
+		vector<Child> children;
+		for(Decl* decl : ns->GetDecls()) {
+			children.push_back(StmtChild(decl));
+		}
+		for(Namespace* nested : ns->GetNested()) {
+			children.push_back(Child{.category = AstCategory_Namespace, .node = nested});
+		}
+		return NewRecord(ns, AstRecord{.category = AstCategory_Namespace,
+									   .name = Intern(ns->GetName()),
+									   .loc = PackLoc(ns->GetLoc()),
+									   .split = {uint32_t(ns->GetDecls().len()), 0}},
+						 children);
+	}
+
+	uint32_t RefType(const Type* type) {
+		if(type == nullptr) {
+			return 0;
+		}
+		if(Stmt* decl = TypeAsStmt((Type*)type)) {
+			return RefStmt(decl);
+		}
+		if(const uint32_t* found = records_.find(type)) {
+			return *found;
+		}
+		vector<Child> children;
+		if(auto* ref_type = dyn_cast<DeclRefType>((Type*)type)) {
+			children.push_back(StmtChild(ref_type->GetDeclRef()));
+		}
+		return NewRecord(type, AstRecord{.category = AstCategory_Type,
+										 .kind = uint8_t(type->GetTypeKind())},
+						 children);
+	}
+
+	uint32_t RefValue(const Value* value) {
+		if(value == nullptr) {
+			return 0;
+		}
+		if(const uint32_t* found = records_.find(value)) {
+			return *found;
+		}
+		AstRecord record{.category = AstCategory_Value,
+						 .kind = uint8_t(value->GetValueKind())};
+		if(auto* integer = dyn_cast<IntegerValue>((Value*)value)) {
+			record.value = integer->GetValue();
+		}
+		return NewRecord(value, record, {});
+	}
+
+	uint32_t RefTemplateArg(TemplateArg arg) {
+		return NewRecord(nullptr, AstRecord{.category = AstCategory_TemplateArg},
+						 {TypeChild(arg.type), StmtChild(arg.int_value)});
+	}
+
+	uint32_t RefStmt(const Stmt* const_stmt) {
+		if(const_stmt == nullptr) {
+			return 0;
+		}
+		if(const uint32_t* found = records_.find(const_stmt)) {
+			return *found;
+		}
+		Stmt* stmt = (Stmt*)const_stmt;
+		AstRecord record{.category = AstCategory_Stmt,
+						 .kind = uint8_t(stmt->GetStmtKind()),
+						 .loc = PackLoc(stmt->GetLoc())};
+		if(auto* decl = dyn_cast<Decl>(stmt)) {
+			record.name = Intern(decl->GetName());
+		}
+		vector<Child> children;
+		auto add_template_params = [&children](TemplatedDecl* decl) {
+			for(TemplateParam* param : decl->GetTemplateParams()) {
+				children.push_back(StmtChild(param));
+			}
+		};
+		auto add_exprs = [&children](vector<Expr*> exprs) {
+			for(Expr* expr : exprs) {
+				children.push_back(StmtChild(expr));
+			}
+		};
+
+		switch(stmt->GetStmtKind()) {
+			case StmtKind_ReturnStmt:
+				children.push_back(StmtChild(cast<ReturnStmt>(stmt)->GetValue()));
+				break;
+			case StmtKind_VarDecl: {
+				auto* var = cast<VarDecl>(stmt);
+				record.flags = var->GetInitType();
+				children.push_back(TypeChild(var->GetType()));
+				add_exprs(var->GetInitParams());
+				break;
+			}
+			case StmtKind_TemplateParam:
+				record.flags = cast<TemplateParam>(stmt)->GetKind();
+				break;
+			case StmtKind_TypedefDecl:
+				children.push_back(TypeChild(cast<TypedefDecl>(stmt)->GetBase()));
+				break;
+			case StmtKind_FuncDecl: {
+				auto* func = cast<FuncDecl>(stmt);
+				record.flags = func->IsPrototype();
+				children.push_back(TypeChild(func->GetReturnType()));
+				add_template_params(func);
+				record.split[0] = children.len();
+				for(VarDecl* param : func->GetParameters()) {
+					children.push_back(StmtChild(param));
+				}
+				record.split[1] = children.len();
+				for(Stmt* body_stmt : func->GetBody()) {
+					children.push_back(StmtChild(body_stmt));
+				}
+				break;
+			}
+			case StmtKind_StructDecl: {
+				auto* struct_decl = cast<StructDecl>(stmt);
+				record.flags = struct_decl->IsDeclaredClass();
+				add_template_params(struct_decl);
+				record.split[0] = children.len();
+				for(Decl* inner : struct_decl->GetInnerDecls()) {
+					children.push_back(StmtChild(inner));
+				}
+				break;
+			}
+			case StmtKind_UsingDecl:
+			case StmtKind_UsingAliasDecl: {
+				auto* using_decl = cast<UsingDecl>(stmt);
+				children.push_back(TypeChild(using_decl->GetBase()));
+				add_template_params(using_decl);
+				break;
+			}
+			case StmtKind_DeclRef: {
+				auto* ref = cast<DeclRef>(stmt);
+				children.push_back(StmtChild(ref->GetRef()));
+				for(TemplateArg arg : ref->GetTemplateArgs()) {
+					children.push_back(Child{.category = AstCategory_TemplateArg, .arg = arg});
+				}
+				break;
+			}
+			case StmtKind_Literal:
+				children.push_back(Child{.category = AstCategory_Value,
+										 .node = cast<Literal>(stmt)->GetValue()});
+				break;
+			case StmtKind_MemberExpr: {
+				auto* member = cast<MemberExpr>(stmt);
+				record.name = Intern(member->GetMemberName());
+				record.flags = member->IsPointer();
+				children.push_back(StmtChild(member->GetBase()));
+				break;
+			}
+			case StmtKind_UnaryOp: {
+				auto* uop = cast<UnaryOp>(stmt);
+				record.name = Intern(uop->GetOp());
+				record.flags = uop->IsPostfix();
+				children.push_back(StmtChild(uop->GetSub()));
+				break;
+			}
+			case StmtKind_CastExpr: {
+				auto* cast_expr = cast<CastExpr>(stmt);
+				record.flags = cast_expr->GetCastType();
+				children.push_back(StmtChild(cast_expr->GetSub()));
+				children.push_back(TypeChild(cast_expr->GetToType()));
+				break;
+			}
+			case StmtKind_ParenExpr:
+				children.push_back(StmtChild(cast<ParenExpr>(stmt)->GetSub()));
+				break;
+			case StmtKind_BinaryOp: {
+				auto* bop = cast<BinaryOp>(stmt);
+				record.name = Intern(bop->GetOp());
+				children.push_back(StmtChild(bop->GetLeft()));
+				children.push_back(StmtChild(bop->GetRight()));
+				break;
+			}
+			case StmtKind_FuncCall: {
+				auto* call = cast<FuncCall>(stmt);
+				children.push_back(StmtChild(call->GetCallee()));
+				add_exprs(call->GetArgs());
+				break;
+			}
+			case StmtKind_CtorCall: {
+				auto* ctor = cast<CtorCall>(stmt);
+				children.push_back(TypeChild(ctor->GetType()));
+				add_exprs(ctor->GetArgs());
+				break;
+			}
+		}
+		return NewRecord(stmt, record, children);
+	}
+
+	buffer<char> data_;
+	hash_map<string, uint32_t> strings_;
+	hash_map<const void*, uint32_t> records_;
+	buffer<Pending> pending_;
+};
+
+// Builds nodes bottom up with an explicit stack. Function bodies are
+// built last, as they may refer back to their function.
+class AstLoader {
+public:
+	AstLoader(const AstImage& image, Arena* arena) : image_(image), arena_(arena) { }
+
+	Namespace* Load() throws(Status) {
+		Resolve(image_.Root()) throws();
+		auto* root = (Namespace*)Required(Built(image_.Root(), AstCategory_Namespace) throws()) throws();
+		for(int64 i=0;i<bodies_.len();++i) {
+			FuncDecl* func = bodies_[i].func;
+			const AstNode node = bodies_[i].node;
+			vector<Stmt*> body;
+			for(int64 c=node.GetSplit(1);c<node.ChildCount();++c) {
+				Resolve(node.Child(c)) throws();
+				body.push_back(Required(BuiltStmt<Stmt>(node.Child(c)) throws()) throws());
+			}
+			func->SetBody(body);
+		}
+		return root;
+	}
+
+private:
+	struct Frame {
+		AstNode node;
+		int64 next_child;
+	};
+
+	struct Body {
+		FuncDecl* func;
+		AstNode node;
+	};
+
+	// Children which must be built before the node itself
+	static int64 RequiredChildren(AstNode node) {
+		if(node.GetCategory() == AstCategory_Stmt && node.GetKind() == StmtKind_FuncDecl) {
+			return node.GetSplit(1);
+		}
+		return node.ChildCount();
+	}
+
+	void* Resolve(AstNode root) throws(Status) {
+		if(root.IsNull()) {
+			return nullptr;
+		}
+		if(!built_.contains(root.Offset())) {
+			image_.CheckRecord(root.Offset()) throws();
+		}
+		buffer<Frame> stack;
+		stack.push_back(Frame{.node = root, .next_child = 0});
+		while(!stack.empty()) {
+			Frame& frame = stack.back();
+			if(frame.next_child == 0 && built_.contains(frame.node.Offset())) {
+				stack.pop_back();
+				continue;
+			}
+			const AstNode node = frame.node;
+			bool ready = true;
+			for(;frame.next_child < RequiredChildren(node);++frame.next_child) {
+				AstNode child = node.Child(frame.next_child);
+				if(child.IsNull() || built_.contains(child.Offset())) {
+					continue;
+				}
+				if(building_.contains(child.Offset())) {
+					throw Status{.message = "Cyclic AST image"};
+				}
+				image_.CheckRecord(child.Offset()) throws();
+				building_.set(child.Offset(), true);
+				ready = false;
+				// Invalidates frame
+				stack.push_back(Frame{.node = child, .next_child = 0});
+				break;
+			}
+			if(ready) {
+				built_.set(node.Offset(), Build(node) throws());
+				building_.remove(node.Offset());
+				stack.pop_back();
+			}
+		}
+		return *built_.find(root.Offset());
+	}
+
+	// Child index of node, which must have it
+	static AstNode Child(AstNode node, int64 index) throws(Status) {
+		if(index >= node.ChildCount()) {
+			throw Status{.message = "Corrupt AST image"};
+		}
+		return node.Child(index);
+	}
+	// Flags of node as an enum no greater than last
+	static int64 Flags(AstNode node, int64 last) throws(Status) {
+		if(node.GetFlags() > last) {
+			throw Status{.message = "Corrupt AST image"};
+		}
+		return node.GetFlags();
+	}
+	// Throws if a child which can't be null is
+	template<typename T>
+	static T* Required(T* built) throws(Status) {
+		if(built == nullptr) {
+			throw Status{.message = "Corrupt AST image"};
+		}
+		return built;
+	}
+
+	// Of a built child, which must be of category
+	void* Built(AstNode node, AstCategory category) throws(Status) {
+		if(node.IsNull()) {
+			return nullptr;
+		}
+		// Only children a node's kind needs first are built
+		void* const* built = built_.find(node.Offset());
+		if(built == nullptr || node.GetCategory() != category) {
+			throw Status{.message = "Corrupt AST image"};
+		}
+		return *built;
+	}
+	// nullptr for null, throws if it isn't a T
+	template<typename T>
+	T* BuiltStmt(AstNode node) throws(Status) {
+		auto* stmt = (Stmt*)Built(node, AstCategory_Stmt) throws();
+		if(stmt != nullptr && !isa<T>(stmt)) {
+			throw Status{.message = "Corrupt AST image"};
+		}
+		return (T*)stmt;
+	}
+	Expr* BuiltExpr(AstNode node) throws(Status) {
+		return BuiltStmt<Expr>(node);
+	}
+	Type* BuiltType(AstNode node) throws(Status) {
+		if(node.IsNull()) {
+			return nullptr;
+		}
+		if(node.GetCategory() == AstCategory_Stmt) {
+			Type* type = StmtAsType(BuiltStmt<Stmt>(node) throws());
+			if(type == nullptr) {
+				throw Status{.message = "Corrupt AST image"};
+			}
+			return type;
+		}
+		return (Type*)Built(node, AstCategory_Type);
+	}
+	vector<TemplateParam*> BuiltTemplateParams(AstNode node, int64 begin, int64 end) throws(Status) {
+		vector<TemplateParam*> ret;
+		for(int64 c=begin;c<end;++c) {
+			ret.push_back(Required(BuiltStmt<TemplateParam>(Child(node, c)) throws()) throws());
+		}
+		return ret;
+	}
+	vector<Expr*> BuiltExprs(AstNode node, int64 begin) throws(Status) {
+		vector<Expr*> ret;
+		for(int64 c=begin;c<node.ChildCount();++c) {
+			ret.push_back(BuiltExpr(Child(node, c)) throws());
+		}
+		return ret;
+	}
+
+	void* Build(AstNode node) throws(Status) {
+		const string name = node.GetName();
+		const LocationRef loc = node.GetLoc();
+		switch(node.GetCategory()) {
+			case AstCategory_Namespace: {
+				auto* ns = arena_->New<Namespace>(name, loc);
+				for(int64 c=0;c<node.ChildCount();++c) {
+					if(c < node.GetSplit(0)) {
+						ns->AddDecl(Required(BuiltStmt<Decl>(Child(node, c)) throws()) throws());
+					} else {
+						auto* nested = (Namespace*)Built(Child(node, c), AstCategory_Namespace) throws();
+						ns->AddNested(Required(nested) throws()) throws();
+					}
+				}
+				return ns;
+			}
+			case AstCategory_Type:
+				switch(node.GetKind()) {
+					case TypeKind_VoidType:
+						return static_cast<Type*>(VoidType::Get());
+					case TypeKind_IntType:
+						return static_cast<Type*>(IntType::Get());
+					case TypeKind_DeclRefType:
+						return static_cast<Type*>(arena_->New<DeclRefType>(
+							Required(BuiltStmt<DeclRef>(Child(node, 0)) throws()) throws()));
+				}
+				break;
+			case AstCategory_Value:
+				switch(node.GetKind()) {
+					case ValueKind_VoidValue:
+						return static_cast<Value*>(arena_->New<VoidValue>());
+					case ValueKind_IntegerValue:
+						return static_cast<Value*>(arena_->New<IntegerValue>(node.GetValue()));
+				}
+				break;
+			case AstCategory_TemplateArg:
+				return arena_->New<TemplateArg>(TemplateArg{.type = BuiltType(Child(node, 0)),
+															.int_value = BuiltExpr(Child(node, 1))});
+			case AstCategory_Stmt:
+				return BuildStmt(node, name, loc) throws();
+			default:
+				break;
+		}
+		throw Status{.message = "Unknown record in AST image"};
+	}
+
+	Stmt* BuildStmt(AstNode node, string name, LocationRef loc) throws(Status) {
+		switch(node.GetKind()) {
+			case StmtKind_ReturnStmt:
+				return arena_->New<ReturnStmt>(BuiltExpr(Child(node, 0)), loc);
+			case StmtKind_VarDecl: {
+				const auto init_type = VarDeclInitType(Flags(node, VarDeclInitType_InitList) throws());
+				if(init_type == VarDeclInitType_Equals && node.ChildCount() != 2) {
+					throw Status{.message = "Corrupt AST image"};
+				}
+				return arena_->New<VarDecl>(name, loc, BuiltType(Child(node, 0)), init_type,
+											BuiltExprs(node, 1));
+			}
+			case StmtKind_TemplateParam:
+				return arena_->New<TemplateParam>(name, TemplateParamKind(Flags(node, TemplateParamKind_Type) throws()), loc);
+			case StmtKind_TypedefDecl:
+				return arena_->New<TypedefDecl>(name, BuiltType(Child(node, 0)), loc);
+			case StmtKind_FuncDecl: {
+				vector<VarDecl*> params;
+				for(int64 c=node.GetSplit(0);c<node.GetSplit(1);++c) {
+					params.push_back(Required(BuiltStmt<VarDecl>(Child(node, c)) throws()) throws());
+				}
+				auto* func = arena_->New<FuncDecl>(name,
+					BuiltTemplateParams(node, 1, node.GetSplit(0)),
+					BuiltType(Child(node, 0)), params,
+					/*is_prototype=*/node.GetFlags() != 0,
+					/*body=*/vector<Stmt*>{}, loc);
+				bodies_.push_back(Body{.func = func, .node = node});
+				return func;
+			}
+			case StmtKind_StructDecl: {
+				vector<Decl*> inner_decls;
+				for(int64 c=node.GetSplit(0);c<node.ChildCount();++c) {
+					inner_decls.push_back(Required(BuiltStmt<Decl>(Child(node, c)) throws()) throws());
+				}
+				return arena_->New<StructDecl>(name, /*declared_class=*/node.GetFlags() != 0,
+											   BuiltTemplateParams(node, 0, node.GetSplit(0)),
+											   inner_decls, loc);
+			}
+			case StmtKind_UsingDecl:
+				return arena_->New<UsingDecl>(name, BuiltType(Child(node, 0)), loc,
+											  BuiltTemplateParams(node, 1, node.ChildCount()));
+			case StmtKind_UsingAliasDecl:
+				return arena_->New<UsingAliasDecl>(name, BuiltType(Child(node, 0)),
+												   BuiltTemplateParams(node, 1, node.ChildCount()),
+												   loc);
+			case StmtKind_DeclRef: {
+				vector<TemplateArg> args;
+				for(int64 c=1;c<node.ChildCount();++c) {
+					auto* arg = (TemplateArg*)Built(Child(node, c), AstCategory_TemplateArg) throws();
+					Required(arg) throws();
+					args.push_back(*arg);
+				}
+				return arena_->New<DeclRef>(Required(BuiltStmt<Decl>(Child(node, 0)) throws()) throws(), args, loc);
+			}
+			case StmtKind_Literal: {
+				auto* value = (Value*)Built(Child(node, 0), AstCategory_Value) throws();
+				return arena_->New<Literal>(Required(value) throws(), loc);
+			}
+			case StmtKind_MemberExpr:
+				return arena_->New<MemberExpr>(BuiltExpr(Child(node, 0)), name,
+											   /*pointer=*/node.GetFlags() != 0, loc);
+			case StmtKind_UnaryOp:
+				return arena_->New<UnaryOp>(name, /*postfix=*/node.GetFlags() != 0,
+											BuiltExpr(Child(node, 0)), loc);
+			case StmtKind_CastExpr:
+				return arena_->New<CastExpr>(CastType(Flags(node, CastType_Reinterpret) throws()), BuiltType(Child(node, 1)),
+											 BuiltExpr(Child(node, 0)), loc);
+			case StmtKind_ParenExpr:
+				return arena_->New<ParenExpr>(BuiltExpr(Child(node, 0)), loc);
+			case StmtKind_BinaryOp:
+				return arena_->New<BinaryOp>(name, BuiltExpr(Child(node, 0)),
+											 BuiltExpr(Child(node, 1)), loc);
+			case StmtKind_FuncCall:
+				return arena_->New<FuncCall>(Required(BuiltStmt<DeclRef>(Child(node, 0)) throws()) throws(),
+											 BuiltExprs(node, 1), loc);
+			case StmtKind_CtorCall:
+				return arena_->New<CtorCall>(BuiltType(Child(node, 0)), BuiltExprs(node, 1), loc);
+		}
+		throw Status{.message = "Unknown statement in AST image"};
+	}
+
+	const AstImage& image_;
+	Arena* arena_;
+	// Record offset to the node built from it
+	hash_map<int64, void*> built_;
+	hash_map<int64, bool> building_;
+	buffer<Body> bodies_;
+};
+
+}  // internal
+
+// Image of ns and every node it references, including declarations from
+// elsewhere such as system headers
+buffer<char> WriteAst(const Namespace& ns) {
+	internal::AstWriter writer;
+	return writer.Write(ns);
+}
+
+void WriteAstFile(const Namespace& ns, string path) throws(Status) {
+	buffer<char> image = WriteAst(ns);
+	FILE* f = fopen(string(path).c_str(), "wb");
+	if(f == nullptr) {
+		throw Status{.message = string("Couldn't open ") + path};
+	}
+	const int64 written = fwrite(image.data(), 1, image.len(), f);
+	fclose(f);
+	if(written != image.len()) {
+		throw Status{.message = string("Couldn't write ") + path};
+	}
+}
+
+// Builds the namespace without scanning or parsing. Nodes are allocated in
+// arena, and their names point into image. Each record is bounds checked
+// when first read, so a corrupt image throws rather than crashing.
+Namespace LoadAst(const AstImage& image, Arena* arena) throws(Status) {
+	internal::AstLoader loader(image, arena);
+	Namespace* root = loader.Load() throws();
+	return std::move(*root);
+}
+
+};  // compiler
+};  // stacklang
+
+#endif//AST_FILE_H
@@ -0,0 +1,228 @@
+#include "ast_file.h"
+#include "scanner.h"
+#include "test_programs.h"
+
+#include <cstdio>
+#include <string>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+void ExpectEq(string a, string b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %s != %s\n",
+			a.c_str(), b.c_str());
+	}
+}
+
+bool SameBytes(const buffer<char>& a, const buffer<char>& b) {
+	return a.len() == b.len() && memcmp(a.data(), b.data(), a.len()) == 0;
+}
+
+compiler::FuncDecl* FindFunc(const compiler::Namespace& ns, string name) {
+	return compiler::cast<compiler::FuncDecl>(ns.FindDecl(name));
+}
+
+void TestRoundTrip() {
+	fprintf(stderr, "--- TestRoundTrip ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(testing::kFooProgram);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	buffer<char> image = compiler::WriteAst(parsed);
+
+	compiler::AstImage view(image.data(), image.len());
+	compiler::AstNode root = view.Root();
+	ExpectEq(root.GetCategory(), compiler::AstCategory_Namespace);
+	ExpectEq(root.GetSplit(0), parsed.GetDecls().len());
+
+	Arena arena;
+	compiler::Namespace loaded = compiler::LoadAst(view, &arena);
+	ExpectEq(loaded.GetDecls().len(), parsed.GetDecls().len());
+	for(int64 i=0;i<loaded.GetDecls().len();++i) {
+		ExpectEq(loaded.GetDecls()[i]->GetName(), parsed.GetDecls()[i]->GetName());
+		ExpectEq(loaded.GetDecls()[i]->GetStmtKind(), parsed.GetDecls()[i]->GetStmtKind());
+	}
+	// Nothing lost or added
+	Expect(SameBytes(compiler::WriteAst(loaded), image));
+
+	compiler::FuncDecl* top = FindFunc(loaded, "top");
+	ExpectEq(top->GetParameters().len(), 2);
+	ExpectEq(top->GetLoc().lineno, FindFunc(parsed, "top")->GetLoc().lineno);
+	vector<compiler::Stmt*> body = top->GetBody();
+	ExpectEq(body.len(), 2);
+	auto* ret = compiler::cast<compiler::ReturnStmt>(body[1]);
+	auto* comma = compiler::cast<compiler::BinaryOp>(ret->GetValue());
+	ExpectEq(comma->GetOp(), ",");
+	auto* minus = compiler::cast<compiler::BinaryOp>(comma->GetLeft());
+	auto* times = compiler::cast<compiler::BinaryOp>(minus->GetLeft());
+	auto* call = compiler::cast<compiler::FuncCall>(times->GetLeft());
+	// References resolve to the loaded declarations
+	Expect(call->GetCallee()->GetRef() == loaded.FindDecl("sum"));
+	auto* member = compiler::cast<compiler::MemberExpr>(call->GetArgs()[1]);
+	ExpectEq(member->GetMemberName(), "a");
+	Expect(!member->IsPointer());
+	Expect(compiler::cast<compiler::DeclRef>(member->GetBase())->GetRef() == top->GetParameters()[0]);
+	auto* templated = compiler::cast<compiler::FuncCall>(times->GetRight());
+	ExpectEq(templated->GetCallee()->GetTemplateArgs().len(), 1);
+	Expect(compiler::cast<compiler::UnaryOp>(comma->GetRight())->IsPostfix());
+
+	auto* foo = compiler::cast<compiler::StructDecl>(loaded.FindDecl("Foo"));
+	ExpectEq(foo->GetTemplateParams().len(), 1);
+	ExpectEq(foo->GetInnerDecls().len(), 2);
+}
+
+void TestMappedFile() {
+	fprintf(stderr, "--- TestMappedFile ---\n");
+	const char* path = "/tmp/ast_file_test.ast";
+	compiler::TokenBuffer tokens = compiler::Scan(testing::kFooProgram);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::WriteAstFile(parsed, path);
+
+	Arena arena;
+	compiler::AstImage image = compiler::AstImage::Map(path);
+	compiler::Namespace loaded = compiler::LoadAst(image, &arena);
+	Expect(SameBytes(compiler::WriteAst(loaded), compiler::WriteAst(parsed)));
+	ExpectEq(FindFunc(loaded, "sum")->GetParameters()[2]->GetName(), "z");
+	unlink(path);
+}
+
+void TestRejectsBadImages() {
+	fprintf(stderr, "--- TestRejectsBadImages ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(testing::kFooProgram);
+	buffer<char> image = compiler::WriteAst(compiler::Parse(tokens));
+
+	int64 failures = 0;
+	try {
+		compiler::AstImage truncated(image.data(), image.len() - 8);
+	} catch(Status status) {
+		ExpectEq(status.message, "Truncated AST image");
+		++failures;
+	}
+	image[4] ^= 1;
+	try {
+		compiler::AstImage old_version(image.data(), image.len());
+	} catch(Status status) {
+		ExpectEq(status.message, "AST image is from another version");
+		++failures;
+	}
+	image[0] ^= 1;
+	try {
+		compiler::AstImage not_ast(image.data(), image.len());
+	} catch(Status status) {
+		ExpectEq(status.message, "Not an AST image");
+		++failures;
+	}
+	ExpectEq(failures, 3);
+	try {
+		compiler::AstImage::Map("/nonexistent/file.ast");
+		Expect(false);
+	} catch(Status status) {
+		++failures;
+	}
+	ExpectEq(failures, 4);
+}
+
+void TestRejectsCorruptRecords() {
+	fprintf(stderr, "--- TestRejectsCorruptRecords ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(testing::kFooProgram);
+	buffer<char> image = compiler::WriteAst(compiler::Parse(tokens));
+
+	// A child of the root outside the image
+	compiler::AstImage view(image.data(), image.len());
+	const int64 child = view.Root().Offset() + sizeof(compiler::AstRecord);
+	const uint32_t outside = image.len() + 64;
+	memcpy(image.data() + child, &outside, sizeof(outside));
+	try {
+		Arena arena;
+		compiler::LoadAst(view, &arena);
+		Expect(false);
+	} catch(Status status) {
+		ExpectEq(status.message, "Corrupt AST image");
+	}
+
+	// Any single corrupt byte is a Status or a different tree, never a crash
+	buffer<char> good = compiler::WriteAst(compiler::Parse(tokens));
+	int64 rejected = 0;
+	for(int64 i=sizeof(compiler::AstFileHeader);i<good.len();++i) {
+		buffer<char> bad = compiler::WriteAst(compiler::Parse(tokens));
+		bad[i] ^= 0x5a;
+		try {
+			Arena arena;
+			compiler::LoadAst(compiler::AstImage(bad.data(), bad.len()), &arena);
+		} catch(Status status) {
+			++rejected;
+		}
+	}
+	Expect(rejected > 0);
+
+	// Cut short, with the header's size matching. 24 bytes with the root
+	// after the header is too small for the root's record.
+	for(int64 len=sizeof(compiler::AstFileHeader);len<good.len();len+=8) {
+		buffer<char> cut;
+		cut.resize(len);
+		memcpy(cut.data(), good.data(), len);
+		auto* header = (compiler::AstFileHeader*)cut.data();
+		header->size = len;
+		if(len == 24) {
+			header->root = sizeof(compiler::AstFileHeader);
+		}
+		string error;
+		try {
+			Arena arena;
+			compiler::LoadAst(compiler::AstImage(cut.data(), cut.len()), &arena);
+		} catch(Status status) {
+			error = status.message;
+		}
+		Expect(error == "Corrupt AST image" || error == "Truncated AST image");
+		if(len == 24) {
+			ExpectEq(error, "Corrupt AST image");
+		}
+	}
+}
+
+// Neither writing nor loading recurses
+void TestDeepExpression() {
+	fprintf(stderr, "--- TestDeepExpression ---\n");
+	const int64 kTerms = 100000;
+	std::string src = testing::DeepSum(kTerms);
+	compiler::TokenBuffer tokens = compiler::Scan(src.c_str());
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	buffer<char> image = compiler::WriteAst(parsed);
+
+	Arena arena;
+	compiler::Namespace loaded = compiler::LoadAst(
+		compiler::AstImage(image.data(), image.len()), &arena);
+	compiler::Expr* expr = compiler::cast<compiler::ReturnStmt>(
+		FindFunc(loaded, "top")->GetBody()[0])->GetValue();
+	int64 terms = 1;
+	while(auto* bop = compiler::dyn_cast<compiler::BinaryOp>(expr)) {
+		++terms;
+		expr = bop->GetLeft();
+	}
+	ExpectEq(terms, kTerms);
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestRoundTrip();
+	stacklang::TestMappedFile();
+	stacklang::TestRejectsBadImages();
+	stacklang::TestRejectsCorruptRecords();
+	stacklang::TestDeepExpression();
+	return 0;
+}
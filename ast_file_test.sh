@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z -pthread ./ast_file_test.cc -o /tmp/ast_file_test
+/tmp/ast_file_test
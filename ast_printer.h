@@ -0,0 +1,651 @@
+#ifndef AST_PRINTER_H
+#define AST_PRINTER_H
+
+#include "string.h"
+#include "vector.h"
+#include "buffer.h"
+#include "utils.h"
+#include "parser.h"
+#include "ast_visitor.h"
+
+// STL
+#include <algorithm>
+#include <assert.h>
+#include <cstdio>
+#include <cstring>
+
+// POSIX
+#include <errno.h>
+#include <unistd.h>
+
+namespace stacklang {
+namespace compiler {
+
+// Collects printed text and writes it to a file descriptor or appends it
+// to a buffer in large chunks
+class PrintSink {
+public:
+	static const int64 kSize = 64*1024;
+
+	explicit PrintSink(int fd) : fd_(fd) {}
+	explicit PrintSink(buffer<char>* out) : out_(out) {}
+	PrintSink(const PrintSink& other) = delete;
+	// Call Flush first to see errors
+	~PrintSink() {
+		try {
+			Flush();
+		} catch(Status status) {
+		}
+	}
+	PrintSink& operator=(const PrintSink& other) = delete;
+
+	void Write(const char* data, int64 len) throws(Status) {
+		if(len_ + len > kSize) {
+			Flush() throws();
+			if(len > kSize) {
+				Emit(data, len) throws();
+				return;
+			}
+		}
+		memcpy(data_ + len_, data, len);
+		len_ += len;
+	}
+	void Write(string s) throws(Status) {
+		Write(s.data(), s.len()) throws();
+	}
+	void Write(const char* s) throws(Status) {
+		Write(s, strlen(s)) throws();
+	}
+	void WriteInt(int64 value) throws(Status) {
+		char digits[24];
+		Write(digits, snprintf(digits, sizeof(digits), "%lu", value)) throws();
+	}
+	void WritePointer(const void* p) throws(Status) {
+		char digits[24];
+		Write(digits, snprintf(digits, sizeof(digits), "%p", p)) throws();
+	}
+
+	void Flush() throws(Status) {
+		const int64 len = len_;
+		len_ = 0;
+		Emit(data_, len) throws();
+	}
+
+private:
+	void Emit(const char* data, int64 len) throws(Status) {
+		if(out_) {
+			const int64 start = out_->len();
+			if(out_->capacity() < start + len) {
+				out_->reserve(std::max(start + len, 2 * out_->capacity()));
+			}
+			out_->resize(start + len);
+			memcpy(out_->data() + start, data, len);
+			return;
+		}
+		while(len > 0) {
+			const ssize_t written = write(fd_, data, len);
+			if(written < 0 && errno == EINTR) {
+				continue;
+			}
+			if(written <= 0) {
+				throw Status{.message = string("Couldn't write AST: ") + strerror(errno)};
+			}
+			data += written;
+			len -= written;
+		}
+	}
+
+	int fd_ = -1;
+	buffer<char>* out_ = nullptr;
+	char data_[kSize];
+	int64 len_ = 0;
+};
+
+const char* StmtKindName(StmtKind kind) {
+	switch(kind) {
+		case StmtKind_ReturnStmt: return "ReturnStmt";
+		case StmtKind_VarDecl: return "VarDecl";
+		case StmtKind_TemplateParam: return "TemplateParam";
+		case StmtKind_TypedefDecl: return "TypedefDecl";
+		case StmtKind_FuncDecl: return "FuncDecl";
+		case StmtKind_StructDecl: return "StructDecl";
+		case StmtKind_UsingDecl: return "UsingDecl";
+		case StmtKind_UsingAliasDecl: return "UsingAliasDecl";
+		case StmtKind_DeclRef: return "DeclRef";
+		case StmtKind_Literal: return "Literal";
+		case StmtKind_MemberExpr: return "MemberExpr";
+		case StmtKind_UnaryOp: return "UnaryOp";
+		case StmtKind_CastExpr: return "CastExpr";
+		case StmtKind_ParenExpr: return "ParenExpr";
+		case StmtKind_BinaryOp: return "BinaryOp";
+		case StmtKind_FuncCall: return "FuncCall";
+		case StmtKind_CtorCall: return "CtorCall";
+	}
+	return "?";
+}
+
+namespace internal {
+
+enum PrintItemKind {
+	PrintItemKind_Text,
+	PrintItemKind_Int,
+	PrintItemKind_Pointer,
+	// FormatIndent
+	PrintItemKind_Indent,
+	PrintItemKind_Stmt,
+	PrintItemKind_Type,
+	PrintItemKind_Namespace,
+};
+
+struct PrintItem {
+	PrintItemKind kind = PrintItemKind_Text;
+	const void* node = nullptr;
+	string text;
+	// Or the value of an Int
+	int64 indent = 0;
+};
+
+// Writes what DebugString returns, without building the string or
+// recursing. Each node is expanded into the text and children it prints,
+// which are then printed in turn.
+class HumanPrinter {
+public:
+	HumanPrinter(PrintSink* sink) : sink_(sink) {}
+
+	void Print(PrintItem root) throws(Status) {
+		stack_.push_back(root);
+		while(!stack_.empty()) {
+			PrintItem item = stack_.pop_back();
+			switch(item.kind) {
+				case PrintItemKind_Text:
+					sink_->Write(item.text) throws();
+					break;
+				case PrintItemKind_Int:
+					sink_->WriteInt(item.indent) throws();
+					break;
+				case PrintItemKind_Pointer:
+					sink_->WritePointer(item.node) throws();
+					break;
+				case PrintItemKind_Indent:
+					for(int64 i=0;i<item.indent;++i) {
+						sink_->Write("  ", 2) throws();
+					}
+					break;
+				case PrintItemKind_Stmt:
+					ExpandStmt((Stmt*)item.node, item.indent) throws();
+					break;
+				case PrintItemKind_Type:
+					ExpandType((Type*)item.node, item.indent);
+					break;
+				case PrintItemKind_Namespace:
+					ExpandNamespace((const Namespace*)item.node, item.indent);
+					break;
+			}
+			// Last first, so they're printed in order
+			for(int64 i=expanded_.len();i>0;--i) {
+				stack_.push_back(expanded_[i-1]);
+			}
+			expanded_.clear();
+		}
+	}
+
+private:
+	void Text(string text) {
+		expanded_.push_back(PrintItem{.kind = PrintItemKind_Text, .text = text});
+	}
+	void Int(int64 value) {
+		expanded_.push_back(PrintItem{.kind = PrintItemKind_Int, .indent = value});
+	}
+	void Indent(int64 indent) {
+		expanded_.push_back(PrintItem{.kind = PrintItemKind_Indent, .indent = indent});
+	}
+	void Child(Stmt* stmt, int64 indent) {
+		expanded_.push_back(PrintItem{.kind = PrintItemKind_Stmt, .node = stmt, .indent = indent});
+	}
+	void Child(Type* type, int64 indent) {
+		expanded_.push_back(PrintItem{.kind = PrintItemKind_Type, .node = type, .indent = indent});
+	}
+	void TemplateParams(TemplatedDecl* decl) {
+		if(!decl->IsTemplated()) {
+			return;
+		}
+		Text("<");
+		bool first = true;
+		for(TemplateParam* param : decl->GetTemplateParams()) {
+			if(!first) {
+				Text(", ");
+			}
+			Text(param->GetName());
+			first = false;
+		}
+		Text(">");
+	}
+	template<typename T>
+	void Args(vector<T*> args, int64 indent) {
+		bool first = true;
+		for(T* arg : args) {
+			if(!first) {
+				Text(",, ");
+			}
+			Child(arg, indent);
+			first = false;
+		}
+	}
+
+	void ExpandNamespace(const Namespace* ns, int64 indent) {
+		Text("Namespace (");
+		Text(ns->GetName());
+		Text(") {\n");
+		for(Decl* decl : ns->GetDecls()) {
+			Indent(indent);
+			Child(decl, indent + 1);
+			Text("\n");
+		}
+		Text("}\n");
+	}
+
+	void ExpandType(Type* type, int64 indent) {
+		if(Stmt* decl = TypeAsStmt(type)) {
+			Child(decl, indent);
+			return;
+		}
+		switch(type->GetTypeKind()) {
+			case TypeKind_VoidType:
+				Text("void");
+				break;
+			case TypeKind_IntType:
+				Text("int");
+				break;
+			case TypeKind_DeclRefType:
+				Child(cast<DeclRefType>(type)->GetDeclRef(), indent);
+				break;
+			default:
+				assert(false && "Unknown TypeKind");
+		}
+	}
+
+	void ExpandStmt(Stmt* stmt, int64 indent) throws(Status) {
+		switch(stmt->GetStmtKind()) {
+			case StmtKind_ReturnStmt:
+				Text("Return(");
+				if(Expr* value = cast<ReturnStmt>(stmt)->GetValue()) {
+					Child(value, indent);
+				}
+				Text(")");
+				break;
+			case StmtKind_TemplateParam: {
+				auto* param = cast<TemplateParam>(stmt);
+				if(param->GetKind() == TemplateParamKind_Int) {
+					Text("int");
+				} else if(param->GetKind() == TemplateParamKind_Type) {
+					Text("typename");
+				}
+				Text(" ");
+				Text(param->GetName());
+				break;
+			}
+			case StmtKind_VarDecl: {
+				auto* var = cast<VarDecl>(stmt);
+				Text("VarDecl ");
+				expanded_.push_back(PrintItem{.kind = PrintItemKind_Pointer, .node = var});
+				Text(" (");
+				Text(var->GetName());
+				Text(" : ");
+				Child(var->GetType(), indent);
+				Text(")");
+				if(var->GetInitType() == VarDeclInitType_Equals) {
+					Text(" = ");
+					Child(var->GetInitParams()[0], 0);
+				} else if(var->GetInitType() == VarDeclInitType_Ctor) {
+					Text("(");
+					for(Expr* param : var->GetInitParams()) {
+						Child(param, 0);
+						Text(" ");
+					}
+					Text(")");
+				}
+				break;
+			}
+			case StmtKind_TypedefDecl: {
+				auto* typedef_decl = cast<TypedefDecl>(stmt);
+				Text("typedef ");
+				Text(typedef_decl->GetName());
+				Text(": ");
+				Child(typedef_decl->GetBase(), indent);
+				break;
+			}
+			case StmtKind_FuncDecl: {
+				auto* func = cast<FuncDecl>(stmt);
+				Text("FuncDecl ");
+				Text(func->GetName());
+				TemplateParams(func);
+				Text("(");
+				for(VarDecl* param : func->GetParameters()) {
+					Child(param, indent);
+					Text(", ");
+				}
+				Text(") -> ");
+				Child(func->GetReturnType(), indent);
+				Text("{\n");
+				for(Stmt* body_stmt : func->GetBody() throws()) {
+					Indent(indent);
+					Child(body_stmt, indent + 1);
+					Text("\n");
+				}
+				Text("}\n");
+				break;
+			}
+			case StmtKind_StructDecl: {
+				auto* struct_decl = cast<StructDecl>(stmt);
+				Text(struct_decl->IsDeclaredClass() ? "class " : "struct ");
+				Text(struct_decl->GetName());
+				Text(" ");
+				TemplateParams(struct_decl);
+				Text("\n");
+				Indent(indent);
+				Text("{\n");
+				for(Decl* decl : struct_decl->GetInnerDecls()) {
+					Indent(indent);
+					Child(decl, indent + 1);
+					Text("\n");
+				}
+				Indent(indent);
+				Text("}");
+				break;
+			}
+			case StmtKind_UsingDecl: {
+				auto* using_decl = cast<UsingDecl>(stmt);
+				Text("using(");
+				Text(using_decl->GetName());
+				Text("): ");
+				Child(using_decl->GetBase(), indent);
+				break;
+			}
+			case StmtKind_UsingAliasDecl: {
+				auto* alias = cast<UsingAliasDecl>(stmt);
+				TemplateParams(alias);
+				Text("using(");
+				Text(alias->GetName());
+				Text(") =  ");
+				Child(alias->GetBase(), indent);
+				break;
+			}
+			case StmtKind_DeclRef: {
+				auto* ref = cast<DeclRef>(stmt);
+				Text("&");
+				Text(ref->GetRef()->GetName());
+				if(!ref->GetTemplateArgs().empty()) {
+					Text("<<");
+					for(TemplateArg arg : ref->GetTemplateArgs()) {
+						if(arg.type) {
+							Child(arg.type, 0);
+						} else if(arg.int_value) {
+							Child(arg.int_value, 0);
+						} else {
+							Text("(null)");
+						}
+						Text(" ");
+					}
+					Text(">>");
+				}
+				break;
+			}
+			case StmtKind_Literal: {
+				Value* value = cast<Literal>(stmt)->GetValue();
+				if(auto* integer = dyn_cast<IntegerValue>(value)) {
+					Text("int(");
+					Int(integer->GetValue());
+					Text(")");
+				} else {
+					Text("void");
+				}
+				break;
+			}
+			case StmtKind_MemberExpr: {
+				auto* member = cast<MemberExpr>(stmt);
+				Child(member->GetBase(), 0);
+				Text(member->IsPointer() ? " -> " : " . ");
+				Text(member->GetMemberName());
+				break;
+			}
+			case StmtKind_UnaryOp: {
+				auto* op = cast<UnaryOp>(stmt);
+				Text(op->GetOp());
+				if(op->IsPostfix()) {
+					Text(" post ");
+				}
+				Text("(");
+				Child(op->GetSub(), indent);
+				Text(")");
+				break;
+			}
+			case StmtKind_CastExpr: {
+				auto* cast_expr = cast<CastExpr>(stmt);
+				Text("cast<");
+				Child(cast_expr->GetToType(), indent);
+				Text(">(");
+				Child(cast_expr->GetSub(), indent);
+				Text(")");
+				break;
+			}
+			case StmtKind_ParenExpr:
+				Text("(( ");
+				Child(cast<ParenExpr>(stmt)->GetSub(), indent);
+				Text(" ))");
+				break;
+			case StmtKind_BinaryOp: {
+				auto* op = cast<BinaryOp>(stmt);
+				Text("( ");
+				Child(op->GetLeft(), indent);
+				Text(" ");
+				Text(op->GetOp());
+				Text(" ");
+				Child(op->GetRight(), indent);
+				Text(" )");
+				break;
+			}
+			case StmtKind_FuncCall: {
+				auto* call = cast<FuncCall>(stmt);
+				Text("call(");
+				Child(call->GetCallee(), indent);
+				Text(": ");
+				Args(call->GetArgs(), indent);
+				Text(")");
+				break;
+			}
+			case StmtKind_CtorCall: {
+				auto* ctor = cast<CtorCall>(stmt);
+				Text("ctor(");
+				Child(ctor->GetType(), indent);
+				Text(": ");
+				Args(ctor->GetArgs(), indent);
+				Text(")");
+				break;
+			}
+		}
+	}
+
+	PrintSink* sink_;
+	buffer<PrintItem> stack_;
+	// Of the item being expanded, in order
+	buffer<PrintItem> expanded_;
+};
+
+// One parenthesized list per node, e.g.
+//   (FuncDecl top (Type int) (VarDecl x (Type int))
+//    (ReturnStmt (BinaryOp "-" (DeclRef x) (Literal 1))))
+// on a single line. Decls and refs are followed by their names, types
+// written as a declaration by its name.
+class SExprDumper : public RecursiveASTVisitor<SExprDumper> {
+public:
+	SExprDumper(PrintSink* sink) : sink_(sink) {}
+
+	bool VisitNamespace(Namespace* ns) throws(Status) {
+		Open("Namespace") throws();
+		// The root namespace has no name
+		if(!ns->GetName().empty()) {
+			Atom(ns->GetName()) throws();
+		}
+		return true;
+	}
+	bool PostVisitNamespace(Namespace* ns) throws(Status) {
+		sink_->Write(")", 1) throws();
+		return true;
+	}
+	bool VisitStmt(Stmt* stmt) throws(Status) {
+		Open(StmtKindName(stmt->GetStmtKind())) throws();
+		return true;
+	}
+	bool PostVisitStmt(Stmt* stmt) throws(Status) {
+		sink_->Write(")", 1) throws();
+		return true;
+	}
+	bool VisitDecl(Decl* decl) throws(Status) {
+		Atom(decl->GetName()) throws();
+		return true;
+	}
+	bool VisitTemplateParam(TemplateParam* param) throws(Status) {
+		if(param->GetKind() == TemplateParamKind_Int) {
+			Atom("int") throws();
+		} else if(param->GetKind() == TemplateParamKind_Type) {
+			Atom("typename") throws();
+		}
+		return true;
+	}
+	bool VisitVarDecl(VarDecl* var) throws(Status) {
+		switch(var->GetInitType()) {
+			case VarDeclInitType_Equals:
+				Atom("=") throws();
+				break;
+			case VarDeclInitType_Ctor:
+				Atom("()") throws();
+				break;
+			case VarDeclInitType_InitList:
+				Atom("{}") throws();
+				break;
+			default:
+				break;
+		}
+		return true;
+	}
+	bool VisitFuncDecl(FuncDecl* func) throws(Status) {
+		if(func->IsPrototype()) {
+			Atom("prototype") throws();
+		}
+		return true;
+	}
+	bool VisitStructDecl(StructDecl* struct_decl) throws(Status) {
+		if(struct_decl->IsDeclaredClass()) {
+			Atom("class") throws();
+		}
+		return true;
+	}
+	bool VisitDeclRef(DeclRef* ref) throws(Status) {
+		Atom(ref->GetRef()->GetName()) throws();
+		return true;
+	}
+	bool VisitLiteral(Literal* literal) throws(Status) {
+		if(auto* integer = dyn_cast<IntegerValue>(literal->GetValue())) {
+			sink_->Write(" ", 1) throws();
+			sink_->WriteInt(integer->GetValue()) throws();
+		} else {
+			Atom("void") throws();
+		}
+		return true;
+	}
+	bool VisitMemberExpr(MemberExpr* member) throws(Status) {
+		Quoted(member->IsPointer() ? "->" : ".") throws();
+		Atom(member->GetMemberName()) throws();
+		return true;
+	}
+	bool VisitUnaryOp(UnaryOp* op) throws(Status) {
+		if(op->GetStmtKind() == StmtKind_UnaryOp) {
+			Quoted(op->GetOp()) throws();
+			if(op->IsPostfix()) {
+				Atom("postfix") throws();
+			}
+		}
+		return true;
+	}
+	bool VisitCastExpr(CastExpr* cast_expr) throws(Status) {
+		static const char* names[] = {
+			"null", "c_style", "cpp_style", "static", "dynamic", "const", "reinterpret"
+		};
+		Atom(names[cast_expr->GetCastType()]) throws();
+		return true;
+	}
+	bool VisitBinaryOp(BinaryOp* op) throws(Status) {
+		Quoted(op->GetOp()) throws();
+		return true;
+	}
+	bool VisitType(Type* type) throws(Status) {
+		Open("Type") throws();
+		if(Stmt* decl = TypeAsStmt(type)) {
+			Atom(cast<Decl>(decl)->GetName()) throws();
+		} else if(isa<VoidType>(type)) {
+			Atom("void") throws();
+		} else if(isa<IntType>(type)) {
+			Atom("int") throws();
+		}
+		return true;
+	}
+	bool PostVisitType(Type* type) throws(Status) {
+		sink_->Write(")", 1) throws();
+		return true;
+	}
+
+private:
+	void Open(const char* name) throws(Status) {
+		if(!first_) {
+			sink_->Write(" ", 1) throws();
+		}
+		first_ = false;
+		sink_->Write("(", 1) throws();
+		sink_->Write(name) throws();
+	}
+	void Atom(string text) throws(Status) {
+		sink_->Write(" ", 1) throws();
+		sink_->Write(text) throws();
+	}
+	void Quoted(string text) throws(Status) {
+		sink_->Write(" \"", 2) throws();
+		sink_->Write(text) throws();
+		sink_->Write("\"", 1) throws();
+	}
+
+	PrintSink* sink_;
+	bool first_ = true;
+};
+
+}  // internal
+
+// Writes what DebugString returns, but in time linear in the size of the
+// AST and without an intermediate string
+void PrintAst(const Namespace& ns, PrintSink* sink, int64 indent=0) throws(Status) {
+	internal::HumanPrinter printer(sink);
+	printer.Print(internal::PrintItem{.kind = internal::PrintItemKind_Namespace,
+									  .node = &ns, .indent = indent}) throws();
+}
+void PrintAst(Stmt* stmt, PrintSink* sink, int64 indent=0) throws(Status) {
+	internal::HumanPrinter printer(sink);
+	printer.Print(internal::PrintItem{.kind = internal::PrintItemKind_Stmt,
+									  .node = stmt, .indent = indent}) throws();
+}
+
+// Writes the S-expression form of ns and every nested namespace, and a
+// newline. See SExprDumper for the format.
+void DumpAst(Namespace* ns, PrintSink* sink) throws(Status) {
+	internal::SExprDumper dumper(sink);
+	dumper.TraverseNamespace(ns) throws();
+	sink->Write("\n", 1) throws();
+}
+void DumpAst(Stmt* stmt, PrintSink* sink) throws(Status) {
+	internal::SExprDumper dumper(sink);
+	dumper.TraverseStmt(stmt) throws();
+	sink->Write("\n", 1) throws();
+}
+
+}  // namespace compiler
+}  // namespace stacklang
+
+#endif//AST_PRINTER_H
@@ -0,0 +1,152 @@
+#include "ast_printer.h"
+#include "scanner.h"
+#include "test_programs.h"
+
+#include <cstdio>
+#include <string>
+
+// POSIX
+#include <fcntl.h>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+void ExpectEq(string a, string b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %s != %s\n",
+			a.c_str(), b.c_str());
+	}
+}
+
+string AsString(const buffer<char>& text) {
+	return string(text.data(), text.len());
+}
+
+void TestMatchesDebugString() {
+	fprintf(stderr, "--- TestMatchesDebugString ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(testing::kFooProgram);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	buffer<char> text;
+	{
+		compiler::PrintSink sink(&text);
+		compiler::PrintAst(parsed, &sink);
+	}
+	ExpectEq(AsString(text), parsed.DebugString());
+
+	for(compiler::Decl* decl : parsed.GetDecls()) {
+		buffer<char> decl_text;
+		compiler::PrintSink sink(&decl_text);
+		compiler::PrintAst(decl, &sink, 2);
+		sink.Flush();
+		ExpectEq(AsString(decl_text), decl->DebugString(2));
+	}
+}
+
+void TestSExpr() {
+	fprintf(stderr, "--- TestSExpr ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(
+		"typedef int Integer;\n"
+		"int top(Integer x) {\n\treturn -x * (int)(1);\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	buffer<char> text;
+	compiler::PrintSink sink(&text);
+	compiler::DumpAst(&parsed, &sink);
+	sink.Flush();
+	ExpectEq(AsString(text),
+		"(Namespace (TypedefDecl Integer (Type int))"
+		" (FuncDecl top (Type int) (VarDecl x (Type Integer))"
+		" (ReturnStmt (BinaryOp \"*\" (UnaryOp \"-\" (DeclRef x))"
+		" (CastExpr c_style (Type int) (ParenExpr (Literal 1)))))))\n");
+}
+
+void TestFileDescriptor() {
+	fprintf(stderr, "--- TestFileDescriptor ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(testing::kFooProgram);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	const char* path = "/tmp/ast_printer_test.txt";
+
+	int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	Expect(fd >= 0);
+	{
+		compiler::PrintSink sink(fd);
+		compiler::PrintAst(parsed, &sink);
+		compiler::DumpAst(&parsed, &sink);
+		sink.Flush();
+	}
+	close(fd);
+
+	buffer<char> expected;
+	{
+		compiler::PrintSink sink(&expected);
+		compiler::PrintAst(parsed, &sink);
+		compiler::DumpAst(&parsed, &sink);
+	}
+	FILE* file = fopen(path, "r");
+	buffer<char> written;
+	written.resize(expected.len() + 1);
+	ExpectEq(fread(written.data(), 1, written.len(), file), expected.len());
+	fclose(file);
+	Expect(memcmp(written.data(), expected.data(), expected.len()) == 0);
+	unlink(path);
+
+	try {
+		compiler::PrintSink closed(fd);
+		closed.Write("x");
+		closed.Flush();
+		Expect(false);
+	} catch(Status status) {
+		Expect(status.message.len() > 0);
+	}
+}
+
+// Much more than fits in the sink at once, and too deep to recurse
+void TestDeepExpression() {
+	fprintf(stderr, "--- TestDeepExpression ---\n");
+	const int64 kTerms = 100000;
+	std::string src = testing::DeepSum(kTerms);
+	compiler::TokenBuffer tokens = compiler::Scan(src.c_str());
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	buffer<char> text;
+	{
+		compiler::PrintSink sink(&text);
+		compiler::PrintAst(parsed, &sink);
+	}
+	// "( " and " + &x )" per addition
+	Expect(text.len() > (kTerms - 1) * 9);
+	ExpectEq(AsString(text).substr(text.len() - 11, 11), "&x ))\n}\n\n}\n");
+
+	buffer<char> dump;
+	{
+		compiler::PrintSink sink(&dump);
+		compiler::DumpAst(&parsed, &sink);
+	}
+	ExpectEq(AsString(dump).substr(0, 47), "(Namespace (FuncDecl top (Type int) (VarDecl x ");
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestMatchesDebugString();
+	stacklang::TestSExpr();
+	stacklang::TestFileDescriptor();
+	stacklang::TestDeepExpression();
+	return 0;
+}
@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z ./ast_printer_test.cc -o /tmp/ast_printer_test
+/tmp/ast_printer_test
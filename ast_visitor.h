@@ -0,0 +1,504 @@
+#ifndef AST_VISITOR_H
+#define AST_VISITOR_H
+
+#include "vector.h"
+#include "buffer.h"
+#include "utils.h"
+#include "parser.h"
+
+// STL
+#include <assert.h>
+
+namespace stacklang {
+namespace compiler {
+
+namespace internal {
+
+enum VisitNodeKind {
+	VisitNodeKind_Namespace,
+	VisitNodeKind_Stmt,
+	VisitNodeKind_Type,
+};
+
+struct VisitFrame {
+	// A Namespace*, Stmt* or Type*, by kind
+	void* node = nullptr;
+	VisitNodeKind kind = VisitNodeKind_Namespace;
+	// Children are done
+	bool post = false;
+};
+
+}  // internal
+
+// Walks every node below a namespace, declaration, statement or type.
+// Derived hides the hooks it needs:
+//
+//   class CountCalls : public RecursiveASTVisitor<CountCalls> {
+//   public:
+//   	bool VisitFuncCall(FuncCall* call) {
+//   		++calls;
+//   		return true;
+//   	}
+//   	int64 calls = 0;
+//   };
+//
+// For each node VisitX hooks run before its children, from the most
+// general class down, e.g. VisitStmt, VisitExpr, VisitUnaryOp then
+// VisitCastExpr. PostVisitX hooks run after the children in the opposite
+// order. A hook returning false stops the whole traversal.
+//
+// Hooks are resolved statically and children are read straight from the
+// nodes, not through Expr::GetOperands. The work list is kept between
+// traversals, so once it has grown to the deepest tree seen nothing is
+// allocated. Nothing recurses, so any depth of expression is fine.
+//
+// Types are visited where they're written, e.g. a variable's type. A
+// declaration used as a type, like a struct, only gets the Type hooks
+// there; its declaration is visited where it's declared. A DeclRef is
+// visited with its template arguments, never the declaration it refers to.
+template<typename Derived>
+class RecursiveASTVisitor {
+public:
+	// Each returns false if a hook stopped the traversal
+	// May parse bodies set aside by BodyParsing_Lazy, see
+	// ShouldParseLazyBodies
+	bool TraverseNamespace(Namespace* ns) throws(Status) {
+		return Traverse(ns, internal::VisitNodeKind_Namespace) throws();
+	}
+	bool TraverseStmt(Stmt* stmt) throws(Status) {
+		return Traverse(stmt, internal::VisitNodeKind_Stmt) throws();
+	}
+	bool TraverseType(Type* type) throws(Status) {
+		return Traverse(type, internal::VisitNodeKind_Type) throws();
+	}
+
+	// Whether a body which hasn't been parsed yet is parsed and visited, or
+	// skipped
+	bool ShouldParseLazyBodies()const {
+		return true;
+	}
+
+#define STACKLANG_VISIT_HOOKS(Class) \
+	bool Visit##Class(Class* node) { return true; } \
+	bool PostVisit##Class(Class* node) { return true; }
+
+	STACKLANG_VISIT_HOOKS(Namespace)
+	STACKLANG_VISIT_HOOKS(Type)
+	STACKLANG_VISIT_HOOKS(VoidType)
+	STACKLANG_VISIT_HOOKS(IntType)
+	STACKLANG_VISIT_HOOKS(DeclRefType)
+
+	STACKLANG_VISIT_HOOKS(Stmt)
+	STACKLANG_VISIT_HOOKS(ReturnStmt)
+
+	STACKLANG_VISIT_HOOKS(Decl)
+	STACKLANG_VISIT_HOOKS(TemplatedDecl)
+	STACKLANG_VISIT_HOOKS(TemplateParam)
+	STACKLANG_VISIT_HOOKS(VarDecl)
+	STACKLANG_VISIT_HOOKS(TypedefDecl)
+	STACKLANG_VISIT_HOOKS(FuncDecl)
+	STACKLANG_VISIT_HOOKS(StructDecl)
+	STACKLANG_VISIT_HOOKS(UsingDecl)
+	STACKLANG_VISIT_HOOKS(UsingAliasDecl)
+
+	STACKLANG_VISIT_HOOKS(Expr)
+	STACKLANG_VISIT_HOOKS(DeclRef)
+	STACKLANG_VISIT_HOOKS(Literal)
+	STACKLANG_VISIT_HOOKS(MemberExpr)
+	STACKLANG_VISIT_HOOKS(UnaryOp)
+	STACKLANG_VISIT_HOOKS(CastExpr)
+	STACKLANG_VISIT_HOOKS(ParenExpr)
+	STACKLANG_VISIT_HOOKS(BinaryOp)
+	STACKLANG_VISIT_HOOKS(FuncCall)
+	STACKLANG_VISIT_HOOKS(CtorCall)
+
+#undef STACKLANG_VISIT_HOOKS
+
+private:
+	Derived& derived() {
+		return *static_cast<Derived*>(this);
+	}
+
+	// Runs hooks of Class and its bases, pre hooks base first and post hooks
+	// base last
+#define STACKLANG_WALK_UP(Class, Base) \
+	bool WalkUpFrom##Class(Class* node) { \
+		return WalkUpFrom##Base(node) && derived().Visit##Class(node); \
+	} \
+	bool PostWalkUpFrom##Class(Class* node) { \
+		return derived().PostVisit##Class(node) && PostWalkUpFrom##Base(node); \
+	}
+
+	bool WalkUpFromStmt(Stmt* node) {
+		return derived().VisitStmt(node);
+	}
+	bool PostWalkUpFromStmt(Stmt* node) {
+		return derived().PostVisitStmt(node);
+	}
+	bool WalkUpFromType(Type* node) {
+		return derived().VisitType(node);
+	}
+	bool PostWalkUpFromType(Type* node) {
+		return derived().PostVisitType(node);
+	}
+	STACKLANG_WALK_UP(VoidType, Type)
+	STACKLANG_WALK_UP(IntType, Type)
+	STACKLANG_WALK_UP(DeclRefType, Type)
+
+	STACKLANG_WALK_UP(ReturnStmt, Stmt)
+
+	STACKLANG_WALK_UP(Decl, Stmt)
+	STACKLANG_WALK_UP(TemplatedDecl, Decl)
+	STACKLANG_WALK_UP(TemplateParam, Decl)
+	STACKLANG_WALK_UP(VarDecl, Decl)
+	STACKLANG_WALK_UP(TypedefDecl, Decl)
+	STACKLANG_WALK_UP(FuncDecl, TemplatedDecl)
+	STACKLANG_WALK_UP(StructDecl, TemplatedDecl)
+	STACKLANG_WALK_UP(UsingDecl, TemplatedDecl)
+	STACKLANG_WALK_UP(UsingAliasDecl, UsingDecl)
+
+	STACKLANG_WALK_UP(Expr, Stmt)
+	STACKLANG_WALK_UP(DeclRef, Expr)
+	STACKLANG_WALK_UP(Literal, Expr)
+	STACKLANG_WALK_UP(MemberExpr, Expr)
+	STACKLANG_WALK_UP(UnaryOp, Expr)
+	STACKLANG_WALK_UP(CastExpr, UnaryOp)
+	STACKLANG_WALK_UP(ParenExpr, Expr)
+	STACKLANG_WALK_UP(BinaryOp, Expr)
+	STACKLANG_WALK_UP(FuncCall, Expr)
+	STACKLANG_WALK_UP(CtorCall, Expr)
+
+#undef STACKLANG_WALK_UP
+
+	// Hooks may start traversals of their own, which use the stack above
+	// the current one
+	bool Traverse(void* root, internal::VisitNodeKind kind) throws(Status) {
+		const int64 base = stack_.len();
+		auto stack_guard = MakeLambdaGuard([&]() {
+			stack_.resize(base);
+		});
+		stack_.push_back(internal::VisitFrame{.node = root, .kind = kind});
+		while(stack_.len() > base) {
+			internal::VisitFrame frame = stack_.pop_back();
+			bool more;
+			switch(frame.kind) {
+				case internal::VisitNodeKind_Namespace:
+					more = frame.post ? PostNamespace(static_cast<Namespace*>(frame.node))
+									  : PreNamespace(static_cast<Namespace*>(frame.node));
+					break;
+				case internal::VisitNodeKind_Stmt:
+					more = frame.post ? PostStmt(static_cast<Stmt*>(frame.node))
+									  : PreStmt(static_cast<Stmt*>(frame.node)) throws();
+					break;
+				case internal::VisitNodeKind_Type:
+					more = frame.post ? PostType(static_cast<Type*>(frame.node))
+									  : PreType(static_cast<Type*>(frame.node));
+					break;
+			}
+			if(!more) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Children are pushed last first, so they're visited in order
+	void PushPost(void* node, internal::VisitNodeKind kind) {
+		stack_.push_back(internal::VisitFrame{.node = node, .kind = kind, .post = true});
+	}
+	void PushStmt(Stmt* stmt) {
+		if(stmt) {
+			stack_.push_back(internal::VisitFrame{.node = stmt,
+												  .kind = internal::VisitNodeKind_Stmt});
+		}
+	}
+	void PushType(Type* type) {
+		if(type) {
+			stack_.push_back(internal::VisitFrame{.node = type,
+												  .kind = internal::VisitNodeKind_Type});
+		}
+	}
+	template<typename T>
+	void PushStmts(vector<T*> stmts) {
+		for(int64 i=stmts.len();i>0;--i) {
+			PushStmt(stmts[i-1]);
+		}
+	}
+	void PushTemplateArgs(vector<TemplateArg> args) {
+		for(int64 i=args.len();i>0;--i) {
+			PushStmt(args[i-1].int_value);
+			PushType(args[i-1].type);
+		}
+	}
+
+	bool PreNamespace(Namespace* ns) {
+		if(!derived().VisitNamespace(ns)) {
+			return false;
+		}
+		PushPost(ns, internal::VisitNodeKind_Namespace);
+		vector<Namespace*> nested = ns->GetNested();
+		for(int64 i=nested.len();i>0;--i) {
+			stack_.push_back(internal::VisitFrame{.node = nested[i-1],
+												  .kind = internal::VisitNodeKind_Namespace});
+		}
+		PushStmts(ns->GetDecls());
+		return true;
+	}
+	bool PostNamespace(Namespace* ns) {
+		return derived().PostVisitNamespace(ns);
+	}
+
+	bool PreType(Type* type) {
+		switch(type->GetTypeKind()) {
+			case TypeKind_VoidType:
+				if(!WalkUpFromVoidType(static_cast<VoidType*>(type))) {
+					return false;
+				}
+				break;
+			case TypeKind_IntType:
+				if(!WalkUpFromIntType(static_cast<IntType*>(type))) {
+					return false;
+				}
+				break;
+			case TypeKind_DeclRefType: {
+				auto* ref_type = static_cast<DeclRefType*>(type);
+				if(!WalkUpFromDeclRefType(ref_type)) {
+					return false;
+				}
+				PushPost(type, internal::VisitNodeKind_Type);
+				PushStmt(ref_type->GetDeclRef());
+				return true;
+			}
+			default:
+				// Declared elsewhere
+				if(!WalkUpFromType(type)) {
+					return false;
+				}
+				break;
+		}
+		PushPost(type, internal::VisitNodeKind_Type);
+		return true;
+	}
+	bool PostType(Type* type) {
+		switch(type->GetTypeKind()) {
+			case TypeKind_VoidType:
+				return PostWalkUpFromVoidType(static_cast<VoidType*>(type));
+			case TypeKind_IntType:
+				return PostWalkUpFromIntType(static_cast<IntType*>(type));
+			case TypeKind_DeclRefType:
+				return PostWalkUpFromDeclRefType(static_cast<DeclRefType*>(type));
+			default:
+				return PostWalkUpFromType(type);
+		}
+	}
+
+	bool PreStmt(Stmt* stmt) throws(Status) {
+		switch(stmt->GetStmtKind()) {
+			case StmtKind_ReturnStmt: {
+				auto* ret = static_cast<ReturnStmt*>(stmt);
+				if(!WalkUpFromReturnStmt(ret)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmt(ret->GetValue());
+				return true;
+			}
+			case StmtKind_TemplateParam:
+				if(!WalkUpFromTemplateParam(static_cast<TemplateParam*>(stmt))) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				return true;
+			case StmtKind_VarDecl: {
+				auto* var = static_cast<VarDecl*>(stmt);
+				if(!WalkUpFromVarDecl(var)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmts(var->GetInitParams());
+				PushType(var->GetType());
+				return true;
+			}
+			case StmtKind_TypedefDecl: {
+				auto* typedef_decl = static_cast<TypedefDecl*>(stmt);
+				if(!WalkUpFromTypedefDecl(typedef_decl)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushType(typedef_decl->GetBase());
+				return true;
+			}
+			case StmtKind_FuncDecl: {
+				auto* func = static_cast<FuncDecl*>(stmt);
+				if(!WalkUpFromFuncDecl(func)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				if(func->IsBodyParsed() || derived().ShouldParseLazyBodies()) {
+					PushStmts(func->GetBody() throws());
+				}
+				PushStmts(func->GetParameters());
+				PushType(func->GetReturnType());
+				PushStmts(func->GetTemplateParams());
+				return true;
+			}
+			case StmtKind_StructDecl: {
+				auto* struct_decl = static_cast<StructDecl*>(stmt);
+				if(!WalkUpFromStructDecl(struct_decl)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmts(struct_decl->GetInnerDecls());
+				PushStmts(struct_decl->GetTemplateParams());
+				return true;
+			}
+			case StmtKind_UsingDecl:
+			case StmtKind_UsingAliasDecl: {
+				auto* using_decl = static_cast<UsingDecl*>(stmt);
+				if(stmt->GetStmtKind() == StmtKind_UsingAliasDecl) {
+					if(!WalkUpFromUsingAliasDecl(static_cast<UsingAliasDecl*>(using_decl))) {
+						return false;
+					}
+				} else if(!WalkUpFromUsingDecl(using_decl)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushType(using_decl->GetBase());
+				PushStmts(using_decl->GetTemplateParams());
+				return true;
+			}
+			case StmtKind_DeclRef: {
+				auto* ref = static_cast<DeclRef*>(stmt);
+				if(!WalkUpFromDeclRef(ref)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushTemplateArgs(ref->GetTemplateArgs());
+				return true;
+			}
+			case StmtKind_Literal:
+				if(!WalkUpFromLiteral(static_cast<Literal*>(stmt))) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				return true;
+			case StmtKind_MemberExpr: {
+				auto* member = static_cast<MemberExpr*>(stmt);
+				if(!WalkUpFromMemberExpr(member)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmt(member->GetBase());
+				return true;
+			}
+			case StmtKind_UnaryOp: {
+				auto* op = static_cast<UnaryOp*>(stmt);
+				if(!WalkUpFromUnaryOp(op)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmt(op->GetSub());
+				return true;
+			}
+			case StmtKind_CastExpr: {
+				auto* cast_expr = static_cast<CastExpr*>(stmt);
+				if(!WalkUpFromCastExpr(cast_expr)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmt(cast_expr->GetSub());
+				PushType(cast_expr->GetToType());
+				return true;
+			}
+			case StmtKind_ParenExpr: {
+				auto* paren = static_cast<ParenExpr*>(stmt);
+				if(!WalkUpFromParenExpr(paren)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmt(paren->GetSub());
+				return true;
+			}
+			case StmtKind_BinaryOp: {
+				auto* op = static_cast<BinaryOp*>(stmt);
+				if(!WalkUpFromBinaryOp(op)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmt(op->GetRight());
+				PushStmt(op->GetLeft());
+				return true;
+			}
+			case StmtKind_FuncCall: {
+				auto* call = static_cast<FuncCall*>(stmt);
+				if(!WalkUpFromFuncCall(call)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmts(call->GetArgs());
+				PushStmt(call->GetCallee());
+				return true;
+			}
+			case StmtKind_CtorCall: {
+				auto* ctor = static_cast<CtorCall*>(stmt);
+				if(!WalkUpFromCtorCall(ctor)) {
+					return false;
+				}
+				PushPost(stmt, internal::VisitNodeKind_Stmt);
+				PushStmts(ctor->GetArgs());
+				PushType(ctor->GetType());
+				return true;
+			}
+		}
+		assert(false && "Unknown StmtKind");
+		return false;
+	}
+
+	bool PostStmt(Stmt* stmt) {
+		switch(stmt->GetStmtKind()) {
+			case StmtKind_ReturnStmt:
+				return PostWalkUpFromReturnStmt(static_cast<ReturnStmt*>(stmt));
+			case StmtKind_TemplateParam:
+				return PostWalkUpFromTemplateParam(static_cast<TemplateParam*>(stmt));
+			case StmtKind_VarDecl:
+				return PostWalkUpFromVarDecl(static_cast<VarDecl*>(stmt));
+			case StmtKind_TypedefDecl:
+				return PostWalkUpFromTypedefDecl(static_cast<TypedefDecl*>(stmt));
+			case StmtKind_FuncDecl:
+				return PostWalkUpFromFuncDecl(static_cast<FuncDecl*>(stmt));
+			case StmtKind_StructDecl:
+				return PostWalkUpFromStructDecl(static_cast<StructDecl*>(stmt));
+			case StmtKind_UsingDecl:
+				return PostWalkUpFromUsingDecl(static_cast<UsingDecl*>(stmt));
+			case StmtKind_UsingAliasDecl:
+				return PostWalkUpFromUsingAliasDecl(static_cast<UsingAliasDecl*>(stmt));
+			case StmtKind_DeclRef:
+				return PostWalkUpFromDeclRef(static_cast<DeclRef*>(stmt));
+			case StmtKind_Literal:
+				return PostWalkUpFromLiteral(static_cast<Literal*>(stmt));
+			case StmtKind_MemberExpr:
+				return PostWalkUpFromMemberExpr(static_cast<MemberExpr*>(stmt));
+			case StmtKind_UnaryOp:
+				return PostWalkUpFromUnaryOp(static_cast<UnaryOp*>(stmt));
+			case StmtKind_CastExpr:
+				return PostWalkUpFromCastExpr(static_cast<CastExpr*>(stmt));
+			case StmtKind_ParenExpr:
+				return PostWalkUpFromParenExpr(static_cast<ParenExpr*>(stmt));
+			case StmtKind_BinaryOp:
+				return PostWalkUpFromBinaryOp(static_cast<BinaryOp*>(stmt));
+			case StmtKind_FuncCall:
+				return PostWalkUpFromFuncCall(static_cast<FuncCall*>(stmt));
+			case StmtKind_CtorCall:
+				return PostWalkUpFromCtorCall(static_cast<CtorCall*>(stmt));
+		}
+		assert(false && "Unknown StmtKind");
+		return false;
+	}
+
+	buffer<internal::VisitFrame> stack_;
+};
+
+}  // namespace compiler
+}  // namespace stacklang
+
+#endif//AST_VISITOR_H
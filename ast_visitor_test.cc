@@ -0,0 +1,286 @@
+#include "ast_visitor.h"
+#include "scanner.h"
+#include "test_programs.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+// Every allocation in the program, to check traversals make none
+static stacklang::int64 sAllocations = 0;
+
+void* operator new(size_t size) {
+	++sAllocations;
+	void* p = malloc(size ? size : 1);
+	if(p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+// Not inlined, so g++ doesn't see free() of what operator new returned
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+	free(p);
+}
+void operator delete[](void* p) noexcept {
+	operator delete(p);
+}
+void operator delete(void* p, size_t size) noexcept {
+	operator delete(p);
+}
+void operator delete[](void* p, size_t size) noexcept {
+	operator delete[](p);
+}
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+void ExpectEq(string a, string b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %s != %s\n",
+			a.c_str(), b.c_str());
+	}
+}
+
+// testing::kFooProgram in a namespace of its own
+std::string NestedFooProgram() {
+	return std::string("namespace inner {") + testing::kFooProgram + "}\n";
+}
+
+class CountingVisitor : public compiler::RecursiveASTVisitor<CountingVisitor> {
+public:
+	bool VisitStmt(compiler::Stmt* stmt) {
+		++stmts;
+		return true;
+	}
+	bool PostVisitStmt(compiler::Stmt* stmt) {
+		++post_stmts;
+		return true;
+	}
+	bool VisitDecl(compiler::Decl* decl) {
+		++decls;
+		return true;
+	}
+	bool VisitExpr(compiler::Expr* expr) {
+		++exprs;
+		return true;
+	}
+	bool VisitFuncDecl(compiler::FuncDecl* func) {
+		++funcs;
+		return true;
+	}
+	bool VisitUnaryOp(compiler::UnaryOp* op) {
+		++unary_ops;
+		return true;
+	}
+	bool VisitCastExpr(compiler::CastExpr* cast) {
+		++casts;
+		return true;
+	}
+	bool VisitFuncCall(compiler::FuncCall* call) {
+		++calls;
+		return true;
+	}
+	bool VisitType(compiler::Type* type) {
+		++types;
+		return true;
+	}
+	bool VisitDeclRefType(compiler::DeclRefType* type) {
+		++ref_types;
+		return true;
+	}
+	bool VisitNamespace(compiler::Namespace* ns) {
+		++namespaces;
+		return true;
+	}
+
+	int64 stmts = 0;
+	int64 post_stmts = 0;
+	int64 decls = 0;
+	int64 exprs = 0;
+	int64 funcs = 0;
+	int64 unary_ops = 0;
+	int64 casts = 0;
+	int64 calls = 0;
+	int64 types = 0;
+	int64 ref_types = 0;
+	int64 namespaces = 0;
+};
+
+void TestCountsEveryNode() {
+	fprintf(stderr, "--- TestCountsEveryNode ---\n");
+	std::string src = NestedFooProgram();
+	compiler::TokenBuffer tokens = compiler::Scan(src.c_str());
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	CountingVisitor visitor;
+	Expect(visitor.TraverseNamespace(&parsed));
+	ExpectEq(visitor.namespaces, 2);
+	ExpectEq(visitor.funcs, 3);
+	// Foo, T, a, b, Integer, Number, bar, N, sum, x, y, z, top, v, w, copy
+	ExpectEq(visitor.decls, 16);
+	// sum, bar<2>
+	ExpectEq(visitor.calls, 2);
+	// *w, ++w, w++ and the cast
+	ExpectEq(visitor.unary_ops, 4);
+	ExpectEq(visitor.casts, 1);
+	// Foo<int> in v, copy and the constructor call
+	ExpectEq(visitor.ref_types, 3);
+	Expect(visitor.types > visitor.ref_types);
+	ExpectEq(visitor.post_stmts, visitor.stmts);
+	ExpectEq(visitor.stmts, visitor.decls + visitor.exprs + 3);
+}
+
+// Records the order hooks run in
+class OrderVisitor : public compiler::RecursiveASTVisitor<OrderVisitor> {
+public:
+	bool VisitExpr(compiler::Expr* expr) {
+		Add("Expr");
+		return true;
+	}
+	bool VisitBinaryOp(compiler::BinaryOp* op) {
+		Add(string("pre") + op->GetOp());
+		return true;
+	}
+	bool PostVisitBinaryOp(compiler::BinaryOp* op) {
+		Add(string("post") + op->GetOp());
+		return true;
+	}
+	bool PostVisitExpr(compiler::Expr* expr) {
+		Add("PostExpr");
+		return true;
+	}
+	bool VisitDeclRef(compiler::DeclRef* ref) {
+		Add(ref->GetRef()->GetName());
+		return true;
+	}
+	bool VisitLiteral(compiler::Literal* literal) {
+		Add("1");
+		return true;
+	}
+
+	std::string order;
+
+private:
+	void Add(string s) {
+		order += s.c_str();
+		order += " ";
+	}
+};
+
+void TestHookOrder() {
+	fprintf(stderr, "--- TestHookOrder ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan("int top(int x) {\n\treturn x - 1;\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	auto* ret = compiler::cast<compiler::FuncDecl>(parsed.FindDecl("top"))->GetBody()[0];
+
+	OrderVisitor visitor;
+	Expect(visitor.TraverseStmt(ret));
+	ExpectEq(string(visitor.order.c_str()),
+			 "Expr pre- Expr x PostExpr Expr 1 PostExpr post- PostExpr ");
+}
+
+// Stops at the first reference to a declaration
+class FindRef : public compiler::RecursiveASTVisitor<FindRef> {
+public:
+	FindRef(string name) : name_(name) {}
+
+	bool VisitDeclRef(compiler::DeclRef* ref) {
+		if(ref->GetRef()->GetName() == name_) {
+			found = ref;
+			return false;
+		}
+		return true;
+	}
+	bool PostVisitFuncDecl(compiler::FuncDecl* func) {
+		++funcs_done;
+		return true;
+	}
+
+	compiler::DeclRef* found = nullptr;
+	int64 funcs_done = 0;
+
+private:
+	string name_;
+};
+
+void TestEarlyExit() {
+	fprintf(stderr, "--- TestEarlyExit ---\n");
+	std::string src = NestedFooProgram();
+	compiler::TokenBuffer tokens = compiler::Scan(src.c_str());
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	FindRef find_sum("sum");
+	Expect(!find_sum.TraverseNamespace(&parsed));
+	Expect(find_sum.found != nullptr);
+	ExpectEq(find_sum.found->GetLoc().lineno, 18);
+	// bar and sum, but not top which was stopped in
+	ExpectEq(find_sum.funcs_done, 2);
+
+	// The visitor can be used again
+	FindRef find_none("nothing");
+	Expect(find_none.TraverseNamespace(&parsed));
+	Expect(find_none.found == nullptr);
+	ExpectEq(find_none.funcs_done, 3);
+}
+
+void TestNoAllocations() {
+	fprintf(stderr, "--- TestNoAllocations ---\n");
+	std::string src = NestedFooProgram();
+	compiler::TokenBuffer tokens = compiler::Scan(src.c_str());
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	CountingVisitor visitor;
+	visitor.TraverseNamespace(&parsed);
+	const int64 stmts = visitor.stmts;
+	// The work list has grown
+	const int64 before = sAllocations;
+	Expect(before > 0);
+	visitor.TraverseNamespace(&parsed);
+	visitor.TraverseNamespace(&parsed);
+	ExpectEq(sAllocations - before, 0);
+	ExpectEq(visitor.stmts, 3 * stmts);
+}
+
+void TestDeepExpression() {
+	fprintf(stderr, "--- TestDeepExpression ---\n");
+	const int64 kTerms = 100000;
+	std::string src = testing::DeepSum(kTerms);
+	compiler::TokenBuffer tokens = compiler::Scan(src.c_str());
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	CountingVisitor visitor;
+	Expect(visitor.TraverseNamespace(&parsed));
+	// Terms and the additions between them
+	ExpectEq(visitor.exprs, 2 * kTerms - 1);
+	ExpectEq(visitor.post_stmts, visitor.stmts);
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestCountsEveryNode();
+	stacklang::TestHookOrder();
+	stacklang::TestEarlyExit();
+	stacklang::TestNoAllocations();
+	stacklang::TestDeepExpression();
+	return 0;
+}
@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z ./ast_visitor_test.cc -o /tmp/ast_visitor_test
+/tmp/ast_visitor_test
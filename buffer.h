@@ -0,0 +1,132 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include "types.h"
+
+// STL
+#include <assert.h>
+#include <utility>
+
+namespace stacklang {
+
+// Growable array which owns its storage.
+// Unlike vector, appends are amortized O(1), but a buffer can only be moved.
+template<typename T>
+class buffer {
+public:
+	buffer() {}
+	buffer(const buffer& other) = delete;
+	buffer(buffer&& other)
+		: storage_(other.storage_),
+		  len_(other.len_),
+		  capacity_(other.capacity_) {
+		other.storage_ = nullptr;
+		other.len_ = 0;
+		other.capacity_ = 0;
+	}
+	~buffer() {
+		delete[] storage_;
+	}
+	buffer& operator=(const buffer& other) = delete;
+	buffer& operator=(buffer&& other) {
+		std::swap(storage_, other.storage_);
+		std::swap(len_, other.len_);
+		std::swap(capacity_, other.capacity_);
+		return *this;
+	}
+
+	int64 len()const {
+		return len_;
+	}
+
+	bool empty()const {
+		return len_ == 0;
+	}
+
+	int64 capacity()const {
+		return capacity_;
+	}
+
+	const T& operator[](int64 index)const {
+		assert(index < len_);
+		return storage_[index];
+	}
+
+	T& operator[](int64 index) {
+		assert(index < len_);
+		return storage_[index];
+	}
+
+	void push_back(T value) {
+		if(len_ == capacity_) {
+			reserve(capacity_ ? capacity_ * 2 : 8);
+		}
+		storage_[len_++] = value;
+	}
+
+	T pop_back() {
+		assert(len_ > 0);
+		return storage_[--len_];
+	}
+
+	T back()const {
+		assert(len_ > 0);
+		return storage_[len_-1];
+	}
+
+	T& back() {
+		assert(len_ > 0);
+		return storage_[len_-1];
+	}
+
+	// Keeps the storage for reuse
+	void clear() {
+		len_ = 0;
+	}
+
+	// Shrinks or grows; new elements are default constructed
+	void resize(int64 len) {
+		reserve(len);
+		for(int64 i=len_;i<len;++i) {
+			storage_[i] = T();
+		}
+		len_ = len;
+	}
+
+	void reserve(int64 capacity) {
+		if(capacity <= capacity_) {
+			return;
+		}
+		T* new_storage = new T[capacity];
+		for(int64 i=0;i<len_;++i) {
+			new_storage[i] = std::move(storage_[i]);
+		}
+		delete[] storage_;
+		storage_ = new_storage;
+		capacity_ = capacity;
+	}
+
+	T* data() {
+		return storage_;
+	}
+
+	const T* data()const {
+		return storage_;
+	}
+
+	const T* begin()const {
+		return storage_;
+	}
+	const T* end()const {
+		return storage_ + len_;
+	}
+
+private:
+	T* storage_ = nullptr;
+	int64 len_ = 0;
+	int64 capacity_ = 0;
+};
+
+};  // stacklang
+
+#endif//BUFFER_H
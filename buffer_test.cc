@@ -0,0 +1,103 @@
+#include "buffer.h"
+
+#include <cstdio>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+void TestSimple() {
+	fprintf(stderr, "--- TestSimple ---\n");
+	buffer<int64> foo;
+	ExpectEq(foo.len(), 0);
+	Expect(foo.empty());
+}
+
+void TestGrow() {
+	fprintf(stderr, "--- TestGrow ---\n");
+	buffer<int64> foo;
+	for(int64 i=0;i<1000;++i) {
+		foo.push_back(i * 3);
+	}
+	ExpectEq(foo.len(), 1000);
+	for(int64 i=0;i<1000;++i) {
+		ExpectEq(foo[i], i * 3);
+	}
+	ExpectEq(foo.back(), 999 * 3);
+}
+
+void TestPopAndClear() {
+	fprintf(stderr, "--- TestPopAndClear ---\n");
+	buffer<int64> foo;
+	foo.push_back(10);
+	foo.push_back(20);
+	ExpectEq(foo.pop_back(), 20);
+	ExpectEq(foo.len(), 1);
+	foo.clear();
+	Expect(foo.empty());
+	foo.push_back(30);
+	ExpectEq(foo[0], 30);
+}
+
+void TestResize() {
+	fprintf(stderr, "--- TestResize ---\n");
+	buffer<int64> foo;
+	foo.resize(5);
+	ExpectEq(foo.len(), 5);
+	ExpectEq(foo[4], 0);
+	foo[4] = 7;
+	foo.resize(2);
+	ExpectEq(foo.len(), 2);
+	ExpectEq(foo.capacity(), 5);
+	foo.reserve(100);
+	ExpectEq(foo.len(), 2);
+	ExpectEq(foo.capacity(), 100);
+}
+
+void TestMove() {
+	fprintf(stderr, "--- TestMove ---\n");
+	buffer<int64> foo;
+	foo.push_back(10);
+	buffer<int64> bar(std::move(foo));
+	ExpectEq(foo.len(), 0);
+	ExpectEq(bar.len(), 1);
+	ExpectEq(bar[0], 10);
+}
+
+void TestIterate() {
+	fprintf(stderr, "--- TestIterate ---\n");
+	buffer<int64> foo;
+	foo.push_back(10);
+	foo.push_back(20);
+	int64 sum = 0;
+	for(int64 v : foo) {
+		sum += v;
+	}
+	ExpectEq(sum, 30);
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestSimple();
+	stacklang::TestGrow();
+	stacklang::TestPopAndClear();
+	stacklang::TestResize();
+	stacklang::TestMove();
+	stacklang::TestIterate();
+	return 0;
+}
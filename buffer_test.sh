@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z  ./buffer_test.cc -o /tmp/buffer_test
+/tmp/buffer_test
@@ -0,0 +1,1199 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "string.h"
+#include "vector.h"
+#include "buffer.h"
+#include "hash_map.h"
+#include "utils.h"
+#include "parser.h"
+#include "ast_visitor.h"
+#include "ast_printer.h"
+#include "constant_fold.h"
+#include "type_check.h"
+#include "int_lowering.h"
+
+// STL
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <cstring>
+
+namespace stacklang {
+namespace compiler {
+
+// X(name, operand bytes, operands pushed less popped)
+// Operands are little endian, 4 byte ones signed. Jumps are to offsets in
+// the program's code.
+#define STACKLANG_OPCODES(X) \
+	X(Const, 8, 1) \
+	X(ConstSmall, 4, 1) \
+	X(Load, 4, 1) \
+	X(Store, 4, 0) \
+	X(StorePop, 4, -1) \
+	X(LoadGlobal, 4, 1) \
+	X(StoreGlobal, 4, 0) \
+	X(StoreGlobalPop, 4, -1) \
+	X(Pop, 0, -1) \
+	X(Add, 0, -1) \
+	X(Sub, 0, -1) \
+	X(Mul, 0, -1) \
+	X(Div, 0, -1) \
+	X(Mod, 0, -1) \
+	X(Shl, 0, -1) \
+	X(Shr, 0, -1) \
+	X(Lt, 0, -1) \
+	X(Le, 0, -1) \
+	X(Gt, 0, -1) \
+	X(Ge, 0, -1) \
+	X(Eq, 0, -1) \
+	X(Ne, 0, -1) \
+	X(BitAnd, 0, -1) \
+	X(BitOr, 0, -1) \
+	X(BitXor, 0, -1) \
+	X(AddConst, 4, 0) \
+	X(Neg, 0, 0) \
+	X(Not, 0, 0) \
+	X(Compl, 0, 0) \
+	X(Bool, 0, 0) \
+	X(Jump, 4, 0) \
+	X(JumpIfZero, 4, -1) \
+	X(JumpIfNotZero, 4, -1) \
+	/* Pops the callee's parameters too */ \
+	X(Call, 4, 1) \
+	X(Return, 0, -1) \
+	/* Ends a call into the VM, never compiled */ \
+	X(Halt, 0, 0)
+
+enum Opcode : uint8_t {
+#define STACKLANG_OPCODE_ENUM(name, size, effect) Opcode_##name,
+	STACKLANG_OPCODES(STACKLANG_OPCODE_ENUM)
+#undef STACKLANG_OPCODE_ENUM
+	Opcode_Count
+};
+
+const char* OpcodeName(Opcode op) {
+	switch(op) {
+#define STACKLANG_OPCODE_NAME(name, size, effect) case Opcode_##name: return #name;
+		STACKLANG_OPCODES(STACKLANG_OPCODE_NAME)
+#undef STACKLANG_OPCODE_NAME
+		default: return "(invalid)";
+	}
+}
+
+int64 OpcodeOperandSize(Opcode op) {
+	switch(op) {
+#define STACKLANG_OPCODE_SIZE(name, size, effect) case Opcode_##name: return size;
+		STACKLANG_OPCODES(STACKLANG_OPCODE_SIZE)
+#undef STACKLANG_OPCODE_SIZE
+		default: return 0;
+	}
+}
+
+int64_t OpcodeStackEffect(Opcode op) {
+	switch(op) {
+#define STACKLANG_OPCODE_EFFECT(name, size, effect) case Opcode_##name: return effect;
+		STACKLANG_OPCODES(STACKLANG_OPCODE_EFFECT)
+#undef STACKLANG_OPCODE_EFFECT
+		default: return 0;
+	}
+}
+
+// Operand of the instruction at offset
+int64 ReadOperand(const uint8_t* code, int64 offset) {
+	const Opcode op = Opcode(code[offset]);
+	if(OpcodeOperandSize(op) == 8) {
+		int64 value;
+		memcpy(&value, code + offset + 1, 8);
+		return value;
+	}
+	int32_t value = 0;
+	memcpy(&value, code + offset + 1, OpcodeOperandSize(op));
+	return int64(int64_t(value));
+}
+
+// No function of a BytecodeProgram
+const int64 kNoFunction = ~int64(0);
+
+// A function of a BytecodeProgram. Parameters and locals are slots of
+// its frame, with operands pushed after them.
+struct BytecodeFunction {
+	// nullptr for a global's initializer
+	FuncDecl* decl = nullptr;
+	// Of an initializer
+	VarDecl* global = nullptr;
+	// Where its template arguments start in the program's
+	int64 template_args = 0;
+	int64 num_params = 0;
+	// Parameters and locals
+	int64 num_slots = 0;
+	// Operands it pushes at most
+	int64 max_stack = 0;
+	// Its code in the program's
+	int64 begin = 0;
+	int64 end = 0;
+	// Same decl, other template arguments, or kNoFunction
+	int64 next = kNoFunction;
+};
+
+// Sets a global to what a function returns
+struct GlobalInit {
+	int64 global;
+	int64 func;
+};
+
+namespace internal {
+class BytecodeCompiler;
+}  // internal
+
+// Functions compiled to bytecode for a stack machine, see CompileBytecode.
+// Every function's code is in one array, so a program is compact and
+// cheap to walk.
+class BytecodeProgram {
+public:
+	BytecodeProgram() {}
+	BytecodeProgram(const BytecodeProgram& other) = delete;
+	BytecodeProgram& operator=(const BytecodeProgram& other) = delete;
+
+	int64 GetFunctionCount()const {
+		return funcs_.len();
+	}
+	const BytecodeFunction& GetFunction(int64 index)const {
+		return funcs_[index];
+	}
+	// Of func without template arguments, kNoFunction if it's not compiled
+	int64 FindFunction(FuncDecl* func)const {
+		const int64* head = heads_.find(func);
+		return head && func->GetTemplateParams().empty() ? *head : kNoFunction;
+	}
+	// Template argument i of func, ints evaluated and types canonical
+	int64 GetIntArg(const BytecodeFunction& func, int64 i)const {
+		return int_args_[func.template_args + i];
+	}
+	Type* GetTypeArg(const BytecodeFunction& func, int64 i)const {
+		return type_args_[func.template_args + i];
+	}
+
+	const buffer<uint8_t>& GetCode()const {
+		return code_;
+	}
+
+	int64 GetGlobalCount()const {
+		return global_vars_.len();
+	}
+	VarDecl* GetGlobal(int64 index)const {
+		return global_vars_[index];
+	}
+	// In the order they run. Globals without one start as zero.
+	const buffer<GlobalInit>& GetGlobalInits()const {
+		return inits_;
+	}
+
+	// What an instruction which can fail came from, nullptr if none
+	Stmt* GetSource(int64 offset)const {
+		int64 lo = 0;
+		int64 hi = sources_.len();
+		while(lo < hi) {
+			const int64 mid = (lo + hi) / 2;
+			if(sources_[mid].offset < offset) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		return lo < sources_.len() && sources_[lo].offset == offset ? sources_[lo].stmt : nullptr;
+	}
+
+private:
+	friend class internal::BytecodeCompiler;
+
+	struct Source {
+		int64 offset;
+		Stmt* stmt;
+	};
+
+	buffer<uint8_t> code_;
+	buffer<BytecodeFunction> funcs_;
+	buffer<Type*> type_args_;
+	buffer<int64> int_args_;
+	// First function of each decl
+	hash_map<FuncDecl*, int64> heads_;
+	buffer<VarDecl*> global_vars_;
+	hash_map<VarDecl*, int64> globals_;
+	buffer<GlobalInit> inits_;
+	// By offset
+	buffer<Source> sources_;
+};
+
+namespace internal {
+
+// Nesting of an expression, which is compiled recursively
+const int64 kMaxBytecodeExpressionDepth = 1000;
+
+// Globals an initializer reads, itself or in the functions it calls
+class GlobalReads : public RecursiveASTVisitor<GlobalReads> {
+public:
+	GlobalReads(buffer<VarDecl*>* globals) : globals_(globals) {}
+
+	void Collect(Expr* init) throws(Status) {
+		TraverseStmt(init) throws();
+		while(pending_.len()) {
+			TraverseStmt(pending_.pop_back()) throws();
+		}
+		// Variables declared in the functions are their locals
+		for(VarDecl* var : refs_) {
+			if(!locals_.contains(var)) {
+				globals_->push_back(var);
+			}
+		}
+	}
+
+	bool VisitVarDecl(VarDecl* var) {
+		locals_.set(var, true);
+		return true;
+	}
+	bool VisitDeclRef(DeclRef* ref) {
+		if(auto* var = dyn_cast<VarDecl>(ref->GetRef())) {
+			refs_.push_back(var);
+		} else if(auto* func = dyn_cast<FuncDecl>(ref->GetRef())) {
+			if(!funcs_.contains(func)) {
+				funcs_.set(func, true);
+				pending_.push_back(func);
+			}
+		}
+		return true;
+	}
+
+private:
+	buffer<VarDecl*>* globals_;
+	buffer<VarDecl*> refs_;
+	hash_map<VarDecl*, bool> locals_;
+	hash_map<FuncDecl*, bool> funcs_;
+	buffer<FuncDecl*> pending_;
+};
+
+// Appends functions to a program, compiling them in the order they're
+// first called so each one's code is contiguous
+class BytecodeCompiler {
+public:
+	BytecodeCompiler(BytecodeProgram* program) : program_(program) {}
+
+	static const int64 kNone = ~int64(0);
+
+	int64 AddFunction(FuncDecl* func) throws(Status) {
+		if(!func->GetTemplateParams().empty()) {
+			throw Status{.message = string("Can't compile template ") + func->GetName() +
+							" without arguments",
+						 .loc = func->GetLoc()};
+		}
+		// Leaves the program as it was on errors
+		const int64 num_funcs = program_->funcs_.len();
+		const int64 num_code = program_->code_.len();
+		const int64 num_args = program_->int_args_.len();
+		const int64 num_globals = program_->global_vars_.len();
+		const int64 num_inits = program_->inits_.len();
+		const int64 num_sources = program_->sources_.len();
+		bool done = false;
+		auto guard = MakeLambdaGuard([&]() {
+			if(done) {
+				return;
+			}
+			for(int64 i=program_->funcs_.len();i-- > num_funcs;) {
+				const BytecodeFunction& added = program_->funcs_[i];
+				if(added.decl == nullptr) {
+					continue;
+				}
+				if(added.next == kNoFunction) {
+					program_->heads_.remove(added.decl);
+				} else {
+					program_->heads_.set(added.decl, added.next);
+				}
+			}
+			for(int64 i=num_globals;i<program_->global_vars_.len();++i) {
+				program_->globals_.remove(program_->global_vars_[i]);
+			}
+			program_->funcs_.resize(num_funcs);
+			program_->code_.resize(num_code);
+			program_->type_args_.resize(num_args);
+			program_->int_args_.resize(num_args);
+			program_->global_vars_.resize(num_globals);
+			program_->inits_.resize(num_inits);
+			program_->sources_.resize(num_sources);
+		});
+		const int64 index = GetFunc(func, nullptr, nullptr, func) throws();
+		for(int64 i=num_funcs;i<program_->funcs_.len();++i) {
+			CompileFunction(i) throws();
+		}
+		done = true;
+		return index;
+	}
+
+private:
+	// Adds decl for those arguments if it's not there, to be compiled
+	int64 GetFunc(FuncDecl* decl, const Type* const* type_args, const int64* int_args,
+				  Stmt* where) throws(Status) {
+		const int64 num_args = decl->GetTemplateParams().len();
+		const int64* head = program_->heads_.find(decl);
+		for(int64 index = head ? *head : kNoFunction;index != kNoFunction;
+			index = program_->funcs_[index].next) {
+			const BytecodeFunction& func = program_->funcs_[index];
+			bool same = true;
+			for(int64 i=0;i<num_args;++i) {
+				same = same && program_->GetTypeArg(func, i) == type_args[i] &&
+					program_->GetIntArg(func, i) == int_args[i];
+			}
+			if(same) {
+				return index;
+			}
+		}
+		if(decl->IsPrototype()) {
+			throw Status{.message = string("Function ") + decl->GetName() + " isn't defined",
+						 .loc = where->GetLoc()};
+		}
+		BytecodeFunction func;
+		func.decl = decl;
+		func.template_args = program_->int_args_.len();
+		func.num_params = decl->GetParameters().len();
+		func.next = head ? *head : kNoFunction;
+		for(int64 i=0;i<num_args;++i) {
+			program_->type_args_.push_back(const_cast<Type*>(type_args[i]));
+			program_->int_args_.push_back(int_args[i]);
+		}
+		const int64 index = program_->funcs_.len();
+		program_->funcs_.push_back(func);
+		program_->heads_.set(decl, index);
+		return index;
+	}
+
+	int64 GetGlobal(VarDecl* var) throws(Status) {
+		if(const int64* index = program_->globals_.find(var)) {
+			return *index;
+		}
+		// A global's type can't use the template arguments of the function
+		// referring to it
+		const int64 current = current_;
+		current_ = kNoFunction;
+		auto guard = MakeLambdaGuard([&]() { current_ = current; });
+		Current().RequireInt(var->GetType(), var) throws();
+		const int64 index = program_->global_vars_.len();
+		program_->global_vars_.push_back(var);
+		program_->globals_.set(var, index);
+		Expr* init = internal::InitExpr(var) throws();
+		if(init == nullptr) {
+			return index;
+		}
+		// What it reads is set first, including through calls
+		buffer<VarDecl*> reads;
+		GlobalReads visitor(&reads);
+		visitor.Collect(init) throws();
+		for(VarDecl* read : reads) {
+			GetGlobal(read) throws();
+		}
+		BytecodeFunction func;
+		func.global = var;
+		func.template_args = program_->int_args_.len();
+		program_->inits_.push_back(GlobalInit{.global = index,
+											  .func = program_->funcs_.len()});
+		program_->funcs_.push_back(func);
+		return index;
+	}
+
+	void CompileFunction(int64 index) throws(Status) {
+		current_ = index;
+		slots_.clear();
+		num_slots_ = 0;
+		depth_ = 0;
+		max_depth_ = 0;
+		last_op_ = kNone;
+		const int64 begin = program_->code_.len();
+		const BytecodeFunction func = program_->funcs_[index];
+		if(func.decl) {
+			CompileBody(func.decl) throws();
+		} else {
+			CompileExpr(internal::InitExpr(func.global), 0) throws();
+			Emit(Opcode_Return, func.global);
+		}
+		if(program_->code_.len() > INT32_MAX) {
+			throw Status{.message = "Program too large to compile",
+						 .loc = func.decl ? func.decl->GetLoc() : func.global->GetLoc()};
+		}
+		BytecodeFunction& compiled = program_->funcs_[index];
+		compiled.begin = begin;
+		compiled.end = program_->code_.len();
+		compiled.num_slots = num_slots_;
+		compiled.max_stack = max_depth_;
+	}
+
+	void CompileBody(FuncDecl* decl) throws(Status) {
+		if(!isa<VoidType>(Current().ResolveType(decl->GetReturnType()))) {
+			Current().RequireInt(decl->GetReturnType(), decl) throws();
+		}
+		for(VarDecl* param : decl->GetParameters()) {
+			Current().RequireInt(param->GetType(), param) throws();
+			slots_.set(param, num_slots_++);
+		}
+		for(Stmt* stmt : decl->GetBody() throws()) {
+			if(auto* ret = dyn_cast<ReturnStmt>(stmt)) {
+				if(ret->GetValue()) {
+					CompileExpr(ret->GetValue(), 0) throws();
+				} else {
+					EmitConst(0, ret);
+				}
+				Emit(Opcode_Return, ret);
+				// The rest can't run
+				return;
+			} else if(auto* var = dyn_cast<VarDecl>(stmt)) {
+				Current().RequireInt(var->GetType(), var) throws();
+				const int64 slot = num_slots_++;
+				slots_.set(var, slot);
+				if(Expr* init = internal::InitExpr(var) throws()) {
+					CompileExpr(init, 0) throws();
+				} else {
+					EmitConst(0, var);
+				}
+				Emit(Opcode_StorePop, var, slot);
+			} else if(auto* expr = dyn_cast<Expr>(stmt)) {
+				CompileExpr(expr, 0) throws();
+				EmitPop(expr);
+			} else {
+				throw Status{.message = string("Can't compile ") +
+								StmtKindName(stmt->GetStmtKind()),
+							 .loc = stmt->GetLoc()};
+			}
+		}
+		EmitConst(0, decl);
+		Emit(Opcode_Return, decl);
+	}
+
+	// Leaves expr's value on the stack
+	void CompileExpr(Expr* expr, int64 depth) throws(Status) {
+		if(depth >= kMaxBytecodeExpressionDepth) {
+			throw Status{.message = "Expression nested too deeply to compile",
+						 .loc = expr->GetLoc()};
+		}
+		++depth;
+		switch(expr->GetStmtKind()) {
+			case StmtKind_Literal: {
+				auto* integer = dyn_cast<IntegerValue>(cast<Literal>(expr)->GetValue());
+				if(integer == nullptr) {
+					throw Status{.message = "Only int literals are supported",
+								 .loc = expr->GetLoc()};
+				}
+				EmitConst(integer->GetValue(), expr);
+				return;
+			}
+			case StmtKind_DeclRef:
+				CompileDeclRef(cast<DeclRef>(expr)) throws();
+				return;
+			case StmtKind_ParenExpr:
+				CompileExpr(cast<ParenExpr>(expr)->GetSub(), depth) throws();
+				return;
+			case StmtKind_CastExpr:
+				Current().RequireInt(cast<CastExpr>(expr)->GetToType(), expr) throws();
+				CompileExpr(cast<CastExpr>(expr)->GetSub(), depth) throws();
+				return;
+			case StmtKind_CtorCall: {
+				// int(x), or int() for zero
+				auto* ctor = cast<CtorCall>(expr);
+				Current().RequireInt(ctor->GetType(), expr) throws();
+				if(ctor->GetArgs().len() > 1) {
+					throw Status{.message = "Can't make an int of several values",
+								 .loc = expr->GetLoc()};
+				}
+				if(ctor->GetArgs().len()) {
+					CompileExpr(ctor->GetArgs()[0], depth) throws();
+				} else {
+					EmitConst(0, expr);
+				}
+				return;
+			}
+			case StmtKind_UnaryOp:
+				CompileUnaryOp(cast<UnaryOp>(expr), depth) throws();
+				return;
+			case StmtKind_BinaryOp:
+				CompileBinaryOp(cast<BinaryOp>(expr), depth) throws();
+				return;
+			case StmtKind_FuncCall:
+				CompileCall(cast<FuncCall>(expr), depth) throws();
+				return;
+			default:
+				throw Status{.message = string("Can't compile ") +
+								StmtKindName(expr->GetStmtKind()),
+							 .loc = expr->GetLoc()};
+		}
+	}
+
+	void CompileDeclRef(DeclRef* ref) throws(Status) {
+		if(auto* param = dyn_cast<TemplateParam>(ref->GetRef())) {
+			int64 value = 0;
+			if(Current().IntArg(param, &value)) {
+				EmitConst(value, ref);
+				return;
+			}
+		} else if(auto* var = dyn_cast<VarDecl>(ref->GetRef())) {
+			if(const int64* slot = slots_.find(var)) {
+				Emit(Opcode_Load, ref, *slot);
+			} else {
+				Emit(Opcode_LoadGlobal, ref, GetGlobal(var) throws());
+			}
+			return;
+		}
+		throw Status{.message = string("Can't use ") + ref->GetRef()->GetName() +
+						" as a value",
+					 .loc = ref->GetLoc()};
+	}
+
+	// Slot of a local, or index of a global
+	bool CompileLValue(Expr* expr, int64* index) throws(Status) {
+		VarDecl* var = NamedVar(expr);
+		if(var == nullptr) {
+			throw Status{.message = "Can only assign to variables",
+						 .loc = expr->GetLoc()};
+		}
+		if(const int64* slot = slots_.find(var)) {
+			*index = *slot;
+			return false;
+		}
+		*index = GetGlobal(var) throws();
+		return true;
+	}
+
+	void CompileUnaryOp(UnaryOp* op, int64 depth) throws(Status) {
+		string name = op->GetOp();
+		if(name == "++" || name == "--") {
+			int64 index = 0;
+			const bool global = CompileLValue(op->GetSub(), &index) throws();
+			const Opcode load = global ? Opcode_LoadGlobal : Opcode_Load;
+			Emit(load, op, index);
+			if(op->IsPostfix()) {
+				// The old value stays under the new
+				Emit(load, op, index);
+			}
+			Emit(Opcode_AddConst, op, name == "++" ? 1 : int64(-1));
+			Emit(op->IsPostfix() ? (global ? Opcode_StoreGlobalPop : Opcode_StorePop)
+								 : (global ? Opcode_StoreGlobal : Opcode_Store),
+				 op, index);
+			return;
+		}
+		CompileExpr(op->GetSub(), depth) throws();
+		if(name == "-") {
+			Emit(Opcode_Neg, op);
+		} else if(name == "!") {
+			Emit(Opcode_Not, op);
+		} else if(name == "~") {
+			Emit(Opcode_Compl, op);
+		} else if(name != "+") {
+			throw Status{.message = string("Unary ") + name + " isn't supported",
+						 .loc = op->GetLoc()};
+		}
+	}
+
+	// Opcode_Count for IntOp_None
+	static Opcode IntOpcode(internal::IntOp op) {
+		static_assert(Opcode_BitXor - Opcode_Add == internal::IntOp_Xor);
+		return op == internal::IntOp_None ? Opcode_Count : Opcode(Opcode_Add + op);
+	}
+
+	void CompileBinaryOp(BinaryOp* op, int64 depth) throws(Status) {
+		string name = op->GetOp();
+		if(IsAssignmentOp(name)) {
+			int64 index = 0;
+			const bool global = CompileLValue(op->GetLeft(), &index) throws();
+			Opcode arithmetic = Opcode_Count;
+			if(name != "=") {
+				// Compound assignments are the operator and =
+				arithmetic = IntOpcode(internal::CompoundAssignmentOp(name));
+				Emit(global ? Opcode_LoadGlobal : Opcode_Load, op, index);
+			}
+			CompileExpr(op->GetRight(), depth) throws();
+			if(arithmetic != Opcode_Count) {
+				Emit(arithmetic, op);
+			}
+			Emit(global ? Opcode_StoreGlobal : Opcode_Store, op, index);
+			return;
+		}
+		if(name == "&&" || name == "||") {
+			// a && b is a ? bool(b) : 0, a || b is a ? 1 : bool(b)
+			const bool is_and = name == "&&";
+			CompileExpr(op->GetLeft(), depth) throws();
+			const int64 short_circuit =
+				EmitJump(is_and ? Opcode_JumpIfZero : Opcode_JumpIfNotZero, op);
+			CompileExpr(op->GetRight(), depth) throws();
+			Emit(Opcode_Bool, op);
+			const int64 end = EmitJump(Opcode_Jump, op);
+			// Where the other path is, which hasn't pushed b
+			--depth_;
+			Bind(short_circuit);
+			EmitConst(is_and ? 0 : 1, op);
+			Bind(end);
+			return;
+		}
+		if(name == ",") {
+			CompileExpr(op->GetLeft(), depth) throws();
+			EmitPop(op);
+			CompileExpr(op->GetRight(), depth) throws();
+			return;
+		}
+		const Opcode arithmetic = IntOpcode(internal::IntOpOf(name));
+		if(arithmetic == Opcode_Count) {
+			throw Status{.message = string("Binary ") + name + " isn't supported",
+						 .loc = op->GetLoc()};
+		}
+		CompileExpr(op->GetLeft(), depth) throws();
+		// x + 1 and x - 1 take the constant with the instruction
+		int64 constant = 0;
+		if((arithmetic == Opcode_Add || arithmetic == Opcode_Sub) &&
+		   IntegerLiteralValue(op->GetRight(), &constant)) {
+			if(arithmetic == Opcode_Sub) {
+				constant = 0 - constant;
+			}
+			if(FitsInt32(constant)) {
+				Emit(Opcode_AddConst, op, constant);
+				return;
+			}
+		}
+		CompileExpr(op->GetRight(), depth) throws();
+		Emit(arithmetic, op);
+	}
+
+	void CompileCall(FuncCall* call, int64 depth) throws(Status) {
+		DeclRef* callee = call->GetCallee();
+		auto* decl = cast<FuncDecl>(callee->GetRef());
+		vector<TemplateParam*> params = decl->GetTemplateParams();
+		vector<TemplateArg> template_args = callee->GetTemplateArgs();
+		if(template_args.len() != params.len()) {
+			throw Status{.message = string("Can't deduce template arguments of ") +
+							decl->GetName(),
+						 .loc = call->GetLoc()};
+		}
+		buffer<Type*> type_args;
+		buffer<int64> int_args;
+		for(TemplateArg arg : template_args) {
+			type_args.push_back(arg.type ? Current().ResolveType(arg.type) : nullptr);
+			int_args.push_back(arg.int_value ? EvaluateConstant(arg.int_value, depth) throws()
+											 : 0);
+		}
+		const int64 index = GetFunc(decl, type_args.data(), int_args.data(), call) throws();
+		for(Expr* arg : call->GetArgs()) {
+			CompileExpr(arg, depth) throws();
+		}
+		Emit(Opcode_Call, call, index);
+		depth_ -= call->GetArgs().len();
+	}
+
+	// Of a template argument, from literals and the function's own
+	// template arguments
+	int64 EvaluateConstant(Expr* expr, int64 depth) throws(Status) {
+		if(depth >= kMaxBytecodeExpressionDepth) {
+			throw Status{.message = "Expression nested too deeply to compile",
+						 .loc = expr->GetLoc()};
+		}
+		++depth;
+		int64 value = 0;
+		if(IntegerLiteralValue(expr, &value)) {
+			return value;
+		}
+		if(auto* ref = dyn_cast<DeclRef>(expr)) {
+			auto* param = dyn_cast<TemplateParam>(ref->GetRef());
+			if(param && Current().IntArg(param, &value)) {
+				return value;
+			}
+		} else if(auto* paren = dyn_cast<ParenExpr>(expr)) {
+			return EvaluateConstant(paren->GetSub(), depth);
+		} else if(auto* cast_expr = dyn_cast<CastExpr>(expr)) {
+			Current().RequireInt(cast_expr->GetToType(), expr) throws();
+			return EvaluateConstant(cast_expr->GetSub(), depth);
+		} else if(auto* unary = dyn_cast<UnaryOp>(expr)) {
+			const int64 sub = EvaluateConstant(unary->GetSub(), depth) throws();
+			if(FoldUnaryOp(unary->GetOp(), sub, &value)) {
+				return value;
+			}
+		} else if(auto* binary = dyn_cast<BinaryOp>(expr)) {
+			const int64 left = EvaluateConstant(binary->GetLeft(), depth) throws();
+			const int64 right = EvaluateConstant(binary->GetRight(), depth) throws();
+			if(FoldBinaryOp(binary->GetOp(), left, right, &value)) {
+				return value;
+			}
+		}
+		throw Status{.message = "Template argument isn't a constant",
+					 .loc = expr->GetLoc()};
+	}
+
+	// The function being compiled with its template arguments, which moves
+	// as specializations are added
+	internal::Specialization Current() {
+		if(current_ == kNoFunction || program_->funcs_[current_].decl == nullptr) {
+			return internal::Specialization{};
+		}
+		const BytecodeFunction& func = program_->funcs_[current_];
+		return internal::Specialization{
+			.decl = func.decl,
+			.type_args = program_->type_args_.data() + func.template_args,
+			.int_args = program_->int_args_.data() + func.template_args};
+	}
+
+	static bool FitsInt32(int64 value) {
+		return int64_t(value) >= INT32_MIN && int64_t(value) <= INT32_MAX;
+	}
+
+	void EmitConst(int64 value, Stmt* source) {
+		Emit(FitsInt32(value) ? Opcode_ConstSmall : Opcode_Const, source, value);
+	}
+
+	void Emit(Opcode op, Stmt* source, int64 operand = 0) {
+		last_op_ = program_->code_.len();
+		// Only what can fail needs where it's from
+		if(op == Opcode_Div || op == Opcode_Mod || op == Opcode_Shl || op == Opcode_Shr ||
+		   op == Opcode_Call) {
+			program_->sources_.push_back(BytecodeProgram::Source{.offset = last_op_,
+																  .stmt = source});
+		}
+		program_->code_.push_back(op);
+		uint8_t bytes[8];
+		const int64 size = OpcodeOperandSize(op);
+		if(size == 8) {
+			memcpy(bytes, &operand, 8);
+		} else {
+			const int32_t small = int32_t(int64_t(operand));
+			memcpy(bytes, &small, 4);
+		}
+		for(int64 i=0;i<size;++i) {
+			program_->code_.push_back(bytes[i]);
+		}
+		depth_ += OpcodeStackEffect(op);
+		if(depth_ > max_depth_) {
+			max_depth_ = depth_;
+		}
+	}
+
+	// Discards the top, or stops the Store which pushed it keeping it
+	void EmitPop(Stmt* source) {
+		if(last_op_ != kNone) {
+			uint8_t& last = program_->code_[last_op_];
+			if(last == Opcode_Store || last == Opcode_StoreGlobal) {
+				last = last == Opcode_Store ? Opcode_StorePop : Opcode_StoreGlobalPop;
+				--depth_;
+				return;
+			}
+		}
+		Emit(Opcode_Pop, source);
+	}
+
+	// Where to patch the target in
+	int64 EmitJump(Opcode op, Stmt* source) {
+		Emit(op, source, 0);
+		return program_->code_.len() - 4;
+	}
+	// Jumps at patch go here
+	void Bind(int64 patch) {
+		const int32_t target = int32_t(program_->code_.len());
+		memcpy(&program_->code_[patch], &target, 4);
+		// Code before isn't all that runs before here
+		last_op_ = kNone;
+	}
+
+	BytecodeProgram* program_;
+	// Function being compiled
+	int64 current_ = kNoFunction;
+	hash_map<VarDecl*, int64> slots_;
+	int64 num_slots_ = 0;
+	// Operands on the stack
+	int64_t depth_ = 0;
+	int64_t max_depth_ = 0;
+	// Offset of the last instruction, kNone if code jumps in after it
+	int64 last_op_ = kNone;
+};
+
+}  // internal
+
+// Compiles func, what it calls and the globals they use into program,
+// returning its index. Functions are compiled once for each set of template
+// arguments. Only int values are supported. Throws, leaving program as it
+// was, if something doesn't compile.
+int64 CompileBytecode(FuncDecl* func, BytecodeProgram* program) throws(Status) {
+	internal::BytecodeCompiler compiler(program);
+	return compiler.AddFunction(func);
+}
+
+namespace internal {
+
+void WriteSigned(int64 value, PrintSink* sink) throws(Status) {
+	char digits[32];
+	sink->Write(digits, snprintf(digits, sizeof(digits), "%ld", long(value))) throws();
+}
+
+// Name with template arguments, like bar<2>
+void WriteFunctionName(const BytecodeProgram& program, int64 index,
+					   PrintSink* sink) throws(Status) {
+	const BytecodeFunction& func = program.GetFunction(index);
+	if(func.decl == nullptr) {
+		sink->Write("(init ") throws();
+		sink->Write(func.global->GetName()) throws();
+		sink->Write(")") throws();
+		return;
+	}
+	sink->Write(func.decl->GetName()) throws();
+	const int64 num_args = func.decl->GetTemplateParams().len();
+	for(int64 i=0;i<num_args;++i) {
+		sink->Write(i ? ", " : "<") throws();
+		if(Type* type = program.GetTypeArg(func, i)) {
+			sink->Write(TypeName(type)) throws();
+		} else {
+			WriteSigned(program.GetIntArg(func, i), sink) throws();
+		}
+	}
+	if(num_args) {
+		sink->Write(">") throws();
+	}
+}
+
+}  // internal
+
+// One line per instruction, at its offset in the function:
+//   bar<2>: 0 params, 0 slots, 1 stack
+//     0  ConstSmall 2
+//     5  Return
+void Disassemble(const BytecodeProgram& program, int64 index, PrintSink* sink) throws(Status) {
+	const BytecodeFunction& func = program.GetFunction(index);
+	internal::WriteFunctionName(program, index, sink) throws();
+	sink->Write(": ") throws();
+	sink->WriteInt(func.num_params) throws();
+	sink->Write(" params, ") throws();
+	sink->WriteInt(func.num_slots) throws();
+	sink->Write(" slots, ") throws();
+	sink->WriteInt(func.max_stack) throws();
+	sink->Write(" stack\n") throws();
+	const uint8_t* code = program.GetCode().data();
+	for(int64 offset=func.begin;offset<func.end;) {
+		const Opcode op = Opcode(code[offset]);
+		char prefix[32];
+		sink->Write(prefix, snprintf(prefix, sizeof(prefix), "%6ld  ",
+									 long(offset - func.begin))) throws();
+		sink->Write(OpcodeName(op)) throws();
+		if(OpcodeOperandSize(op)) {
+			const int64 operand = ReadOperand(code, offset);
+			sink->Write(" ") throws();
+			if(op == Opcode_Jump || op == Opcode_JumpIfZero || op == Opcode_JumpIfNotZero) {
+				internal::WriteSigned(operand - func.begin, sink) throws();
+			} else {
+				internal::WriteSigned(operand, sink) throws();
+			}
+			if(op == Opcode_Call) {
+				sink->Write(" (") throws();
+				internal::WriteFunctionName(program, operand, sink) throws();
+				sink->Write(")") throws();
+			} else if(op == Opcode_LoadGlobal || op == Opcode_StoreGlobal ||
+					  op == Opcode_StoreGlobalPop) {
+				sink->Write(" (") throws();
+				sink->Write(program.GetGlobal(operand)->GetName()) throws();
+				sink->Write(")") throws();
+			}
+		}
+		sink->Write("\n") throws();
+		offset += 1 + OpcodeOperandSize(op);
+	}
+}
+
+void Disassemble(const BytecodeProgram& program, PrintSink* sink) throws(Status) {
+	for(int64 i=0;i<program.GetFunctionCount();++i) {
+		Disassemble(program, i, sink) throws();
+	}
+}
+
+struct VirtualMachineOptions {
+	// For the parameters, locals and operands of every active call
+	int64 stack_slots = 1 << 20;
+	int64 max_call_depth = 1 << 16;
+};
+
+// Runs a BytecodeProgram. Functions are linked into direct threaded code
+// on first use: each instruction becomes the address of the code running
+// it, so dispatch is one indirect jump (computed goto, a GCC and Clang
+// extension). Frames and operands share one stack and return addresses
+// another, both allocated up front, so calls don't allocate.
+// Globals keep their values across calls. The program may grow, but
+// mustn't be destroyed, while the VM is used.
+class VirtualMachine {
+public:
+	VirtualMachine(const BytecodeProgram* program,
+				   VirtualMachineOptions options = VirtualMachineOptions{})
+		: program_(program) {
+		stack_.resize(options.stack_slots);
+		returns_.resize(options.max_call_depth);
+	}
+	VirtualMachine(const VirtualMachine& other) = delete;
+	VirtualMachine& operator=(const VirtualMachine& other) = delete;
+
+	// Throws on errors running it, like dividing by zero or overflowing
+	// the stack
+	int64 Call(int64 func, vector<int64> args) throws(Status) {
+		Link();
+		while(initialized_ < program_->GetGlobalInits().len()) {
+			GlobalInit init = program_->GetGlobalInits()[initialized_];
+			globals_[init.global] = Execute(init.func, nullptr) throws();
+			++initialized_;
+		}
+		const BytecodeFunction& compiled = program_->GetFunction(func);
+		if(args.len() != compiled.num_params || compiled.decl == nullptr) {
+			throw Status{.message = "Wrong number of arguments calling function",
+						 .loc = compiled.decl ? compiled.decl->GetLoc() : LocationRef{}};
+		}
+		for(int64 i=0;i<args.len();++i) {
+			stack_[i] = args[i];
+		}
+		return Execute(func, nullptr);
+	}
+	// func must be compiled into the program
+	int64 Call(FuncDecl* func, vector<int64> args) throws(Status) {
+		const int64 index = program_->FindFunction(func);
+		if(index == kNoFunction) {
+			throw Status{.message = string("Function ") + func->GetName() + " isn't compiled",
+						 .loc = func->GetLoc()};
+		}
+		return Call(index, args);
+	}
+
+private:
+	struct ThreadedInsn {
+		const void* handler;
+		int64 operand;
+	};
+	struct LinkedFunc {
+		// Index of its first instruction
+		int64 entry;
+		int64 num_params;
+		int64 num_slots;
+		// Slots and operands
+		int64 frame_size;
+	};
+	struct ReturnFrame {
+		const ThreadedInsn* ip;
+		int64* fp;
+	};
+
+	// Links functions added to the program since
+	void Link() {
+		if(funcs_.len() == program_->GetFunctionCount()) {
+			return;
+		}
+		const void* const* labels = nullptr;
+		Execute(0, &labels);
+		const uint8_t* code = program_->GetCode().data();
+		buffer<int64> indices;
+		for(int64 i=funcs_.len();i<program_->GetFunctionCount();++i) {
+			const BytecodeFunction& func = program_->GetFunction(i);
+			const int64 entry = threaded_.len();
+			// Instruction each jump target is
+			indices.resize(func.end - func.begin);
+			int64 count = 0;
+			for(int64 offset=func.begin;offset<func.end;offset += 1 + OpcodeOperandSize(Opcode(code[offset]))) {
+				indices[offset - func.begin] = entry + count++;
+			}
+			for(int64 offset=func.begin;offset<func.end;offset += 1 + OpcodeOperandSize(Opcode(code[offset]))) {
+				const Opcode op = Opcode(code[offset]);
+				int64 operand = OpcodeOperandSize(op) ? ReadOperand(code, offset) : 0;
+				if(op == Opcode_Jump || op == Opcode_JumpIfZero || op == Opcode_JumpIfNotZero) {
+					operand = indices[operand - func.begin];
+				}
+				threaded_.push_back(ThreadedInsn{labels[op], operand});
+				offsets_.push_back(offset);
+			}
+			funcs_.push_back(LinkedFunc{.entry = entry,
+										.num_params = func.num_params,
+										.num_slots = func.num_slots,
+										.frame_size = func.num_slots + func.max_stack});
+		}
+		globals_.resize(program_->GetGlobalCount());
+	}
+
+	[[noreturn]] void Fail(const ThreadedInsn* insn, string message) throws(Status) {
+		Stmt* source = program_->GetSource(offsets_[insn - threaded_.data()]);
+		throw Status{.message = message, .loc = source ? source->GetLoc() : LocationRef{}};
+	}
+	[[noreturn]] void FailCall(const ThreadedInsn* insn, int64 func) throws(Status) {
+		const BytecodeFunction& callee = program_->GetFunction(func);
+		Fail(insn, string("Stack overflow calling ") +
+				   (callee.decl ? callee.decl->GetName() : callee.global->GetName())) throws();
+	}
+
+	// Runs func with its arguments at the bottom of the stack, or with
+	// labels, sets them to the code running each opcode
+	int64 Execute(int64 func, const void* const** labels) throws(Status) {
+#define STACKLANG_OPCODE_LABEL(name, size, effect) &&op_##name,
+		static const void* const kLabels[] = {
+			STACKLANG_OPCODES(STACKLANG_OPCODE_LABEL)
+		};
+#undef STACKLANG_OPCODE_LABEL
+		if(labels) {
+			*labels = kLabels;
+			return 0;
+		}
+#define STACKLANG_NEXT() goto *(++ip)->handler
+#define STACKLANG_JUMP(target) ip = base + (target); goto *ip->handler
+#define STACKLANG_BINARY(expr) { \
+			const int64 b = sp[-1]; \
+			const int64 a = sp[-2]; \
+			--sp; \
+			sp[-1] = (expr); \
+			STACKLANG_NEXT(); \
+		}
+#define STACKLANG_DIVIDE(expr) { \
+			const int64 b = sp[-1]; \
+			const int64 a = sp[-2]; \
+			if(b == 0) { \
+				Fail(ip, "Division by zero") throws(); \
+			} \
+			if(int64_t(b) == -1 && int64_t(a) == INT64_MIN) { \
+				Fail(ip, "Division overflow") throws(); \
+			} \
+			--sp; \
+			sp[-1] = int64(expr); \
+			STACKLANG_NEXT(); \
+		}
+#define STACKLANG_SHIFT(expr) { \
+			const int64 b = sp[-1]; \
+			const int64 a = sp[-2]; \
+			if(b >= 64) { \
+				Fail(ip, "Shift out of range") throws(); \
+			} \
+			--sp; \
+			sp[-1] = int64(expr); \
+			STACKLANG_NEXT(); \
+		}
+
+		const ThreadedInsn* const base = threaded_.data();
+		const LinkedFunc* const funcs = funcs_.data();
+		int64* const globals = globals_.data();
+		int64* const stack_end = stack_.data() + stack_.len();
+		ReturnFrame* rsp = returns_.data();
+		ReturnFrame* const returns_end = rsp + returns_.len();
+		const ThreadedInsn halt = {kLabels[Opcode_Halt], 0};
+
+		const ThreadedInsn* ip = base + funcs[func].entry;
+		if(funcs[func].frame_size > stack_.len() || returns_.len() == 0) {
+			FailCall(ip, func) throws();
+		}
+		rsp->ip = &halt;
+		rsp->fp = nullptr;
+		++rsp;
+		int64* fp = stack_.data();
+		int64* sp = fp + funcs[func].num_slots;
+		goto *ip->handler;
+
+	op_Const:
+	op_ConstSmall:
+		*sp++ = ip->operand;
+		STACKLANG_NEXT();
+	op_Load:
+		*sp++ = fp[ip->operand];
+		STACKLANG_NEXT();
+	op_Store:
+		fp[ip->operand] = sp[-1];
+		STACKLANG_NEXT();
+	op_StorePop:
+		fp[ip->operand] = *--sp;
+		STACKLANG_NEXT();
+	op_LoadGlobal:
+		*sp++ = globals[ip->operand];
+		STACKLANG_NEXT();
+	op_StoreGlobal:
+		globals[ip->operand] = sp[-1];
+		STACKLANG_NEXT();
+	op_StoreGlobalPop:
+		globals[ip->operand] = *--sp;
+		STACKLANG_NEXT();
+	op_Pop:
+		--sp;
+		STACKLANG_NEXT();
+	op_Add: STACKLANG_BINARY(a + b)
+	op_Sub: STACKLANG_BINARY(a - b)
+	op_Mul: STACKLANG_BINARY(a * b)
+	op_Div: STACKLANG_DIVIDE(int64_t(a) / int64_t(b))
+	op_Mod: STACKLANG_DIVIDE(int64_t(a) % int64_t(b))
+	op_Shl: STACKLANG_SHIFT(a << b)
+	op_Shr: STACKLANG_SHIFT(int64_t(a) >> b)
+	op_Lt: STACKLANG_BINARY(int64_t(a) < int64_t(b))
+	op_Le: STACKLANG_BINARY(int64_t(a) <= int64_t(b))
+	op_Gt: STACKLANG_BINARY(int64_t(a) > int64_t(b))
+	op_Ge: STACKLANG_BINARY(int64_t(a) >= int64_t(b))
+	op_Eq: STACKLANG_BINARY(a == b)
+	op_Ne: STACKLANG_BINARY(a != b)
+	op_BitAnd: STACKLANG_BINARY(a & b)
+	op_BitOr: STACKLANG_BINARY(a | b)
+	op_BitXor: STACKLANG_BINARY(a ^ b)
+	op_AddConst:
+		sp[-1] += ip->operand;
+		STACKLANG_NEXT();
+	op_Neg:
+		sp[-1] = 0 - sp[-1];
+		STACKLANG_NEXT();
+	op_Not:
+		sp[-1] = !sp[-1];
+		STACKLANG_NEXT();
+	op_Compl:
+		sp[-1] = ~sp[-1];
+		STACKLANG_NEXT();
+	op_Bool:
+		sp[-1] = sp[-1] != 0;
+		STACKLANG_NEXT();
+	op_Jump:
+		STACKLANG_JUMP(ip->operand);
+	op_JumpIfZero:
+		if(*--sp == 0) {
+			STACKLANG_JUMP(ip->operand);
+		}
+		STACKLANG_NEXT();
+	op_JumpIfNotZero:
+		if(*--sp != 0) {
+			STACKLANG_JUMP(ip->operand);
+		}
+		STACKLANG_NEXT();
+	op_Call: {
+		// The arguments on the stack are the callee's first slots
+		const LinkedFunc& callee = funcs[ip->operand];
+		int64* callee_fp = sp - callee.num_params;
+		if(callee_fp + callee.frame_size > stack_end || rsp == returns_end) {
+			FailCall(ip, ip->operand) throws();
+		}
+		rsp->ip = ip + 1;
+		rsp->fp = fp;
+		++rsp;
+		fp = callee_fp;
+		sp = fp + callee.num_slots;
+		STACKLANG_JUMP(callee.entry);
+	}
+	op_Return: {
+		const int64 value = sp[-1];
+		sp = fp;
+		--rsp;
+		fp = rsp->fp;
+		ip = rsp->ip;
+		*sp++ = value;
+		goto *ip->handler;
+	}
+	op_Halt:
+		return sp[-1];
+
+#undef STACKLANG_SHIFT
+#undef STACKLANG_DIVIDE
+#undef STACKLANG_BINARY
+#undef STACKLANG_JUMP
+#undef STACKLANG_NEXT
+	}
+
+	const BytecodeProgram* program_;
+	buffer<ThreadedInsn> threaded_;
+	// Offset in the program of each threaded instruction
+	buffer<int64> offsets_;
+	buffer<LinkedFunc> funcs_;
+	buffer<int64> globals_;
+	// Global initializers run
+	int64 initialized_ = 0;
+	buffer<int64> stack_;
+	buffer<ReturnFrame> returns_;
+};
+
+}  // namespace compiler
+}  // namespace stacklang
+
+#endif//BYTECODE_H
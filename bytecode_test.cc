@@ -0,0 +1,244 @@
+#include "bytecode.h"
+#include "scanner.h"
+#include "test_programs.h"
+
+#include <cstdio>
+#include <string>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %ld != %ld\n",
+			a, b);
+	}
+}
+
+void ExpectEq(string a, string b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %s != %s\n",
+			a.c_str(), b.c_str());
+	}
+}
+
+string AsString(const buffer<char>& text) {
+	return string(text.data(), text.len());
+}
+
+compiler::FuncDecl* FindFunc(const compiler::Namespace& ns, string name) {
+	return compiler::cast<compiler::FuncDecl>(ns.FindDecl(name));
+}
+
+// top(3, 4) of src, or top(3) if it takes one, or -1 with the message of
+// the Status compiling or running it throws
+int64 RunTop(const char* src, string* error = nullptr) {
+	compiler::TokenBuffer tokens = compiler::Scan(src);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::FuncDecl* top = FindFunc(parsed, "top");
+	compiler::BytecodeProgram program;
+	try {
+		const int64 index = compiler::CompileBytecode(top, &program);
+		compiler::VirtualMachine vm(&program);
+		if(top->GetParameters().len() == 1) {
+			return vm.Call(index, {3});
+		}
+		return vm.Call(index, {3, 4});
+	} catch(Status status) {
+		if(error) {
+			*error = status.message;
+		}
+		return -1;
+	}
+}
+
+// Runs every program of kIntPrograms
+void TestPrograms() {
+	fprintf(stderr, "--- TestPrograms ---\n");
+	for(const testing::IntProgram& program : testing::kIntPrograms) {
+		string error;
+		const int64 result = RunTop(program.src, &error);
+		if(program.error) {
+			ExpectEq(result, int64(-1));
+			ExpectEq(error, program.error);
+		} else {
+			ExpectEq(result, program.result);
+		}
+	}
+}
+
+void TestRecursion() {
+	fprintf(stderr, "--- TestRecursion ---\n");
+	// 30000 calls deep, within the default 65536
+	ExpectEq(RunTop("int count(int x, int acc) {\n\tx && (acc = count(x - 1, acc + 1));\n"
+					"\treturn acc;\n}\n"
+					"int top(int x, int y) {\n\treturn count(x * 10000, y);\n}\n"), 30004);
+}
+
+void TestGlobals() {
+	fprintf(stderr, "--- TestGlobals ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(
+		"int base = 2;\n"
+		"int counter = base * 2 + 1;\n"
+		"namespace outer {\nint x;\n}\n"
+		"int bump(int by) {\n\tcounter += by;\n\touter::x++;\n\treturn counter * 10 + outer::x;\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::BytecodeProgram program;
+	compiler::CompileBytecode(FindFunc(parsed, "bump"), &program);
+	// base is initialized before counter, which reads it
+	ExpectEq(program.GetGlobalCount(), 3);
+	ExpectEq(program.GetGlobalInits().len(), 2);
+	ExpectEq(program.GetGlobal(program.GetGlobalInits()[0].global)->GetName(), "base");
+	ExpectEq(program.GetGlobal(program.GetGlobalInits()[1].global)->GetName(), "counter");
+
+	compiler::VirtualMachine vm(&program);
+	ExpectEq(vm.Call(FindFunc(parsed, "bump"), {3}), 81);
+	ExpectEq(vm.Call(FindFunc(parsed, "bump"), {1}), 92);
+	compiler::VirtualMachine fresh(&program);
+	ExpectEq(fresh.Call(FindFunc(parsed, "bump"), {1}), 61);
+}
+
+void TestDisassemble() {
+	fprintf(stderr, "--- TestDisassemble ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(
+		"template<int N>\nint bar() {\n\treturn N;\n}\n"
+		"int top(int x) {\n\treturn bar<2>() * 10 + x - 1;\n}\n"
+		"int both(int x, int y) {\n\treturn x && y;\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::BytecodeProgram program;
+	ExpectEq(compiler::CompileBytecode(FindFunc(parsed, "top"), &program), 0);
+	ExpectEq(compiler::CompileBytecode(FindFunc(parsed, "both"), &program), 2);
+	// Already compiled
+	ExpectEq(compiler::CompileBytecode(FindFunc(parsed, "top"), &program), 0);
+	ExpectEq(program.FindFunction(FindFunc(parsed, "both")), 2);
+	ExpectEq(program.FindFunction(FindFunc(parsed, "bar")), compiler::kNoFunction);
+
+	buffer<char> text;
+	{
+		compiler::PrintSink sink(&text);
+		compiler::Disassemble(program, &sink);
+	}
+	ExpectEq(AsString(text),
+		"top: 1 params, 1 slots, 2 stack\n"
+		"     0  Call 1 (bar<2>)\n"
+		"     5  ConstSmall 10\n"
+		"    10  Mul\n"
+		"    11  Load 0\n"
+		"    16  Add\n"
+		"    17  AddConst -1\n"
+		"    22  Return\n"
+		"bar<2>: 0 params, 0 slots, 1 stack\n"
+		"     0  ConstSmall 2\n"
+		"     5  Return\n"
+		"both: 2 params, 2 slots, 1 stack\n"
+		"     0  Load 0\n"
+		"     5  JumpIfZero 21\n"
+		"    10  Load 1\n"
+		"    15  Bool\n"
+		"    16  Jump 26\n"
+		"    21  ConstSmall 0\n"
+		"    26  Return\n");
+
+	compiler::VirtualMachine vm(&program);
+	ExpectEq(vm.Call(int64(0), {3}), 22);
+	ExpectEq(vm.Call(2, {3, 4}), 1);
+	ExpectEq(vm.Call(2, {3, 0}), 0);
+}
+
+void TestStatementsCompiled() {
+	fprintf(stderr, "--- TestStatementsCompiled ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(
+		"int top(int x) {\n\tint y = x;\n\ty = y * 2;\n\treturn y;\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::BytecodeProgram program;
+	compiler::CompileBytecode(FindFunc(parsed, "top"), &program);
+	buffer<char> text;
+	{
+		compiler::PrintSink sink(&text);
+		compiler::Disassemble(program, &sink);
+	}
+	// Values of statements are stored without being pushed again
+	ExpectEq(AsString(text),
+		"top: 1 params, 2 slots, 2 stack\n"
+		"     0  Load 0\n"
+		"     5  StorePop 1\n"
+		"    10  Load 1\n"
+		"    15  ConstSmall 2\n"
+		"    20  Mul\n"
+		"    21  StorePop 1\n"
+		"    26  Load 1\n"
+		"    31  Return\n");
+}
+
+void TestErrors() {
+	fprintf(stderr, "--- TestErrors ---\n");
+	string error;
+	// Deeper than it compiles
+	std::string src = "int top(int x, int y) {\n\treturn x";
+	for(int64 i=0;i<2000;++i) {
+		src += " + x";
+	}
+	src += ";\n}\n";
+	ExpectEq(RunTop(src.c_str(), &error), int64(-1));
+	ExpectEq(error, "Expression nested too deeply to compile");
+
+	// What failed to compile isn't left in the program
+	compiler::TokenBuffer tokens = compiler::Scan(
+		"int ok(int x) {\n\treturn x + 1;\n}\n"
+		"int f(int x);\n"
+		"int g = 7;\n"
+		"int bad(int x) {\n\treturn ok(x) + g + f(x);\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::BytecodeProgram program;
+	try {
+		compiler::CompileBytecode(FindFunc(parsed, "bad"), &program);
+		Expect(false);
+	} catch(Status status) {
+		ExpectEq(status.message, "Function f isn't defined");
+	}
+	ExpectEq(program.GetFunctionCount(), 0);
+	ExpectEq(program.GetGlobalCount(), 0);
+	ExpectEq(program.GetCode().len(), 0);
+	ExpectEq(compiler::CompileBytecode(FindFunc(parsed, "ok"), &program), 0);
+	compiler::VirtualMachine vm(&program);
+	ExpectEq(vm.Call(FindFunc(parsed, "ok"), {1}), 2);
+
+	// A small stack overflows sooner
+	compiler::VirtualMachineOptions options;
+	options.max_call_depth = 10;
+	compiler::TokenBuffer count_tokens = compiler::Scan("int count(int x) {\n\tx && (x = count(x - 1) + 1);\n\treturn x;\n}\n");
+	compiler::Namespace count_parsed = compiler::Parse(count_tokens);
+	compiler::FuncDecl* count = FindFunc(count_parsed, "count");
+	compiler::BytecodeProgram counting;
+	compiler::CompileBytecode(count, &counting);
+	compiler::VirtualMachine shallow(&counting, options);
+	ExpectEq(shallow.Call(count, {8}), 8);
+	try {
+		shallow.Call(count, {20});
+		Expect(false);
+	} catch(Status status) {
+		ExpectEq(status.message, "Stack overflow calling count");
+	}
+	// Still usable after
+	ExpectEq(shallow.Call(count, {5}), 5);
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestPrograms();
+	stacklang::TestRecursion();
+	stacklang::TestGlobals();
+	stacklang::TestDisassemble();
+	stacklang::TestStatementsCompiled();
+	stacklang::TestErrors();
+	return 0;
+}
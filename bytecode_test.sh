@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z ./bytecode_test.cc -o /tmp/bytecode_test
+/tmp/bytecode_test
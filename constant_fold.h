@@ -0,0 +1,410 @@
+#ifndef CONSTANT_FOLD_H
+#define CONSTANT_FOLD_H
+
+#include "string.h"
+#include "vector.h"
+#include "buffer.h"
+#include "hash_map.h"
+#include "arena.h"
+#include "utils.h"
+#include "parser.h"
+#include "ast_visitor.h"
+
+// STL
+#include <assert.h>
+#include <stdint.h>
+
+namespace stacklang {
+namespace compiler {
+
+// Integers are 64 bit two's complement. Operators which would be undefined,
+// like division by 0, aren't folded.
+// False if op isn't folded
+bool FoldBinaryOp(string op, int64 left, int64 right, int64* result) {
+	const int64_t signed_left = int64_t(left);
+	const int64_t signed_right = int64_t(right);
+	if(op == "+") {
+		*result = left + right;
+	} else if(op == "-") {
+		*result = left - right;
+	} else if(op == "*") {
+		*result = left * right;
+	} else if(op == "/" || op == "%") {
+		if(right == 0 || (signed_left == INT64_MIN && signed_right == -1)) {
+			return false;
+		}
+		*result = op == "/" ? signed_left / signed_right : signed_left % signed_right;
+	} else if(op == "<<" || op == ">>") {
+		if(right >= 64) {
+			return false;
+		}
+		*result = op == "<<" ? left << right : int64(signed_left >> right);
+	} else if(op == "<") {
+		*result = signed_left < signed_right;
+	} else if(op == "<=") {
+		*result = signed_left <= signed_right;
+	} else if(op == ">") {
+		*result = signed_left > signed_right;
+	} else if(op == ">=") {
+		*result = signed_left >= signed_right;
+	} else if(op == "==") {
+		*result = left == right;
+	} else if(op == "!=") {
+		*result = left != right;
+	} else if(op == "&") {
+		*result = left & right;
+	} else if(op == "|") {
+		*result = left | right;
+	} else if(op == "^") {
+		*result = left ^ right;
+	} else if(op == "&&") {
+		*result = left && right;
+	} else if(op == "||") {
+		*result = left || right;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// False if op isn't folded
+bool FoldUnaryOp(string op, int64 sub, int64* result) {
+	if(op == "-") {
+		*result = 0 - sub;
+	} else if(op == "+") {
+		*result = sub;
+	} else if(op == "!") {
+		*result = sub == 0;
+	} else if(op == "~") {
+		*result = ~sub;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+namespace internal {
+
+// Integer the expression is, if it's a literal
+bool IntegerLiteralValue(Stmt* stmt, int64* value) {
+	auto* literal = dyn_cast<Literal>(stmt);
+	if(literal == nullptr) {
+		return false;
+	}
+	auto* integer = dyn_cast<IntegerValue>(literal->GetValue());
+	if(integer == nullptr) {
+		return false;
+	}
+	*value = integer->GetValue();
+	return true;
+}
+
+// The variable expr names, through parentheses
+VarDecl* NamedVar(Expr* expr) {
+	while(auto* paren = dyn_cast<ParenExpr>(expr)) {
+		expr = paren->GetSub();
+	}
+	auto* ref = dyn_cast<DeclRef>(expr);
+	return ref ? dyn_cast<VarDecl>(ref->GetRef()) : nullptr;
+}
+
+// Variables which are assigned, incremented or have their address taken
+// after they're declared
+class AssignedVars : public RecursiveASTVisitor<AssignedVars> {
+public:
+	bool VisitUnaryOp(UnaryOp* op) {
+		if(op->GetOp() == "++" || op->GetOp() == "--" || op->GetOp() == "&") {
+			Add(NamedVar(op->GetSub()));
+		}
+		return true;
+	}
+	bool VisitBinaryOp(BinaryOp* op) {
+		if(IsAssignmentOp(op->GetOp())) {
+			Add(NamedVar(op->GetLeft()));
+		}
+		return true;
+	}
+
+	bool Contains(VarDecl* var)const {
+		return vars_.contains(var);
+	}
+
+private:
+	void Add(VarDecl* var) {
+		if(var) {
+			vars_.set(var, true);
+		}
+	}
+
+	hash_map<VarDecl*, bool> vars_;
+};
+
+// Replaces each expression by what it folds to after its children have
+// been, so every node is seen once and nothing recurses.
+// Each statement leaves what replaces it on pending_ for its parent to
+// take.
+class ConstantFolder : public RecursiveASTVisitor<ConstantFolder> {
+public:
+	ConstantFolder(const AssignedVars* assigned,
+				   Arena* arena,
+				   InstantiationTable* instantiations)
+		: assigned_(assigned), arena_(arena), instantiations_(instantiations) {
+	}
+
+	bool VisitStmt(Stmt* stmt) {
+		if(skip_ == 0) {
+			starts_.push_back(pending_.len());
+		}
+		return true;
+	}
+	bool PostVisitStmt(Stmt* stmt) {
+		if(skip_ == 0) {
+			const int64 start = starts_.pop_back();
+			Stmt* folded = Fold(stmt, start);
+			pending_.resize(start);
+			pending_.push_back(folded);
+		}
+		return true;
+	}
+	// Types are shared, see InstantiationTable::GetType
+	bool VisitType(Type* type) {
+		++skip_;
+		return true;
+	}
+	bool PostVisitType(Type* type) {
+		--skip_;
+		return true;
+	}
+	// Only local variables are propagated, others may be assigned
+	// elsewhere
+	bool VisitFuncDecl(FuncDecl* func) {
+		scopes_.push_back(StmtKind_FuncDecl);
+		// A default value is only what the parameter is when none is passed
+		for(VarDecl* param : func->GetParameters()) {
+			params_.set(param, true);
+		}
+		return true;
+	}
+	bool PostVisitFuncDecl(FuncDecl* func) {
+		scopes_.pop_back();
+		return true;
+	}
+	bool VisitStructDecl(StructDecl* struct_decl) {
+		scopes_.push_back(StmtKind_StructDecl);
+		return true;
+	}
+	bool PostVisitStructDecl(StructDecl* struct_decl) {
+		scopes_.pop_back();
+		return true;
+	}
+
+	// Expressions replaced
+	int64 GetFolded()const {
+		return folded_;
+	}
+
+private:
+	Expr* Child(int64 start, int64 i) {
+		return cast<Expr>(pending_[start + i]);
+	}
+	int64 Children(int64 start)const {
+		return pending_.len() - start;
+	}
+
+	Expr* NewInteger(int64 value, Expr* replaced) {
+		++folded_;
+		return arena_->New<Literal>(arena_->New<IntegerValue>(value), replaced->GetLoc());
+	}
+
+	Stmt* Fold(Stmt* stmt, int64 start) {
+		int64 sub = 0;
+		int64 left = 0;
+		switch(stmt->GetStmtKind()) {
+			case StmtKind_ReturnStmt:
+				if(Children(start) == 1) {
+					cast<ReturnStmt>(stmt)->SetValue(Child(start, 0));
+				}
+				return stmt;
+			case StmtKind_VarDecl: {
+				auto* var = cast<VarDecl>(stmt);
+				for(int64 i=0;i<Children(start);++i) {
+					if(var->GetInitParams()[i] != Child(start, i)) {
+						var->SetInitParam(i, Child(start, i));
+					}
+				}
+				int64 value;
+				if(var->GetInitType() == VarDeclInitType_Equals &&
+				   !scopes_.empty() && scopes_.back() == StmtKind_FuncDecl &&
+				   isa<IntType>(CanonicalType(var->GetType())) &&
+				   !assigned_->Contains(var) && !params_.contains(var) &&
+				   IntegerLiteralValue(var->GetInitParams()[0], &value)) {
+					constants_.set(var, value);
+				}
+				return stmt;
+			}
+			case StmtKind_DeclRef: {
+				auto* ref = cast<DeclRef>(stmt);
+				FoldTemplateArgs(ref, start);
+				if(const int64* value = constants_.find(ref->GetRef())) {
+					return NewInteger(*value, ref);
+				}
+				return stmt;
+			}
+			case StmtKind_MemberExpr:
+				cast<MemberExpr>(stmt)->SetBase(Child(start, 0));
+				return stmt;
+			case StmtKind_UnaryOp:
+			case StmtKind_CastExpr: {
+				auto* op = cast<UnaryOp>(stmt);
+				op->SetSub(Child(start, 0));
+				int64 value;
+				if(!IntegerLiteralValue(op->GetSub(), &sub)) {
+					return stmt;
+				}
+				if(auto* cast_expr = dyn_cast<CastExpr>(op)) {
+					if(isa<IntType>(CanonicalType(cast_expr->GetToType()))) {
+						return NewInteger(sub, op);
+					}
+				} else if(FoldUnaryOp(op->GetOp(), sub, &value)) {
+					return NewInteger(value, op);
+				}
+				return stmt;
+			}
+			case StmtKind_ParenExpr: {
+				auto* paren = cast<ParenExpr>(stmt);
+				paren->SetSub(Child(start, 0));
+				if(IntegerLiteralValue(paren->GetSub(), &sub)) {
+					++folded_;
+					return paren->GetSub();
+				}
+				return stmt;
+			}
+			case StmtKind_BinaryOp: {
+				auto* op = cast<BinaryOp>(stmt);
+				op->SetLeft(Child(start, 0));
+				op->SetRight(Child(start, 1));
+				if(!IntegerLiteralValue(op->GetLeft(), &left)) {
+					return stmt;
+				}
+				// Nothing to evaluate on the left
+				if(op->GetOp() == ",") {
+					++folded_;
+					return op->GetRight();
+				}
+				int64 right;
+				int64 value;
+				if(IntegerLiteralValue(op->GetRight(), &right) &&
+				   FoldBinaryOp(op->GetOp(), left, right, &value)) {
+					return NewInteger(value, op);
+				}
+				return stmt;
+			}
+			case StmtKind_FuncCall: {
+				// After the callee
+				auto* call = cast<FuncCall>(stmt);
+				for(int64 i=1;i<Children(start);++i) {
+					if(call->GetArgs()[i-1] != Child(start, i)) {
+						call->SetArg(i-1, Child(start, i));
+					}
+				}
+				return stmt;
+			}
+			case StmtKind_CtorCall: {
+				auto* ctor = cast<CtorCall>(stmt);
+				for(int64 i=0;i<Children(start);++i) {
+					if(ctor->GetArgs()[i] != Child(start, i)) {
+						ctor->SetArg(i, Child(start, i));
+					}
+				}
+				return stmt;
+			}
+			default:
+				return stmt;
+		}
+	}
+
+	// Children are the integer arguments, in order. The reference is
+	// interned again if they changed, as bar<1 + 1> is now bar<2>.
+	void FoldTemplateArgs(DeclRef* ref, int64 start) {
+		if(Children(start) == 0) {
+			return;
+		}
+		vector<TemplateArg> args = ref->GetTemplateArgs();
+		bool changed = false;
+		int64 child = 0;
+		for(int64 i=0;i<args.len();++i) {
+			if(args[i].int_value && args[i].int_value != Child(start, child++)) {
+				changed = true;
+			}
+		}
+		if(!changed) {
+			return;
+		}
+		vector<TemplateArg> new_args;
+		child = 0;
+		for(TemplateArg arg : args) {
+			if(arg.int_value) {
+				arg.int_value = Child(start, child++);
+			}
+			new_args.push_back(arg);
+		}
+		Instantiation* instantiation = nullptr;
+		if(ref->GetInstantiation() && instantiations_) {
+			instantiation = instantiations_->Intern(cast<TemplatedDecl>(ref->GetRef()),
+													new_args, arena_);
+		}
+		ref->SetTemplateArgs(new_args, instantiation);
+	}
+
+	const AssignedVars* assigned_;
+	Arena* arena_;
+	InstantiationTable* instantiations_;
+	// Inside a type
+	int64 skip_ = 0;
+	// What replaces each statement whose parent hasn't taken it yet
+	buffer<Stmt*> pending_;
+	// Where the children of each unfinished statement start in pending_
+	buffer<int64> starts_;
+	// Innermost last, FuncDecl or StructDecl
+	buffer<StmtKind> scopes_;
+	// Local variables initialized to a constant and never changed
+	hash_map<Decl*, int64> constants_;
+	// Of every function seen
+	hash_map<VarDecl*, bool> params_;
+	int64 folded_ = 0;
+};
+
+}  // internal
+
+// Evaluates integer arithmetic on literals and casts of it to int, and
+// replaces local int variables which are initialized with = and never
+// changed by their values, rewriting ns in place. New literals are
+// allocated from arena.
+// References whose template arguments fold are interned again in
+// instantiations, or left without an instantiation if that's nullptr.
+// Types aren't changed.
+// Returns the number of expressions replaced.
+int64 FoldConstants(Namespace* ns,
+					Arena* arena,
+					InstantiationTable* instantiations=nullptr) throws(Status) {
+	internal::AssignedVars assigned;
+	assigned.TraverseNamespace(ns) throws();
+	internal::ConstantFolder folder(&assigned, arena, instantiations);
+	folder.TraverseNamespace(ns) throws();
+	return folder.GetFolded();
+}
+
+int64 FoldConstants(FuncDecl* func,
+					Arena* arena,
+					InstantiationTable* instantiations=nullptr) throws(Status) {
+	internal::AssignedVars assigned;
+	assigned.TraverseStmt(func) throws();
+	internal::ConstantFolder folder(&assigned, arena, instantiations);
+	folder.TraverseStmt(func) throws();
+	return folder.GetFolded();
+}
+
+}  // namespace compiler
+}  // namespace stacklang
+
+#endif//CONSTANT_FOLD_H
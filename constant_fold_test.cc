@@ -0,0 +1,180 @@
+#include "constant_fold.h"
+#include "scanner.h"
+
+#include <cstdio>
+#include <string>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+void ExpectEq(string a, string b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %s != %s\n",
+			a.c_str(), b.c_str());
+	}
+}
+
+compiler::FuncDecl* FindFunc(const compiler::Namespace& ns, string name) {
+	return compiler::cast<compiler::FuncDecl>(ns.FindDecl(name));
+}
+
+compiler::Expr* Returned(compiler::FuncDecl* func) {
+	vector<compiler::Stmt*> body = func->GetBody();
+	return compiler::cast<compiler::ReturnStmt>(body[body.len() - 1])->GetValue();
+}
+
+// -1 if expr isn't an integer literal
+int64 LiteralValue(compiler::Expr* expr) {
+	auto* literal = compiler::dyn_cast<compiler::Literal>(expr);
+	if(literal == nullptr) {
+		return -1;
+	}
+	return compiler::cast<compiler::IntegerValue>(literal->GetValue())->GetValue();
+}
+
+void TestFoldsArithmetic() {
+	fprintf(stderr, "--- TestFoldsArithmetic ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(R"(
+int mixed(int x) {
+	return (int)(3*4) + x;
+}
+int whole(int x) {
+	return (1 + 2) * 3 - 10 / 2, -(4 % 3) + (7 > 2) + ~0;
+}
+int shifts(int x) {
+	return (1 << 4) | (-16 >> 2);
+}
+int kept(int x) {
+	return 1 / 0 + x * (2 - 2);
+}
+)");
+	Arena arena;
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	Expect(compiler::FoldConstants(&parsed, &arena) > 0);
+
+	auto* mixed = compiler::cast<compiler::BinaryOp>(Returned(FindFunc(parsed, "mixed")));
+	ExpectEq(LiteralValue(mixed->GetLeft()), 12);
+	Expect(compiler::isa<compiler::DeclRef>(mixed->GetRight()));
+	// -1 + 1 + -1
+	ExpectEq(LiteralValue(Returned(FindFunc(parsed, "whole"))), int64(-1));
+	ExpectEq(LiteralValue(Returned(FindFunc(parsed, "shifts"))), 16 | int64(-4));
+	// Division by 0 is left to fail at run time
+	auto* kept = compiler::cast<compiler::BinaryOp>(Returned(FindFunc(parsed, "kept")));
+	Expect(compiler::isa<compiler::BinaryOp>(kept->GetLeft()));
+	auto* times = compiler::cast<compiler::BinaryOp>(kept->GetRight());
+	ExpectEq(LiteralValue(times->GetRight()), 0);
+}
+
+void TestPropagatesLocals() {
+	fprintf(stderr, "--- TestPropagatesLocals ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(R"(
+int sum(int x, int y) {
+	return x + y;
+}
+int top(int x) {
+	int a = 2 * 3;
+	int b = a + 1;
+	int c = 5;
+	int d(4);
+	++c;
+	return sum(a * b + c, d);
+}
+)");
+	Arena arena;
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::FuncDecl* top = FindFunc(parsed, "top");
+	compiler::FoldConstants(top, &arena);
+
+	auto* b = compiler::cast<compiler::VarDecl>(top->GetBody()[1]);
+	ExpectEq(LiteralValue(b->GetInitParams()[0]), 7);
+	auto* call = compiler::cast<compiler::FuncCall>(Returned(top));
+	auto* plus = compiler::cast<compiler::BinaryOp>(call->GetArgs()[0]);
+	ExpectEq(LiteralValue(plus->GetLeft()), 42);
+	// Changed, and not initialized with =
+	ExpectEq(compiler::cast<compiler::DeclRef>(plus->GetRight())->GetRef()->GetName(), "c");
+	ExpectEq(compiler::cast<compiler::DeclRef>(call->GetArgs()[1])->GetRef()->GetName(), "d");
+}
+
+void TestKeepsDefaultArguments() {
+	fprintf(stderr, "--- TestKeepsDefaultArguments ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan("int f(int x = 3) {\n\treturn x + 1;\n}\n");
+	Arena arena;
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::FuncDecl* f = FindFunc(parsed, "f");
+	ExpectEq(compiler::FoldConstants(f, &arena), 0);
+	// Callers may pass another x
+	auto* plus = compiler::cast<compiler::BinaryOp>(Returned(f));
+	ExpectEq(compiler::cast<compiler::DeclRef>(plus->GetLeft())->GetRef()->GetName(), "x");
+}
+
+void TestTemplateArgs() {
+	fprintf(stderr, "--- TestTemplateArgs ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(R"(
+template<int N>
+int bar() {
+	return N;
+}
+int top(int x) {
+	return bar<2 + 1>() + bar<3>();
+}
+)");
+	compiler::TokenBufferSource source(tokens);
+	compiler::TokenStream stream(&source);
+	Arena arena;
+	compiler::InstantiationTable instantiations;
+	compiler::Namespace parsed("", LocationRef{});
+	compiler::ParseInto(parsed, stream, nullptr, &arena, compiler::ParseOptions{},
+						nullptr, &instantiations);
+
+	auto* plus = compiler::cast<compiler::BinaryOp>(Returned(FindFunc(parsed, "top")));
+	compiler::DeclRef* folded = compiler::cast<compiler::FuncCall>(plus->GetLeft())->GetCallee();
+	compiler::DeclRef* literal = compiler::cast<compiler::FuncCall>(plus->GetRight())->GetCallee();
+	Expect(folded->GetInstantiation() != literal->GetInstantiation());
+
+	compiler::FoldConstants(&parsed, &arena, &instantiations);
+	ExpectEq(LiteralValue(folded->GetTemplateArgs()[0].int_value), 3);
+	Expect(folded->GetInstantiation() == literal->GetInstantiation());
+	ExpectEq(instantiations.size(), 2);
+}
+
+// Nothing recurses
+void TestDeepExpression() {
+	fprintf(stderr, "--- TestDeepExpression ---\n");
+	const int64 kTerms = 100000;
+	std::string src = "int top(int x) {\n\treturn 1";
+	for(int64 i=1;i<kTerms;++i) {
+		src += " + 1";
+	}
+	src += ";\n}\n";
+	compiler::TokenBuffer tokens = compiler::Scan(src.c_str());
+	Arena arena;
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	ExpectEq(compiler::FoldConstants(&parsed, &arena), kTerms - 1);
+	ExpectEq(LiteralValue(Returned(FindFunc(parsed, "top"))), kTerms);
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestFoldsArithmetic();
+	stacklang::TestPropagatesLocals();
+	stacklang::TestKeepsDefaultArguments();
+	stacklang::TestTemplateArgs();
+	stacklang::TestDeepExpression();
+	return 0;
+}
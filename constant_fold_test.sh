@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z ./constant_fold_test.cc -o /tmp/constant_fold_test
+/tmp/constant_fold_test
@@ -0,0 +1,231 @@
+#ifndef FLAT_AST_H
+#define FLAT_AST_H
+
+#include "buffer.h"
+#include "utils.h"
+#include "parser.h"
+#include "ast_visitor.h"
+
+// STL
+#include <assert.h>
+#include <stdint.h>
+
+namespace stacklang {
+namespace compiler {
+
+namespace internal {
+class FlatBodyBuilder;
+}  // internal
+
+// A node of a FlatBody
+struct FlatNode {
+	StmtKind GetKind()const {
+		return StmtKind(kind);
+	}
+	int64 GetChildCount()const {
+		return count;
+	}
+	// Of a Literal, 0 for void
+	int64 GetInt()const {
+		assert(kind == StmtKind_Literal);
+		return int64(child[0]) | (int64(child[1]) << 32);
+	}
+
+	uint32_t kind;
+	uint32_t count;
+	// Indices of the first two children. With more, child[0] is where
+	// they start in the body's child list. A Literal's value otherwise.
+	uint32_t child[2];
+};
+
+// Children of a FlatNode, indices into the body
+class FlatChildren {
+public:
+	FlatChildren(const uint32_t* begin, const uint32_t* end) : begin_(begin), end_(end) {}
+	int64 len()const {
+		return end_ - begin_;
+	}
+	uint32_t operator[](int64 i)const {
+		assert(i < len());
+		return begin_[i];
+	}
+	const uint32_t* begin()const {
+		return begin_;
+	}
+	const uint32_t* end()const {
+		return end_;
+	}
+private:
+	const uint32_t* begin_;
+	const uint32_t* end_;
+};
+
+// A function body as one array of nodes in post-order, so every node comes
+// after its children and a pass over the body reads memory front to back.
+// Nodes are the statements and expressions of the body, with each one's
+// children as its operands in the pointer AST. A call's children are its
+// callee and then its arguments. Types and template arguments aren't
+// nodes, GetStmt has them.
+//
+// Built with FlattenBody. It doesn't follow changes to the pointer AST.
+class FlatBody {
+public:
+	FlatBody() {}
+	FlatBody(FlatBody&& other) = default;
+	FlatBody& operator=(FlatBody&& other) = default;
+
+	int64 size()const {
+		return nodes_.len();
+	}
+	const FlatNode& operator[](uint32_t index)const {
+		return nodes_[index];
+	}
+	// In post-order
+	const FlatNode* begin()const {
+		return nodes_.begin();
+	}
+	const FlatNode* end()const {
+		return nodes_.end();
+	}
+
+	FlatChildren GetChildren(uint32_t index)const {
+		const FlatNode& node = nodes_[index];
+		if(node.count <= 2) {
+			return FlatChildren(node.child, node.child + node.count);
+		}
+		const uint32_t* first = children_.data() + node.child[0];
+		return FlatChildren(first, first + node.count);
+	}
+	// The node in the pointer AST
+	Stmt* GetStmt(uint32_t index)const {
+		return stmts_[index];
+	}
+	// Nodes of the body's statements, in order
+	const buffer<uint32_t>& GetRoots()const {
+		return roots_;
+	}
+
+	// Computes a T for every node, children first. eval(index, results)
+	// returns node index's, with its children's already in results.
+	// results is reused, so passes over many bodies needn't allocate.
+	template<typename T, typename Eval>
+	void Evaluate(buffer<T>* results, Eval eval)const {
+		results->clear();
+		results->reserve(nodes_.len());
+		for(uint32_t i=0;i<nodes_.len();++i) {
+			results->push_back(eval(i, *results));
+		}
+	}
+
+private:
+	friend class internal::FlatBodyBuilder;
+
+	buffer<FlatNode> nodes_;
+	buffer<Stmt*> stmts_;
+	// Children of nodes with more than two
+	buffer<uint32_t> children_;
+	buffer<uint32_t> roots_;
+};
+
+namespace internal {
+
+// Appends each node when the visitor is done with its children, which are
+// the nodes appended since it started that haven't been taken as children
+class FlatBodyBuilder : public RecursiveASTVisitor<FlatBodyBuilder> {
+public:
+	FlatBodyBuilder(FlatBody* body) : body_(body) {}
+
+	bool VisitStmt(Stmt* stmt) {
+		if(skip_ == 0) {
+			starts_.push_back(pending_.len());
+		}
+		return true;
+	}
+	bool PostVisitStmt(Stmt* stmt) throws(Status) {
+		if(skip_ == 0) {
+			Append(stmt) throws();
+		}
+		return true;
+	}
+	// Not operands
+	bool VisitType(Type* type) {
+		++skip_;
+		return true;
+	}
+	bool PostVisitType(Type* type) {
+		--skip_;
+		return true;
+	}
+	bool VisitDeclRef(DeclRef* ref) {
+		++skip_;
+		return true;
+	}
+	bool PostVisitDeclRef(DeclRef* ref) {
+		--skip_;
+		return true;
+	}
+
+	// Adds a statement of the body
+	void AddRoot(Stmt* stmt) throws(Status) {
+		TraverseStmt(stmt) throws();
+		assert(pending_.len() == 1);
+		body_->roots_.push_back(pending_.pop_back());
+	}
+
+private:
+	void Append(Stmt* stmt) throws(Status) {
+		if(body_->nodes_.len() >= UINT32_MAX) {
+			throw Status{.message = "Function body too large to flatten",
+						 .loc = stmt->GetLoc()};
+		}
+		const int64 start = starts_.pop_back();
+		FlatNode node = {.kind = uint32_t(stmt->GetStmtKind()),
+						 .count = uint32_t(pending_.len() - start),
+						 .child = {0, 0}};
+		if(node.count > 2) {
+			node.child[0] = body_->children_.len();
+			for(int64 i=start;i<pending_.len();++i) {
+				body_->children_.push_back(pending_[i]);
+			}
+		} else {
+			for(uint32_t i=0;i<node.count;++i) {
+				node.child[i] = pending_[start + i];
+			}
+		}
+		if(auto* literal = dyn_cast<Literal>(stmt)) {
+			if(auto* integer = dyn_cast<IntegerValue>(literal->GetValue())) {
+				node.child[0] = uint32_t(integer->GetValue());
+				node.child[1] = uint32_t(integer->GetValue() >> 32);
+			}
+		}
+		pending_.resize(start);
+		pending_.push_back(body_->nodes_.len());
+		body_->nodes_.push_back(node);
+		body_->stmts_.push_back(stmt);
+	}
+
+	FlatBody* body_;
+	// Inside a type or template arguments
+	int64 skip_ = 0;
+	// Nodes not yet taken as children
+	buffer<uint32_t> pending_;
+	// Where the children of each unfinished node start in pending_
+	buffer<int64> starts_;
+};
+
+}  // internal
+
+// Parses the body first if it was set aside
+FlatBody FlattenBody(FuncDecl* func) throws(Status) {
+	FlatBody body;
+	internal::FlatBodyBuilder builder(&body);
+	for(Stmt* stmt : func->GetBody() throws()) {
+		builder.AddRoot(stmt) throws();
+	}
+	return body;
+}
+
+}  // namespace compiler
+}  // namespace stacklang
+
+#endif//FLAT_AST_H
@@ -0,0 +1,167 @@
+#include "flat_ast.h"
+#include "scanner.h"
+#include "test_programs.h"
+
+#include <cstdio>
+#include <string>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+compiler::FuncDecl* FindFunc(const compiler::Namespace& ns, string name) {
+	return compiler::cast<compiler::FuncDecl>(ns.FindDecl(name));
+}
+
+void TestPostOrder() {
+	fprintf(stderr, "--- TestPostOrder ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(testing::kFooProgram);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::FuncDecl* top = FindFunc(parsed, "top");
+	compiler::FlatBody body = compiler::FlattenBody(top);
+
+	// Children come first
+	for(uint32_t i=0;i<body.size();++i) {
+		for(uint32_t child : body.GetChildren(i)) {
+			Expect(child < i);
+		}
+	}
+	ExpectEq(body.GetRoots().len(), 2);
+	Expect(body.GetStmt(body.GetRoots()[0]) == top->GetBody()[0]);
+	Expect(body.GetStmt(body.GetRoots()[1]) == top->GetBody()[1]);
+	// The return is last, its value just before
+	ExpectEq(body.GetRoots()[1], body.size() - 1);
+	ExpectEq(body.GetChildren(body.size() - 1)[0], body.size() - 2);
+	// copy(v)
+	ExpectEq(body[body.GetRoots()[0]].GetKind(), compiler::StmtKind_VarDecl);
+	ExpectEq(body[body.GetRoots()[0]].GetChildCount(), 1);
+
+	int64 calls = 0;
+	int64 literals = 0;
+	for(uint32_t i=0;i<body.size();++i) {
+		if(body[i].GetKind() == compiler::StmtKind_Literal) {
+			ExpectEq(body[i].GetInt(), 1);
+			++literals;
+		}
+		if(body[i].GetKind() != compiler::StmtKind_FuncCall) {
+			continue;
+		}
+		++calls;
+		auto* call = compiler::cast<compiler::FuncCall>(body.GetStmt(i));
+		compiler::FlatChildren children = body.GetChildren(i);
+		ExpectEq(children.len(), call->GetArgs().len() + 1);
+		Expect(body.GetStmt(children[0]) == call->GetCallee());
+		for(int64 arg=0;arg<call->GetArgs().len();++arg) {
+			Expect(body.GetStmt(children[arg + 1]) == call->GetArgs()[arg]);
+		}
+	}
+	ExpectEq(calls, 2);
+	// bar's 2 is a template argument, not an operand
+	ExpectEq(literals, 1);
+}
+
+// Value of a constant expression, or not constant
+struct Folded {
+	bool constant;
+	int64 value;
+};
+
+Folded Fold(const compiler::FlatBody& body, uint32_t index, const buffer<Folded>& results) {
+	const compiler::FlatNode& node = body[index];
+	compiler::FlatChildren children = body.GetChildren(index);
+	switch(node.GetKind()) {
+		case compiler::StmtKind_Literal:
+			return Folded{true, node.GetInt()};
+		case compiler::StmtKind_ParenExpr:
+		case compiler::StmtKind_ReturnStmt:
+			return children.len() ? results[children[0]] : Folded{false, 0};
+		case compiler::StmtKind_BinaryOp: {
+			Folded left = results[children[0]];
+			Folded right = results[children[1]];
+			if(!left.constant || !right.constant) {
+				return Folded{false, 0};
+			}
+			string op = compiler::cast<compiler::BinaryOp>(body.GetStmt(index))->GetOp();
+			if(op == "+") {
+				return Folded{true, left.value + right.value};
+			} else if(op == "-") {
+				return Folded{true, left.value - right.value};
+			} else if(op == "*") {
+				return Folded{true, left.value * right.value};
+			} else if(op == "/") {
+				return Folded{true, left.value / right.value};
+			}
+			return Folded{false, 0};
+		}
+		default:
+			return Folded{false, 0};
+	}
+}
+
+void TestEvaluate() {
+	fprintf(stderr, "--- TestEvaluate ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(
+		"int top(int x) {\n\treturn (1 + 2) * 7 - 4 / 2;\n}\n"
+		"int other(int x) {\n\treturn (1 + 2) * x;\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	buffer<Folded> results;
+	compiler::FlatBody top = compiler::FlattenBody(FindFunc(parsed, "top"));
+	top.Evaluate(&results, [&](uint32_t index, const buffer<Folded>& results) {
+		return Fold(top, index, results);
+	});
+	ExpectEq(results.len(), top.size());
+	Folded folded = results[top.GetRoots()[0]];
+	Expect(folded.constant);
+	ExpectEq(folded.value, 19);
+
+	compiler::FlatBody other = compiler::FlattenBody(FindFunc(parsed, "other"));
+	other.Evaluate(&results, [&](uint32_t index, const buffer<Folded>& results) {
+		return Fold(other, index, results);
+	});
+	Expect(!results[other.GetRoots()[0]].constant);
+	// (1 + 2) still folds
+	uint32_t times = other.GetChildren(other.GetRoots()[0])[0];
+	Expect(results[other.GetChildren(times)[0]].constant);
+	ExpectEq(results[other.GetChildren(times)[0]].value, 3);
+}
+
+void TestDeepExpression() {
+	fprintf(stderr, "--- TestDeepExpression ---\n");
+	const int64 kTerms = 100000;
+	std::string src = testing::DeepSum(kTerms, "1");
+	compiler::TokenBuffer tokens = compiler::Scan(src.c_str());
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	compiler::FlatBody body = compiler::FlattenBody(FindFunc(parsed, "top"));
+	// Terms, additions and the return
+	ExpectEq(body.size(), 2 * kTerms);
+	buffer<Folded> results;
+	body.Evaluate(&results, [&](uint32_t index, const buffer<Folded>& results) {
+		return Fold(body, index, results);
+	});
+	ExpectEq(results[body.GetRoots()[0]].value, kTerms);
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestPostOrder();
+	stacklang::TestEvaluate();
+	stacklang::TestDeepExpression();
+	return 0;
+}
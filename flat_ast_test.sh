@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z ./flat_ast_test.cc -o /tmp/flat_ast_test
+/tmp/flat_ast_test
@@ -0,0 +1,216 @@
+#ifndef HASH_MAP_H
+#define HASH_MAP_H
+
+#include "types.h"
+#include "string.h"
+#include "buffer.h"
+#include "utils.h"
+
+// STL
+#include <initializer_list>
+#include <assert.h>
+
+namespace stacklang {
+
+// FNV-1a
+int64 Hash(string s) {
+	int64 h = 14695981039346656037ul;
+	const char* data = s.data();
+	for(int64 i=0;i<s.len();++i) {
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ul;
+	}
+	return h;
+}
+
+// Finalizer from MurmurHash3
+int64 Hash(int64 v) {
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdul;
+	v ^= v >> 33;
+	v *= 0xc4ceb3f99ac2a3f9ul;
+	v ^= v >> 33;
+	return v;
+}
+
+template<typename T>
+int64 Hash(T* p) {
+	return Hash(int64(p));
+}
+
+int64 HashCombine(int64 seed, int64 v) {
+	return Hash(seed ^ (v + 0x9e3779b97f4a7c15ul + (seed << 6) + (seed >> 2)));
+}
+
+// Open addressing with linear probing.
+// Removal shifts entries back instead of leaving tombstones, so lookups
+// never degrade after many removals.
+// Can only be moved, as it owns its storage.
+template<typename K, typename V>
+class hash_map {
+public:
+	struct Pair {
+		K key;
+		V value;
+	};
+
+	hash_map() {}
+	hash_map(std::initializer_list<Pair> inits) {
+		for(Pair init : inits) {
+			set(init.key, init.value);
+		}
+	}
+	hash_map(const hash_map& other) = delete;
+	hash_map(hash_map&& other) = default;
+	hash_map& operator=(hash_map&& other) = default;
+
+	int64 size()const {
+		return size_;
+	}
+
+	bool empty()const {
+		return size_ == 0;
+	}
+
+	bool contains(K key)const {
+		return find(key) != nullptr;
+	}
+
+	// nullptr if absent. Invalidated by set() and remove().
+	V* find(K key) {
+		int64 slot = 0;
+		return FindSlot(key, &slot) ? &slots_[slot].value : nullptr;
+	}
+	const V* find(K key)const {
+		int64 slot = 0;
+		return FindSlot(key, &slot) ? &slots_[slot].value : nullptr;
+	}
+
+	V at(K key)const throws(Status) {
+		const V* ret = find(key);
+		if(ret == nullptr) {
+			throw Status{.message = "Couldn't find element"};
+		}
+		return *ret;
+	}
+
+	void set(K key, V value) {
+		// Keep load under 3/4
+		if((size_ + 1) * 4 > slots_.len() * 3) {
+			Grow();
+		}
+		int64 slot = 0;
+		if(!FindSlot(key, &slot)) {
+			used_[slot] = true;
+			slots_[slot].key = key;
+			++size_;
+		}
+		slots_[slot].value = value;
+	}
+
+	void remove(K key) {
+		int64 slot = 0;
+		if(!FindSlot(key, &slot)) {
+			return;
+		}
+		const int64 mask = slots_.len() - 1;
+		used_[slot] = false;
+		--size_;
+		// Shift back following entries which probed past the hole
+		int64 hole = slot;
+		for(int64 next = (hole + 1) & mask; used_[next]; next = (next + 1) & mask) {
+			int64 home = Hash(slots_[next].key) & mask;
+			if(((next - home) & mask) >= ((next - hole) & mask)) {
+				slots_[hole] = slots_[next];
+				used_[hole] = true;
+				used_[next] = false;
+				hole = next;
+			}
+		}
+	}
+
+	void clear() {
+		for(int64 i=0;i<used_.len();++i) {
+			used_[i] = false;
+		}
+		size_ = 0;
+	}
+
+	class iterator {
+	public:
+		iterator(const hash_map* to, int64 index)
+			: to_(to), index_(index) {
+			SkipEmpty();
+		}
+		bool operator!=(iterator o)const {
+			return to_ != o.to_ || index_ != o.index_;
+		}
+		Pair operator*()const {
+			return to_->slots_[index_];
+		}
+		// prefix
+		iterator operator++() {
+			++index_;
+			SkipEmpty();
+			return *this;
+		}
+	private:
+		void SkipEmpty() {
+			while(index_ < to_->used_.len() && !to_->used_[index_]) {
+				++index_;
+			}
+		}
+		const hash_map* to_;
+		int64 index_;
+	};
+
+	iterator begin()const {
+		return iterator(this, 0);
+	}
+	iterator end()const {
+		return iterator(this, used_.len());
+	}
+
+private:
+	// Returns whether the key is present; *slot is where it is or would go
+	bool FindSlot(K key, int64* slot)const {
+		if(slots_.empty()) {
+			return false;
+		}
+		const int64 mask = slots_.len() - 1;
+		for(int64 i = Hash(key) & mask;; i = (i + 1) & mask) {
+			if(!used_[i]) {
+				*slot = i;
+				return false;
+			}
+			if(slots_[i].key == key) {
+				*slot = i;
+				return true;
+			}
+		}
+	}
+
+	void Grow() {
+		buffer<Pair> old_slots(std::move(slots_));
+		buffer<bool> old_used(std::move(used_));
+		const int64 new_len = old_slots.empty() ? 16 : old_slots.len() * 2;
+		slots_ = buffer<Pair>();
+		used_ = buffer<bool>();
+		slots_.resize(new_len);
+		used_.resize(new_len);
+		size_ = 0;
+		for(int64 i=0;i<old_slots.len();++i) {
+			if(old_used[i]) {
+				set(old_slots[i].key, old_slots[i].value);
+			}
+		}
+	}
+
+	buffer<Pair> slots_;
+	buffer<bool> used_;
+	int64 size_ = 0;
+};
+
+};  // stacklang
+
+#endif//HASH_MAP_H
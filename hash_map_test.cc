@@ -0,0 +1,111 @@
+#include "hash_map.h"
+
+#include "string.h"
+
+#include <cstdio>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+void TestSimple() {
+	fprintf(stderr, "--- TestSimple ---\n");
+	hash_map<string, int64> foo;
+	ExpectEq(foo.size(), 0);
+	Expect(!foo.contains("hey"));
+}
+
+void TestInitList() {
+	fprintf(stderr, "--- TestInitList ---\n");
+	hash_map<string, int64> foo{{"hey", 10}, {"foo", 3}};
+	ExpectEq(foo.size(), 2);
+	ExpectEq(*foo.find("foo"), 3);
+}
+
+void TestAddRemove() {
+	fprintf(stderr, "--- TestAddRemove ---\n");
+	hash_map<string, int64> foo{{"hey", 10}};
+	foo.set("you", 100);
+	ExpectEq(foo.size(), 2);
+
+	try {
+		ExpectEq(foo.at("you"), 100) throws();
+		ExpectEq(foo.at("hey"), 10) throws();
+		foo.remove("hey");
+		Expect(!foo.contains("hey"));
+		ExpectEq(foo.at("you"), 100) throws();
+	} catch(Status status) {
+		fprintf(stderr, "failed: %s\n", status.message.c_str());
+		exit(1);
+	}
+}
+
+void TestOverwrite() {
+	fprintf(stderr, "--- TestOverwrite ---\n");
+	hash_map<string, int64> foo;
+	foo.set("hey", 1);
+	foo.set("hey", 2);
+	ExpectEq(foo.size(), 1);
+	ExpectEq(*foo.find("hey"), 2);
+}
+
+void TestMany() {
+	fprintf(stderr, "--- TestMany ---\n");
+	hash_map<int64, int64> foo;
+	for(int64 i=0;i<10000;++i) {
+		foo.set(i, i * 2);
+	}
+	ExpectEq(foo.size(), 10000);
+	// Remove every other, which exercises back shifting
+	for(int64 i=0;i<10000;i+=2) {
+		foo.remove(i);
+	}
+	ExpectEq(foo.size(), 5000);
+	for(int64 i=0;i<10000;++i) {
+		const int64* v = foo.find(i);
+		if(i % 2) {
+			Expect(v != nullptr && *v == i * 2);
+		} else {
+			Expect(v == nullptr);
+		}
+	}
+}
+
+void TestIterate() {
+	fprintf(stderr, "--- TestIterate ---\n");
+	hash_map<int64, int64> foo;
+	for(int64 i=1;i<=100;++i) {
+		foo.set(i, i);
+	}
+	int64 sum = 0;
+	for(auto p : foo) {
+		sum += p.value;
+	}
+	ExpectEq(sum, 5050);
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestSimple();
+	stacklang::TestInitList();
+	stacklang::TestAddRemove();
+	stacklang::TestOverwrite();
+	stacklang::TestMany();
+	stacklang::TestIterate();
+	return 0;
+}
@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z  ./hash_map_test.cc -o /tmp/hash_map_test
+/tmp/hash_map_test
@@ -0,0 +1,137 @@
+#ifndef INT_LOWERING_H
+#define INT_LOWERING_H
+
+#include "string.h"
+#include "vector.h"
+#include "utils.h"
+#include "parser.h"
+#include "type_check.h"
+
+namespace stacklang {
+namespace compiler {
+namespace internal {
+
+// Shared by the Interpreter and the bytecode compiler, which both lower
+// functions of int values.
+
+const int64 kNoTemplateParam = ~int64(0);
+
+// A function being compiled for some template arguments, or none for a
+// global's initializer
+struct Specialization {
+	FuncDecl* decl = nullptr;
+	// By template parameter, types resolved and ints evaluated
+	Type* const* type_args = nullptr;
+	const int64* int_args = nullptr;
+
+	// Of a template parameter of decl, kNoTemplateParam if not one
+	int64 TemplateParamIndex(TemplateParam* param)const {
+		if(decl == nullptr) {
+			return kNoTemplateParam;
+		}
+		vector<TemplateParam*> params = decl->GetTemplateParams();
+		for(int64 i=0;i<params.len();++i) {
+			if(params[i] == param) {
+				return i;
+			}
+		}
+		return kNoTemplateParam;
+	}
+
+	// Whether param is an int template parameter of decl, and its value
+	bool IntArg(TemplateParam* param, int64* value)const {
+		const int64 index = TemplateParamIndex(param);
+		if(index == kNoTemplateParam || param->GetKind() != TemplateParamKind_Int) {
+			return false;
+		}
+		*value = int_args[index];
+		return true;
+	}
+
+	// Canonical, with template parameters replaced by their arguments
+	Type* ResolveType(Type* type)const {
+		type = CanonicalType(type);
+		if(auto* param = dyn_cast<TemplateParam>(type)) {
+			const int64 index = TemplateParamIndex(param);
+			if(index != kNoTemplateParam && type_args[index]) {
+				return type_args[index];
+			}
+		}
+		return type;
+	}
+
+	void RequireInt(Type* type, Stmt* where)const throws(Status) {
+		if(!isa<IntType>(ResolveType(type))) {
+			throw Status{.message = string("Only int values are supported, not ") +
+							TypeName(type),
+						 .loc = where->GetLoc()};
+		}
+	}
+};
+
+// Initializer of an int variable, nullptr if there isn't one
+Expr* InitExpr(VarDecl* var) throws(Status) {
+	vector<Expr*> init = var->GetInitParams();
+	if(var->GetInitType() == VarDeclInitType_None || init.len() == 0) {
+		return nullptr;
+	}
+	if(init.len() != 1) {
+		throw Status{.message = string("Can't initialize int ") + var->GetName() +
+						" with several values",
+					 .loc = var->GetLoc()};
+	}
+	return init[0];
+}
+
+// Binary operators on two ints giving one
+enum IntOp {
+	IntOp_Add,
+	IntOp_Sub,
+	IntOp_Mul,
+	IntOp_Div,
+	IntOp_Mod,
+	IntOp_Shl,
+	IntOp_Shr,
+	IntOp_Lt,
+	IntOp_Le,
+	IntOp_Gt,
+	IntOp_Ge,
+	IntOp_Eq,
+	IntOp_Ne,
+	IntOp_And,
+	IntOp_Or,
+	IntOp_Xor,
+	IntOp_None,
+};
+
+// IntOp_None for assignments, logical and other operators
+IntOp IntOpOf(string op) {
+	if(op == "+") return IntOp_Add;
+	if(op == "-") return IntOp_Sub;
+	if(op == "*") return IntOp_Mul;
+	if(op == "/") return IntOp_Div;
+	if(op == "%") return IntOp_Mod;
+	if(op == "<<") return IntOp_Shl;
+	if(op == ">>") return IntOp_Shr;
+	if(op == "<") return IntOp_Lt;
+	if(op == "<=") return IntOp_Le;
+	if(op == ">") return IntOp_Gt;
+	if(op == ">=") return IntOp_Ge;
+	if(op == "==") return IntOp_Eq;
+	if(op == "!=") return IntOp_Ne;
+	if(op == "&") return IntOp_And;
+	if(op == "|") return IntOp_Or;
+	if(op == "^") return IntOp_Xor;
+	return IntOp_None;
+}
+
+// Of a compound assignment like +=, IntOp_None for =
+IntOp CompoundAssignmentOp(string op) {
+	return IntOpOf(string(op.data(), op.len() - 1));
+}
+
+}  // internal
+}  // namespace compiler
+}  // namespace stacklang
+
+#endif//INT_LOWERING_H
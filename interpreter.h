@@ -0,0 +1,808 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include "string.h"
+#include "vector.h"
+#include "buffer.h"
+#include "hash_map.h"
+#include "arena.h"
+#include "utils.h"
+#include "parser.h"
+#include "ast_printer.h"
+#include "type_check.h"
+#include "int_lowering.h"
+
+// STL
+#include <assert.h>
+#include <stdint.h>
+
+namespace stacklang {
+namespace compiler {
+
+struct InterpreterOptions {
+	// Slots for the parameters and locals of every active call
+	int64 stack_slots = 1 << 16;
+	// Native stack calls may use, as compiled code recurses. Deep
+	// expressions go a little past it.
+	int64 native_stack_bytes = 1 << 20;
+	// Nesting of an expression, which is compiled and run recursively
+	int64 max_expression_depth = 1000;
+	// Functions compiled at once, as compiling one compiles its callees
+	int64 max_compile_depth = 1000;
+};
+
+namespace internal {
+
+struct Closure;
+struct CompiledFunc;
+
+// Runs closure in the frame of the call it's in
+typedef int64 (*ClosureFn)(const Closure* closure, int64* frame);
+
+// A compiled expression or statement, fn specialized to what it does so
+// running it doesn't look at the AST
+struct Closure {
+	ClosureFn fn;
+	// Operands
+	const Closure* a = nullptr;
+	const Closure* b = nullptr;
+	// A constant, a slot, or the slot a call's frame starts at
+	int64 value = 0;
+	// Of a global
+	int64* cell = nullptr;
+	// Callee of a call
+	CompiledFunc* func = nullptr;
+	// Arguments of a call, statements of a body
+	const Closure* const* list = nullptr;
+	int64 count = 0;
+	// For errors
+	Stmt* stmt = nullptr;
+};
+
+// Where calls are checked against
+struct Machine {
+	int64* stack_end = nullptr;
+	uintptr_t native_limit = 0;
+};
+
+// A function compiled for one set of template arguments
+struct CompiledFunc {
+	FuncDecl* decl = nullptr;
+	// By template parameter, types resolved and ints evaluated
+	Type** type_args = nullptr;
+	int64* int_args = nullptr;
+	const Closure* body = nullptr;
+	// Slots for parameters, locals and the arguments of calls
+	int64 frame_size = 0;
+	Machine* machine = nullptr;
+	// Same decl, other template arguments
+	CompiledFunc* next = nullptr;
+};
+
+inline int64 Run(const Closure* closure, int64* frame) throws(Status) {
+	return closure->fn(closure, frame);
+}
+
+// Signed, as int is
+inline int64_t Signed(int64 v) {
+	return int64_t(v);
+}
+
+inline int64 OpAdd(int64 a, int64 b, const Closure* c) { return a + b; }
+inline int64 OpSub(int64 a, int64 b, const Closure* c) { return a - b; }
+inline int64 OpMul(int64 a, int64 b, const Closure* c) { return a * b; }
+inline int64 OpLt(int64 a, int64 b, const Closure* c) { return Signed(a) < Signed(b); }
+inline int64 OpLe(int64 a, int64 b, const Closure* c) { return Signed(a) <= Signed(b); }
+inline int64 OpGt(int64 a, int64 b, const Closure* c) { return Signed(a) > Signed(b); }
+inline int64 OpGe(int64 a, int64 b, const Closure* c) { return Signed(a) >= Signed(b); }
+inline int64 OpEq(int64 a, int64 b, const Closure* c) { return a == b; }
+inline int64 OpNe(int64 a, int64 b, const Closure* c) { return a != b; }
+inline int64 OpAnd(int64 a, int64 b, const Closure* c) { return a & b; }
+inline int64 OpOr(int64 a, int64 b, const Closure* c) { return a | b; }
+inline int64 OpXor(int64 a, int64 b, const Closure* c) { return a ^ b; }
+// Of =
+inline int64 OpRight(int64 a, int64 b, const Closure* c) { return b; }
+
+// Where C leaves them undefined
+void CheckDivisor(int64 a, int64 b, const Closure* c) throws(Status) {
+	if(b == 0) {
+		throw Status{.message = "Division by zero", .loc = c->stmt->GetLoc()};
+	}
+	if(Signed(b) == -1 && Signed(a) == INT64_MIN) {
+		throw Status{.message = "Division overflow", .loc = c->stmt->GetLoc()};
+	}
+}
+inline int64 OpDiv(int64 a, int64 b, const Closure* c) throws(Status) {
+	CheckDivisor(a, b, c) throws();
+	return Signed(a) / Signed(b);
+}
+inline int64 OpMod(int64 a, int64 b, const Closure* c) throws(Status) {
+	CheckDivisor(a, b, c) throws();
+	return Signed(a) % Signed(b);
+}
+void CheckShift(int64 b, const Closure* c) throws(Status) {
+	if(b >= 64) {
+		throw Status{.message = "Shift out of range", .loc = c->stmt->GetLoc()};
+	}
+}
+inline int64 OpShl(int64 a, int64 b, const Closure* c) throws(Status) {
+	CheckShift(b, c) throws();
+	return a << b;
+}
+inline int64 OpShr(int64 a, int64 b, const Closure* c) throws(Status) {
+	CheckShift(b, c) throws();
+	return Signed(a) >> b;
+}
+
+inline int64 OpNeg(int64 a) { return 0 - a; }
+inline int64 OpNot(int64 a) { return !a; }
+inline int64 OpCompl(int64 a) { return ~a; }
+
+typedef int64 (*BinaryFn)(int64 a, int64 b, const Closure* c);
+typedef int64 (*UnaryFn)(int64 a);
+
+int64 RunConst(const Closure* c, int64* frame) {
+	return c->value;
+}
+int64 RunLoad(const Closure* c, int64* frame) {
+	return frame[c->value];
+}
+int64 RunLoadGlobal(const Closure* c, int64* frame) {
+	return *c->cell;
+}
+
+template<BinaryFn Op>
+int64 RunBinary(const Closure* c, int64* frame) throws(Status) {
+	int64 left = Run(c->a, frame) throws();
+	return Op(left, Run(c->b, frame), c);
+}
+// b is constant
+template<BinaryFn Op>
+int64 RunBinaryConst(const Closure* c, int64* frame) throws(Status) {
+	return Op(Run(c->a, frame), c->b->value, c);
+}
+// a is a local and b constant, like x - 1
+template<BinaryFn Op>
+int64 RunBinaryLoadConst(const Closure* c, int64* frame) throws(Status) {
+	return Op(frame[c->a->value], c->b->value, c);
+}
+template<UnaryFn Op>
+int64 RunUnary(const Closure* c, int64* frame) throws(Status) {
+	return Op(Run(c->a, frame));
+}
+
+template<BinaryFn Op>
+int64 RunAssign(const Closure* c, int64* frame) throws(Status) {
+	int64 right = Run(c->b, frame) throws();
+	return frame[c->value] = Op(frame[c->value], right, c);
+}
+template<BinaryFn Op>
+int64 RunAssignGlobal(const Closure* c, int64* frame) throws(Status) {
+	int64 right = Run(c->b, frame) throws();
+	return *c->cell = Op(*c->cell, right, c);
+}
+template<int kDelta, bool kPostfix>
+int64 RunIncrement(const Closure* c, int64* frame) {
+	int64 old = frame[c->value];
+	frame[c->value] = old + int64(kDelta);
+	return kPostfix ? old : old + int64(kDelta);
+}
+template<int kDelta, bool kPostfix>
+int64 RunIncrementGlobal(const Closure* c, int64* frame) {
+	int64 old = *c->cell;
+	*c->cell = old + int64(kDelta);
+	return kPostfix ? old : old + int64(kDelta);
+}
+
+int64 RunLogicalAnd(const Closure* c, int64* frame) throws(Status) {
+	return Run(c->a, frame) && Run(c->b, frame);
+}
+int64 RunLogicalOr(const Closure* c, int64* frame) throws(Status) {
+	return Run(c->a, frame) || Run(c->b, frame);
+}
+int64 RunComma(const Closure* c, int64* frame) throws(Status) {
+	Run(c->a, frame) throws();
+	return Run(c->b, frame);
+}
+
+// Statements, the last being the return
+int64 RunBody(const Closure* c, int64* frame) throws(Status) {
+	const int64 last = c->count - 1;
+	for(int64 i=0;i<last;++i) {
+		Run(c->list[i], frame) throws();
+	}
+	return Run(c->list[last], frame);
+}
+
+// A callee's body until it's compiled, which a constant might call
+int64 RunUncompiled(const Closure* c, int64* frame) throws(Status) {
+	throw Status{.message = "Function called while it's being compiled",
+				 .loc = c->stmt->GetLoc()};
+}
+
+// The callee's frame starts at value, arguments first
+int64 RunCall(const Closure* c, int64* frame) throws(Status) {
+	CompiledFunc* func = c->func;
+	int64* callee = frame + c->value;
+	char here;
+	if(callee + func->frame_size > func->machine->stack_end ||
+	   uintptr_t(&here) < func->machine->native_limit) {
+		throw Status{.message = string("Stack overflow calling ") + func->decl->GetName(),
+					 .loc = c->stmt->GetLoc()};
+	}
+	// Calls in argument i put their frames after it
+	for(int64 i=0;i<c->count;++i) {
+		callee[i] = Run(c->list[i], frame) throws();
+	}
+	return Run(func->body, callee);
+}
+
+// Compiling one function
+struct FuncContext {
+	// nullptr for a global's initializer
+	CompiledFunc* func = nullptr;
+	hash_map<VarDecl*, int64> slots;
+	int64 next_slot = 0;
+	// Where the frame of a call would start
+	int64 top = 0;
+	// Compiling a template argument, which can't read locals
+	bool constant = false;
+
+	Specialization Spec()const {
+		if(func == nullptr) {
+			return Specialization{};
+		}
+		return Specialization{.decl = func->decl,
+							  .type_args = func->type_args,
+							  .int_args = func->int_args};
+	}
+};
+
+}  // internal
+
+// Runs functions of int values. Each function body is compiled once, on
+// first call, into a tree of closures specialized to each operation, with
+// variables resolved to slots of a frame and operators to direct calls.
+// Calls put their frames one after another in a stack of slots allocated
+// up front.
+// Functions are compiled for each set of template arguments they're
+// called with. Structs, pointers and function references aren't supported
+// yet and fail to compile. Globals are initialized when first used.
+class Interpreter {
+public:
+	Interpreter(InterpreterOptions options = InterpreterOptions{})
+		: options_(options) {
+		stack_.resize(options_.stack_slots);
+		machine_.stack_end = stack_.data() + stack_.len();
+	}
+	// Compiled code points into the interpreter
+	Interpreter(const Interpreter& other) = delete;
+	Interpreter& operator=(const Interpreter& other) = delete;
+
+	// Compiles func and what it calls on first use. Throws if it doesn't
+	// compile, or on errors running it, like dividing by zero or
+	// overflowing the stack.
+	int64 Call(FuncDecl* func, vector<int64> args) throws(Status) {
+		if(!func->GetTemplateParams().empty()) {
+			throw Status{.message = string("Can't call template ") + func->GetName() +
+							" without arguments",
+						 .loc = func->GetLoc()};
+		}
+		if(args.len() != func->GetParameters().len()) {
+			throw Status{.message = string("Wrong number of arguments calling ") +
+							func->GetName(),
+						 .loc = func->GetLoc()};
+		}
+		internal::CompiledFunc* compiled = GetFunc(func, nullptr, nullptr, func) throws();
+		if(compiled->frame_size > stack_.len()) {
+			throw Status{.message = string("Stack overflow calling ") + func->GetName(),
+						 .loc = func->GetLoc()};
+		}
+		for(int64 i=0;i<args.len();++i) {
+			stack_[i] = args[i];
+		}
+		char here;
+		machine_.native_limit = uintptr_t(&here) - options_.native_stack_bytes;
+		return internal::Run(compiled->body, stack_.data());
+	}
+
+private:
+	internal::CompiledFunc* GetFunc(FuncDecl* decl, Type** type_args, int64* int_args,
+									Stmt* where) throws(Status) {
+		const int64 num_args = decl->GetTemplateParams().len();
+		internal::CompiledFunc** head = funcs_.find(decl);
+		for(internal::CompiledFunc* func = head ? *head : nullptr;func;func = func->next) {
+			bool same = true;
+			for(int64 i=0;i<num_args;++i) {
+				same = same && func->type_args[i] == type_args[i] &&
+					func->int_args[i] == int_args[i];
+			}
+			if(same) {
+				return func;
+			}
+		}
+		if(decl->IsPrototype()) {
+			throw Status{.message = string("Function ") + decl->GetName() + " isn't defined",
+						 .loc = where->GetLoc()};
+		}
+		if(compiling_ >= options_.max_compile_depth) {
+			throw Status{.message = string("Calls nested too deeply to compile at ") +
+							decl->GetName(),
+						 .loc = where->GetLoc()};
+		}
+		auto* func = arena_.New<internal::CompiledFunc>();
+		func->decl = decl;
+		func->type_args = type_args;
+		func->int_args = int_args;
+		func->machine = &machine_;
+		func->next = head ? *head : nullptr;
+		auto* uncompiled = arena_.New<internal::Closure>();
+		uncompiled->fn = &internal::RunUncompiled;
+		uncompiled->stmt = decl;
+		func->body = uncompiled;
+		// What this compiles is forgotten if it fails, so nothing can call
+		// a function left uncompiled
+		const int64 num_added = added_.len();
+		const int64 num_added_globals = added_globals_.len();
+		funcs_.set(decl, func);
+		added_.push_back(func);
+		++compiling_;
+		bool done = false;
+		auto guard = MakeLambdaGuard([&]() {
+			--compiling_;
+			if(done) {
+				return;
+			}
+			while(added_.len() > num_added) {
+				internal::CompiledFunc* added = added_.pop_back();
+				if(added->next) {
+					funcs_.set(added->decl, added->next);
+				} else {
+					funcs_.remove(added->decl);
+				}
+			}
+			while(added_globals_.len() > num_added_globals) {
+				globals_.remove(added_globals_.pop_back());
+			}
+		});
+		CompileFunc(func) throws();
+		done = true;
+		if(compiling_ == 1) {
+			added_.clear();
+			added_globals_.clear();
+		}
+		return func;
+	}
+
+	void CompileFunc(internal::CompiledFunc* func) throws(Status) {
+		FuncDecl* decl = func->decl;
+		internal::FuncContext ctx;
+		ctx.func = func;
+		if(!isa<VoidType>(ctx.Spec().ResolveType(decl->GetReturnType()))) {
+			ctx.Spec().RequireInt(decl->GetReturnType(), decl) throws();
+		}
+		for(VarDecl* param : decl->GetParameters()) {
+			ctx.Spec().RequireInt(param->GetType(), param) throws();
+			ctx.slots.set(param, ctx.next_slot++);
+		}
+		buffer<const internal::Closure*> stmts;
+		bool returns = false;
+		for(Stmt* stmt : decl->GetBody() throws()) {
+			ctx.top = ctx.next_slot;
+			if(auto* ret = dyn_cast<ReturnStmt>(stmt)) {
+				stmts.push_back(ret->GetValue() ? CompileExpr(&ctx, ret->GetValue(), 0) throws()
+												: Const(0, ret));
+				returns = true;
+				// The rest can't run
+				break;
+			} else if(auto* var = dyn_cast<VarDecl>(stmt)) {
+				stmts.push_back(CompileLocal(&ctx, var) throws());
+			} else if(auto* expr = dyn_cast<Expr>(stmt)) {
+				stmts.push_back(CompileExpr(&ctx, expr, 0) throws());
+			} else {
+				throw Status{.message = string("Can't interpret ") +
+								StmtKindName(stmt->GetStmtKind()),
+							 .loc = stmt->GetLoc()};
+			}
+		}
+		if(!returns) {
+			stmts.push_back(Const(0, decl));
+		}
+		func->frame_size = Max(func->frame_size, ctx.next_slot);
+		if(stmts.len() == 1) {
+			func->body = stmts[0];
+			return;
+		}
+		auto* body = New(&internal::RunBody, decl);
+		body->list = CopyList(stmts);
+		body->count = stmts.len();
+		func->body = body;
+	}
+
+	const internal::Closure* CompileLocal(internal::FuncContext* ctx, VarDecl* var) throws(Status) {
+		ctx->Spec().RequireInt(var->GetType(), var) throws();
+		const int64 slot = ctx->next_slot++;
+		ctx->slots.set(var, slot);
+		ctx->top = ctx->next_slot;
+		ctx->func->frame_size = Max(ctx->func->frame_size, ctx->next_slot);
+		auto* store = New(&internal::RunAssign<&internal::OpRight>, var);
+		store->value = slot;
+		store->b = CompileInit(ctx, var) throws();
+		return store;
+	}
+
+	// Zero without an initializer
+	const internal::Closure* CompileInit(internal::FuncContext* ctx, VarDecl* var) throws(Status) {
+		Expr* init = internal::InitExpr(var) throws();
+		return init ? CompileExpr(ctx, init, 0) : Const(0, var);
+	}
+
+	// Compiles expr, which may call functions with frames from ctx->top
+	const internal::Closure* CompileExpr(internal::FuncContext* ctx, Expr* expr,
+										 int64 depth) throws(Status) {
+		if(depth >= options_.max_expression_depth) {
+			throw Status{.message = "Expression nested too deeply to interpret",
+						 .loc = expr->GetLoc()};
+		}
+		++depth;
+		switch(expr->GetStmtKind()) {
+			case StmtKind_Literal: {
+				auto* integer = dyn_cast<IntegerValue>(cast<Literal>(expr)->GetValue());
+				if(integer == nullptr) {
+					throw Status{.message = "Only int literals are supported",
+								 .loc = expr->GetLoc()};
+				}
+				return Const(integer->GetValue(), expr);
+			}
+			case StmtKind_DeclRef:
+				return CompileDeclRef(ctx, cast<DeclRef>(expr)) throws();
+			case StmtKind_ParenExpr:
+				return CompileExpr(ctx, cast<ParenExpr>(expr)->GetSub(), depth);
+			case StmtKind_CastExpr: {
+				auto* cast_expr = cast<CastExpr>(expr);
+				ctx->Spec().RequireInt(cast_expr->GetToType(), expr) throws();
+				return CompileExpr(ctx, cast_expr->GetSub(), depth);
+			}
+			case StmtKind_UnaryOp:
+				return CompileUnaryOp(ctx, cast<UnaryOp>(expr), depth) throws();
+			case StmtKind_BinaryOp:
+				return CompileBinaryOp(ctx, cast<BinaryOp>(expr), depth) throws();
+			case StmtKind_FuncCall:
+				return CompileCall(ctx, cast<FuncCall>(expr), depth) throws();
+			case StmtKind_CtorCall: {
+				// int(x), or int() for zero
+				auto* ctor = cast<CtorCall>(expr);
+				ctx->Spec().RequireInt(ctor->GetType(), expr) throws();
+				if(ctor->GetArgs().len() > 1) {
+					throw Status{.message = "Can't make an int of several values",
+								 .loc = expr->GetLoc()};
+				}
+				return ctor->GetArgs().len() ? CompileExpr(ctx, ctor->GetArgs()[0], depth)
+											 : Const(0, expr);
+			}
+			default:
+				throw Status{.message = string("Can't interpret ") +
+								StmtKindName(expr->GetStmtKind()),
+							 .loc = expr->GetLoc()};
+		}
+	}
+
+	const internal::Closure* CompileDeclRef(internal::FuncContext* ctx,
+											DeclRef* ref) throws(Status) {
+		if(auto* param = dyn_cast<TemplateParam>(ref->GetRef())) {
+			int64 value = 0;
+			if(ctx->Spec().IntArg(param, &value)) {
+				return Const(value, ref);
+			}
+		} else if(auto* var = dyn_cast<VarDecl>(ref->GetRef())) {
+			if(int64* slot = ctx->slots.find(var)) {
+				if(ctx->constant) {
+					throw Status{.message = string("Template argument reads ") +
+									var->GetName() + ", which isn't constant",
+								 .loc = ref->GetLoc()};
+				}
+				internal::Closure* load = New(&internal::RunLoad, ref);
+				load->value = *slot;
+				return load;
+			}
+			internal::Closure* load = New(&internal::RunLoadGlobal, ref);
+			load->cell = GetGlobal(var) throws();
+			return load;
+		}
+		throw Status{.message = string("Can't use ") + ref->GetRef()->GetName() +
+						" as a value",
+					 .loc = ref->GetLoc()};
+	}
+
+	// Where an assignment goes: a slot, or a global's cell
+	void CompileLValue(internal::FuncContext* ctx, Expr* expr, int64* slot,
+					   int64** cell) throws(Status) {
+		while(auto* paren = dyn_cast<ParenExpr>(expr)) {
+			expr = paren->GetSub();
+		}
+		auto* ref = dyn_cast<DeclRef>(expr);
+		auto* var = ref ? dyn_cast<VarDecl>(ref->GetRef()) : nullptr;
+		if(var == nullptr) {
+			throw Status{.message = "Can only assign to variables",
+						 .loc = expr->GetLoc()};
+		}
+		*cell = nullptr;
+		if(int64* found = ctx->slots.find(var)) {
+			*slot = *found;
+		} else {
+			*cell = GetGlobal(var) throws();
+		}
+	}
+
+	const internal::Closure* CompileUnaryOp(internal::FuncContext* ctx, UnaryOp* op,
+											int64 depth) throws(Status) {
+		string name = op->GetOp();
+		if(name == "++" || name == "--") {
+			int64 slot = 0;
+			int64* cell = nullptr;
+			CompileLValue(ctx, op->GetSub(), &slot, &cell) throws();
+			internal::ClosureFn fn = nullptr;
+			if(name == "++") {
+				fn = op->IsPostfix() ? (cell ? &internal::RunIncrementGlobal<1, true>
+											 : &internal::RunIncrement<1, true>)
+									 : (cell ? &internal::RunIncrementGlobal<1, false>
+											 : &internal::RunIncrement<1, false>);
+			} else {
+				fn = op->IsPostfix() ? (cell ? &internal::RunIncrementGlobal<-1, true>
+											 : &internal::RunIncrement<-1, true>)
+									 : (cell ? &internal::RunIncrementGlobal<-1, false>
+											 : &internal::RunIncrement<-1, false>);
+			}
+			internal::Closure* inc = New(fn, op);
+			inc->value = slot;
+			inc->cell = cell;
+			return inc;
+		}
+		const internal::Closure* sub = CompileExpr(ctx, op->GetSub(), depth) throws();
+		if(name == "+") {
+			return sub;
+		}
+		internal::ClosureFn fn = nullptr;
+		if(name == "-") {
+			fn = &internal::RunUnary<&internal::OpNeg>;
+		} else if(name == "!") {
+			fn = &internal::RunUnary<&internal::OpNot>;
+		} else if(name == "~") {
+			fn = &internal::RunUnary<&internal::OpCompl>;
+		} else {
+			throw Status{.message = string("Unary ") + name + " isn't supported",
+						 .loc = op->GetLoc()};
+		}
+		internal::Closure* unary = New(fn, op);
+		unary->a = sub;
+		return unary;
+	}
+
+	// nullptr for IntOp_None
+	static internal::BinaryFn IntOpFn(internal::IntOp op) {
+		static const internal::BinaryFn kFns[] = {
+			&internal::OpAdd, &internal::OpSub, &internal::OpMul, &internal::OpDiv,
+			&internal::OpMod, &internal::OpShl, &internal::OpShr, &internal::OpLt,
+			&internal::OpLe,  &internal::OpGt,  &internal::OpGe,  &internal::OpEq,
+			&internal::OpNe,  &internal::OpAnd, &internal::OpOr,  &internal::OpXor,
+			nullptr,
+		};
+		static_assert(sizeof(kFns) / sizeof(kFns[0]) == internal::IntOp_None + 1);
+		return kFns[op];
+	}
+
+	// The three ways of running op, with operands in a closure, a constant
+	// right operand, or a local and a constant
+	template<internal::BinaryFn Op>
+	static internal::ClosureFn BinaryFns(int64 form) {
+		switch(form) {
+			case 0: return &internal::RunBinary<Op>;
+			case 1: return &internal::RunBinaryConst<Op>;
+			default: return &internal::RunBinaryLoadConst<Op>;
+		}
+	}
+	static internal::ClosureFn BinaryFnFor(internal::BinaryFn op, int64 form) {
+		if(op == &internal::OpAdd) return BinaryFns<&internal::OpAdd>(form);
+		if(op == &internal::OpSub) return BinaryFns<&internal::OpSub>(form);
+		if(op == &internal::OpMul) return BinaryFns<&internal::OpMul>(form);
+		if(op == &internal::OpDiv) return BinaryFns<&internal::OpDiv>(form);
+		if(op == &internal::OpMod) return BinaryFns<&internal::OpMod>(form);
+		if(op == &internal::OpShl) return BinaryFns<&internal::OpShl>(form);
+		if(op == &internal::OpShr) return BinaryFns<&internal::OpShr>(form);
+		if(op == &internal::OpLt) return BinaryFns<&internal::OpLt>(form);
+		if(op == &internal::OpLe) return BinaryFns<&internal::OpLe>(form);
+		if(op == &internal::OpGt) return BinaryFns<&internal::OpGt>(form);
+		if(op == &internal::OpGe) return BinaryFns<&internal::OpGe>(form);
+		if(op == &internal::OpEq) return BinaryFns<&internal::OpEq>(form);
+		if(op == &internal::OpNe) return BinaryFns<&internal::OpNe>(form);
+		if(op == &internal::OpAnd) return BinaryFns<&internal::OpAnd>(form);
+		if(op == &internal::OpOr) return BinaryFns<&internal::OpOr>(form);
+		return BinaryFns<&internal::OpXor>(form);
+	}
+	template<internal::BinaryFn Op>
+	static internal::ClosureFn AssignFns(bool global) {
+		return global ? &internal::RunAssignGlobal<Op> : &internal::RunAssign<Op>;
+	}
+	static internal::ClosureFn AssignFnFor(internal::BinaryFn op, bool global) {
+		if(op == nullptr) return AssignFns<&internal::OpRight>(global);
+		if(op == &internal::OpAdd) return AssignFns<&internal::OpAdd>(global);
+		if(op == &internal::OpSub) return AssignFns<&internal::OpSub>(global);
+		if(op == &internal::OpMul) return AssignFns<&internal::OpMul>(global);
+		if(op == &internal::OpDiv) return AssignFns<&internal::OpDiv>(global);
+		if(op == &internal::OpMod) return AssignFns<&internal::OpMod>(global);
+		if(op == &internal::OpShl) return AssignFns<&internal::OpShl>(global);
+		if(op == &internal::OpShr) return AssignFns<&internal::OpShr>(global);
+		if(op == &internal::OpAnd) return AssignFns<&internal::OpAnd>(global);
+		if(op == &internal::OpOr) return AssignFns<&internal::OpOr>(global);
+		return AssignFns<&internal::OpXor>(global);
+	}
+
+	const internal::Closure* CompileBinaryOp(internal::FuncContext* ctx, BinaryOp* op,
+											 int64 depth) throws(Status) {
+		string name = op->GetOp();
+		if(IsAssignmentOp(name)) {
+			int64 slot = 0;
+			int64* cell = nullptr;
+			CompileLValue(ctx, op->GetLeft(), &slot, &cell) throws();
+			// Compound assignments are the operator and =
+			internal::BinaryFn arithmetic =
+				name == "=" ? nullptr : IntOpFn(internal::CompoundAssignmentOp(name));
+			internal::Closure* assign = New(AssignFnFor(arithmetic, cell != nullptr), op);
+			assign->value = slot;
+			assign->cell = cell;
+			assign->b = CompileExpr(ctx, op->GetRight(), depth) throws();
+			return assign;
+		}
+		const internal::Closure* left = CompileExpr(ctx, op->GetLeft(), depth) throws();
+		const internal::Closure* right = CompileExpr(ctx, op->GetRight(), depth) throws();
+		internal::ClosureFn fn = nullptr;
+		if(name == "&&") {
+			fn = &internal::RunLogicalAnd;
+		} else if(name == "||") {
+			fn = &internal::RunLogicalOr;
+		} else if(name == ",") {
+			fn = &internal::RunComma;
+		} else if(internal::BinaryFn arithmetic = IntOpFn(internal::IntOpOf(name))) {
+			int64 form = 0;
+			if(right->fn == &internal::RunConst) {
+				form = left->fn == &internal::RunLoad ? 2 : 1;
+			}
+			fn = BinaryFnFor(arithmetic, form);
+		} else {
+			throw Status{.message = string("Binary ") + name + " isn't supported",
+						 .loc = op->GetLoc()};
+		}
+		internal::Closure* binary = New(fn, op);
+		binary->a = left;
+		binary->b = right;
+		return binary;
+	}
+
+	const internal::Closure* CompileCall(internal::FuncContext* ctx, FuncCall* call,
+										 int64 depth) throws(Status) {
+		DeclRef* callee = call->GetCallee();
+		auto* decl = cast<FuncDecl>(callee->GetRef());
+		vector<TemplateParam*> params = decl->GetTemplateParams();
+		vector<TemplateArg> template_args = callee->GetTemplateArgs();
+		if(template_args.len() != params.len()) {
+			throw Status{.message = string("Can't deduce template arguments of ") +
+							decl->GetName(),
+						 .loc = call->GetLoc()};
+		}
+		Type** type_args = nullptr;
+		int64* int_args = nullptr;
+		if(params.len()) {
+			type_args = (Type**)arena_.Allocate(sizeof(Type*) * params.len(), alignof(Type*));
+			int_args = (int64*)arena_.Allocate(sizeof(int64) * params.len(), alignof(int64));
+		}
+		for(int64 i=0;i<params.len();++i) {
+			type_args[i] = template_args[i].type ? ctx->Spec().ResolveType(template_args[i].type)
+												 : nullptr;
+			int_args[i] = template_args[i].int_value
+				? EvaluateConstant(ctx, template_args[i].int_value) throws()
+				: 0;
+		}
+		internal::CompiledFunc* func = GetFunc(decl, type_args, int_args, call) throws();
+
+		vector<Expr*> args = call->GetArgs();
+		buffer<const internal::Closure*> compiled;
+		const int64 start = ctx->top;
+		auto guard = MakeLambdaGuard([&]() { ctx->top = start; });
+		for(int64 i=0;i<args.len();++i) {
+			ctx->top = start + i;
+			compiled.push_back(CompileExpr(ctx, args[i], depth) throws());
+		}
+		if(ctx->func) {
+			ctx->func->frame_size = Max(ctx->func->frame_size, start + args.len());
+		}
+		internal::Closure* closure = New(&internal::RunCall, call);
+		closure->func = func;
+		closure->value = start;
+		closure->list = CopyList(compiled);
+		closure->count = compiled.len();
+		return closure;
+	}
+
+	// Runs expr now, as nothing else is running while compiling
+	int64 EvaluateConstant(internal::FuncContext* ctx, Expr* expr) throws(Status) {
+		const bool was_constant = ctx->constant;
+		const int64 top = ctx->top;
+		auto guard = MakeLambdaGuard([&]() {
+			ctx->constant = was_constant;
+			ctx->top = top;
+		});
+		ctx->constant = true;
+		ctx->top = 0;
+		const internal::Closure* closure = CompileExpr(ctx, expr, 0) throws();
+		char here;
+		machine_.native_limit = uintptr_t(&here) - options_.native_stack_bytes;
+		return internal::Run(closure, stack_.data());
+	}
+
+	int64* GetGlobal(VarDecl* var) throws(Status) {
+		if(int64** cell = globals_.find(var)) {
+			return *cell;
+		}
+		internal::FuncContext global;
+		global.Spec().RequireInt(var->GetType(), var) throws();
+		int64* cell = arena_.New<int64>(0);
+		globals_.set(var, cell);
+		bool done = false;
+		auto guard = MakeLambdaGuard([&]() {
+			if(!done) {
+				globals_.remove(var);
+			}
+		});
+		if(Expr* init = internal::InitExpr(var) throws()) {
+			*cell = EvaluateConstant(&global, init) throws();
+		}
+		done = true;
+		if(compiling_ != 0) {
+			added_globals_.push_back(var);
+		}
+		return cell;
+	}
+
+	static int64 Max(int64 a, int64 b) {
+		return a > b ? a : b;
+	}
+
+	internal::Closure* New(internal::ClosureFn fn, Stmt* stmt) {
+		auto* closure = arena_.New<internal::Closure>();
+		closure->fn = fn;
+		closure->stmt = stmt;
+		return closure;
+	}
+	internal::Closure* Const(int64 value, Stmt* stmt) {
+		internal::Closure* closure = New(&internal::RunConst, stmt);
+		closure->value = value;
+		return closure;
+	}
+	const internal::Closure* const* CopyList(const buffer<const internal::Closure*>& list) {
+		auto** copy = (const internal::Closure**)arena_.Allocate(
+			sizeof(internal::Closure*) * (list.len() ? list.len() : 1), alignof(internal::Closure*));
+		for(int64 i=0;i<list.len();++i) {
+			copy[i] = list[i];
+		}
+		return copy;
+	}
+
+	InterpreterOptions options_;
+	Arena arena_;
+	buffer<int64> stack_;
+	internal::Machine machine_;
+	// Every compilation of each function
+	hash_map<FuncDecl*, internal::CompiledFunc*> funcs_;
+	hash_map<VarDecl*, int64*> globals_;
+	// Functions being compiled
+	int64 compiling_ = 0;
+	// Compiled or initialized since the outermost function being compiled
+	// started, in order
+	buffer<internal::CompiledFunc*> added_;
+	buffer<VarDecl*> added_globals_;
+};
+
+}  // namespace compiler
+}  // namespace stacklang
+
+#endif//INTERPRETER_H
@@ -0,0 +1,136 @@
+#include "interpreter.h"
+#include "scanner.h"
+#include "test_programs.h"
+
+#include <cstdio>
+#include <string>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %ld != %ld\n",
+			a, b);
+	}
+}
+
+void ExpectEq(string a, string b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %s != %s\n",
+			a.c_str(), b.c_str());
+	}
+}
+
+compiler::FuncDecl* FindFunc(const compiler::Namespace& ns, string name) {
+	return compiler::cast<compiler::FuncDecl>(ns.FindDecl(name));
+}
+
+// top(3, 4) of src, or top(3) if it takes one, or -1 with the message of
+// the Status it throws
+int64 RunTop(const char* src, string* error = nullptr) {
+	compiler::TokenBuffer tokens = compiler::Scan(src);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::FuncDecl* top = FindFunc(parsed, "top");
+	compiler::Interpreter interpreter;
+	try {
+		if(top->GetParameters().len() == 1) {
+			return interpreter.Call(top, {3});
+		}
+		return interpreter.Call(top, {3, 4});
+	} catch(Status status) {
+		if(error) {
+			*error = status.message;
+		}
+		return -1;
+	}
+}
+
+// Runs every program of kIntPrograms
+void TestPrograms() {
+	fprintf(stderr, "--- TestPrograms ---\n");
+	for(const testing::IntProgram& program : testing::kIntPrograms) {
+		string error;
+		const int64 result = RunTop(program.src, &error);
+		if(program.error) {
+			ExpectEq(result, int64(-1));
+			ExpectEq(error, program.error);
+		} else {
+			ExpectEq(result, program.result);
+		}
+	}
+}
+
+void TestGlobals() {
+	fprintf(stderr, "--- TestGlobals ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(
+		"int counter = 5;\n"
+		"namespace outer {\nint x;\n}\n"
+		"int bump(int by) {\n\tcounter += by;\n\touter::x++;\n\treturn counter * 10 + outer::x;\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::Interpreter interpreter;
+	ExpectEq(interpreter.Call(FindFunc(parsed, "bump"), {3}), 81);
+	ExpectEq(interpreter.Call(FindFunc(parsed, "bump"), {1}), 92);
+}
+
+void TestCompiledOnce() {
+	fprintf(stderr, "--- TestCompiledOnce ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(
+		"int top(int x, int y) {\n\treturn x - y;\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::FuncDecl* top = FindFunc(parsed, "top");
+	compiler::Interpreter interpreter;
+	ExpectEq(interpreter.Call(top, {3, 4}), int64(-1));
+	// Runs what was compiled, not the AST
+	auto* ret = compiler::cast<compiler::ReturnStmt>(top->GetBody()[0]);
+	auto* minus = compiler::cast<compiler::BinaryOp>(ret->GetValue());
+	minus->SetRight(minus->GetLeft());
+	ExpectEq(interpreter.Call(top, {3, 4}), int64(-1));
+	compiler::Interpreter fresh;
+	ExpectEq(fresh.Call(top, {3, 4}), 0);
+}
+
+void TestErrors() {
+	fprintf(stderr, "--- TestErrors ---\n");
+	string error;
+	// Functions which failed to compile fail the same way when called again,
+	// directly or from a function compiled later
+	compiler::TokenBuffer tokens = compiler::Scan(
+		"int bad(int x) {\n\treturn *x;\n}\n"
+		"int top(int x, int y) {\n\treturn bad(x) + y;\n}\n"
+		"int down(int x) {\n\treturn down(x - 1) + *x;\n}\n");
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::Interpreter interpreter;
+	for(const char* name : {"bad", "bad", "top", "down", "down"}) {
+		error = "";
+		try {
+			compiler::FuncDecl* func = FindFunc(parsed, name);
+			interpreter.Call(func, func->GetParameters().len() == 1 ? vector<int64>{3}
+																	 : vector<int64>{3, 4});
+		} catch(Status status) {
+			error = status.message;
+		}
+		ExpectEq(error, "Unary * isn't supported");
+	}
+
+	// Deeper than it compiles
+	std::string src = "int top(int x, int y) {\n\treturn x";
+	for(int64 i=0;i<2000;++i) {
+		src += " + x";
+	}
+	src += ";\n}\n";
+	ExpectEq(RunTop(src.c_str(), &error), int64(-1));
+	ExpectEq(error, "Expression nested too deeply to interpret");
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestPrograms();
+	stacklang::TestGlobals();
+	stacklang::TestCompiledOnce();
+	stacklang::TestErrors();
+	return 0;
+}
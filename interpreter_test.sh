@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z ./interpreter_test.cc -o /tmp/interpreter_test
+/tmp/interpreter_test
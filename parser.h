@@ -6,21 +6,156 @@
 #include "set.h"
 #include "utils.h"
 #include "scanner.h"
+#include "arena.h"
 #include "map.h"
+#include "hash_map.h"
 #include "tokens.h"
+#include "trace.h"
 
 // STL
 #include <initializer_list>
 #include <assert.h>
 #include <string>
-#include <sstream>
+#include <cstdio>
+#include <type_traits>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 namespace stacklang {
 namespace compiler {
 
+class Stmt;
+class Type;
+class Value;
+
+// Every node records its concrete class, so checking a node's class is an
+// integer compare rather than a dynamic_cast.
+// Ranges of kinds cover subclasses, so classes are ordered depth first.
+enum StmtKind {
+	StmtKind_ReturnStmt,
+
+	StmtKind_VarDecl,
+	StmtKind_TemplateParam,
+	StmtKind_TypedefDecl,
+	StmtKind_FuncDecl,
+	StmtKind_StructDecl,
+	StmtKind_UsingDecl,
+	StmtKind_UsingAliasDecl,
+
+	StmtKind_DeclRef,
+	StmtKind_Literal,
+	StmtKind_MemberExpr,
+	StmtKind_UnaryOp,
+	StmtKind_CastExpr,
+	StmtKind_ParenExpr,
+	StmtKind_BinaryOp,
+	StmtKind_FuncCall,
+	StmtKind_CtorCall,
+
+	StmtKind_FirstDecl = StmtKind_VarDecl,
+	StmtKind_LastDecl = StmtKind_UsingAliasDecl,
+	StmtKind_FirstTemplatedDecl = StmtKind_FuncDecl,
+	StmtKind_LastTemplatedDecl = StmtKind_UsingAliasDecl,
+	StmtKind_FirstExpr = StmtKind_DeclRef,
+	StmtKind_LastExpr = StmtKind_CtorCall,
+};
+
+enum TypeKind {
+	TypeKind_VoidType,
+	TypeKind_IntType,
+	TypeKind_DeclRefType,
+	// Also Decls
+	TypeKind_TemplateParam,
+	TypeKind_TypedefDecl,
+	TypeKind_StructDecl,
+	TypeKind_UsingDecl,
+	TypeKind_UsingAliasDecl,
+};
+
+enum ValueKind {
+	ValueKind_VoidValue,
+	ValueKind_IntegerValue,
+};
+
+// For classes which are both Decls and Types, the other base of the same
+// object, else nullptr. Defined after the classes.
+Type* StmtAsType(Stmt* stmt);
+Stmt* TypeAsStmt(Type* type);
+
+namespace internal {
+
+template<typename To, typename From>
+struct CastTraits {
+	static constexpr bool kUpcast = std::is_convertible<From*, To*>::value;
+	static constexpr bool kBothStmt =
+		std::is_base_of<Stmt, To>::value && std::is_base_of<Stmt, From>::value;
+	static constexpr bool kBothType =
+		std::is_base_of<Type, To>::value && std::is_base_of<Type, From>::value;
+	static constexpr bool kBothValue =
+		std::is_base_of<Value, To>::value && std::is_base_of<Value, From>::value;
+};
+
+}  // internal
+
+// Whether p is a To. p can't be nullptr.
+// Works across the Stmt and Type hierarchies, e.g. a Decl* is a Type if
+// it's a StructDecl.
+template<typename To, typename From>
+bool isa(From* p) {
+	typedef internal::CastTraits<To, From> Traits;
+	assert(p);
+	if constexpr(Traits::kUpcast) {
+		return true;
+	} else if constexpr(Traits::kBothStmt) {
+		return To::classof(static_cast<Stmt*>(p));
+	} else if constexpr(Traits::kBothType) {
+		return To::classof(static_cast<Type*>(p));
+	} else if constexpr(Traits::kBothValue) {
+		return To::classof(static_cast<Value*>(p));
+	} else if constexpr(std::is_base_of<Stmt, From>::value) {
+		Type* type = StmtAsType(p);
+		return type && isa<To>(type);
+	} else {
+		static_assert(std::is_base_of<Type, From>::value, "Not an AST class");
+		Stmt* stmt = TypeAsStmt(p);
+		return stmt && isa<To>(stmt);
+	}
+}
+
+// p must be a To
+template<typename To, typename From>
+To* cast(From* p) {
+	typedef internal::CastTraits<To, From> Traits;
+	assert(isa<To>(p));
+	if constexpr(Traits::kUpcast) {
+		return p;
+	} else if constexpr(Traits::kBothStmt) {
+		return static_cast<To*>(static_cast<Stmt*>(p));
+	} else if constexpr(Traits::kBothType) {
+		return static_cast<To*>(static_cast<Type*>(p));
+	} else if constexpr(Traits::kBothValue) {
+		return static_cast<To*>(static_cast<Value*>(p));
+	} else if constexpr(std::is_base_of<Stmt, From>::value) {
+		return cast<To>(StmtAsType(p));
+	} else {
+		return cast<To>(TypeAsStmt(p));
+	}
+}
+
+// nullptr if p is nullptr or not a To
+template<typename To, typename From>
+To* dyn_cast(From* p) {
+	if(p == nullptr || !isa<To>(p)) {
+		return nullptr;
+	}
+	return cast<To>(p);
+}
+
+// dyn_cast taking the pointer type
 template<typename PtrTo, typename PtrFrom>
 PtrTo AsA(PtrFrom *p) {
-	return dynamic_cast<PtrTo>(p);
+	return dyn_cast<typename std::remove_pointer<PtrTo>::type>(p);
 }
 
 struct Identifier {
@@ -43,15 +178,6 @@ struct Identifier {
 	}
 };
 
-bool IsDigit(char c) {
-	return (c >= '0') && (c <= '9');
-}
-
-bool IsLetter(char c) {
-	return ((c >= 'a') && (c <= 'z')) ||
-		   ((c >= 'A') && (c <= 'Z'));
-}
-
 void IsValidID(string id, LocationRef loc) throws(Status) {
 	if(id.len() <= 0) {
 		return;
@@ -81,48 +207,96 @@ class Expr;
 
 class Type {
 public:
+	Type(TypeKind kind) : type_kind_(kind) { }
 	virtual string DebugString(int64 indent)const = 0;
+	TypeKind GetTypeKind()const {
+		return type_kind_;
+	}
+	static bool classof(const Type* type) {
+		return true;
+	}
+private:
+	TypeKind type_kind_;
 };
 
+// Builtin types are singletons, so they compare by pointer like the rest.
+// See CanonicalType.
 class VoidType : public Type {
 public:
+	static VoidType* Get() {
+		static VoidType type;
+		return &type;
+	}
+	static bool classof(const Type* type) {
+		return type->GetTypeKind() == TypeKind_VoidType;
+	}
 	string DebugString(int64 indent)const override {
 		return "void";
 	}
+private:
+	VoidType() : Type(TypeKind_VoidType) { }
 };
 
 class IntType : public Type {
 public:
+	static IntType* Get() {
+		static IntType type;
+		return &type;
+	}
+	static bool classof(const Type* type) {
+		return type->GetTypeKind() == TypeKind_IntType;
+	}
 	string DebugString(int64 indent)const override {
 		return "int";
 	}
+private:
+	IntType() : Type(TypeKind_IntType) { }
 };
 
 class Value {
 public:
+	Value(ValueKind kind) : value_kind_(kind) { }
 	virtual string DebugString()const = 0;
 	virtual Type* GetType()const = 0;
+	ValueKind GetValueKind()const {
+		return value_kind_;
+	}
+	static bool classof(const Value* value) {
+		return true;
+	}
+private:
+	ValueKind value_kind_;
 };
 
 class VoidValue : public Value {
 public:
+	VoidValue() : Value(ValueKind_VoidValue) { }
+	static bool classof(const Value* value) {
+		return value->GetValueKind() == ValueKind_VoidValue;
+	}
 	string DebugString()const override {
 		return "void";
 	}
 	Type* GetType()const override {
-		return new VoidType;
+		return VoidType::Get();
 	}
 };
 
 class IntegerValue : public Value {
 public:
-	IntegerValue(int64 value) : value_(value) { }
+	IntegerValue(int64 value) : Value(ValueKind_IntegerValue), value_(value) { }
+	static bool classof(const Value* value) {
+		return value->GetValueKind() == ValueKind_IntegerValue;
+	}
 	string DebugString()const override {
 
 		return string("int(") + std::to_string(value_).c_str() + ")";
 	}
 	Type* GetType()const override {
-		return new IntType;
+		return IntType::Get();
+	}
+	int64 GetValue()const {
+		return value_;
 	}
 private:
 	int64 value_;
@@ -131,20 +305,31 @@ private:
 
 class Stmt {
 public:
-	Stmt(LocationRef loc) : loc_(loc) { }
+	Stmt(StmtKind kind, LocationRef loc) : stmt_kind_(kind), loc_(loc) { }
 	virtual string DebugString(int64 indent)const = 0;
 	LocationRef GetLoc()const {
 		return loc_;
 	}
+	StmtKind GetStmtKind()const {
+		return stmt_kind_;
+	}
+	static bool classof(const Stmt* stmt) {
+		return true;
+	}
 private:
+	StmtKind stmt_kind_;
 	LocationRef loc_;
 };
 
 class Decl : public Stmt {
 public:
-  Decl(string name, LocationRef loc) : Stmt(loc), name_(name) {
+  Decl(StmtKind kind, string name, LocationRef loc) : Stmt(kind, loc), name_(name) {
  	IsValidID(name, loc) throws();
   }
+  static bool classof(const Stmt* stmt) {
+  	return stmt->GetStmtKind() >= StmtKind_FirstDecl &&
+  		stmt->GetStmtKind() <= StmtKind_LastDecl;
+  }
   virtual ~Decl() {} ;
   string GetName()const {
   	return name_;
@@ -163,8 +348,14 @@ enum TemplateParamKind {
 class TemplateParam : public Decl, public Type {
 public:
 	TemplateParam(string name, TemplateParamKind kind, LocationRef loc)
-	 : Decl(name, loc), kind_(kind) {
+	 : Decl(StmtKind_TemplateParam, name, loc), Type(TypeKind_TemplateParam), kind_(kind) {
 
+	 }
+	 static bool classof(const Stmt* stmt) {
+	 	return stmt->GetStmtKind() == StmtKind_TemplateParam;
+	 }
+	 static bool classof(const Type* type) {
+	 	return type->GetTypeKind() == TypeKind_TemplateParam;
 	 }
 	 ~TemplateParam() override {}
 	  string DebugString(int64 indent)const override {
@@ -186,8 +377,12 @@ private:
 
 class TemplatedDecl : public Decl {
 public:
-  TemplatedDecl(string name, vector<TemplateParam*> template_params, LocationRef loc) throws()
-  	: Decl(name, loc), template_params_(template_params) {
+  TemplatedDecl(StmtKind kind, string name, vector<TemplateParam*> template_params, LocationRef loc) throws()
+  	: Decl(kind, name, loc), template_params_(template_params) {
+  }
+  static bool classof(const Stmt* stmt) {
+  	return stmt->GetStmtKind() >= StmtKind_FirstTemplatedDecl &&
+  		stmt->GetStmtKind() <= StmtKind_LastTemplatedDecl;
   }
   virtual ~TemplatedDecl() {} ;
   bool IsTemplated()const {
@@ -222,7 +417,11 @@ private:
 
 class Expr : public Stmt {
 public:
-	Expr(LocationRef loc) : Stmt(loc) { }
+	Expr(StmtKind kind, LocationRef loc) : Stmt(kind, loc) { }
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() >= StmtKind_FirstExpr &&
+			stmt->GetStmtKind() <= StmtKind_LastExpr;
+	}
 	virtual vector<Expr*> GetOperands()const = 0;
 private:
 };
@@ -243,12 +442,50 @@ struct TemplateArg {
 	}
 };
 
+// A template with particular arguments, shared by every reference to it.
+// See InstantiationTable.
+class Instantiation {
+public:
+	Instantiation(TemplatedDecl* decl, vector<TemplateArg> args, int64 hash)
+		: decl_(decl), args_(args), hash_(hash) { }
+
+	TemplatedDecl* GetDecl()const {
+		return decl_;
+	}
+	vector<TemplateArg> GetArgs()const {
+		return args_;
+	}
+	int64 GetHash()const {
+		return hash_;
+	}
+
+private:
+	friend class InstantiationTable;
+
+	TemplatedDecl* decl_;
+	vector<TemplateArg> args_;
+	int64 hash_;
+	// Next with the same hash
+	Instantiation* next_ = nullptr;
+	// Of a type template, see InstantiationTable::GetType
+	Type* type_ = nullptr;
+};
+
 class DeclRef : public Expr {
 public:
 	DeclRef(Decl* ref, vector<TemplateArg> template_args, LocationRef loc) : 
-		Expr(loc), ref_(ref), template_args_(template_args) {
+		Expr(StmtKind_DeclRef, loc), ref_(ref), template_args_(template_args) {
 
 	}
+	// ref must be instantiation's template
+	DeclRef(Decl* ref, Instantiation* instantiation, LocationRef loc) : 
+		Expr(StmtKind_DeclRef, loc), ref_(ref), template_args_(instantiation->GetArgs()),
+		instantiation_(instantiation) {
+		assert(instantiation->GetDecl() == ref);
+	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_DeclRef;
+	}
   	string DebugString(int64 indent)const override {
   		string ret = string("&") + ref_->GetName();
   		if(!template_args_.empty()) {
@@ -264,19 +501,40 @@ public:
 	Decl* GetRef()const {
 		return ref_;
 	}
+	// For a declaration replacing ref, see TranslationUnit::Reparse
+	// instantiation is of ref with the same arguments, if there are any
+	void SetRef(Decl* ref, Instantiation* instantiation=nullptr) {
+		assert(instantiation == nullptr || instantiation->GetDecl() == ref);
+		ref_ = ref;
+		instantiation_ = instantiation;
+	}
 	vector<Expr*> GetOperands()const override { return {}; }
 	vector<TemplateArg> GetTemplateArgs()const {
 		return template_args_;
 	}
+	// instantiation is of ref with args, if there is one
+	void SetTemplateArgs(vector<TemplateArg> args, Instantiation* instantiation) {
+		assert(instantiation == nullptr || instantiation->GetDecl() == ref_);
+		template_args_ = args;
+		instantiation_ = instantiation;
+	}
+	// nullptr if ref isn't a template, or the arguments weren't interned
+	Instantiation* GetInstantiation()const {
+		return instantiation_;
+	}
 private:
 	Decl* ref_;
 	vector<TemplateArg> template_args_;
+	Instantiation* instantiation_ = nullptr;
 };
 
 
 class DeclRefType : public Type {
 public:
-	DeclRefType(DeclRef* ref) : ref_(ref) {
+	DeclRefType(DeclRef* ref) : Type(TypeKind_DeclRefType), ref_(ref) {
+	}
+	static bool classof(const Type* type) {
+		return type->GetTypeKind() == TypeKind_DeclRefType;
 	}
 	string DebugString(int64 indent)const override {
 		return ref_->DebugString(indent);
@@ -291,9 +549,12 @@ private:
 class Literal : public Expr {
 public:
 	Literal(Value* value, LocationRef loc) : 
-		Expr(loc), value_(value) {
+		Expr(StmtKind_Literal, loc), value_(value) {
 
 	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_Literal;
+	}
   	string DebugString(int64 indent)const override {
   		return value_->DebugString();
   	}
@@ -309,9 +570,12 @@ private:
 class MemberExpr : public Expr {
 public:
 	MemberExpr(Expr* base, string member_name, bool pointer, LocationRef loc)
-		: Expr(loc), base_(base), member_name_(member_name), pointer_(pointer) {
+		: Expr(StmtKind_MemberExpr, loc), base_(base), member_name_(member_name), pointer_(pointer) {
 
 	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_MemberExpr;
+	}
 
 	vector<Expr*> GetOperands()const override {
 		return {base_};
@@ -327,6 +591,16 @@ public:
 	Expr* GetBase()const {
 		return base_;
 	}
+	void SetBase(Expr* base) {
+		base_ = base;
+	}
+	string GetMemberName()const {
+		return member_name_;
+	}
+	// -> rather than .
+	bool IsPointer()const {
+		return pointer_;
+	}
 
 private:
 	Expr* base_;
@@ -340,8 +614,11 @@ class UnaryOp : public Expr {
 public:
 	// op may be "" if derived
 	UnaryOp(string op, bool postfix, Expr* sub, LocationRef loc)
-		: Expr(loc), op_(op), postfix_(postfix), sub_(sub) {
-//		assert(!AsA<BinaryOp*>(sub));
+		: UnaryOp(StmtKind_UnaryOp, op, postfix, sub, loc) {
+	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_UnaryOp ||
+			stmt->GetStmtKind() == StmtKind_CastExpr;
 	}
 	string DebugString(int64 indent) const override {
 		string ret = op_;
@@ -366,6 +643,12 @@ public:
 	vector<Expr*> GetOperands()const override {
 		return {sub_};
 	}
+protected:
+	// For subclasses
+	UnaryOp(StmtKind kind, string op, bool postfix, Expr* sub, LocationRef loc)
+		: Expr(kind, loc), op_(op), postfix_(postfix), sub_(sub) {
+//		assert(!isa<BinaryOp>(sub));
+	}
 private:
 	string op_;
 	bool postfix_;
@@ -386,9 +669,12 @@ enum CastType {
 class CastExpr : public UnaryOp {
 public:
 	CastExpr(CastType cast_type, Type* to_type, Expr* sub, LocationRef loc) 
-	  : UnaryOp("", /*postfix=*/false, sub, loc), cast_type_(cast_type), to_type_(to_type) {
+	  : UnaryOp(StmtKind_CastExpr, "", /*postfix=*/false, sub, loc), cast_type_(cast_type), to_type_(to_type) {
 
 	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_CastExpr;
+	}
 	string DebugString(int64 indent) const override {
 		return string("cast<") + to_type_->DebugString(indent) + ">(" + GetSub()->DebugString(indent) + ")";
 	}
@@ -406,8 +692,11 @@ public:
 // Exists to prevent precedence adjustment
 class ParenExpr : public Expr {
 public:
-	ParenExpr(Expr* sub, LocationRef loc) : Expr(loc), sub_(sub) {
+	ParenExpr(Expr* sub, LocationRef loc) : Expr(StmtKind_ParenExpr, loc), sub_(sub) {
 
+	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_ParenExpr;
 	}
 	string DebugString(int64 indent) const override {
 		return string("(( ") + sub_->DebugString(indent) + " ))";
@@ -415,16 +704,24 @@ public:
 	vector<Expr*> GetOperands()const override {
 		return {sub_};
 	}
+	Expr* GetSub()const {
+		return sub_;
+	}
+	void SetSub(Expr* sub) {
+		sub_ = sub;
+	}
  private:
 	Expr* sub_;
 };
 
 class BinaryOp : public Expr {
 public:
-	// Throws if precedence can't be found for op
-	BinaryOp(string op, Expr* left, Expr* right, LocationRef loc) throws(Status) : 
-		Expr(loc), op_(op), left_(left), right_(right) {
-		AdjustPrecedence();
+	// Operands must already be grouped by precedence
+	BinaryOp(string op, Expr* left, Expr* right, LocationRef loc) : 
+		Expr(StmtKind_BinaryOp, loc), op_(op), left_(left), right_(right) {
+	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_BinaryOp;
 	}
 	string DebugString(int64 indent) const override {
 		return string("( ") + left_->DebugString(indent) + " " + op_ + " " + right_->DebugString(indent) + " )";
@@ -452,48 +749,21 @@ private:
 	Expr* left_;
 	Expr* right_;
 
-	// Throws if precedence can't be found for op
-	// Only called from constructor, so doesn't violate mutabiilty
-	void AdjustPrecedence() throws(Status) {
-		BinaryOp* right_bop = AsA<BinaryOp*>(right_);
-		if(right_bop == nullptr) {
-			return;
-		}
-		map<string, int64> precedences = GetAllInfixOperatorsWithPrecedence();
-		// Don't need to consider left: tree is built left to right
-		int64 my_prec = precedences.at(op_);
-		int64 right_prec = precedences.at(right_bop->op_);
-
-		if(my_prec < right_prec) {
-			// -- original --
-			// x*(y+z)
-			// ----------
-
-			// -- goal --
-			// (x*y)+z
-			// ----------
-
-
-			Expr* x = left_;
-			Expr* y = right_bop->left_;
-			Expr* z = right_bop->right_;
-			BinaryOp* sub = right_bop;
-
-			std::swap(op_, right_bop->op_);
-			// x+(y*z)
-			std::swap(left_, right_);
-			// (y*z)+x
-			sub->left_ = x;
-			sub->right_ = y;
-			right_ = z;
-		}
-	}
 };
 
+bool IsAssignmentOp(string op) {
+	return op == "=" || op == "+=" || op == "-=" || op == "*=" || op == "/=" ||
+		op == "%=" || op == "&=" || op == "^=" || op == "|=" || op == ">>=" ||
+		op == "<<=";
+}
+
 class ReturnStmt : public Stmt {
 public:
 	ReturnStmt(Expr* value, LocationRef loc) 
-		: Stmt(loc), value_(value) {
+		: Stmt(StmtKind_ReturnStmt, loc), value_(value) {
+	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_ReturnStmt;
 	}
 	string DebugString(int64 indent)const {
 		return string("Return(") + value_->DebugString(indent) + ")";
@@ -502,6 +772,9 @@ public:
 	Expr* GetValue()const {
 		return value_;
 	}
+	void SetValue(Expr* value) {
+		value_ = value;
+	}
 private:
 	Expr* value_;
 };
@@ -518,19 +791,21 @@ public:
 	VarDecl(string name, LocationRef loc, Type* type, 
 			VarDeclInitType init_type,
 			vector<Expr*> init_params) 
-	  : Decl(name, loc), type_(type), 
+	  : Decl(StmtKind_VarDecl, name, loc), type_(type), 
 	  	init_type_(init_type), init_params_(init_params) {
 	 	assert(!(init_type_ == VarDeclInitType_Equals && 
 	 			 init_params.len() != 1));
 	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_VarDecl;
+	}
 	~VarDecl() override {}
     string DebugString(int64 indent)const override {
       // TODO: Temp
-	  std::ostringstream stream;
-	  stream << this;
-      string ptr = stream.str().c_str();
+	  char ptr[32];
+	  snprintf(ptr, sizeof(ptr), "%p", (const void*)this);
 
-      string ret = string("VarDecl ") + ptr + " (" 
+      string ret = string("VarDecl ") + string(ptr).c_str() + " (" 
   	  	+ GetName() + " : " + type_->DebugString(indent) + ")";
 
   	  if(init_type_ == VarDeclInitType_Equals) {
@@ -555,12 +830,19 @@ public:
     vector<Expr*> GetInitParams()const {
     	return init_params_;
     }
+    void SetInitParam(int64 index, Expr* param) {
+    	init_params_.set(index, param);
+    }
 private:
 	Type* type_ = nullptr;
 	VarDeclInitType init_type_ = VarDeclInitType_None;
 	vector<Expr*> init_params_;
 };
 
+struct LazyBody;
+// Parses a body set aside by BodyParsing_Lazy
+void MaterializeBody(LazyBody* lazy) throws(Status);
+
 class FuncDecl : public TemplatedDecl {
 public:
 	FuncDecl(string name,
@@ -570,12 +852,15 @@ public:
 			 bool is_prototype,
 			 vector<Stmt*> body,
 			 LocationRef loc) 
-	  : TemplatedDecl(name, template_params, loc),
+	  : TemplatedDecl(StmtKind_FuncDecl, name, template_params, loc),
 	  	return_type_(return_type),
 	  	parameters_(parameters),
 	  	is_prototype_(is_prototype),
 	  	body_(body) {
 	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_FuncDecl;
+	}
 	~FuncDecl() override {}
 	string DebugString(int64 indent)const override {
 		string params;
@@ -586,7 +871,7 @@ public:
 	  	string ret = string("FuncDecl ") + GetName() + TemplateParamsString();
 	  	ret += string("(") + params + ") -> " + return_type_->DebugString(indent);
 	  	ret = ret + "{\n";
-	  	for(Stmt* stmt : body_) {
+	  	for(Stmt* stmt : GetBody()) {
 	  		ret = ret + FormatIndent(indent) + stmt->DebugString(indent+1) + "\n";
 	  	}
 	  	ret = ret + "}\n";
@@ -598,17 +883,34 @@ public:
 	Type* GetReturnType()const {
 		return return_type_;
 	}
-	vector<Stmt*> GetBody() const{
+	bool IsPrototype()const {
+		return is_prototype_;
+	}
+	// Parses the body first if it was set aside
+	// Not safe to call from several threads while a body is unparsed
+	vector<Stmt*> GetBody() const throws(Status) {
+		if(lazy_body_) {
+			MaterializeBody(lazy_body_) throws();
+		}
 		return body_;
 	}
 	void SetBody(vector<Stmt*> body) {
 		body_ = body;
+		lazy_body_ = nullptr;
+	}
+	void SetLazyBody(LazyBody* lazy_body) {
+		lazy_body_ = lazy_body;
+	}
+	// False until GetBody parses a body which was set aside
+	bool IsBodyParsed()const {
+		return lazy_body_ == nullptr;
 	}
 private:
 	Type* return_type_;
 	vector<VarDecl*> parameters_;
 	bool is_prototype_;
 	vector<Stmt*> body_;
+	LazyBody* lazy_body_ = nullptr;
 };
 
 class StructDecl : public TemplatedDecl, public Type {
@@ -618,13 +920,23 @@ public:
 			   vector<TemplateParam*> template_params,
 			   vector<Decl*> inner_decls,
 			   LocationRef ref)
-	  : TemplatedDecl(name, template_params, ref),
+	  : TemplatedDecl(StmtKind_StructDecl, name, template_params, ref),
+	    Type(TypeKind_StructDecl),
 	    inner_decls_(inner_decls),
 	    declared_class_(declared_class) {
 	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_StructDecl;
+	}
+	static bool classof(const Type* type) {
+		return type->GetTypeKind() == TypeKind_StructDecl;
+	}
 	vector<Decl*> GetInnerDecls()const {
 		return inner_decls_;
 	}
+	bool IsDeclaredClass()const {
+		return declared_class_;
+	}
 	string DebugString(int64 indent)const override {
 		string ret = declared_class_ ? "class " : "struct ";
 		ret += GetName() + " ";
@@ -645,7 +957,13 @@ private:
 class TypedefDecl : public Decl, public Type {
 public:
 	TypedefDecl(string name, Type* base, LocationRef loc) 
-		: Decl(name, loc), base_(base) {
+		: Decl(StmtKind_TypedefDecl, name, loc), Type(TypeKind_TypedefDecl), base_(base) {
+	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_TypedefDecl;
+	}
+	static bool classof(const Type* type) {
+		return type->GetTypeKind() == TypeKind_TypedefDecl;
 	}
 	~TypedefDecl() {
 	}
@@ -667,10 +985,18 @@ public:
 			  Type* base,
 			  LocationRef loc,
 			  vector<TemplateParam*> template_params = {}) 
-		: TemplatedDecl(name, template_params, loc), base_(base) {
+		: UsingDecl(StmtKind_UsingDecl, TypeKind_UsingDecl, name, base, loc, template_params) {
 	}
 	~UsingDecl() {
 	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_UsingDecl ||
+			stmt->GetStmtKind() == StmtKind_UsingAliasDecl;
+	}
+	static bool classof(const Type* type) {
+		return type->GetTypeKind() == TypeKind_UsingDecl ||
+			type->GetTypeKind() == TypeKind_UsingAliasDecl;
+	}
 
 	Type* GetBase()const {
 		return base_;
@@ -679,6 +1005,16 @@ public:
 	string DebugString(int64 indent)const override {
 		return string("using(") + GetName() + "): " + base_->DebugString(indent);
 	}
+protected:
+	// For subclasses
+	UsingDecl(StmtKind stmt_kind,
+			  TypeKind type_kind,
+			  string name,
+			  Type* base,
+			  LocationRef loc,
+			  vector<TemplateParam*> template_params)
+		: TemplatedDecl(stmt_kind, name, template_params, loc), Type(type_kind), base_(base) {
+	}
 private:
 	Type* base_ = nullptr;
 };
@@ -689,10 +1025,17 @@ public:
 				   Type* base, 
 				   vector<TemplateParam*> template_params, 
 				   LocationRef loc) 
-		: UsingDecl(name, base, loc, template_params) {
+		: UsingDecl(StmtKind_UsingAliasDecl, TypeKind_UsingAliasDecl,
+					name, base, loc, template_params) {
 	}
 	~UsingAliasDecl() {
 	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_UsingAliasDecl;
+	}
+	static bool classof(const Type* type) {
+		return type->GetTypeKind() == TypeKind_UsingAliasDecl;
+	}
 
 	string DebugString(int64 indent)const override {
 		return TemplateParamsString() + 
@@ -719,31 +1062,66 @@ public:
   	string GetName() {
   		return name_;
   	}
-  	void AddNested(Namespace* nested) {
-  		// TODO: Throw on duplicate
+  	// Reopened namespaces are merged by the caller, see FindNested
+  	void AddNested(Namespace* nested) throws(Status) {
+  		if(nested_by_name_.contains(nested->GetName())) {
+  			throw Status{.message = string("Duplicate namespace ") + nested->GetName(),
+  						 .loc = nested->loc_};
+  		}
   		nested_.push_back(nested);
+  		nested_by_name_.set(nested->GetName(), nested);
   	}
+  	// A later declaration of the same name, like a definition after its
+  	// prototype, is the one found by name
   	void AddDecl(Decl* decl) {
-  		// TODO: Throw on duplicate
   		decls_.push_back(decl);
+  		decls_by_name_.set(decl->GetName(), decl);
+  	}
+  	// nullptr if absent
+  	Namespace* FindNested(string name)const {
+  		Namespace* const* found = nested_by_name_.find(name);
+  		return found ? *found : nullptr;
+  	}
+  	// nullptr if absent
+  	Decl* FindDecl(string name)const {
+  		Decl* const* found = decls_by_name_.find(name);
+  		return found ? *found : nullptr;
   	}
   	string GetName()const {
   		return name_;
   	}
+  	LocationRef GetLoc()const {
+  		return loc_;
+  	}
   	vector<Decl*> GetDecls() const {
   		return decls_;
   	}
+  	vector<Namespace*> GetNested() const {
+  		return nested_;
+  	}
+  	// Forgets every declaration and nested namespace
+  	void Clear() {
+  		nested_ = vector<Namespace*>();
+  		decls_ = vector<Decl*>();
+  		nested_by_name_.clear();
+  		decls_by_name_.clear();
+  	}
 private:
  	string name_;
  	LocationRef loc_;
  	vector<Namespace*> nested_;
  	vector<Decl*> decls_;
+ 	hash_map<string, Namespace*> nested_by_name_;
+ 	hash_map<string, Decl*> decls_by_name_;
 };
 
 class FuncCall : public Expr {
 public:
 	FuncCall(DeclRef* callee, vector<Expr*> args, LocationRef loc) 
-		: Expr(loc), callee_(callee), args_(args) {
+		: Expr(StmtKind_FuncCall, loc), callee_(callee), args_(args) {
+	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_FuncCall;
 	}
 	string DebugString(int64 indent) const override {
 		string ret = string("call(") + callee_->DebugString(indent) + ": ";
@@ -764,6 +1142,9 @@ public:
 	vector<Expr*> GetArgs()const {
 		return args_;
 	}
+	void SetArg(int64 index, Expr* arg) {
+		args_.set(index, arg);
+	}
 	DeclRef* GetCallee() const {
 		return callee_;
 	}
@@ -775,7 +1156,10 @@ public:
 class CtorCall : public Expr {
 public:
 	CtorCall(Type* type, vector<Expr*> args, LocationRef loc) 
-		: Expr(loc), type_(type), args_(args) {
+		: Expr(StmtKind_CtorCall, loc), type_(type), args_(args) {
+	}
+	static bool classof(const Stmt* stmt) {
+		return stmt->GetStmtKind() == StmtKind_CtorCall;
 	}
 	string DebugString(int64 indent) const override {
 		string ret = string("ctor(") + type_->DebugString(indent) + ": ";
@@ -796,6 +1180,9 @@ public:
 	vector<Expr*> GetArgs()const {
 		return args_;
 	}
+	void SetArg(int64 index, Expr* arg) {
+		args_.set(index, arg);
+	}
 	Type* GetType() const {
 		return type_;
 	}
@@ -804,220 +1191,874 @@ public:
 	vector<Expr*> args_;
 };
 
-struct Token {
-	string content;
-	LocationRef loc;
-};
+Type* StmtAsType(Stmt* stmt) {
+	switch(stmt->GetStmtKind()) {
+		case StmtKind_TemplateParam:
+			return static_cast<TemplateParam*>(stmt);
+		case StmtKind_TypedefDecl:
+			return static_cast<TypedefDecl*>(stmt);
+		case StmtKind_StructDecl:
+			return static_cast<StructDecl*>(stmt);
+		case StmtKind_UsingDecl:
+		case StmtKind_UsingAliasDecl:
+			return static_cast<UsingDecl*>(stmt);
+		default:
+			return nullptr;
+	}
+}
+
+Stmt* TypeAsStmt(Type* type) {
+	switch(type->GetTypeKind()) {
+		case TypeKind_TemplateParam:
+			return static_cast<TemplateParam*>(type);
+		case TypeKind_TypedefDecl:
+			return static_cast<TypedefDecl*>(type);
+		case TypeKind_StructDecl:
+			return static_cast<StructDecl*>(type);
+		case TypeKind_UsingDecl:
+		case TypeKind_UsingAliasDecl:
+			return static_cast<UsingDecl*>(type);
+		default:
+			return nullptr;
+	}
+}
 
+// Without typedefs and aliases, so types are the same exactly when their
+// canonical types are the same pointer. Builtin types are singletons and
+// each instantiation of a type template has one type, from
+// InstantiationTable.
+// Alias templates are kept, as their bases depend on their arguments.
+Type* CanonicalType(Type* type) {
+	while(type) {
+		if(auto* typedef_decl = dyn_cast<TypedefDecl>(type)) {
+			type = typedef_decl->GetBase();
+		} else if(auto* using_decl = dyn_cast<UsingDecl>(type)) {
+			if(using_decl->IsTemplated()) {
+				return type;
+			}
+			type = using_decl->GetBase();
+		} else {
+			return type;
+		}
+	}
+	return type;
+}
 
-struct ContextFrame {
-	Namespace* in_namespace = nullptr;
-	Namespace* top_namespace = nullptr;
-	map<string, Decl*> decls;
-};
+bool SameType(Type* a, Type* b) {
+	return CanonicalType(a) == CanonicalType(b);
+}
 
-struct Context {
-	// Front is the top of the stack
-	vector<ContextFrame> frames;
+namespace internal {
 
-	void PushFrame() {
-		ContextFrame new_frame = frames.front();
-		frames.push_front(new_frame);
+int64 HashTemplateExpr(Expr* expr);
+bool SameTemplateExpr(Expr* a, Expr* b);
+
+// Declarations by identity, other types by structure
+int64 HashTemplateType(Type* type) {
+	if(type == nullptr) {
+		return 0;
 	}
-	void PopFrame() {
-		frames.pop_front();
+	if(Stmt* decl = TypeAsStmt(type)) {
+		return Hash(decl);
 	}
-	void AddDecl(Decl* decl) throws(Status) {
-		ContextFrame top = frames.front();
-		if(top.decls.contains(decl->GetName())) {
-			throw Status{.message = string("Duplicate declaration ") + decl->GetName()};
-		}
-		top.decls.set(decl->GetName(), decl);
-		frames.set(0, top);
+	if(auto* ref_type = dyn_cast<DeclRefType>(type)) {
+		return HashTemplateExpr(ref_type->GetDeclRef());
 	}
+	return Hash(int64(type->GetTypeKind()));
+}
 
-  	void RemoveDecl(Decl* decl) {
-		ContextFrame top = frames.front();
-		if(!top.decls.contains(decl->GetName())) {
-			throw Status{.message = string("Declaration does not exist to remove ") + decl->GetName()};
-		}
-		top.decls.remove(decl->GetName());
-		frames.set(0, top);
-  	}
-};
+bool SameTemplateType(Type* a, Type* b) {
+	if(a == b) {
+		return true;
+	}
+	if(a == nullptr || b == nullptr || a->GetTypeKind() != b->GetTypeKind() ||
+	   TypeAsStmt(a) != nullptr) {
+		return false;
+	}
+	if(auto* ref_type = dyn_cast<DeclRefType>(a)) {
+		return SameTemplateExpr(ref_type->GetDeclRef(), cast<DeclRefType>(b)->GetDeclRef());
+	}
+	return true;
+}
 
+int64 HashTemplateArgs(vector<TemplateArg> args) {
+	int64 ret = args.len();
+	for(TemplateArg arg : args) {
+		ret = HashCombine(ret, HashTemplateType(arg.type));
+		ret = HashCombine(ret, HashTemplateExpr(arg.int_value));
+	}
+	return ret;
+}
 
-bool PeekAndConsumeUtil(vector<Token>& tokens,
-					vector<string> look_for) {
-	if(tokens.len() < look_for.len()) {
+bool SameTemplateArgs(vector<TemplateArg> a, vector<TemplateArg> b) {
+	if(a.len() != b.len()) {
 		return false;
 	}
-	for(int64 i=0;i<look_for.len();++i) {
-		if(tokens[i].content != look_for[i]) {
+	for(int64 i=0;i<a.len();++i) {
+		if(!SameTemplateType(a[i].type, b[i].type) ||
+		   !SameTemplateExpr(a[i].int_value, b[i].int_value)) {
 			return false;
 		}
 	}
-	tokens.pop_front(look_for.len());
 	return true;
 }
 
-bool PeekForAnyUtil(vector<Token>& tokens, set<string> look_for) {
-	if(tokens.len() < 1) {
-		throw Status{.message="No tokens to consume"};
-	}
-	string next = tokens[0].content;
-	bool found = false;
-	for(string s : look_for) {
-		if(s == next) {
-			found = true;
+// Expressions are compared as written, so 2 and 1+1 differ
+int64 HashTemplateExpr(Expr* expr) {
+	if(expr == nullptr) {
+		return 0;
+	}
+	int64 ret = Hash(int64(expr->GetStmtKind()));
+	switch(expr->GetStmtKind()) {
+		case StmtKind_DeclRef: {
+			auto* ref = cast<DeclRef>(expr);
+			ret = HashCombine(ret, Hash(ref->GetRef()));
+			// Nested arguments are interned first
+			ret = HashCombine(ret, ref->GetInstantiation() ?
+				Hash(ref->GetInstantiation()) : HashTemplateArgs(ref->GetTemplateArgs()));
 			break;
 		}
+		case StmtKind_Literal: {
+			Value* value = cast<Literal>(expr)->GetValue();
+			ret = HashCombine(ret, value->GetValueKind());
+			if(auto* integer = dyn_cast<IntegerValue>(value)) {
+				ret = HashCombine(ret, integer->GetValue());
+			}
+			break;
+		}
+		case StmtKind_MemberExpr:
+			ret = HashCombine(ret, Hash(cast<MemberExpr>(expr)->GetMemberName()));
+			ret = HashCombine(ret, cast<MemberExpr>(expr)->IsPointer());
+			break;
+		case StmtKind_UnaryOp:
+			ret = HashCombine(ret, Hash(cast<UnaryOp>(expr)->GetOp()));
+			ret = HashCombine(ret, cast<UnaryOp>(expr)->IsPostfix());
+			break;
+		case StmtKind_CastExpr:
+			ret = HashCombine(ret, cast<CastExpr>(expr)->GetCastType());
+			ret = HashCombine(ret, HashTemplateType(cast<CastExpr>(expr)->GetToType()));
+			break;
+		case StmtKind_BinaryOp:
+			ret = HashCombine(ret, Hash(cast<BinaryOp>(expr)->GetOp()));
+			break;
+		case StmtKind_FuncCall:
+			ret = HashCombine(ret, HashTemplateExpr(cast<FuncCall>(expr)->GetCallee()));
+			break;
+		case StmtKind_CtorCall:
+			ret = HashCombine(ret, HashTemplateType(cast<CtorCall>(expr)->GetType()));
+			break;
+		default:
+			break;
 	}
-	return found;
+	for(Expr* operand : expr->GetOperands()) {
+		ret = HashCombine(ret, HashTemplateExpr(operand));
+	}
+	return ret;
 }
 
-// Throws if none fouond
-Token ConsumeOneOfOrError(vector<Token>& tokens,
-					set<string> look_for) throws() {
-
-	if(!PeekForAnyUtil(tokens, look_for)) {
-		string message = "Expected one of: ";
-		for(string s : look_for) {
-			message += s + " ";
+bool SameTemplateExpr(Expr* a, Expr* b) {
+	if(a == b) {
+		return true;
+	}
+	if(a == nullptr || b == nullptr || a->GetStmtKind() != b->GetStmtKind()) {
+		return false;
+	}
+	switch(a->GetStmtKind()) {
+		case StmtKind_DeclRef: {
+			auto* ref_a = cast<DeclRef>(a);
+			auto* ref_b = cast<DeclRef>(b);
+			if(ref_a->GetRef() != ref_b->GetRef()) {
+				return false;
+			}
+			if(ref_a->GetInstantiation() || ref_b->GetInstantiation()) {
+				return ref_a->GetInstantiation() == ref_b->GetInstantiation();
+			}
+			return SameTemplateArgs(ref_a->GetTemplateArgs(), ref_b->GetTemplateArgs());
 		}
-		throw Status{.message = message};
+		case StmtKind_Literal: {
+			Value* value_a = cast<Literal>(a)->GetValue();
+			Value* value_b = cast<Literal>(b)->GetValue();
+			if(value_a->GetValueKind() != value_b->GetValueKind()) {
+				return false;
+			}
+			auto* integer_a = dyn_cast<IntegerValue>(value_a);
+			return !integer_a || integer_a->GetValue() == cast<IntegerValue>(value_b)->GetValue();
+		}
+		case StmtKind_MemberExpr:
+			if(cast<MemberExpr>(a)->GetMemberName() != cast<MemberExpr>(b)->GetMemberName() ||
+			   cast<MemberExpr>(a)->IsPointer() != cast<MemberExpr>(b)->IsPointer()) {
+				return false;
+			}
+			break;
+		case StmtKind_UnaryOp:
+			if(cast<UnaryOp>(a)->GetOp() != cast<UnaryOp>(b)->GetOp() ||
+			   cast<UnaryOp>(a)->IsPostfix() != cast<UnaryOp>(b)->IsPostfix()) {
+				return false;
+			}
+			break;
+		case StmtKind_CastExpr:
+			if(cast<CastExpr>(a)->GetCastType() != cast<CastExpr>(b)->GetCastType() ||
+			   !SameTemplateType(cast<CastExpr>(a)->GetToType(), cast<CastExpr>(b)->GetToType())) {
+				return false;
+			}
+			break;
+		case StmtKind_BinaryOp:
+			if(cast<BinaryOp>(a)->GetOp() != cast<BinaryOp>(b)->GetOp()) {
+				return false;
+			}
+			break;
+		case StmtKind_FuncCall:
+			if(!SameTemplateExpr(cast<FuncCall>(a)->GetCallee(), cast<FuncCall>(b)->GetCallee())) {
+				return false;
+			}
+			break;
+		case StmtKind_CtorCall:
+			if(!SameTemplateType(cast<CtorCall>(a)->GetType(), cast<CtorCall>(b)->GetType())) {
+				return false;
+			}
+			break;
+		default:
+			break;
 	}
-
-	Token next = tokens.pop_front(1);
-	return next;
-}
-
-void ConsumeOrError(vector<Token>& tokens,
-					vector<string> look_for) throws(Status) {
-	if(!PeekAndConsumeUtil(tokens, look_for)) {
-		string message = string("Got token ") + tokens[0].content + " Expected token(s): ";
-		for(string s : look_for) {
-			message = message + s;
+	vector<Expr*> operands_a = a->GetOperands();
+	vector<Expr*> operands_b = b->GetOperands();
+	if(operands_a.len() != operands_b.len()) {
+		return false;
+	}
+	for(int64 i=0;i<operands_a.len();++i) {
+		if(!SameTemplateExpr(operands_a[i], operands_b[i])) {
+			return false;
 		}
-		throw Status{.message = message};
 	}
+	return true;
 }
 
-Expr* ParseExpr(Context& context,
-				vector<Token>& tokens,
-				set<string> disallow_infixes);
-DeclRef* ParseDeclRef(Context& context,
-				vector<Token>& tokens) throws(Status);
+}  // internal
 
-vector<Expr*> ParseCommaSeparatedArguments(Context& context,
-											vector<Token>& tokens,
-											string terminator);
+// One Instantiation per template and structurally equal arguments, so
+// work on a specialization happens once however often it's named.
+// Safe to use from several threads.
+class InstantiationTable {
+public:
+	InstantiationTable() {}
+	InstantiationTable(const InstantiationTable& other) = delete;
+
+	// args are kept if the instantiation is new, which is allocated in
+	// arena
+	Instantiation* Intern(TemplatedDecl* decl, vector<TemplateArg> args, Arena* arena) {
+		const int64 hash = HashCombine(Hash(decl), internal::HashTemplateArgs(args));
+		std::lock_guard<std::mutex> lock(mutex_);
+		Instantiation** head = by_hash_.find(hash);
+		for(Instantiation* found = head ? *head : nullptr;found;found = found->next_) {
+			if(found->decl_ == decl && internal::SameTemplateArgs(found->args_, args)) {
+				++hits_;
+				return found;
+			}
+		}
+		auto* instantiation = arena->New<Instantiation>(decl, args, hash);
+		instantiation->next_ = head ? *head : nullptr;
+		by_hash_.set(hash, instantiation);
+		++size_;
+		return instantiation;
+	}
+
+	// The one type for the instantiation of a type template ref refers
+	// to, which is made from ref the first time
+	Type* GetType(DeclRef* ref, Arena* arena) {
+		Instantiation* instantiation = ref->GetInstantiation();
+		assert(instantiation && StmtAsType(instantiation->GetDecl()));
+		std::lock_guard<std::mutex> lock(mutex_);
+		if(instantiation->type_ == nullptr) {
+			instantiation->type_ = arena->New<DeclRefType>(ref);
+		}
+		return instantiation->type_;
+	}
 
-// Throws on failure
-Identifier ParseIdentifier(vector<Token>& tokens) throws(Status) {
-	Identifier ret;
-	if(PeekAndConsumeUtil(tokens, {"::"})) {
-		ret.global = true;
+	// Distinct instantiations
+	int64 size()const {
+		return size_;
+	}
+	// Interns which found an existing instantiation
+	int64 Hits()const {
+		return hits_;
 	}
-	do {
-		Token next_token = tokens.pop_front();
-		IsValidID(next_token.content, next_token.loc) throws();
-		ret.parts.push_back(next_token.content);
-		ret.loc = next_token.loc;
-	}while(PeekAndConsumeUtil(tokens, {"::"}));
-	return ret;
-}
 
-Identifier ConsumeIdentifierFromSingleToken(vector<Token>& tokens) throws(Status) {
-	Token name_tok = tokens.pop_front();
-	IsValidID(name_tok.content, name_tok.loc) throws();
-	return {.global = false, .parts = {name_tok.content}, .loc = name_tok.loc};
-}
+private:
+	std::mutex mutex_;
+	hash_map<int64, Instantiation*> by_hash_;
+	int64 size_ = 0;
+	int64 hits_ = 0;
+};
 
-Decl* GetDeclByIdentifier(Namespace* in_namespace, Identifier id) throws(Status) {
-	
+struct ContextFrame {
+	Namespace* in_namespace = nullptr;
+	Namespace* top_namespace = nullptr;
+	// Identifies in_namespace by the names leading to it, 0 at the top
+	int64 scope = 0;
+};
+
+int64 NestedScope(int64 scope, string name) {
+	return HashCombine(scope, Hash(name));
 }
 
-Decl* GetDeclByIdentifier(Context& context, Identifier id) throws(Status) {
-	if(id.global) {
-		throw Status{.message = "TODO: Get global identifiers"};
+// Declarations in scope by name. Each name maps to its innermost
+// declaration, which records the one it shadows. Declarations are logged
+// in order, so leaving a scope only undoes the ones made in it.
+class SymbolTable {
+public:
+	SymbolTable() {}
+	SymbolTable(const SymbolTable& other) = delete;
+	SymbolTable(SymbolTable&& other) = default;
+	SymbolTable& operator=(SymbolTable&& other) = default;
+
+	void PushScope() {
+		scope_begins_.push_back(log_.len());
+	}
+
+	void PopScope() {
+		assert(!scope_begins_.empty());
+		const int64 begin = scope_begins_.pop_back();
+		while(log_.len() > begin) {
+			const Binding binding = log_.pop_back();
+			if(!binding.removed) {
+				Unbind(binding);
+			}
+		}
 	}
-	assert(id.parts.len() > 0);
-	if(id.parts.len() > 1) {
-		throw Status{.message = "TODO: Get qualified identifiers"};
+
+	// 0 before any scope is pushed
+	int64 Depth()const {
+		return scope_begins_.len();
 	}
 
-	const string name = id.parts[0];
+	// nullptr if name isn't declared in any scope
+	Decl* Find(string name)const {
+		const int64* head = heads_.find(name);
+		return head ? log_[*head].decl : nullptr;
+	}
 
-	// Search from the top
-	for(ContextFrame frame : context.frames) {
-		if(frame.decls.contains(name)) {
-			return frame.decls.at(name);
-		}
+	// Whether name is declared in the innermost scope
+	bool InScope(string name)const {
+		const int64* head = heads_.find(name);
+		return head && *head >= ScopeBegin();
 	}
 
-	// TODO: namespaces above
-fprintf(stderr, "Couldn't find identifier %s\n", id.DebugString().c_str());
-	throw Status{.message = string("Couldn't find identifier ") + id.DebugString()};
-}
+	// Shadows declarations of name in outer scopes
+	void Add(string name, Decl* decl) {
+		assert(!InScope(name));
+		const int64* head = heads_.find(name);
+		log_.push_back(Binding{.name = name,
+							   .decl = decl,
+							   .shadowed = head ? *head : kNone,
+							   .removed = false});
+		heads_.set(name, log_.len() - 1);
+	}
 
-// Returns nullptr on failure when throw_on_fail = false
-// Only consumes tokens on success
-Type* ParseType(Context& context, vector<Token>& tokens, bool throw_on_fail=true) throws(Status) {
-	try {
-		const vector<Token> prev_tokens = tokens;
-		auto prev_tokens_guard = MakeLambdaGuard(
-			[&tokens, prev_tokens]() {
-				tokens = prev_tokens;
-			}
-		);
+	// Only declarations in the innermost scope can be removed
+	// Returns false if there's no such declaration
+	bool Remove(string name) {
+		if(!InScope(name)) {
+			return false;
+		}
+		const int64 index = *heads_.find(name);
+		Unbind(log_[index]);
+		log_[index].removed = true;
+		return true;
+	}
 
-		Token next_token = tokens[0];
-		if(next_token.content == "void") {
-			tokens.pop_front();
-			prev_tokens_guard.deactivate();
-			return new VoidType;
-		} else if(next_token.content == "int") {
-			tokens.pop_front();
-			prev_tokens_guard.deactivate();
-			return new IntType;
+private:
+	static const int64 kNone = ~int64(0);
+
+	struct Binding {
+		string name;
+		Decl* decl;
+		// Index in log_ of the binding this shadows, or kNone
+		int64 shadowed;
+		bool removed;
+	};
+
+	int64 ScopeBegin()const {
+		return scope_begins_.empty() ? 0 : scope_begins_.back();
+	}
+
+	void Unbind(const Binding& binding) {
+		if(binding.shadowed == kNone) {
+			heads_.remove(binding.name);
+		} else {
+			heads_.set(binding.name, binding.shadowed);
 		}
-		DeclRef* decl = nullptr;
-		try {
-//			Identifier id = ParseIdentifier(tokens) throws();
-//			decl = GetDeclByIdentifier(context, id) throws();
-			decl = ParseDeclRef(context, tokens) throws ();
-fprintf(stderr, "In ParseType: decl %s\n", decl ? decl->DebugString(0).c_str() : "(null)");
-		} catch(Status status) {
-			throw status;
+	}
+
+	// Undo log, every live binding and the ones they shadow
+	buffer<Binding> log_;
+	// Start of each scope in log_
+	buffer<int64> scope_begins_;
+	// Name to index in log_ of its innermost binding
+	hash_map<string, int64> heads_;
+};
+
+// Declarations which aren't in the token stream, such as those in skipped
+// system headers, parsed when first referenced
+class ExternalDeclSource {
+public:
+	// nullptr if there's no such declaration
+	virtual Decl* FindDecl(string name) throws(Status) = 0;
+};
+
+// Function body set aside while its declaration is parsed
+struct DeferredBody {
+	FuncDecl* func = nullptr;
+	// Between the braces, allocated with the AST
+	Token* tokens = nullptr;
+	int64 len = 0;
+	// Namespaces the function is declared in, outermost first
+	vector<ContextFrame> frames;
+	// May be nullptr, see Context::instantiations
+	InstantiationTable* instantiations = nullptr;
+};
+
+enum BodyParsing {
+	// As each function is declared
+	BodyParsing_Inline,
+	// Once every top level declaration is known, on several threads.
+	// Bodies see every declaration at namespace scope, including those
+	// after them.
+	BodyParsing_Parallel,
+	// When FuncDecl::GetBody is first called, with the same scope as
+	// BodyParsing_Parallel. Only in a TranslationUnit, as bodies refer
+	// to the namespaces they're in.
+	BodyParsing_Lazy,
+};
+
+// What a BodyParsing_Lazy body needs to be parsed later
+struct LazyBody {
+	DeferredBody body;
+	Arena* arena;
+	ExternalDeclSource* external;
+};
+
+struct ParseOptions {
+	BodyParsing bodies = BodyParsing_Inline;
+	// 0 for one per core
+	int64 threads = 0;
+};
+
+// A declaration in a namespace as it was parsed, see
+// TranslationUnit::Reparse
+struct ParsedItem {
+	// See ContextFrame::scope
+	int64 scope = 0;
+	// Token positions
+	int64 begin = 0;
+	int64 end = 0;
+	// Of every token, and of those before a function body. A declaration
+	// with the same signature can stand in for another in references.
+	int64 fingerprint = 0;
+	int64 signature = 0;
+	Decl* decl = nullptr;
+};
+
+int64 HashToken(const Token& token) {
+	return HashCombine(Hash(token.content), token.kind);
+}
+
+// at(position) returns a token of the item
+template<typename F>
+void HashItemTokens(F at, ParsedItem* item) {
+	const bool has_body = item->end > item->begin &&
+		at(item->end - 1).kind == TokenKind_RBrace;
+	int64 fingerprint = item->scope;
+	int64 signature = item->scope;
+	bool in_signature = true;
+	for(int64 p=item->begin;p<item->end;++p) {
+		const Token& token = at(p);
+		if(has_body && token.kind == TokenKind_LBrace) {
+			in_signature = false;
+		}
+		fingerprint = HashCombine(fingerprint, HashToken(token));
+		if(in_signature) {
+			signature = HashCombine(signature, HashToken(token));
+		}
+	}
+	item->fingerprint = HashCombine(fingerprint, item->end - item->begin);
+	item->signature = has_body ? signature : item->fingerprint;
+}
+
+// Declarations as they're parsed, and those kept from a previous parse
+struct ParsedItems {
+	// In source order
+	buffer<ParsedItem> items;
+	// By token position, declarations used instead of parsing the item
+	// there
+	hash_map<int64, ParsedItem> reuse;
+	// Namespaces of a previous parse by scope, emptied to be filled again
+	hash_map<int64, Namespace*> namespaces;
+};
+
+enum ParseRule {
+	ParseRule_Type,
+	ParseRule_DeclRef,
+	ParseRule_Count,
+};
+
+// Outcomes of speculative parses by rule and token position, so
+// backtracking doesn't parse the same tokens with the same rule again.
+// Outcomes depend on the declarations in scope, so each is stamped with
+// Context::generation and ignored once that changes.
+class ParseMemo {
+public:
+	struct Entry {
+		int64 generation = 0;
+		bool ok = false;
+		// Node returned on success, may be nullptr
+		void* result = nullptr;
+		// Token position after success
+		int64 end = 0;
+		// Thrown on failure
+		Status error;
+	};
+
+	// nullptr if there's no current entry
+	const Entry* Find(ParseRule rule, int64 position, int64 generation)const {
+		const Entry* entry = entries_.find(Key(rule, position));
+		if(entry == nullptr || entry->generation != generation) {
+			return nullptr;
+		}
+		return entry;
+	}
+
+	void Set(ParseRule rule, int64 position, Entry entry) {
+		entries_.set(Key(rule, position), entry);
+	}
+
+	// For when positions seen so far won't be parsed again
+	void Clear() {
+		entries_.clear();
+	}
+
+	int64 Hits()const {
+		return hits_;
+	}
+	void CountHit() {
+		++hits_;
+	}
+
+private:
+	static int64 Key(ParseRule rule, int64 position) {
+		return position * ParseRule_Count + rule;
+	}
+
+	hash_map<int64, Entry> entries_;
+	int64 hits_ = 0;
+};
+
+struct Context {
+	// Back is the innermost
+	buffer<ContextFrame> frames;
+	// Declarations of every frame, a scope per pushed frame
+	SymbolTable symbols;
+	// Searched after all frames, may be nullptr
+	ExternalDeclSource* external = nullptr;
+	// Owns every node parsed
+	Arena* arena = nullptr;
+	// May be nullptr
+	ParseMemo* memo = nullptr;
+	// Changes whenever the declarations in scope do
+	int64 generation = 0;
+	// If set, bodies of functions declared in a namespace are added here
+	// instead of parsed
+	buffer<DeferredBody>* deferred = nullptr;
+	// If set, declarations in namespaces are recorded here, and those it
+	// holds for reuse are used instead of parsing their tokens
+	ParsedItems* items = nullptr;
+	// If set, template arguments of references are interned here
+	InstantiationTable* instantiations = nullptr;
+
+	// Inherits the innermost frame's namespaces
+	void PushFrame() {
+		PushFrame(frames.back());
+	}
+	void PushFrame(ContextFrame frame) {
+		frames.push_back(frame);
+		symbols.PushScope();
+		++generation;
+	}
+	void PopFrame() {
+		frames.pop_back();
+		symbols.PopScope();
+		++generation;
+	}
+	void AddDecl(Decl* decl) throws(Status) {
+		if(symbols.InScope(decl->GetName())) {
+			throw Status{.message = string("Duplicate declaration ") + decl->GetName()};
+		}
+		symbols.Add(decl->GetName(), decl);
+		++generation;
+	}
+
+  	void RemoveDecl(Decl* decl) {
+		if(!symbols.Remove(decl->GetName())) {
+			throw Status{.message = string("Declaration does not exist to remove ") + decl->GetName()};
+		}
+		++generation;
+  	}
+};
+
+// Runs parse(), or replays its outcome if it already ran at this position
+// Only outcomes which didn't change the scope themselves are kept.
+template<typename T, typename F>
+T* Memoized(Context& context, TokenStream& tokens, ParseRule rule, F parse) throws(Status) {
+	if(context.memo == nullptr) {
+		return parse();
+	}
+	const int64 start = tokens.Position();
+	const int64 generation = context.generation;
+	if(const ParseMemo::Entry* entry = context.memo->Find(rule, start, generation)) {
+		context.memo->CountHit();
+		if(!entry->ok) {
+			throw entry->error;
+		}
+		tokens.Rewind(entry->end);
+		return (T*)entry->result;
+	}
+
+	T* result = nullptr;
+	try {
+		result = parse();
+	} catch(Status status) {
+		if(context.generation == generation) {
+			context.memo->Set(rule, start, ParseMemo::Entry{.generation = generation,
+															.ok = false,
+															.error = status});
+		}
+		throw status;
+	}
+	if(context.generation == generation) {
+		context.memo->Set(rule, start, ParseMemo::Entry{.generation = generation,
+														.ok = true,
+														.result = result,
+														.end = tokens.Position()});
+	}
+	return result;
+}
+
+
+bool PeekAndConsumeUtil(TokenStream& tokens,
+					TokenKind look_for) {
+	if(tokens.Kind() != look_for) {
+		return false;
+	}
+	tokens.Consume();
+	return true;
+}
+
+bool PeekForAnyUtil(TokenStream& tokens, TokenKindSet look_for) {
+	if(tokens.empty()) {
+		throw Status{.message="No tokens to consume"};
+	}
+	return look_for.contains(tokens.Kind());
+}
+
+// Throws if none fouond
+Token ConsumeOneOfOrError(TokenStream& tokens,
+					TokenKindSet look_for) throws() {
+
+	if(!PeekForAnyUtil(tokens, look_for)) {
+		string message = "Expected one of: ";
+		for(int64 kind=0;kind<TokenKind_Count;++kind) {
+			if(look_for.contains(TokenKind(kind))) {
+				message += string(TokenKindSpelling(TokenKind(kind))) + " ";
+			}
 		}
+		throw Status{.message = message};
+	}
+
+	return tokens.Consume();
+}
 
+void ConsumeOrError(TokenStream& tokens,
+					TokenKind look_for) throws(Status) {
+	if(!PeekAndConsumeUtil(tokens, look_for)) {
+		string message = string("Got token ") + tokens.Text() + " Expected token(s): "
+			+ TokenKindSpelling(look_for);
+		throw Status{.message = message};
+	}
+}
+
+Expr* ParseExpr(Context& context,
+				TokenStream& tokens,
+				TokenKindSet disallow_infixes);
+FuncCall* ParseFuncCall(Context& context,
+				TokenStream& tokens, 
+				DeclRef* decl_ref);
+DeclRef* ParseDeclRef(Context& context,
+				TokenStream& tokens) throws(Status);
+
+vector<Expr*> ParseCommaSeparatedArguments(Context& context,
+											TokenStream& tokens,
+											TokenKind terminator);
+
+Token ConsumeIdentifierToken(TokenStream& tokens) throws(Status) {
+	Token next_token = tokens.Consume() throws();
+	if(next_token.kind != TokenKind_Identifier) {
+		throw Status{.message = string("Invalid identifier: ") + next_token.content,
+					 .loc = next_token.loc};
+	}
+	return next_token;
+}
+
+// Throws on failure
+Identifier ParseIdentifier(TokenStream& tokens) throws(Status) {
+	Identifier ret;
+	if(PeekAndConsumeUtil(tokens, TokenKind_ColonColon)) {
+		ret.global = true;
+	}
+	do {
+		Token next_token = ConsumeIdentifierToken(tokens) throws();
+		ret.parts.push_back(next_token.content);
+		ret.loc = next_token.loc;
+	}while(PeekAndConsumeUtil(tokens, TokenKind_ColonColon));
+	return ret;
+}
+
+Identifier ConsumeIdentifierFromSingleToken(TokenStream& tokens) throws(Status) {
+	Token name_tok = ConsumeIdentifierToken(tokens) throws();
+	return {.parts = {name_tok.content}, .global = false, .loc = name_tok.loc};
+}
+
+// Looks id up relative to in_namespace, ignoring id.global
+// nullptr if not found
+Decl* GetDeclByIdentifier(Namespace* in_namespace, Identifier id) {
+	assert(id.parts.len() > 0);
+	const int64 last = id.parts.len() - 1;
+	for(int64 p=0;p<last && in_namespace;++p) {
+		in_namespace = in_namespace->FindNested(id.parts[p]);
+	}
+	return in_namespace ? in_namespace->FindDecl(id.parts[last]) : nullptr;
+}
+
+Decl* GetDeclByIdentifier(Context& context, Identifier id) throws(Status) {
+	assert(id.parts.len() > 0);
+	const bool qualified = id.parts.len() > 1;
+
+	if(id.global) {
+		Decl* decl = GetDeclByIdentifier(context.frames.back().top_namespace, id);
 		if(decl) {
-			if(auto param = AsA<TemplateParam*>(decl->GetRef())) {
-				if(param->GetKind() != TemplateParamKind_Type) {
-					throw Status{.message = "Only typenames template parameters can be used as types"};
-				}
+			return decl;
+		}
+	} else {
+		const string name = id.parts[0];
 
-				prev_tokens_guard.deactivate();
-				return param;
+		// Innermost first
+		Decl* decl = qualified ? nullptr : context.symbols.Find(name);
+		if(decl) {
+			return decl;
+		}
+
+		// Enclosing namespaces, innermost first. Also finds declarations
+		// from earlier openings of a reopened namespace.
+		Namespace* searched = nullptr;
+		for(int64 f=context.frames.len();f>0;--f) {
+			Namespace* in_namespace = context.frames[f-1].in_namespace;
+			if(in_namespace == nullptr || in_namespace == searched) {
+				continue;
 			}
-			if(auto type = AsA<Type*>(decl->GetRef())) {
-				prev_tokens_guard.deactivate();
-				return type;
+			searched = in_namespace;
+			decl = GetDeclByIdentifier(in_namespace, id);
+			if(decl) {
+				return decl;
+			}
+		}
+
+		if(context.external) {
+			// Qualified names are looked up whole, like std::size_t
+			string external_name = name;
+			for(int64 i=1;i<id.parts.len();++i) {
+				external_name = external_name + "::" + id.parts[i];
 			}
-			auto func_decl = AsA<FuncDecl*>(decl->GetRef());
-			auto templated_decl = AsA<TemplatedDecl*>(decl->GetRef());
-			if(templated_decl && !func_decl) {
-	fprintf(stderr, "!!! TODO: TemplatedDecl\n");
-				exit(1);
+			decl = context.external->FindDecl(external_name) throws();
+			if(decl) {
+				return decl;
 			}
+		}
+	}
+
+	TRACE(Lookup, Info, "Couldn't find identifier %s\n", id.DebugString().c_str());
+	throw Status{.message = string("Couldn't find identifier ") + id.DebugString()};
+}
+
+// Throws on failure
+// Only consumes tokens on success
+Type* ParseTypeUncached(Context& context, TokenStream& tokens) throws(Status) {
+	const int64 prev_pos = tokens.Position();
+	auto prev_tokens_guard = MakeLambdaGuard(
+		[&tokens, prev_pos]() {
+			tokens.Rewind(prev_pos);
+		}
+	);
+
+	Token next_token = tokens.Peek();
+	switch(next_token.kind) {
+		case TokenKind_Void:
+			tokens.Consume();
+			prev_tokens_guard.deactivate();
+			return VoidType::Get();
+		case TokenKind_Int:
+			tokens.Consume();
+			prev_tokens_guard.deactivate();
+			return IntType::Get();
+		default:
+			break;
+	}
+	DeclRef* decl = nullptr;
+	try {
+//			Identifier id = ParseIdentifier(tokens) throws();
+//			decl = GetDeclByIdentifier(context, id) throws();
+		decl = ParseDeclRef(context, tokens) throws ();
+		TRACE(Type, Verbose, "In ParseType: decl %s\n", decl ? decl->DebugString(0).c_str() : "(null)");
+	} catch(Status status) {
+		throw status;
+	}
 
-			string message = string("Decl can't be interpreted as type: ") + decl->DebugString(0);
-fprintf(stderr, "LOG: %s\n", message.c_str());
-			throw Status{.message = message};
+	if(decl) {
+		if(auto param = dyn_cast<TemplateParam>(decl->GetRef())) {
+			if(param->GetKind() != TemplateParamKind_Type) {
+				throw Status{.message = "Only typenames template parameters can be used as types"};
+			}
+
+			prev_tokens_guard.deactivate();
+			return param;
+		}
+		if(auto type = dyn_cast<Type>(decl->GetRef())) {
+			prev_tokens_guard.deactivate();
+			if(decl->GetInstantiation()) {
+				return context.instantiations->GetType(decl, context.arena);
+			}
+			return type;
+		}
+		auto func_decl = dyn_cast<FuncDecl>(decl->GetRef());
+		auto templated_decl = dyn_cast<TemplatedDecl>(decl->GetRef());
+		if(templated_decl && !func_decl) {
+fprintf(stderr, "!!! TODO: TemplatedDecl\n");
+			exit(1);
 		}
 
-		throw Status{.message = string("Don't know how to translate token to type: ") + next_token.content};
+		string message = string("Decl can't be interpreted as type: ") + decl->DebugString(0);
+		TRACE(Type, Info, "LOG: %s\n", message.c_str());
+		throw Status{.message = message};
+	}
+
+	throw Status{.message = string("Don't know how to translate token to type: ") + next_token.content};
+}
+
+// Returns nullptr on failure when throw_on_fail = false
+// Only consumes tokens on success
+Type* ParseType(Context& context, TokenStream& tokens, bool throw_on_fail=true) throws(Status) {
+	try {
+		return Memoized<Type>(context, tokens, ParseRule_Type,
+			[&context, &tokens]() {
+				return ParseTypeUncached(context, tokens);
+			}) throws();
 	} catch (Status status) {
 
 		if(throw_on_fail) {
@@ -1031,39 +2072,38 @@ fprintf(stderr, "LOG: %s\n", message.c_str());
 
 // If there's no <, then returns empty without consuming input
 vector<TemplateParam*> ParseTemplateParams(Context& context,
-										  vector<Token>& tokens) {
-	auto PeekAndConsume = [&tokens](vector<string> look_for) {
+										  TokenStream& tokens) {
+	auto PeekAndConsume = [&tokens](TokenKind look_for) {
 		return PeekAndConsumeUtil(tokens, look_for);
 	};
 
-	if(!PeekAndConsume({"<"})) {
+	if(!PeekAndConsume(TokenKind_Less)) {
 		return {};
 	}
 	vector<TemplateParam*> template_params;
 	for(bool first = true;
-		!PeekAndConsume({">"});
+		!PeekAndConsume(TokenKind_Greater);
 		first = false) {
 
 		if(!first) {
-			ConsumeOrError(tokens, {","}) throws();
+			ConsumeOrError(tokens, TokenKind_Comma) throws();
 		}
 
-		Token kind_tok = ConsumeOneOfOrError(tokens, {"int", "typename"}) throws();
-		string kind_word = kind_tok.content;
+		Token kind_tok = ConsumeOneOfOrError(tokens, {TokenKind_Int, TokenKind_Typename}) throws();
 
 		TemplateParamKind kind = TemplateParamKind_Null;
 
-		if(kind_word == "int") {
+		if(kind_tok.kind == TokenKind_Int) {
 			kind = TemplateParamKind_Int;
-		} else if(kind_word == "typename") {
+		} else if(kind_tok.kind == TokenKind_Typename) {
 			kind = TemplateParamKind_Type;
 		}
 
-		Token name_tok = tokens.pop_front();
+		Token name_tok = tokens.Consume();
 		string name = name_tok.content;
 		LocationRef loc = name_tok.loc;
 
-		auto* decl = new TemplateParam(name, kind, loc);
+		auto* decl = context.arena->New<TemplateParam>(name, kind, loc);
 
 		template_params.push_back(decl);
 		context.AddDecl(decl);
@@ -1072,17 +2112,13 @@ vector<TemplateParam*> ParseTemplateParams(Context& context,
 }
 
 vector<TemplateArg> ParseTemplateArgs(Context& context,
-									  vector<Token>& tokens,
+									  TokenStream& tokens,
 									  vector<TemplateParam*> template_params) throws() {
-	auto PeekAndConsume = [&tokens](vector<string> look_for) {
-		return PeekAndConsumeUtil(tokens, look_for);
-	};
-
 	if(template_params.empty()) {
 		return {};
 	}
 
-	ConsumeOrError(tokens, {"<"}) throws();
+	ConsumeOrError(tokens, TokenKind_Less) throws();
 
 	vector<TemplateArg> ret;
 
@@ -1090,15 +2126,15 @@ vector<TemplateArg> ParseTemplateArgs(Context& context,
 	for(TemplateParam* param : template_params) {
 
 		if(!first) {
-			ConsumeOrError(tokens, {","}) throws();
+			ConsumeOrError(tokens, TokenKind_Comma) throws();
 		}
 
 		if(param->GetKind() == TemplateParamKind_Type) {
-fprintf(stderr, "---- Parse type TemplateArg ---\n");
+			TRACE(Type, Verbose, "---- Parse type TemplateArg ---\n");
 			ret.push_back(TemplateArg{.type = ParseType(context, tokens)}) throws();
 		} else if(param->GetKind() == TemplateParamKind_Int) {
-fprintf(stderr, "---- Parse int TemplateArg ---\n");
-			ret.push_back(TemplateArg{.int_value = ParseExpr(context, tokens, /*disallow_infix=*/{",", ">"})}) throws();
+			TRACE(Type, Verbose, "---- Parse int TemplateArg ---\n");
+			ret.push_back(TemplateArg{.int_value = ParseExpr(context, tokens, /*disallow_infix=*/{TokenKind_Comma, TokenKind_Greater})}) throws();
 		} else {
 			// TODO: Parse args
 			// TODO: Unpack commas becomes annoying here..
@@ -1108,7 +2144,7 @@ fprintf(stderr, "---- Parse int TemplateArg ---\n");
 		first = false;
 	}
 
-	ConsumeOrError(tokens, {">"}) throws();
+	ConsumeOrError(tokens, TokenKind_Greater) throws();
 
 	return ret;
 }
@@ -1119,7 +2155,7 @@ fprintf(stderr, "---- Parse int TemplateArg ---\n");
 // param_mode disallows ctor, init list
 // Does not consume the ;
 VarDecl* ParseVarDecl(Context& context,
-				vector<Token>& tokens,
+				TokenStream& tokens,
 				Identifier id,
 				vector<TemplateParam*> template_params,
 				Type* type,
@@ -1132,28 +2168,28 @@ VarDecl* ParseVarDecl(Context& context,
 
 	string name = id.parts[0];
 
-	vector<Token> prev_tokens = tokens;
+	const int64 prev_pos = tokens.Position();
 	auto tokens_guard = MakeLambdaGuard(
-		[prev_tokens, &tokens]() {
-			tokens = prev_tokens;
+		[prev_pos, &tokens]() {
+			tokens.Rewind(prev_pos);
 		}
 	);
 	
 	VarDeclInitType init_type = VarDeclInitType_None;
 	vector<Expr*> init_params;
 
-	if(PeekAndConsumeUtil(tokens, {"="})) {
+	if(PeekAndConsumeUtil(tokens, TokenKind_Equal)) {
 		init_type = VarDeclInitType_Equals;
-		init_params.push_back(ParseExpr(context, tokens, /*disallow_infix=*/{","}));
-	} else if(!param_mode && PeekAndConsumeUtil(tokens, {"("})) {
+		init_params.push_back(ParseExpr(context, tokens, /*disallow_infix=*/{TokenKind_Comma}));
+	} else if(!param_mode && PeekAndConsumeUtil(tokens, TokenKind_LParen)) {
 		init_type = VarDeclInitType_Ctor;
-		init_params = ParseCommaSeparatedArguments(context, tokens, /*terminator*/{")"});
-	} else if(!param_mode && PeekAndConsumeUtil(tokens, {"{"})) {
+		init_params = ParseCommaSeparatedArguments(context, tokens, /*terminator*/TokenKind_RParen);
+	} else if(!param_mode && PeekAndConsumeUtil(tokens, TokenKind_LBrace)) {
 		init_type = VarDeclInitType_InitList;
-		init_params = ParseCommaSeparatedArguments(context, tokens, /*terminator*/{"}"});
+		init_params = ParseCommaSeparatedArguments(context, tokens, /*terminator*/TokenKind_RBrace);
 	}
 
-	VarDecl* decl = new VarDecl(name, id.loc, type, 
+	VarDecl* decl = context.arena->New<VarDecl>(name, id.loc, type, 
 								init_type, init_params);
 	
 	context.AddDecl(decl);
@@ -1162,16 +2198,16 @@ VarDecl* ParseVarDecl(Context& context,
 }
 
 VarDecl* ParseParamDecl(Context& context,
-					  vector<Token>& tokens) throws(Status) {
-fprintf(stderr, "ParseParamDecl next %s\n", tokens[0].content.c_str());
+					  TokenStream& tokens) throws(Status) {
+	TRACE(Decl, Verbose, "ParseParamDecl next %s\n", tokens.Text().c_str());
 
 	Type* type = ParseType(context, tokens) throws();
 
-fprintf(stderr, "ParseParamDecl type %s\n", type->DebugString(0).c_str());
+	TRACE(Decl, Verbose, "ParseParamDecl type %s\n", type->DebugString(0).c_str());
 
 	Identifier id = ConsumeIdentifierFromSingleToken(tokens) throws();
 
-fprintf(stderr, "ParseParamDecl id %s\n", id.DebugString().c_str());
+	TRACE(Decl, Verbose, "ParseParamDecl id %s\n", id.DebugString().c_str());
 
 
 	return ParseVarDecl(context, tokens, id, 
@@ -1185,19 +2221,19 @@ fprintf(stderr, "ParseParamDecl id %s\n", id.DebugString().c_str());
 // Only consumes tokens if successful
 // Returns nullptr if an identifier couldn't be parsed
 // Throws if it was an identifier but it couldn't be resolved, or missing template args
-DeclRef* ParseDeclRef(Context& context,
-				vector<Token>& tokens) throws(Status) {
-fprintf(stderr, "ParseDeclRef %s\n", tokens[0].content.c_str());
+DeclRef* ParseDeclRefUncached(Context& context,
+				TokenStream& tokens) throws(Status) {
+	TRACE(Lookup, Verbose, "ParseDeclRef %s\n", tokens.Text().c_str());
 
-	vector<Token> prev_tokens = tokens;
+	const int64 prev_pos = tokens.Position();
 
 	auto tokens_guard = MakeLambdaGuard(
-		[prev_tokens, &tokens]() {
-			tokens = prev_tokens;
+		[prev_pos, &tokens]() {
+			tokens.Rewind(prev_pos);
 		}
 	);
 
-	LocationRef loc = tokens[0].loc;
+	LocationRef loc = tokens.Loc();
 
 	// Decl for identifier
 	Identifier id;
@@ -1210,78 +2246,72 @@ fprintf(stderr, "ParseDeclRef %s\n", tokens[0].content.c_str());
 	Decl* decl = GetDeclByIdentifier(context, id) throws();
 
 	vector<TemplateArg> template_args;
-	auto templated_decl = AsA<TemplatedDecl*>(decl);
+	auto templated_decl = dyn_cast<TemplatedDecl>(decl);
 	if(templated_decl) {
 		vector<TemplateParam*> template_params = templated_decl->GetTemplateParams();
 		template_args = ParseTemplateArgs(context, tokens, template_params);
 	}
 
-	DeclRef* ret = new DeclRef(decl, /*template_params=*/template_args, loc);
+	DeclRef* ret = nullptr;
+	if(templated_decl && templated_decl->IsTemplated() && context.instantiations) {
+		Instantiation* instantiation = context.instantiations->Intern(
+			templated_decl, template_args, context.arena);
+		ret = context.arena->New<DeclRef>(decl, instantiation, loc);
+	} else {
+		ret = context.arena->New<DeclRef>(decl, /*template_params=*/template_args, loc);
+	}
 
 	tokens_guard.deactivate();
 	return ret;
 }
 
-Expr* AdjustUnaryPrecedence(UnaryOp* uop) {
-	Expr* subexpr = uop->GetSub();
-
-	if(auto bop = AsA<BinaryOp*>(subexpr)) {
-		// --- Goal ---
-		// (-x)+y
-		// --- Original ---
-		// -(x+y)
-
-		Expr* x = bop->GetLeft();
-		Expr* y = bop->GetRight();
-
-		uop->SetSub(x);
-		bop->SetLeft(uop);
-		bop->SetRight(y);
-
-		return bop;
-	}
-	return uop;
+DeclRef* ParseDeclRef(Context& context,
+				TokenStream& tokens) throws(Status) {
+	return Memoized<DeclRef>(context, tokens, ParseRule_DeclRef,
+		[&context, &tokens]() {
+			return ParseDeclRefUncached(context, tokens);
+		}) throws();
 }
 
 BinaryOp* IsCommaOp(Expr* expr) {
-	auto bop = AsA<BinaryOp*>(expr);
+	auto bop = dyn_cast<BinaryOp>(expr);
 	return (bop && bop->GetOp() == ",") ? bop : nullptr;
 }
 
 // Consumes terminator, such as ")"
 vector<Expr*> ParseCommaSeparatedArguments(Context& context,
-											vector<Token>& tokens,
-											string terminator) {
+											TokenStream& tokens,
+											TokenKind terminator) {
 	vector<Expr*> args;
-	if(PeekAndConsumeUtil(tokens, {terminator})) {
+	if(PeekAndConsumeUtil(tokens, terminator)) {
 		return args;
 	}
 	do {
-		args.push_back(ParseExpr(context, tokens, /*disallow_infix=*/{","}));
-	} while(PeekAndConsumeUtil(tokens, {","}));
-	ConsumeOrError(tokens, {terminator});
+		args.push_back(ParseExpr(context, tokens, /*disallow_infix=*/{TokenKind_Comma}));
+	} while(PeekAndConsumeUtil(tokens, TokenKind_Comma));
+	ConsumeOrError(tokens, terminator);
 	return args;
 }
 
 // Returns nullptr on non-function form
 // Only consumes tokens on success
 FuncCall* ParseFuncCall(Context& context,
-				vector<Token>& tokens, 
+				TokenStream& tokens, 
 				DeclRef* decl_ref) {
 
-	vector<Token> prev_tokens = tokens;
+	const int64 prev_pos = tokens.Position();
 
 	auto tokens_guard = MakeLambdaGuard(
-		[prev_tokens, &tokens]() {
-			tokens = prev_tokens;
+		[prev_pos, &tokens]() {
+			tokens.Rewind(prev_pos);
 		}
 	);
 
-	auto PeekAndConsume = [&tokens](vector<string> look_for) {
+	auto PeekAndConsume = [&tokens](TokenKind look_for) {
 		return PeekAndConsumeUtil(tokens, look_for);
 	};
 
-	if(!PeekAndConsume({"("})) {
+	if(!PeekAndConsume(TokenKind_LParen)) {
 		return nullptr;
 	}
 
@@ -1291,14 +2321,14 @@ FuncCall* ParseFuncCall(Context& context,
 
 	// Check that the decl is a function
 	Decl* callee_decl = decl_ref->GetRef();
-	auto callee = AsA<FuncDecl*>(callee_decl);
+	auto callee = dyn_cast<FuncDecl>(callee_decl);
 
 	if(!callee) {
 		throw Status{.message = string("Decl is not a function: ") + callee_decl->DebugString(0)};
 	}
 
 	// We can throw errors after this, as it must be a call
-	vector<Expr*> args = ParseCommaSeparatedArguments(context, tokens, /*terminator=*/")");
+	vector<Expr*> args = ParseCommaSeparatedArguments(context, tokens, /*terminator=*/TokenKind_RParen);
 
 	if(args.len() != callee->GetParameters().len()) {
 		throw Status{.message = string("Function ") + callee->GetName() 
@@ -1306,160 +2336,207 @@ FuncCall* ParseFuncCall(Context& context,
 		+ " parameters"};
 	}
 
-	FuncCall* funccall = new FuncCall(decl_ref, args, loc);
+	FuncCall* funccall = context.arena->New<FuncCall>(decl_ref, args, loc);
 
 	tokens_guard.deactivate();
 
 	return funccall;
 }
 
-Expr* ParseExpr(Context& context,
-				vector<Token>& tokens,
-				set<string> disallow_infixes) {
-	fprintf(stderr, "ParseExpr %s\n", tokens[0].content.c_str());
-
-	LocationRef loc;
-	if(tokens.len()) {
-		loc = tokens[0].loc;
-	}
+// A leaf and its postfix operators
+// Returns nullptr without consuming tokens if there's no leaf
+Expr* ParsePrimaryExpr(Context& context,
+				TokenStream& tokens) throws(Status) {
+	LocationRef loc = tokens.Loc();
 	Expr* leaf_parsed = nullptr;
 
 	// Integer literal
-	try{
-		long long integer_literal = std::stoll(tokens[0].content.c_str()) throws();
-		assert(leaf_parsed == nullptr);
-		leaf_parsed = new Literal(new IntegerValue(integer_literal), tokens[0].loc);
-		tokens.pop_front();
-	} catch(std::invalid_argument invalid) {
-	} catch(std::out_of_range invalid) {
-	}
-
-	// C style cast or parenthesis
-	if(!leaf_parsed && tokens[0].content == "(") {
-		LocationRef paren_loc = tokens[0].loc;
-		tokens.pop_front();
-
-		// C style cast
-		//DeclRef* decl_ref = ParseDeclRef(context, tokens);
-		Type* cast_to = ParseType(context, tokens, /*throw_on_failure=*/false);
-
-		if(cast_to != nullptr) {
-			ConsumeOrError(tokens, {")"});
-			Expr* sub_expr = ParseExpr(context, tokens, disallow_infixes);
-			Expr* cast_expr = new CastExpr(CastType_CStyle, cast_to, sub_expr, paren_loc);
-			Expr* ret = AdjustUnaryPrecedence(AsA<UnaryOp*>(cast_expr));
-			return ret;
-		}
+	if(tokens.Kind() == TokenKind_IntLiteral) {
+		Token literal_tok = tokens.Consume();
+		IntegerValue* value = context.arena->New<IntegerValue>(literal_tok.value);
+		leaf_parsed = context.arena->New<Literal>(value, literal_tok.loc);
+	}
 
-		// Regular parenthetical
-		Expr* inner = new ParenExpr(ParseExpr(context, tokens, disallow_infixes), paren_loc);
-		ConsumeOrError(tokens, {")"});
+	// Parenthesis, casts are handled as prefix operators
+	if(!leaf_parsed && tokens.Kind() == TokenKind_LParen) {
+		LocationRef paren_loc = tokens.Consume().loc;
+		Expr* inner = context.arena->New<ParenExpr>(ParseExpr(context, tokens, /*disallow_infix=*/{}), paren_loc);
+		ConsumeOrError(tokens, TokenKind_RParen);
 		leaf_parsed = inner;
 	}
 
-
 	// Ctor / CPP style cast
-	Type* ctor_of_type = ParseType(context, tokens, /*throw_on_fail=*/false);
-fprintf(stderr, "-- ctor_of_type %p\n", ctor_of_type);
-	if(!leaf_parsed && ctor_of_type) {
-		ConsumeOrError(tokens, {"("});
-		auto ctor_of_struct = AsA<StructDecl*>(ctor_of_type);
-		if(ctor_of_struct) {
-			fprintf(stderr, "!! TODO: Ctor call on struct check param count\n");
+	if(!leaf_parsed) {
+		Type* ctor_of_type = ParseType(context, tokens, /*throw_on_fail=*/false);
+		TRACE(Expr, Verbose, "-- ctor_of_type %p\n", ctor_of_type);
+		if(ctor_of_type) {
+			ConsumeOrError(tokens, TokenKind_LParen);
+			auto ctor_of_struct = dyn_cast<StructDecl>(ctor_of_type);
+			if(ctor_of_struct) {
+				TRACE(Expr, Info, "!! TODO: Ctor call on struct check param count\n");
+			}
+			// TODO: Typedef
+			TRACE(Expr, Verbose, "ParseExpr ctor_of_type %s\n",
+				ctor_of_type->DebugString(0).c_str());
+			vector<Expr*> args = ParseCommaSeparatedArguments(context, tokens, /*terminator=*/TokenKind_RParen);
+			leaf_parsed = context.arena->New<CtorCall>(ctor_of_type, args, loc);
 		}
-		// TODO: Typedef
-		fprintf(stderr, "ParseExpr ctor_of_type %s\n", 
-			ctor_of_type->DebugString(0).c_str());
-		vector<Expr*> args = ParseCommaSeparatedArguments(context, tokens, /*terminator=*/")");
-		leaf_parsed = new CtorCall(ctor_of_type, args, loc);
 	}
 
-
 	// Decl for identifier
 	DeclRef* decl_ref = nullptr;
 	if(!leaf_parsed) {
 		decl_ref = ParseDeclRef(context, tokens);
 	}
 	if(decl_ref != nullptr) {
-fprintf(stderr, "-- decl_ref %s\n", decl_ref->GetRef()->DebugString(0).c_str());
-		assert(!leaf_parsed);
+		TRACE(Expr, Verbose, "-- decl_ref %s\n", decl_ref->GetRef()->DebugString(0).c_str());
 		leaf_parsed = decl_ref;
 	}
 
 	// Function call
-	if(decl_ref && compiler::AsA<FuncDecl*>(decl_ref->GetRef())) {
-fprintf(stderr, "-- Trying ParseFuncCall next %s\n", tokens[0].content.c_str());
+	if(decl_ref && isa<FuncDecl>(decl_ref->GetRef())) {
+		TRACE(Expr, Verbose, "-- Trying ParseFuncCall next %s\n", tokens.Text().c_str());
 		FuncCall* call = ParseFuncCall(context, tokens, decl_ref);
 		if(call != nullptr) {
 			leaf_parsed = call;
 		}
 	}
 
-	const set<string> unary_operators = GetAllUnaryOperators();
-	if(!leaf_parsed && unary_operators.contains(tokens[0].content)) {
-		Token uop_tok = tokens[0];
-		tokens.pop_front();
-
-		Expr* sub_expr = ParseExpr(context, tokens, disallow_infixes);
-		UnaryOp* uop_expr = new UnaryOp(uop_tok.content, /*postfix=*/false, sub_expr, uop_tok.loc);
-		return AdjustUnaryPrecedence(uop_expr);
+	while(leaf_parsed && IsUnaryPostfixOperator(tokens.Kind())) {
+		Token uop_tok = tokens.Consume();
+		switch(uop_tok.kind) {
+			case TokenKind_Period:
+			case TokenKind_Arrow: {
+				Identifier id = ConsumeIdentifierFromSingleToken(tokens);
+				leaf_parsed = context.arena->New<MemberExpr>(leaf_parsed,
+											 id.parts[0],
+											 uop_tok.kind == TokenKind_Arrow,
+											 uop_tok.loc);
+				break;
+			}
+			default:
+				leaf_parsed = context.arena->New<UnaryOp>(TokenKindSpelling(uop_tok.kind), /*postfix=*/true, leaf_parsed, uop_tok.loc);
+				break;
+		}
 	}
 
-	const set<string> unary_postfix = GetAllUnaryPostfixOperators();
-	if(leaf_parsed && unary_postfix.contains(tokens[0].content)) {
-		Token uop_tok = tokens.pop_front();
-		if(uop_tok.content == "." || uop_tok.content == "->") {
-			Identifier id = ConsumeIdentifierFromSingleToken(tokens);
-			leaf_parsed = new MemberExpr(leaf_parsed,
-										 id.parts[0],
-										 uop_tok.content == "->",
-										 uop_tok.loc);
-		} else {
-			leaf_parsed = new UnaryOp(uop_tok.content, /*postfix=*/true, leaf_parsed, uop_tok.loc);
+	return leaf_parsed;
+}
+
+// Prefix operator, C style cast or infix operator waiting for its right
+// operand
+struct PendingOperator {
+	TokenKind kind;
+	LocationRef loc;
+	// nullptr unless infix
+	Expr* left;
+	// Set for C style casts
+	Type* cast_to;
+};
+
+// Whether pending takes the operand before the infix operator next,
+// rather than next taking it as its left operand
+bool BindsBefore(const PendingOperator& pending, TokenKind next) {
+	// Prefix operators bind tighter than any infix operator
+	if(pending.left == nullptr) {
+		return true;
+	}
+	const int64 pending_prec = InfixPrecedence(pending.kind);
+	const int64 next_prec = InfixPrecedence(next);
+	return pending_prec < next_prec ||
+		(pending_prec == next_prec && !IsRightAssociative(next));
+}
+
+// Operator precedence parsing with an explicit stack, so long operator
+// chains don't recurse. Recursion is only for parentheses and arguments.
+Expr* ParseExpr(Context& context,
+				TokenStream& tokens,
+				TokenKindSet disallow_infixes) {
+	TRACE(Expr, Verbose, "ParseExpr %s\n", tokens.Text().c_str());
+
+	buffer<PendingOperator> pending;
+	auto reduce = [&context, &pending](Expr* right) -> Expr* {
+		const PendingOperator op = pending.pop_back();
+		if(op.cast_to) {
+			return context.arena->New<CastExpr>(CastType_CStyle, op.cast_to, right, op.loc);
 		}
-	}
+		if(op.left == nullptr) {
+			return context.arena->New<UnaryOp>(TokenKindSpelling(op.kind), /*postfix=*/false, right, op.loc);
+		}
+		return context.arena->New<BinaryOp>(TokenKindSpelling(op.kind), op.left, right, op.loc);
+	};
 
-	set<string> infix_operators = GetAllInfixOperators();
-	infix_operators.remove(disallow_infixes);
+	for(;;) {
+		// Prefix operators and casts
+		for(;;) {
+			if(tokens.Kind() == TokenKind_LParen) {
+				const int64 prev_pos = tokens.Position();
+				LocationRef paren_loc = tokens.Consume().loc;
+				Type* cast_to = ParseType(context, tokens, /*throw_on_fail=*/false);
+				if(cast_to != nullptr && PeekAndConsumeUtil(tokens, TokenKind_RParen)) {
+					pending.push_back(PendingOperator{.kind = TokenKind_LParen,
+													  .loc = paren_loc,
+													  .left = nullptr,
+													  .cast_to = cast_to});
+					continue;
+				}
+				// Parenthesis
+				tokens.Rewind(prev_pos);
+				break;
+			}
+			if(IsUnaryOperator(tokens.Kind())) {
+				Token uop_tok = tokens.Consume();
+				pending.push_back(PendingOperator{.kind = uop_tok.kind,
+												  .loc = uop_tok.loc,
+												  .left = nullptr,
+												  .cast_to = nullptr});
+				continue;
+			}
+			break;
+		}
 
-	if(leaf_parsed && infix_operators.contains(tokens[0].content)) {
-		Token operator_token = tokens.pop_front();
-		Expr* right_side = ParseExpr(context, tokens, disallow_infixes);
-		return new BinaryOp(operator_token.content,
-							leaf_parsed,
-							right_side,
-							operator_token.loc) throws();
-	}
+		Expr* operand = ParsePrimaryExpr(context, tokens) throws();
+		if(operand == nullptr) {
+			throw Status{.message=string("Unable to parse expr starting at ") + tokens.Text(),
+						 .loc=tokens.Loc()};
+		}
 
-	if(leaf_parsed != nullptr) {
-		return leaf_parsed;
-	}
+		const TokenKind next_kind = tokens.Kind();
+		const bool infix = IsInfixOperator(next_kind) && !disallow_infixes.contains(next_kind);
+		while(!pending.empty() && (!infix || BindsBefore(pending.back(), next_kind))) {
+			operand = reduce(operand);
+		}
+		if(!infix) {
+			return operand;
+		}
 
-	throw Status{.message=string("Unable to parse expr starting at ") + tokens[0].content};
+		Token operator_token = tokens.Consume();
+		pending.push_back(PendingOperator{.kind = next_kind,
+										  .loc = operator_token.loc,
+										  .left = operand,
+										  .cast_to = nullptr});
+	}
 }
 
 Stmt* ParseStmt(Context& context,
-				vector<Token>& tokens) {
+				TokenStream& tokens) {
 
-	Token next_token = tokens[0];
-	LocationRef loc = next_token.loc;
+	LocationRef loc = tokens.Loc();
 
-	if(PeekAndConsumeUtil(tokens, {"return"})) {
-		Stmt* ret = new ReturnStmt(ParseExpr(context, tokens, /*disallow_infix=*/{}), loc);
-fprintf(stderr, "ParseStmt return next %s ret %s\n", 
-	tokens[0].content.c_str(),
-	ret->DebugString(0).c_str());
-		ConsumeOrError(tokens, {";"}) throws ();
+	if(PeekAndConsumeUtil(tokens, TokenKind_Return)) {
+		Stmt* ret = context.arena->New<ReturnStmt>(ParseExpr(context, tokens, /*disallow_infix=*/{}), loc);
+		TRACE(Stmt, Verbose, "ParseStmt return next %s\n", tokens.Text().c_str());
+		ConsumeOrError(tokens, TokenKind_Semi) throws ();
 		return ret;
 	}
 
 	// TODO: Static
 
 	try {
-		vector<Token> prev_tokens = tokens;
+		const int64 prev_pos = tokens.Position();
 		auto tokens_guard = MakeLambdaGuard(
-			[prev_tokens, &tokens]() {
-				tokens = prev_tokens;
+			[prev_pos, &tokens]() {
+				tokens.Rewind(prev_pos);
 			}
 		);
 		Type* type = ParseType(context, tokens, /*throw_on_failure=*/false) throws();
@@ -1471,7 +2548,7 @@ fprintf(stderr, "ParseStmt return next %s ret %s\n",
 							type,
 							/*static_specified=*/false, 
 							/*param_mode=*/false) throws();
-			ConsumeOrError(tokens, {";"}) throws ();
+			ConsumeOrError(tokens, TokenKind_Semi) throws ();
 			tokens_guard.deactivate();
 			return ret;
 		}
@@ -1480,7 +2557,44 @@ fprintf(stderr, "ParseStmt return next %s ret %s\n",
 	}
 
 	Stmt* ret = ParseExpr(context, tokens, /*disallow_infix=*/{}) throws ();
-	ConsumeOrError(tokens, {";"}) throws ();
+	ConsumeOrError(tokens, TokenKind_Semi) throws ();
+	return ret;
+}
+
+// Copies the tokens up to the brace matching the one just consumed, and
+// consumes that brace
+DeferredBody DeferBody(Context& context,
+					   TokenStream& tokens,
+					   FuncDecl* func) throws(Status) {
+	buffer<Token> body;
+	for(int64 depth = 1;;) {
+		if(tokens.empty()) {
+			throw Status{.message = string("Unterminated body of ") + func->GetName(),
+						 .loc = func->GetLoc()};
+		}
+		Token token = tokens.Consume();
+		if(token.kind == TokenKind_LBrace) {
+			++depth;
+		} else if(token.kind == TokenKind_RBrace && --depth == 0) {
+			break;
+		}
+		body.push_back(token);
+	}
+
+	DeferredBody ret{.func = func,
+					 .tokens = (Token*)context.arena->Allocate(body.len() * sizeof(Token), alignof(Token)),
+					 .len = body.len(),
+					 .instantiations = context.instantiations};
+	for(int64 i=0;i<body.len();++i) {
+		new(&ret.tokens[i]) Token(body[i]);
+	}
+	Namespace* prev = nullptr;
+	for(ContextFrame frame : context.frames) {
+		if(frame.in_namespace != prev) {
+			ret.frames.push_back(frame);
+			prev = frame.in_namespace;
+		}
+	}
 	return ret;
 }
 
@@ -1488,16 +2602,16 @@ fprintf(stderr, "ParseStmt return next %s ret %s\n",
 // Starts from after the "return_type name"
 // Only consumes tokens on success
 FuncDecl* ParseFuncDecl(Context& context,
-						vector<Token>& tokens,
+						TokenStream& tokens,
 						Identifier id,
 						vector<TemplateParam*> template_params,
 						Type* return_type,
 						bool static_specified) throws(Status) {
-	vector<Token> prev_tokens = tokens;
+	const int64 prev_pos = tokens.Position();
 
 	auto tokens_guard = MakeLambdaGuard(
-		[prev_tokens, &tokens]() {
-			tokens = prev_tokens;
+		[prev_pos, &tokens]() {
+			tokens.Rewind(prev_pos);
 		}
 	);
 
@@ -1509,9 +2623,9 @@ FuncDecl* ParseFuncDecl(Context& context,
 	string name = id.parts[0];
 	LocationRef loc = id.loc;
 
-fprintf(stderr, "-- ParseFuncDecl %s\n", name.c_str());
+	TRACE(Decl, Verbose, "-- ParseFuncDecl %s\n", name.c_str());
 
-	auto PeekAndConsume = [&tokens](vector<string> look_for) {
+	auto PeekAndConsume = [&tokens](TokenKind look_for) {
 		return PeekAndConsumeUtil(tokens, look_for);
 	};
 
@@ -1522,39 +2636,42 @@ fprintf(stderr, "-- ParseFuncDecl %s\n", name.c_str());
 			context.PopFrame();
 	});
 
-	ConsumeOrError(tokens, {"("});
+	ConsumeOrError(tokens, TokenKind_LParen);
 
 	vector<VarDecl*> parameters;
 
 	for(bool first = true;
-		!PeekAndConsume({")"});
+		!PeekAndConsume(TokenKind_RParen);
 		first = false) {
 
 		if(!first) {
-			ConsumeOrError(tokens, {","}) throws();
+			ConsumeOrError(tokens, TokenKind_Comma) throws();
 		}
 
 		parameters.push_back(ParseParamDecl(context, tokens));
 	}
 
 	bool is_prototype = false;
-	if(PeekAndConsume({";"})) {
+	if(PeekAndConsume(TokenKind_Semi)) {
 		is_prototype = true;
 	}
 
-	auto funcdecl = new FuncDecl(name, /*template_params=*/template_params, 
+	auto funcdecl = context.arena->New<FuncDecl>(name, /*template_params=*/template_params, 
 								 return_type, parameters, 
 								 /*is_prototype=*/is_prototype,
-								 /*body=*/{}, loc);
+								 /*body=*/vector<Stmt*>{}, loc);
 	// Add as soon as the signature is ready for recursion to find it
 	context.AddDecl(funcdecl);
 
-	if(!is_prototype) {
-		ConsumeOrError(tokens, {"{"});
+	if(!is_prototype && context.deferred) {
+		ConsumeOrError(tokens, TokenKind_LBrace);
+		context.deferred->push_back(DeferBody(context, tokens, funcdecl)) throws();
+	} else if(!is_prototype) {
+		ConsumeOrError(tokens, TokenKind_LBrace);
 
 		vector<Stmt*> body;
 
-		while(!PeekAndConsume({"}"})) {
+		while(!PeekAndConsume(TokenKind_RBrace)) {
 			body.push_back(ParseStmt(context, tokens));
 		}
 
@@ -1567,33 +2684,33 @@ fprintf(stderr, "-- ParseFuncDecl %s\n", name.c_str());
 }
 
 StructDecl* ParseStructDecl(Context& context,
-							vector<Token>& tokens,
+							TokenStream& tokens,
 							vector<TemplateParam*> template_params) throws();
 
 // Consumes ;
 TypedefDecl* ParseTypedef(Context& context,
-						  vector<Token>& tokens) {
+						  TokenStream& tokens) {
 	Type* type = ParseType(context, tokens);
 	Identifier id = ConsumeIdentifierFromSingleToken(tokens);
-	ConsumeOrError(tokens, {";"});
-	return new TypedefDecl(id.parts[0], type, id.loc);
+	ConsumeOrError(tokens, TokenKind_Semi);
+	return context.arena->New<TypedefDecl>(id.parts[0], type, id.loc);
 }
 
 // Consumes the ;
 UsingDecl* ParseUsing(Context& context,
-					  vector<Token>& tokens,
+					  TokenStream& tokens,
 					  vector<TemplateParam*> template_params) {
 	Identifier id = ParseIdentifier(tokens) throws();
-	if(PeekAndConsumeUtil(tokens, {"="})) {
+	if(PeekAndConsumeUtil(tokens, TokenKind_Equal)) {
 		if(id.global || id.parts.len() > 1) {
 			throw Status{.message = "Using = can't specify qualified identifier as alias"};
 		}
-fprintf(stderr, "--- ParseUsing %s = %s\n", id.parts.back().c_str(), tokens[0].content.c_str());
+		TRACE(Decl, Verbose, "--- ParseUsing %s = %s\n", id.parts.back().c_str(), tokens.Text().c_str());
 		// TODO: Apply template params
 		Type* base = ParseType(context, tokens) throws();
-fprintf(stderr, "----- base %s\n", base->DebugString(0).c_str());
-		ConsumeOrError(tokens, {";"});
-		return new UsingAliasDecl(id.parts[0],
+		TRACE(Decl, Verbose, "----- base %s\n", base->DebugString(0).c_str());
+		ConsumeOrError(tokens, TokenKind_Semi);
+		return context.arena->New<UsingAliasDecl>(id.parts[0],
 							 base,
 							 template_params, 
 							 id.loc);
@@ -1601,21 +2718,21 @@ fprintf(stderr, "----- base %s\n", base->DebugString(0).c_str());
 	if(template_params.len() > 0) {
 		throw Status{.message = "Using can't have template params unless aliasing"};		
 	}
-fprintf(stderr, "ParseUsing id %s\n", id.DebugString().c_str());
+	TRACE(Decl, Verbose, "ParseUsing id %s\n", id.DebugString().c_str());
 	Decl* decl = GetDeclByIdentifier(context, id) throws();
-	auto type = AsA<Type*>(decl);
+	auto type = dyn_cast<Type>(decl);
 	if(type == nullptr) {
 		throw Status{.message = "Using declaration must be on type name"};		
 	}
-	ConsumeOrError(tokens, {";"});
-	return new UsingDecl(id.parts.back(),
+	ConsumeOrError(tokens, TokenKind_Semi);
+	return context.arena->New<UsingDecl>(id.parts.back(),
 						 type, 
 			  			 id.loc);
 }
 
 // Consumes the ;
-Decl* ParseDecl(Context& context, vector<Token>& tokens) {
-	auto PeekAndConsume = [&tokens](vector<string> look_for) {
+Decl* ParseDecl(Context& context, TokenStream& tokens) {
+	auto PeekAndConsume = [&tokens](TokenKind look_for) {
 		return PeekAndConsumeUtil(tokens, look_for);
 	};
 
@@ -1626,24 +2743,24 @@ Decl* ParseDecl(Context& context, vector<Token>& tokens) {
 	});
 
 
-	if(PeekAndConsume({"typedef"})) {
+	if(PeekAndConsume(TokenKind_Typedef)) {
 		return ParseTypedef(context, tokens);
 	}
 
 	vector<TemplateParam*> template_params;
-	if(PeekAndConsume({"template"})) {
+	if(PeekAndConsume(TokenKind_Template)) {
 		template_params = ParseTemplateParams(context, tokens);
 	}
 
-	if(PeekAndConsume({"using"})) {
+	if(PeekAndConsume(TokenKind_Using)) {
 		return ParseUsing(context, tokens, template_params);
 	}
-	if(PeekForAnyUtil(tokens, {"class", "struct"})) {
+	if(PeekForAnyUtil(tokens, {TokenKind_Class, TokenKind_Struct})) {
 		return ParseStructDecl(context, tokens, template_params);
 	}
 
 	bool static_specified = false;
-	if(PeekAndConsumeUtil(tokens, {"static"})) {
+	if(PeekAndConsumeUtil(tokens, TokenKind_Static)) {
 		static_specified = true;
 	}
 
@@ -1657,34 +2774,33 @@ Decl* ParseDecl(Context& context, vector<Token>& tokens) {
 		// Function proto is default, as it's the most complicated to parse
 		return ParseFuncDecl(context, tokens, id, template_params, type, static_specified);
 	} catch (Status status) {
-		fprintf(stderr, "ParseDecl:ParseFuncDecl status %s\n", status.message.c_str());
+		TRACE(Decl, Info, "ParseDecl:ParseFuncDecl status %s\n", status.message.c_str());
 	}
 
 	Decl* ret = ParseVarDecl(context, tokens, id, template_params, type, static_specified);
-	ConsumeOrError(tokens, {";"});
+	ConsumeOrError(tokens, TokenKind_Semi);
 	return ret;
 }
 
 // Consumes struct/class token
 StructDecl* ParseStructDecl(Context& context,
-							vector<Token>& tokens,
+							TokenStream& tokens,
 							vector<TemplateParam*> template_params) throws() {
 
-	Token keyword_tok = tokens.pop_front();
+	Token keyword_tok = tokens.Consume();
 	LocationRef loc = keyword_tok.loc;
-	string keyword = keyword_tok.content;
 
 	bool declared_class = false;
 
-	if(keyword == "class") {
+	if(keyword_tok.kind == TokenKind_Class) {
 		declared_class = true;
-	} else if (keyword == "struct") {
+	} else if (keyword_tok.kind == TokenKind_Struct) {
 		declared_class = false;
 	} else {
-		throw Status{.message=string("INTERNAL: ParseStructDecl called with first token ") + keyword};
+		throw Status{.message=string("INTERNAL: ParseStructDecl called with first token ") + keyword_tok.content};
 	}
 
-	Token name_tok = tokens.pop_front();
+	Token name_tok = tokens.Consume();
 
 	context.PushFrame();
 	auto template_context_pop_guard = MakeLambdaGuard(
@@ -1692,30 +2808,64 @@ StructDecl* ParseStructDecl(Context& context,
 			context.PopFrame();
 	});
 
+	// Member function bodies need the members in scope
+	buffer<DeferredBody>* deferred = context.deferred;
+	context.deferred = nullptr;
+	auto deferred_guard = MakeLambdaGuard(
+		[&context, deferred]() {
+			context.deferred = deferred;
+	});
+
 	vector<Decl*> inner_decls;
 
-	ConsumeOrError(tokens, {"{"});
+	ConsumeOrError(tokens, TokenKind_LBrace);
 
-	while(!PeekAndConsumeUtil(tokens, {"}"})) {
+	while(!PeekAndConsumeUtil(tokens, TokenKind_RBrace)) {
 		Decl* decl = ParseDecl(context, tokens);
 		context.AddDecl(decl);
 		inner_decls.push_back(decl);
 	}
 
 	// TODO: inline decls
-	ConsumeOrError(tokens, {";"});
+	ConsumeOrError(tokens, TokenKind_Semi);
 
-	return new StructDecl(name_tok.content,
+	return context.arena->New<StructDecl>(name_tok.content,
 						   declared_class,
 						   template_params,
 						   inner_decls,
 						   loc);
 }
 
+// Skips the tokens of a declaration context.items has to reuse, and
+// records the declaration
+Decl* ParseOrReuseDecl(Context& context, TokenStream& tokens) throws(Status) {
+	ParsedItem item{.scope = context.frames.back().scope,
+					.begin = tokens.Position()};
+	if(const ParsedItem* reused = context.items->reuse.find(item.begin)) {
+		item = *reused;
+		while(tokens.Position() < item.end) {
+			tokens.Consume();
+		}
+	} else {
+		item.decl = ParseDecl(context, tokens);
+		item.end = tokens.Position();
+		buffer<Token> item_tokens;
+		tokens.Rewind(item.begin);
+		while(tokens.Position() < item.end) {
+			item_tokens.push_back(tokens.Consume());
+		}
+		HashItemTokens([&item_tokens, &item](int64 position) -> const Token& {
+			return item_tokens[position - item.begin];
+		}, &item);
+	}
+	context.items->items.push_back(item);
+	return item.decl;
+}
+
 void ParseNamespaceContents(Context& context,
-							vector<Token>& tokens,
+							TokenStream& tokens,
 							Namespace& result) throws(Status) {
-	auto PeekAndConsume = [&tokens](vector<string> look_for) {
+	auto PeekAndConsume = [&tokens](TokenKind look_for) {
 		return PeekAndConsumeUtil(tokens, look_for);
 	};
 
@@ -1726,61 +2876,694 @@ void ParseNamespaceContents(Context& context,
 			context.PopFrame();
 	});
 
-	int64 debug_prev_token_count = -1;
-	while(!tokens.empty() && !PeekAndConsumeUtil(tokens, {"}"})) {
-		assert(debug_prev_token_count != tokens.len());
-		debug_prev_token_count = tokens.len();
+	int64 debug_prev_pos = -1;
+	while(!tokens.empty() && !PeekAndConsumeUtil(tokens, TokenKind_RBrace)) {
+		assert(debug_prev_pos != tokens.Position());
+		debug_prev_pos = tokens.Position();
 
-		if(PeekAndConsume({"namespace"})) {
-			Token name_tok = tokens.pop_front();
-			if(!PeekAndConsume({"{"})) {
+		if(PeekAndConsume(TokenKind_Namespace)) {
+			Token name_tok = tokens.Consume();
+			if(!PeekAndConsume(TokenKind_LBrace)) {
 				throw Status{.message="Expected { after", .loc=name_tok.loc};
 			}
 
 			ContextFrame prev_frame = context.frames.back();
-			auto nested = new Namespace(name_tok.content, name_tok.loc);
-			context.frames.push_back(ContextFrame{.in_namespace = nested, 
-												  .top_namespace = prev_frame.top_namespace});
+			const int64 scope = NestedScope(prev_frame.scope, name_tok.content);
+			// Reopening adds to the same namespace
+			Namespace* nested = result.FindNested(name_tok.content);
+			if(nested == nullptr) {
+				Namespace** previous = context.items ? context.items->namespaces.find(scope) : nullptr;
+				nested = previous ? *previous :
+					context.arena->New<Namespace>(name_tok.content, name_tok.loc);
+				result.AddNested(nested);
+			}
+			context.PushFrame(ContextFrame{.in_namespace = nested, 
+										   .top_namespace = prev_frame.top_namespace,
+										   .scope = scope});
+			auto namespace_pop_guard = MakeLambdaGuard(
+				[&context]() {
+					context.PopFrame();
+			});
 			ParseNamespaceContents(context, tokens, *nested);
-			result.AddNested(nested);
+		} else {
+			Decl* decl = nullptr;
+			if(context.items) {
+				decl = ParseOrReuseDecl(context, tokens) throws();
+			} else {
+				decl = ParseDecl(context, tokens);
+			}
+
+			result.AddDecl(decl) throws();
+			context.AddDecl(decl) throws();
 		}
 
-		Decl* decl = ParseDecl(context, tokens);
+		// Never backtracks across top level declarations
+		tokens.Release();
+		if(context.memo) {
+			context.memo->Clear();
+		}
+	}
+}
+
+
+// Replays tokens which were set aside
+class DeferredTokenSource : public TokenSource {
+public:
+	DeferredTokenSource(const Token* tokens, int64 len) : tokens_(tokens), len_(len) { }
+	bool Next(Token* token) override {
+		if(next_ >= len_) {
+			return false;
+		}
+		*token = tokens_[next_++];
+		return true;
+	}
+private:
+	const Token* tokens_;
+	int64 len_;
+	int64 next_ = 0;
+};
+
+// Parses a set aside body in a scope of its own, with the function's
+// template params and params
+void ParseDeferredBody(const DeferredBody& deferred,
+					   Arena* arena,
+					   ExternalDeclSource* external) throws(Status) {
+	DeferredTokenSource source(deferred.tokens, deferred.len);
+	TokenStream tokens(&source);
+	Context context;
+	for(ContextFrame frame : deferred.frames) {
+		context.frames.push_back(frame);
+	}
+	context.external = external;
+	context.arena = arena;
+	ParseMemo memo;
+	context.memo = &memo;
+	context.instantiations = deferred.instantiations;
 
-		result.AddDecl(decl) throws();
-		context.AddDecl(decl) throws();
+	FuncDecl* func = deferred.func;
+	context.PushFrame();
+	for(TemplateParam* param : func->GetTemplateParams()) {
+		context.AddDecl(param) throws();
+	}
+	context.PushFrame();
+	for(VarDecl* param : func->GetParameters()) {
+		context.AddDecl(param) throws();
 	}
+	context.AddDecl(func) throws();
+
+	vector<Stmt*> body;
+	while(!tokens.empty()) {
+		body.push_back(ParseStmt(context, tokens));
+	}
+	func->SetBody(body);
 }
 
+void MaterializeBody(LazyBody* lazy) throws(Status) {
+	ParseDeferredBody(lazy->body, lazy->arena, lazy->external) throws();
+}
 
-// Returns the anonymous namespace
-Namespace Parse(vector<string> tokens_raw) throws(Status) {
+namespace internal {
 
-	// Process line markers
-	LocationRef last_marker;
-	vector<Token> tokens;
+// Lets threads share a source which isn't thread safe
+class LockedDeclSource : public ExternalDeclSource {
+public:
+	LockedDeclSource(ExternalDeclSource* source) : source_(source) { }
+	Decl* FindDecl(string name) throws(Status) override {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return source_->FindDecl(name);
+	}
+private:
+	ExternalDeclSource* source_;
+	std::mutex mutex_;
+};
 
-	while(!tokens_raw.empty()) {
-		string next_token = tokens_raw[0];
-		tokens_raw.pop_front();
+}  // internal
 
-		if(next_token[0] == '#') {
-			// TODO: Actually parse and place in last_marker
-			continue;
+// Each thread allocates from an arena of its own, which arena takes over
+// once all bodies are parsed.
+// Throws the failure of the first body in source order to fail.
+void ParseDeferredBodies(const buffer<DeferredBody>& bodies,
+						 Arena* arena,
+						 ExternalDeclSource* external,
+						 int64 threads) throws(Status) {
+	if(threads == 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+	if(threads > bodies.len()) {
+		threads = bodies.len();
+	}
+	if(threads <= 1) {
+		for(const DeferredBody& body : bodies) {
+			ParseDeferredBody(body, arena, external) throws();
 		}
+		return;
+	}
 
-		tokens.push_back(Token{.content = next_token, .loc = last_marker});
+	internal::LockedDeclSource locked_external(external);
+	buffer<Status> failures;
+	failures.resize(bodies.len());
+	Arena* thread_arenas = new Arena[threads];
+	std::atomic<int64> next_body(0);
+	buffer<std::thread*> workers;
+	for(int64 t=0;t<threads;++t) {
+		workers.push_back(new std::thread([&, t]() {
+			for(int64 b = next_body++;b < bodies.len();b = next_body++) {
+				try {
+					ParseDeferredBody(bodies[b],
+									  &thread_arenas[t],
+									  external ? &locked_external : nullptr);
+				} catch(Status status) {
+					failures[b] = status;
+				}
+			}
+		}));
+	}
+	for(std::thread* worker : workers) {
+		worker->join();
+		delete worker;
 	}
+	for(int64 t=0;t<threads;++t) {
+		arena->Adopt(std::move(thread_arenas[t]));
+	}
+	delete[] thread_arenas;
+
+	for(const Status& failure : failures) {
+		if(!failure.ok()) {
+			throw failure;
+		}
+	}
+}
+
+// Parses into the anonymous namespace result, which must not move while
+// lazy bodies are unparsed
+// Tokens are pulled from the stream as needed, and only the current
+// top level declaration's tokens are held at once.
+// Nodes are allocated in arena, or in a new arena which is never freed.
+// Template instantiations are interned in instantiations, or in a table
+// of their own. Lazy bodies need one which outlives them.
+void ParseInto(Namespace& result,
+			   TokenStream& tokens,
+			   ExternalDeclSource* external=nullptr,
+			   Arena* arena=nullptr,
+			   ParseOptions options=ParseOptions{},
+			   ParsedItems* items=nullptr,
+			   InstantiationTable* instantiations=nullptr) throws(Status) {
+	assert(instantiations || options.bodies != BodyParsing_Lazy);
+	// TODO: Parse line markers into locations
 
-	// Anonymous
-	Namespace result(/*name=*/"", /*loc=*/LocationRef{});
 	Context context;
-	context.frames.push_back(ContextFrame{.in_namespace = &result});
+	context.frames.push_back(ContextFrame{.in_namespace = &result,
+										  .top_namespace = &result});
+	context.external = external;
+	context.arena = arena ? arena : new Arena;
+	ParseMemo memo;
+	context.memo = &memo;
+	context.items = items;
+	InstantiationTable own_instantiations;
+	context.instantiations = instantiations ? instantiations : &own_instantiations;
+	buffer<DeferredBody> deferred;
+	if(options.bodies != BodyParsing_Inline) {
+		context.deferred = &deferred;
+	}
 	ParseNamespaceContents(context, tokens, result);
 	assert(tokens.empty());
+
+	if(options.bodies == BodyParsing_Lazy) {
+		for(const DeferredBody& body : deferred) {
+			body.func->SetLazyBody(context.arena->New<LazyBody>(LazyBody{.body = body,
+																		 .arena = context.arena,
+																		 .external = external}));
+		}
+		return;
+	}
+	ParseDeferredBodies(deferred, context.arena, external, options.threads) throws();
+}
+
+// Returns the anonymous namespace
+Namespace Parse(TokenStream& tokens,
+				ExternalDeclSource* external=nullptr,
+				Arena* arena=nullptr,
+				ParseOptions options=ParseOptions{}) throws(Status) {
+	if(options.bodies == BodyParsing_Lazy) {
+		throw Status{.message = "Lazy bodies need a TranslationUnit to parse into"};
+	}
+	// Anonymous
+	Namespace result(/*name=*/"", /*loc=*/LocationRef{});
+	ParseInto(result, tokens, external, arena, options) throws();
 	return result;
 }
 
+Namespace Parse(TokenSource& source, ExternalDeclSource* external=nullptr) throws(Status) {
+	TokenStream tokens(&source);
+	return Parse(tokens, external);
+}
+
+namespace internal {
+
+struct Reference {
+	Decl* target;
+	// nullptr where target is used as a type, which can't be redirected
+	DeclRef* ref;
+};
+
+// References to declarations from decl and its parts, including bodies
+// parsed so far
+void CollectReferences(Decl* decl, buffer<Reference>* refs) {
+	buffer<Stmt*> stmts;
+	buffer<Type*> types;
+	stmts.push_back(decl);
+	auto add_all = [&stmts](auto nodes) {
+		for(Stmt* node : nodes) {
+			stmts.push_back(node);
+		}
+	};
+	auto add_template_params = [&add_all](TemplatedDecl* templated) {
+		add_all(templated->GetTemplateParams());
+	};
+	while(!stmts.empty() || !types.empty()) {
+		if(!types.empty()) {
+			Type* type = types.pop_back();
+			if(Stmt* type_decl = TypeAsStmt(type)) {
+				refs->push_back(Reference{.target = cast<Decl>(type_decl), .ref = nullptr});
+			} else if(auto* ref_type = dyn_cast<DeclRefType>(type)) {
+				// Shared by every use of the instantiation, so not redirected
+				refs->push_back(Reference{.target = ref_type->GetDeclRef()->GetRef(),
+										  .ref = nullptr});
+			}
+			continue;
+		}
+		Stmt* stmt = stmts.pop_back();
+		if(stmt == nullptr) {
+			continue;
+		}
+		switch(stmt->GetStmtKind()) {
+			case StmtKind_ReturnStmt:
+				stmts.push_back(cast<ReturnStmt>(stmt)->GetValue());
+				break;
+			case StmtKind_VarDecl:
+				types.push_back(cast<VarDecl>(stmt)->GetType());
+				add_all(cast<VarDecl>(stmt)->GetInitParams());
+				break;
+			case StmtKind_TypedefDecl:
+				types.push_back(cast<TypedefDecl>(stmt)->GetBase());
+				break;
+			case StmtKind_FuncDecl: {
+				auto* func = cast<FuncDecl>(stmt);
+				types.push_back(func->GetReturnType());
+				add_template_params(func);
+				add_all(func->GetParameters());
+				// Bodies still set aside find what they refer to by name
+				if(func->IsBodyParsed()) {
+					add_all(func->GetBody());
+				}
+				break;
+			}
+			case StmtKind_StructDecl:
+				add_template_params(cast<StructDecl>(stmt));
+				add_all(cast<StructDecl>(stmt)->GetInnerDecls());
+				break;
+			case StmtKind_UsingDecl:
+			case StmtKind_UsingAliasDecl:
+				types.push_back(cast<UsingDecl>(stmt)->GetBase());
+				add_template_params(cast<UsingDecl>(stmt));
+				break;
+			case StmtKind_DeclRef: {
+				auto* ref = cast<DeclRef>(stmt);
+				refs->push_back(Reference{.target = ref->GetRef(), .ref = ref});
+				for(TemplateArg arg : ref->GetTemplateArgs()) {
+					if(arg.type) {
+						types.push_back(arg.type);
+					}
+					stmts.push_back(arg.int_value);
+				}
+				break;
+			}
+			case StmtKind_CastExpr:
+				types.push_back(cast<CastExpr>(stmt)->GetToType());
+				add_all(cast<Expr>(stmt)->GetOperands());
+				break;
+			case StmtKind_FuncCall:
+				stmts.push_back(cast<FuncCall>(stmt)->GetCallee());
+				add_all(cast<Expr>(stmt)->GetOperands());
+				break;
+			case StmtKind_CtorCall:
+				types.push_back(cast<CtorCall>(stmt)->GetType());
+				add_all(cast<Expr>(stmt)->GetOperands());
+				break;
+			default:
+				if(auto* expr = dyn_cast<Expr>(stmt)) {
+					add_all(expr->GetOperands());
+				}
+				break;
+		}
+	}
+}
+
+// Splits tokens into declarations by brackets alone. Those whose tokens
+// match a declaration of the previous parse keep it, unless it refers to
+// one which changed in a way references to it can't follow.
+class ReusePlan {
+public:
+	ReusePlan(const buffer<ParsedItem>& previous, const buffer<Token>& tokens)
+		: previous_(previous) {
+		Split(tokens);
+		for(int64 o=0;o<previous_.len();++o) {
+			previous_index_.set(previous_[o].decl, o);
+		}
+		kept_.resize(fresh_.len());
+		replaces_.resize(fresh_.len());
+		kept_by_.resize(previous_.len());
+		replaced_by_.resize(previous_.len());
+		for(int64 f=0;f<fresh_.len();++f) {
+			kept_[f] = kNone;
+			replaces_[f] = kNone;
+		}
+		for(int64 o=0;o<previous_.len();++o) {
+			kept_by_[o] = kNone;
+			replaced_by_[o] = kNone;
+		}
+
+		Match(/*by_signature=*/false);
+		Match(/*by_signature=*/true);
+		DropStaleReferences();
+	}
+
+	// By token position, previous declarations to keep
+	hash_map<int64, ParsedItem> Reuse()const {
+		hash_map<int64, ParsedItem> reuse;
+		for(int64 f=0;f<fresh_.len();++f) {
+			if(kept_[f] != kNone) {
+				ParsedItem item = fresh_[f];
+				item.decl = previous_[kept_[f]].decl;
+				reuse.set(item.begin, item);
+			}
+		}
+		return reuse;
+	}
+
+	// Points references in kept declarations at the declarations replacing
+	// what they referred to, instantiated in instantiations. False if the
+	// parse didn't split declarations as planned, and some can't be.
+	bool Redirect(const buffer<ParsedItem>& parsed,
+				  InstantiationTable* instantiations,
+				  Arena* arena) {
+		hash_map<int64, ParsedItem> parsed_at;
+		hash_map<Decl*, bool> present;
+		for(const ParsedItem& item : parsed) {
+			parsed_at.set(item.begin, item);
+			present.set(item.decl, true);
+		}
+		hash_map<Decl*, Decl*> replacements;
+		for(int64 o=0;o<previous_.len();++o) {
+			if(replaced_by_[o] == kNone) {
+				continue;
+			}
+			const ParsedItem& planned = fresh_[replaced_by_[o]];
+			const ParsedItem* item = parsed_at.find(planned.begin);
+			if(item && item->end == planned.end &&
+			   item->decl->GetName() == previous_[o].decl->GetName()) {
+				replacements.set(previous_[o].decl, item->decl);
+			}
+		}
+		for(int64 f=0;f<fresh_.len();++f) {
+			if(kept_[f] == kNone || !present.contains(previous_[kept_[f]].decl)) {
+				continue;
+			}
+			for(int64 r=ref_begins_[f];r<ref_ends_[f];++r) {
+				const Reference& ref = refs_[r];
+				if(!previous_index_.contains(ref.target) || present.contains(ref.target)) {
+					continue;
+				}
+				Decl* const* replacement = replacements.find(ref.target);
+				if(replacement == nullptr || ref.ref == nullptr) {
+					return false;
+				}
+				Instantiation* instantiation = ref.ref->GetInstantiation();
+				if(instantiation) {
+					instantiation = instantiations->Intern(cast<TemplatedDecl>(*replacement),
+														  instantiation->GetArgs(), arena);
+				}
+				ref.ref->SetRef(*replacement, instantiation);
+			}
+		}
+		return true;
+	}
+
+private:
+	static const int64 kNone = ~int64(0);
+
+	// End of the declaration starting at begin: after a ; outside
+	// brackets, or after the } closing them and a ; following it
+	static int64 FindItemEnd(const buffer<Token>& tokens, int64 begin) {
+		int64 depth = 0;
+		for(int64 p=begin;p<tokens.len();++p) {
+			const TokenKind kind = tokens[p].kind;
+			if(kind == TokenKind_LParen || kind == TokenKind_LBrace) {
+				++depth;
+			} else if(kind == TokenKind_RParen || kind == TokenKind_RBrace) {
+				if(depth == 0) {
+					return p;
+				}
+				--depth;
+				if(depth == 0 && kind == TokenKind_RBrace) {
+					const bool semi = p + 1 < tokens.len() && tokens[p + 1].kind == TokenKind_Semi;
+					return semi ? p + 2 : p + 1;
+				}
+			} else if(kind == TokenKind_Semi && depth == 0) {
+				return p + 1;
+			}
+		}
+		return tokens.len();
+	}
+
+	void Split(const buffer<Token>& tokens) {
+		buffer<int64> scopes;
+		scopes.push_back(0);
+		int64 p = 0;
+		while(p < tokens.len()) {
+			if(tokens[p].kind == TokenKind_Namespace && p + 2 < tokens.len() &&
+			   tokens[p + 2].kind == TokenKind_LBrace) {
+				scopes.push_back(NestedScope(scopes.back(), tokens[p + 1].content));
+				p += 3;
+			} else if(tokens[p].kind == TokenKind_RBrace && scopes.len() > 1) {
+				scopes.pop_back();
+				++p;
+			} else {
+				ParsedItem item{.scope = scopes.back(),
+								.begin = p,
+								.end = FindItemEnd(tokens, p)};
+				if(item.end == item.begin) {
+					++item.end;
+				}
+				HashItemTokens([&tokens](int64 position) -> const Token& {
+					return tokens[position];
+				}, &item);
+				fresh_.push_back(item);
+				p = item.end;
+			}
+		}
+	}
+
+	// Pairs fresh and previous declarations with the same tokens, or the
+	// same signature, in order
+	void Match(bool by_signature) {
+		auto key = [by_signature](const ParsedItem& item) {
+			return HashCombine(item.scope, by_signature ? item.signature : item.fingerprint);
+		};
+		auto unpaired = [this](int64 o) {
+			return kept_by_[o] == kNone && replaced_by_[o] == kNone;
+		};
+		hash_map<int64, int64> heads;
+		buffer<int64> next;
+		next.resize(previous_.len());
+		for(int64 o=previous_.len();o-- > 0;) {
+			if(!unpaired(o)) {
+				continue;
+			}
+			const int64* head = heads.find(key(previous_[o]));
+			next[o] = head ? *head : kNone;
+			heads.set(key(previous_[o]), o);
+		}
+		for(int64 f=0;f<fresh_.len();++f) {
+			if(kept_[f] != kNone || replaces_[f] != kNone) {
+				continue;
+			}
+			int64* head = heads.find(key(fresh_[f]));
+			if(head == nullptr || *head == kNone) {
+				continue;
+			}
+			const int64 o = *head;
+			*head = next[o];
+			if(by_signature) {
+				Replace(f, o);
+			} else {
+				kept_[f] = o;
+				kept_by_[o] = f;
+			}
+		}
+	}
+
+	void Replace(int64 f, int64 o) {
+		replaces_[f] = o;
+		replaced_by_[o] = f;
+	}
+
+	// Kept declarations referring to one which isn't kept are parsed
+	// again, unless a declaration with the same signature replaces it and
+	// the references can be redirected. Parsing one again makes it a
+	// replacement too, so repeats until nothing changes.
+	void DropStaleReferences() {
+		ref_begins_.resize(fresh_.len());
+		ref_ends_.resize(fresh_.len());
+		for(int64 f=0;f<fresh_.len();++f) {
+			ref_begins_[f] = refs_.len();
+			if(kept_[f] != kNone) {
+				CollectReferences(previous_[kept_[f]].decl, &refs_);
+			}
+			ref_ends_[f] = refs_.len();
+		}
+		bool changed = true;
+		while(changed) {
+			changed = false;
+			for(int64 f=0;f<fresh_.len();++f) {
+				if(kept_[f] != kNone && !CanKeep(f)) {
+					const int64 o = kept_[f];
+					kept_[f] = kNone;
+					kept_by_[o] = kNone;
+					Replace(f, o);
+					changed = true;
+				}
+			}
+		}
+	}
+
+	bool CanKeep(int64 f)const {
+		for(int64 r=ref_begins_[f];r<ref_ends_[f];++r) {
+			const int64* o = previous_index_.find(refs_[r].target);
+			if(o == nullptr || kept_by_[*o] != kNone) {
+				continue;
+			}
+			if(refs_[r].ref == nullptr || replaced_by_[*o] == kNone) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	const buffer<ParsedItem>& previous_;
+	// Declarations in the new tokens, without decl
+	buffer<ParsedItem> fresh_;
+	hash_map<Decl*, int64> previous_index_;
+	// Pairings, kNone where there's none
+	buffer<int64> kept_;
+	buffer<int64> replaces_;
+	buffer<int64> kept_by_;
+	buffer<int64> replaced_by_;
+	// From kept declarations, refs_[ref_begins_[f], ref_ends_[f])
+	buffer<Reference> refs_;
+	buffer<int64> ref_begins_;
+	buffer<int64> ref_ends_;
+};
+
+}  // internal
+
+// Everything parsed from one input. Dropping it frees all of its nodes
+// at once.
+class TranslationUnit {
+public:
+	TranslationUnit(TokenSource& source,
+					ExternalDeclSource* external=nullptr,
+					ParseOptions options=ParseOptions{}) throws(Status)
+		: external_(external), options_(options) {
+		TokenStream tokens(&source);
+		ParseInto(namespace_, tokens, external_, &arena_, options_, &items_,
+				  &instantiations_) throws();
+	}
+	TranslationUnit(const TranslationUnit& other) = delete;
+
+	// Parses an edited version of the input. Declarations in namespaces
+	// whose tokens didn't change are kept rather than parsed again, so the
+	// parsing done is in proportion to the edit.
+	// References from kept declarations to replaced ones are redirected,
+	// where the replacement has the same signature, such as a function
+	// whose body changed. Otherwise the declarations referring to them are
+	// parsed again too.
+	// Replaced nodes stay allocated, and kept ones keep pointing into the
+	// tokens they were parsed from, so every input must outlive the unit.
+	// On failure the unit is left empty, and the next Reparse parses
+	// everything.
+	void Reparse(TokenSource& source) throws(Status) {
+		buffer<Token> tokens;
+		Token token;
+		while(source.Next(&token)) {
+			if(token.kind != TokenKind_LineMarker) {
+				tokens.push_back(token);
+			}
+		}
+
+		internal::ReusePlan plan(items_.items, tokens);
+		ParsedItems items;
+		items.reuse = plan.Reuse();
+		try {
+			ParseKeeping(tokens, &items) throws();
+			if(!plan.Redirect(items.items, &instantiations_, &arena_)) {
+				TRACE(Decl, Info, "Reparse: declarations split unexpectedly, parsing everything\n");
+				items = ParsedItems();
+				ParseKeeping(tokens, &items) throws();
+			}
+		} catch(Status status) {
+			namespace_.Clear();
+			items_ = ParsedItems();
+			throw status;
+		}
+		items_ = std::move(items);
+	}
+
+	const Namespace& GetNamespace()const {
+		return namespace_;
+	}
+	const Arena& GetArena()const {
+		return arena_;
+	}
+	const InstantiationTable& GetInstantiations()const {
+		return instantiations_;
+	}
+
+private:
+	// Parses into the namespaces of the previous parse, as bodies set aside
+	// refer to them
+	void ParseKeeping(const buffer<Token>& tokens, ParsedItems* items) throws(Status) {
+		CollectNamespaces(&namespace_, /*scope=*/0, &items->namespaces);
+		for(auto pair : items->namespaces) {
+			pair.value->Clear();
+		}
+		DeferredTokenSource source(tokens.data(), tokens.len());
+		TokenStream stream(&source);
+		ParseInto(namespace_, stream, external_, &arena_, options_, items,
+				  &instantiations_) throws();
+	}
+
+	static void CollectNamespaces(Namespace* ns, int64 scope,
+								  hash_map<int64, Namespace*>* namespaces) {
+		namespaces->set(scope, ns);
+		for(Namespace* nested : ns->GetNested()) {
+			CollectNamespaces(nested, NestedScope(scope, nested->GetName()), namespaces);
+		}
+	}
+
+	Arena arena_;
+	Namespace namespace_;
+	ExternalDeclSource* external_;
+	ParseOptions options_;
+	ParsedItems items_;
+	InstantiationTable instantiations_;
+};
+
+Namespace Parse(const TokenBuffer& token_buffer) throws(Status) {
+	TokenBufferSource source(token_buffer);
+	return Parse(source);
+}
+
 }  // compiler
 }  // stacklang
 
@@ -2,6 +2,10 @@
 #include "scanner.h"
 
 #include <cstdio>
+#include <string>
+
+// POSIX
+#include <fcntl.h>
 
 
 namespace stacklang {
@@ -46,7 +50,7 @@ int64 CountNodes(compiler::Expr* expr) {
 	void test_body_##__name(string __test_name) 
 
 compiler::Namespace TestParse(const char* src) throws() {
-	vector<string> tokens = compiler::Scan(src) throws();
+	compiler::TokenBuffer tokens = compiler::Scan(src) throws();
 
 	return compiler::Parse(tokens) throws();
 }
@@ -259,12 +263,67 @@ int top(int x, int y) {
 
 	compiler::Expr* top = TestSingleFunctionSingleReturn(src);
 
+	// Left associative: (x+y)-10
 	auto top_op = compiler::AsA<compiler::BinaryOp*>(top);
 	ASSERT(top_op != nullptr);
-	EXPECT_EQ(top_op->GetOp(), "+");
+	EXPECT_EQ(top_op->GetOp(), "-");
+	EXPECT_EQ(compiler::cast<compiler::BinaryOp>(top_op->GetLeft())->GetOp(), "+");
 	EXPECT_EQ(CountNodes(top), 5);
 }
 
+DECLARE_TEST(TestOperatorAssociativity) {
+
+	const char* src = R"(
+int top(int x, int y) {
+	return x = y = -x * 2 - y - 1;
+}
+	)";
+
+	compiler::Expr* top = TestSingleFunctionSingleReturn(src);
+
+	// x = (y = ((((-x)*2)-y)-1))
+	auto top_op = compiler::AsA<compiler::BinaryOp*>(top);
+	ASSERT(top_op != nullptr);
+	EXPECT_EQ(top_op->GetOp(), "=");
+	auto inner_assign = compiler::cast<compiler::BinaryOp>(top_op->GetRight());
+	EXPECT_EQ(inner_assign->GetOp(), "=");
+	auto minus_one = compiler::cast<compiler::BinaryOp>(inner_assign->GetRight());
+	EXPECT_EQ(minus_one->GetOp(), "-");
+	auto minus_y = compiler::cast<compiler::BinaryOp>(minus_one->GetLeft());
+	EXPECT_EQ(minus_y->GetOp(), "-");
+	auto times = compiler::cast<compiler::BinaryOp>(minus_y->GetLeft());
+	EXPECT_EQ(times->GetOp(), "*");
+	Assert(__test_name, compiler::isa<compiler::UnaryOp>(times->GetLeft()));
+	EXPECT_EQ(CountNodes(top), 12);
+}
+
+DECLARE_TEST(LongExpressionChain) {
+	const int64 kTerms = 1000000;
+	std::string src = "int top() { return 1";
+	for(int64 i=1;i<kTerms;++i) {
+		src += i % 3 ? "+1" : "*1";
+	}
+	src += "; }";
+
+	compiler::Expr* top = TestSingleFunctionSingleReturn(src.c_str());
+
+	// Walk the left spine, recursing would overflow on the tree itself
+	int64 terms = 1;
+	compiler::Expr* expr = top;
+	while(auto bop = compiler::dyn_cast<compiler::BinaryOp>(expr)) {
+		EXPECT_EQ(bop->GetOp(), "+");
+		auto right = bop->GetRight();
+		while(auto product = compiler::dyn_cast<compiler::BinaryOp>(right)) {
+			EXPECT_EQ(product->GetOp(), "*");
+			++terms;
+			right = product->GetLeft();
+		}
+		++terms;
+		expr = bop->GetLeft();
+	}
+	EXPECT_EQ(terms, kTerms);
+}
+
 
 DECLARE_TEST(CStyleCast)
 {
@@ -1151,15 +1210,620 @@ int top(int x, Integer y) {
 }
 	)";
 
-	compiler::Expr* top = TestSingleFunctionSingleReturn(src);
+	vector<compiler::Stmt*> body = ParseAndGetTopBody(src);
+	EXPECT_EQ(body.len(), 2);
+	auto* return_stmt = compiler::AsA<compiler::ReturnStmt*>(body[1]);
+	ASSERT(return_stmt != nullptr);
+	compiler::Expr* top = return_stmt->GetValue();
 
 	compiler::DeclRef* decl_ref = nullptr;
 	EXPECT_NOT_NULL(decl_ref = compiler::AsA<compiler::DeclRef*>(top));
 	compiler::VarDecl* param_decl = nullptr;
 	EXPECT_NOT_NULL(param_decl = compiler::AsA<compiler::VarDecl*>(decl_ref->GetRef()));
-	compiler::TypedefDecl* typedef_decl = nullptr;
-	EXPECT_NOT_NULL(typedef_decl = compiler::AsA<compiler::TypedefDecl*>(param_decl->GetType()));
-	EXPECT_EQ(typedef_decl->GetName(), "Integer");
+	compiler::UsingDecl* using_decl = nullptr;
+	EXPECT_NOT_NULL(using_decl = compiler::AsA<compiler::UsingDecl*>(param_decl->GetType()));
+	ASSERT(using_decl != nullptr);
+	EXPECT_EQ(using_decl->GetName(), "Integer");
+}
+
+DECLARE_TEST(HexLiteral)
+{
+	const char* src = R"(
+int top(int x) {
+	return 0x10 + x;
+}
+	)";
+
+	compiler::Expr* top = TestSingleFunctionSingleReturn(src);
+
+	auto top_op = compiler::AsA<compiler::BinaryOp*>(top);
+	ASSERT(top_op != nullptr);
+	auto literal = compiler::AsA<compiler::Literal*>(top_op->GetLeft());
+	ASSERT(literal != nullptr);
+	auto value = compiler::AsA<compiler::IntegerValue*>(literal->GetValue());
+	ASSERT(value != nullptr);
+	EXPECT_EQ(value->GetValue(), 16);
+}
+
+DECLARE_TEST(StreamingBoundedLookahead)
+{
+	const char* path = "/tmp/parser_test_streaming_input.cc";
+	FILE* f = fopen(path, "w");
+	const int64 kNumFuncs = 200;
+	for(int64 i=0;i<kNumFuncs;++i) {
+		fprintf(f, "int f%li(int x, int y) {\n\treturn x * %li + y;\n}\n", i, i);
+	}
+	fclose(f);
+
+	int fd = open(path, O_RDONLY);
+	ASSERT(fd >= 0);
+	compiler::Lexer lexer(fd, /*chunk_size=*/256);
+	compiler::TokenStream tokens(&lexer);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	close(fd);
+
+	EXPECT_EQ(parsed.GetDecls().len(), kNumFuncs);
+	// One function is 19 tokens, the whole input is 200x that
+	Assert(__test_name, tokens.MaxBuffered() < 40);
+}
+
+DECLARE_TEST(TranslationUnitArena)
+{
+	const char* src = R"(
+int add(int x, int y) {
+	return x + y * 2;
+}
+)";
+	compiler::TokenBuffer tokens = compiler::Scan(src);
+	compiler::TokenBufferSource source(tokens);
+	compiler::TranslationUnit unit(source);
+
+	vector<compiler::Decl*> decls = unit.GetNamespace().GetDecls();
+	EXPECT_EQ(decls.len(), 1);
+	Assert(__test_name, unit.GetArena().Owns(decls[0]));
+	Assert(__test_name, unit.GetArena().BytesAllocated() > 0);
+}
+
+DECLARE_TEST(KindCasts)
+{
+	auto* param = new compiler::TemplateParam("T", compiler::TemplateParamKind_Type, {});
+	auto* decl = new compiler::StructDecl("S", /*declared_class=*/false, {param}, {}, {});
+	auto* alias = new compiler::UsingAliasDecl("A", decl, {param}, {});
+
+	// Across Decl and Type, through either base
+	compiler::Decl* as_decl = decl;
+	compiler::Type* as_type = compiler::dyn_cast<compiler::Type>(as_decl);
+	Assert(__test_name, as_type == static_cast<compiler::Type*>(decl));
+	Assert(__test_name, compiler::dyn_cast<compiler::Decl>(as_type) == as_decl);
+	Assert(__test_name, compiler::dyn_cast<compiler::TemplatedDecl>(as_type) == decl);
+	Assert(__test_name, compiler::dyn_cast<compiler::StructDecl>(as_type) == decl);
+	EXPECT_NULL(compiler::dyn_cast<compiler::UsingDecl>(as_type));
+
+	compiler::Type* param_type = param;
+	Assert(__test_name, compiler::dyn_cast<compiler::Decl>(param_type) == param);
+	EXPECT_NULL(compiler::dyn_cast<compiler::TemplatedDecl>(param_type));
+
+	compiler::Type* alias_type = alias;
+	Assert(__test_name, compiler::isa<compiler::UsingDecl>(alias_type));
+	Assert(__test_name, compiler::isa<compiler::UsingAliasDecl>(alias_type));
+	Assert(__test_name, compiler::isa<compiler::TemplatedDecl>(alias_type));
+
+	auto* typedef_decl = new compiler::TypedefDecl("I", compiler::IntType::Get(), {});
+	compiler::Stmt* stmt = typedef_decl;
+	Assert(__test_name, compiler::isa<compiler::Type>(stmt));
+	Assert(__test_name, !compiler::isa<compiler::Expr>(stmt));
+	Assert(__test_name, compiler::cast<compiler::Type>(stmt) == static_cast<compiler::Type*>(typedef_decl));
+
+	// Non decl types aren't Stmts
+	compiler::Type* int_type = compiler::IntType::Get();
+	EXPECT_NULL(compiler::dyn_cast<compiler::Decl>(int_type));
+	compiler::Expr* cast_expr = new compiler::CastExpr(compiler::CastType_CStyle, int_type,
+			new compiler::Literal(new compiler::IntegerValue(1), {}), {});
+	Assert(__test_name, compiler::isa<compiler::UnaryOp>(cast_expr));
+	EXPECT_NULL(compiler::dyn_cast<compiler::BinaryOp>(cast_expr));
+	EXPECT_NULL(compiler::dyn_cast<compiler::Type>(cast_expr));
+}
+
+DECLARE_TEST(ParseMemoReplays)
+{
+	compiler::TokenBuffer buffer = compiler::Scan("foo bar");
+	compiler::TokenBufferSource source(buffer);
+	compiler::TokenStream tokens(&source);
+
+	Arena arena;
+	compiler::ParseMemo memo;
+	compiler::Namespace ns;
+	compiler::Context context;
+	context.frames.push_back(compiler::ContextFrame{.in_namespace = &ns});
+	context.arena = &arena;
+	context.memo = &memo;
+	context.AddDecl(new compiler::VarDecl("foo", {}, compiler::IntType::Get(),
+			compiler::VarDeclInitType_None, {}));
+
+	// Not a type, but parses foo as a DeclRef on the way
+	EXPECT_NULL(compiler::ParseType(context, tokens, /*throw_on_fail=*/false));
+	EXPECT_EQ(tokens.Position(), 0);
+	EXPECT_EQ(memo.Hits(), 0);
+
+	compiler::DeclRef* ref = compiler::ParseDeclRef(context, tokens);
+	EXPECT_EQ(memo.Hits(), 1);
+	EXPECT_NOT_NULL(ref);
+	EXPECT_EQ(tokens.Position(), 1);
+
+	// Failure is replayed too
+	tokens.Rewind(0);
+	EXPECT_NULL(compiler::ParseType(context, tokens, /*throw_on_fail=*/false));
+	EXPECT_EQ(memo.Hits(), 2);
+
+	// New declarations invalidate
+	context.AddDecl(new compiler::VarDecl("bar", {}, compiler::IntType::Get(),
+			compiler::VarDeclInitType_None, {}));
+	Assert(__test_name, compiler::ParseDeclRef(context, tokens) != ref);
+	EXPECT_EQ(memo.Hits(), 2);
+}
+
+DECLARE_TEST(SymbolTableShadowing)
+{
+	auto* outer_x = new compiler::VarDecl("x", {}, compiler::IntType::Get(),
+			compiler::VarDeclInitType_None, {});
+	auto* inner_x = new compiler::VarDecl("x", {}, compiler::IntType::Get(),
+			compiler::VarDeclInitType_None, {});
+	auto* y = new compiler::VarDecl("y", {}, compiler::IntType::Get(),
+			compiler::VarDeclInitType_None, {});
+
+	compiler::SymbolTable symbols;
+	symbols.Add("x", outer_x);
+	symbols.PushScope();
+	EXPECT_EQ(symbols.Depth(), 1);
+	Assert(__test_name, symbols.Find("x") == outer_x);
+	Assert(__test_name, !symbols.InScope("x"));
+
+	symbols.Add("x", inner_x);
+	symbols.Add("y", y);
+	Assert(__test_name, symbols.Find("x") == inner_x);
+	Assert(__test_name, symbols.InScope("x"));
+
+	// Removing uncovers the shadowed declaration
+	Assert(__test_name, symbols.Remove("x"));
+	Assert(__test_name, symbols.Find("x") == outer_x);
+	Assert(__test_name, !symbols.Remove("x"));
+	symbols.Add("x", inner_x);
+
+	symbols.PopScope();
+	EXPECT_EQ(symbols.Depth(), 0);
+	Assert(__test_name, symbols.Find("x") == outer_x);
+	EXPECT_NULL(symbols.Find("y"));
+}
+
+DECLARE_TEST(ScopesDontLeak)
+{
+	const char* src = R"(
+int f(int x) {
+	return x;
+}
+int x;
+int g(int y) {
+	return x + y;
+}
+int top(int y) {
+	return y;
+}
+	)";
+
+	// Parameters are gone once their function is done, so x and y can be
+	// declared again
+	compiler::Namespace parsed = TestParse(src);
+	EXPECT_EQ(parsed.GetDecls().len(), 4);
+}
+
+DECLARE_TEST(QualifiedLookup)
+{
+	const char* src = R"(
+namespace outer {
+int x;
+namespace inner {
+int y;
+}
+}
+namespace outer {
+int f(int z) {
+	return x + inner::y + z;
+}
+}
+int top(int x) {
+	return ::outer::f(outer::inner::y) + x;
+}
+	)";
+
+	compiler::Namespace parsed = TestParse(src);
+	EXPECT_EQ(parsed.GetNested().len(), 1);
+	compiler::Namespace* outer = parsed.FindNested("outer");
+	ASSERT(outer != nullptr);
+	// Reopened namespace merged
+	EXPECT_EQ(outer->GetDecls().len(), 2);
+	compiler::Namespace* inner = outer->FindNested("inner");
+	ASSERT(inner != nullptr);
+
+	compiler::Identifier id{.parts = {"inner", "y"}};
+	Assert(__test_name, compiler::GetDeclByIdentifier(outer, id) == inner->FindDecl("y"));
+	id.parts = {"inner", "missing"};
+	EXPECT_NULL(compiler::GetDeclByIdentifier(outer, id));
+
+	auto* top = compiler::AsA<compiler::FuncDecl*>(parsed.FindDecl("top"));
+	ASSERT(top != nullptr);
+	auto* return_stmt = compiler::AsA<compiler::ReturnStmt*>(top->GetBody()[0]);
+	ASSERT(return_stmt != nullptr);
+	auto* sum = compiler::AsA<compiler::BinaryOp*>(return_stmt->GetValue());
+	ASSERT(sum != nullptr);
+	auto* call = compiler::AsA<compiler::FuncCall*>(sum->GetLeft());
+	ASSERT(call != nullptr);
+	Assert(__test_name, call->GetCallee()->GetRef() == outer->FindDecl("f"));
+}
+
+// Generated functions which each call the one before
+std::string ChainedFunctions(int64 count) {
+	std::string src = "int g;\nint f0(int x) {\n\treturn x;\n}\n";
+	for(int64 i=1;i<count;++i) {
+		src += "int f" + std::to_string(i) + "(int x) {\n" +
+			"\tint y = x * " + std::to_string(i) + ";\n" +
+			"\treturn f" + std::to_string(i-1) + "(y + g);\n}\n";
+	}
+	return src;
+}
+
+DECLARE_TEST(ParallelBodies)
+{
+	const int64 kFuncs = 300;
+	std::string src = ChainedFunctions(kFuncs);
+	compiler::TokenBuffer buffer = compiler::Scan(src.c_str());
+
+	compiler::TokenBufferSource inline_source(buffer);
+	compiler::TranslationUnit inline_unit(inline_source);
+
+	compiler::TokenBufferSource parallel_source(buffer);
+	compiler::TranslationUnit parallel_unit(parallel_source, /*external=*/nullptr,
+			compiler::ParseOptions{.bodies = compiler::BodyParsing_Parallel, .threads = 4});
+
+	vector<compiler::Decl*> inline_decls = inline_unit.GetNamespace().GetDecls();
+	vector<compiler::Decl*> parallel_decls = parallel_unit.GetNamespace().GetDecls();
+	EXPECT_EQ(parallel_decls.len(), kFuncs + 1);
+	ASSERT(parallel_decls.len() == inline_decls.len());
+	for(int64 i=1;i<parallel_decls.len();++i) {
+		auto* inline_func = compiler::cast<compiler::FuncDecl>(inline_decls[i]);
+		auto* parallel_func = compiler::cast<compiler::FuncDecl>(parallel_decls[i]);
+		vector<compiler::Stmt*> inline_body = inline_func->GetBody();
+		vector<compiler::Stmt*> parallel_body = parallel_func->GetBody();
+		ASSERT(parallel_body.len() == inline_body.len());
+		auto* ret = compiler::cast<compiler::ReturnStmt>(parallel_body[parallel_body.len() - 1]);
+		EXPECT_EQ(CountNodes(ret->GetValue()),
+				  CountNodes(compiler::cast<compiler::ReturnStmt>(inline_body[inline_body.len() - 1])->GetValue()));
+		Assert(__test_name, parallel_unit.GetArena().Owns(ret));
+		if(i > 1) {
+			// Calls resolve to the previous declaration
+			auto* call = compiler::cast<compiler::FuncCall>(ret->GetValue());
+			Assert(__test_name, call->GetCallee()->GetRef() == parallel_decls[i-1]);
+		}
+	}
+}
+
+DECLARE_TEST(ParallelBodiesFirstFailure)
+{
+	std::string src = ChainedFunctions(50);
+	src += "int bad1() {\n\treturn missing1;\n}\n";
+	src += "int h() {\n\treturn 1;\n}\n";
+	src += "int bad2() {\n\treturn missing2;\n}\n";
+	compiler::TokenBuffer buffer = compiler::Scan(src.c_str());
+	compiler::TokenBufferSource source(buffer);
+	compiler::TokenStream tokens(&source);
+	try {
+		compiler::Parse(tokens, /*external=*/nullptr, /*arena=*/nullptr,
+				compiler::ParseOptions{.bodies = compiler::BodyParsing_Parallel, .threads = 4});
+		FAIL("Expected failure");
+	} catch(Status status) {
+		EXPECT_EQ(status.message, "Couldn't find identifier missing1");
+	}
+}
+
+DECLARE_TEST(LazyBodies)
+{
+	const int64 kFuncs = 300;
+	std::string src = ChainedFunctions(kFuncs);
+	src += "int bad() {\n\treturn missing;\n}\n";
+	compiler::TokenBuffer buffer = compiler::Scan(src.c_str());
+	compiler::TokenBufferSource source(buffer);
+	compiler::TranslationUnit unit(source, /*external=*/nullptr,
+			compiler::ParseOptions{.bodies = compiler::BodyParsing_Lazy});
+
+	vector<compiler::Decl*> decls = unit.GetNamespace().GetDecls();
+	EXPECT_EQ(decls.len(), kFuncs + 2);
+	for(int64 i=1;i<decls.len();++i) {
+		Assert(__test_name, !compiler::cast<compiler::FuncDecl>(decls[i])->IsBodyParsed());
+	}
+
+	// Only what's asked for is parsed
+	const int64 bytes_before = unit.GetArena().BytesAllocated();
+	auto* f5 = compiler::cast<compiler::FuncDecl>(unit.GetNamespace().FindDecl("f5"));
+	vector<compiler::Stmt*> body = f5->GetBody();
+	EXPECT_EQ(body.len(), 2);
+	Assert(__test_name, f5->IsBodyParsed());
+	Assert(__test_name, unit.GetArena().BytesAllocated() > bytes_before);
+	auto* f4 = compiler::cast<compiler::FuncDecl>(unit.GetNamespace().FindDecl("f4"));
+	Assert(__test_name, !f4->IsBodyParsed());
+	auto* call = compiler::cast<compiler::FuncCall>(
+		compiler::cast<compiler::ReturnStmt>(body[1])->GetValue());
+	Assert(__test_name, call->GetCallee()->GetRef() == f4);
+
+	// Errors surface on first access
+	auto* bad = compiler::cast<compiler::FuncDecl>(unit.GetNamespace().FindDecl("bad"));
+	try {
+		bad->GetBody();
+		FAIL("Expected failure");
+	} catch(Status status) {
+		EXPECT_EQ(status.message, "Couldn't find identifier missing");
+	}
+}
+
+compiler::Decl* FindIn(const compiler::TranslationUnit& unit, string name) {
+	return unit.GetNamespace().FindDecl(name);
+}
+
+compiler::FuncCall* ReturnedCall(compiler::Decl* decl) {
+	vector<compiler::Stmt*> body = compiler::cast<compiler::FuncDecl>(decl)->GetBody();
+	return compiler::cast<compiler::FuncCall>(
+		compiler::cast<compiler::ReturnStmt>(body[body.len() - 1])->GetValue());
+}
+
+DECLARE_TEST(ReparseKeepsUnchanged)
+{
+	const int64 kFuncs = 50;
+	std::string src = ChainedFunctions(kFuncs);
+	compiler::TokenBuffer buffer = compiler::Scan(src.c_str());
+	compiler::TokenBufferSource source(buffer);
+	compiler::TranslationUnit unit(source);
+	compiler::Decl* f9 = FindIn(unit, "f9");
+	compiler::Decl* f10 = FindIn(unit, "f10");
+	compiler::Decl* f11 = FindIn(unit, "f11");
+
+	// Only the body of f10 changes
+	std::string edited = src;
+	const std::string from = "x * 10;";
+	edited.replace(edited.find(from), from.size(), "x * 10 + 1;");
+	compiler::TokenBuffer edited_buffer = compiler::Scan(edited.c_str());
+	compiler::TokenBufferSource edited_source(edited_buffer);
+	const int64 bytes_before = unit.GetArena().BytesAllocated();
+	unit.Reparse(edited_source);
+
+	EXPECT_EQ(unit.GetNamespace().GetDecls().len(), kFuncs + 1);
+	Assert(__test_name, FindIn(unit, "f9") == f9);
+	Assert(__test_name, FindIn(unit, "f11") == f11);
+	compiler::Decl* new_f10 = FindIn(unit, "f10");
+	Assert(__test_name, new_f10 != f10);
+	EXPECT_EQ(compiler::cast<compiler::FuncDecl>(new_f10)->GetBody().len(), 2);
+	// The kept caller follows the edited function
+	Assert(__test_name, ReturnedCall(f11)->GetCallee()->GetRef() == new_f10);
+	Assert(__test_name, ReturnedCall(new_f10)->GetCallee()->GetRef() == f9);
+	// Far less than parsing everything again
+	Assert(__test_name, unit.GetArena().BytesAllocated() - bytes_before < bytes_before / 10);
+}
+
+DECLARE_TEST(ReparseSignatureChange)
+{
+	const char* src = R"(
+struct Foo {
+	int a;
+};
+int g;
+int one(int x) {
+	return x;
+}
+int two(int x) {
+	return one(x);
+}
+int three(int x) {
+	return two(x);
+}
+int four(Foo f) {
+	return three(g);
+}
+)";
+	compiler::TokenBuffer buffer = compiler::Scan(src);
+	compiler::TokenBufferSource source(buffer);
+	compiler::TranslationUnit unit(source);
+	compiler::Decl* two = FindIn(unit, "two");
+	compiler::Decl* three = FindIn(unit, "three");
+	compiler::Decl* four = FindIn(unit, "four");
+
+	// Callers of a changed signature are parsed again, and so are users of
+	// a changed struct, while their callers only follow them
+	const char* edited = R"(
+struct Foo {
+	int a;
+	int b;
+};
+int g;
+int one(int y) {
+	return y;
+}
+int two(int x) {
+	return one(x);
+}
+int three(int x) {
+	return two(x);
+}
+int four(Foo f) {
+	return three(g);
+}
+)";
+	compiler::TokenBuffer edited_buffer = compiler::Scan(edited);
+	compiler::TokenBufferSource edited_source(edited_buffer);
+	unit.Reparse(edited_source);
+
+	compiler::Decl* new_two = FindIn(unit, "two");
+	Assert(__test_name, new_two != two);
+	Assert(__test_name, ReturnedCall(new_two)->GetCallee()->GetRef() == FindIn(unit, "one"));
+	Assert(__test_name, FindIn(unit, "three") == three);
+	Assert(__test_name, ReturnedCall(three)->GetCallee()->GetRef() == new_two);
+	Assert(__test_name, FindIn(unit, "four") != four);
+
+	// Removing what's referred to is an error, as in a full parse
+	const char* removed = R"(
+struct Foo {
+	int a;
+	int b;
+};
+int g;
+int three(int x) {
+	return two(x);
+}
+)";
+	compiler::TokenBuffer removed_buffer = compiler::Scan(removed);
+	string full_parse_error;
+	try {
+		TestParse(removed);
+	} catch(Status status) {
+		full_parse_error = status.message;
+	}
+	compiler::TokenBufferSource removed_source(removed_buffer);
+	try {
+		unit.Reparse(removed_source);
+		FAIL("Expected failure");
+	} catch(Status status) {
+		EXPECT_EQ(status.message, full_parse_error);
+	}
+	EXPECT_EQ(unit.GetNamespace().GetDecls().len(), 0);
+}
+
+DECLARE_TEST(ReparseNamespaces)
+{
+	const char* src = R"(
+namespace a {
+int one(int x) {
+	return x;
+}
+}
+int two(int x) {
+	return a::one(x);
+}
+namespace a {
+int three(int x) {
+	return two(x);
+}
+}
+)";
+	compiler::TokenBuffer buffer = compiler::Scan(src);
+	compiler::TokenBufferSource source(buffer);
+	compiler::TranslationUnit unit(source, /*external=*/nullptr,
+			compiler::ParseOptions{.bodies = compiler::BodyParsing_Lazy});
+	compiler::Namespace* a = unit.GetNamespace().FindNested("a");
+	compiler::Decl* two = FindIn(unit, "two");
+	compiler::Decl* three = a->FindDecl("three");
+	ReturnedCall(two);
+	ReturnedCall(three);
+
+	const char* edited = R"(
+namespace a {
+int one(int x) {
+	return x + 1;
+}
+}
+int two(int x) {
+	return a::one(x);
+}
+namespace a {
+int three(int x) {
+	return two(x);
+}
+}
+)";
+	compiler::TokenBuffer edited_buffer = compiler::Scan(edited);
+	compiler::TokenBufferSource edited_source(edited_buffer);
+	unit.Reparse(edited_source);
+
+	// Set aside bodies still find their namespaces
+	Assert(__test_name, unit.GetNamespace().FindNested("a") == a);
+	EXPECT_EQ(a->GetDecls().len(), 2);
+	Assert(__test_name, FindIn(unit, "two") == two);
+	Assert(__test_name, a->FindDecl("three") == three);
+	Assert(__test_name, ReturnedCall(two)->GetCallee()->GetRef() == a->FindDecl("one"));
+	Assert(__test_name, ReturnedCall(three)->GetCallee()->GetRef() == two);
+}
+
+DECLARE_TEST(SharedInstantiations)
+{
+	const char* src = R"(
+template<typename T>
+struct Foo {
+	T a = 3;
+};
+template<int N>
+int bar() {
+	return N;
+}
+int top(Foo<int> v, Foo<int> w) {
+	Foo<int> x(v);
+	return bar<2>() + bar<2>() + bar<1 + 1>() + bar<3>();
+}
+)";
+	compiler::TokenBuffer buffer = compiler::Scan(src);
+	compiler::TokenBufferSource source(buffer);
+	compiler::TranslationUnit unit(source);
+
+	auto* top = compiler::cast<compiler::FuncDecl>(FindIn(unit, "top"));
+	vector<compiler::Instantiation*> bars;
+	compiler::Expr* expr = compiler::cast<compiler::ReturnStmt>(top->GetBody()[1])->GetValue();
+	while(auto* bop = compiler::dyn_cast<compiler::BinaryOp>(expr)) {
+		bars.push_back(compiler::cast<compiler::FuncCall>(bop->GetRight())->GetCallee()->GetInstantiation());
+		expr = bop->GetLeft();
+	}
+	bars.push_back(compiler::cast<compiler::FuncCall>(expr)->GetCallee()->GetInstantiation());
+	// bar<3>, bar<1 + 1>, bar<2>, bar<2>
+	ASSERT(bars.len() == 4);
+	Assert(__test_name, bars[2] == bars[3]);
+	// Arguments are compared as written
+	Assert(__test_name, bars[1] != bars[2]);
+	Assert(__test_name, bars[0] != bars[2]);
+	Assert(__test_name, bars[0]->GetDecl() == FindIn(unit, "bar"));
+	EXPECT_EQ(bars[0]->GetArgs().len(), 1);
+	// With Foo<int>, which every use of shares
+	EXPECT_EQ(unit.GetInstantiations().size(), 4);
+	Assert(__test_name, unit.GetInstantiations().Hits() >= 3);
+}
+
+DECLARE_TEST(UniqueTypes)
+{
+	const char* src = R"(
+template<typename T>
+struct Foo {
+	T a = 3;
+};
+typedef int Integer;
+using Number = Integer;
+int top(Foo<int> v, Foo<int> w, Number n, int i) {
+	Foo<int> x(v);
+	return i;
+}
+)";
+	compiler::TokenBuffer buffer = compiler::Scan(src);
+	compiler::TokenBufferSource source(buffer);
+	compiler::TranslationUnit unit(source);
+
+	auto* top = compiler::cast<compiler::FuncDecl>(FindIn(unit, "top"));
+	vector<compiler::VarDecl*> params = top->GetParameters();
+	ASSERT(params.len() == 4);
+	// Builtins are singletons
+	Assert(__test_name, top->GetReturnType() == params[3]->GetType());
+	Assert(__test_name, compiler::IntType::Get() == params[3]->GetType());
+	// Aliases are the same type as what they name
+	Assert(__test_name, params[2]->GetType() != params[3]->GetType());
+	Assert(__test_name, compiler::SameType(params[2]->GetType(), params[3]->GetType()));
+	Assert(__test_name, !compiler::SameType(params[0]->GetType(), params[3]->GetType()));
+	// One type per specialization
+	auto* foo_int = compiler::dyn_cast<compiler::DeclRefType>(params[0]->GetType());
+	ASSERT(foo_int);
+	Assert(__test_name, params[1]->GetType() == foo_int);
+	auto* x = compiler::cast<compiler::VarDecl>(top->GetBody()[0]);
+	Assert(__test_name, x->GetType() == foo_int);
+	Assert(__test_name, foo_int->GetDeclRef()->GetRef() == FindIn(unit, "Foo"));
 }
 
 // TODO: Using templated
@@ -0,0 +1,515 @@
+#ifndef PREPROCESSOR_H
+#define PREPROCESSOR_H
+
+#include "string.h"
+#include "vector.h"
+#include "buffer.h"
+#include "hash_map.h"
+#include "utils.h"
+#include "scanner.h"
+
+// POSIX
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace stacklang {
+namespace compiler {
+
+string OwnedString(const char* chars, int64 len) {
+	char* storage = new char[len + 1];
+	memcpy(storage, chars, len);
+	storage[len] = 0;
+	return string(storage, len);
+}
+
+// Everything before the last /, or "." if none
+string DirName(string path) {
+	for(int64 i=path.len();i>0;--i) {
+		if(path[i-1] == '/') {
+			return path.substr(0, i-1);
+		}
+	}
+	return ".";
+}
+
+// Backslashes only appear in directives as line continuations
+bool IsSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\\' || c == '\n' || c == '\r';
+}
+
+string TrimSpace(string s) {
+	int64 begin = 0;
+	int64 end = s.len();
+	while(begin < end && IsSpace(s[begin])) {
+		++begin;
+	}
+	while(end > begin && IsSpace(s[end-1])) {
+		--end;
+	}
+	return s.substr(begin, end - begin);
+}
+
+// Leading identifier of s
+string FirstWord(string s) {
+	int64 len = 0;
+	while(len < s.len() && (IsLetter(s[len]) || IsDigit(s[len]) || s[len] == '_')) {
+		++len;
+	}
+	return s.substr(0, len);
+}
+
+// A directive line split into name and the rest, without comments
+struct Directive {
+	string name;
+	string rest;
+};
+
+Directive SplitDirective(string text) {
+	assert(text.len() > 0 && text[0] == '#');
+	text = TrimSpace(text.tail(1));
+	for(int64 i=0;i+1<text.len();++i) {
+		if(text[i] == '/' && (text[i+1] == '/' || text[i+1] == '*')) {
+			text = text.substr(0, i);
+			break;
+		}
+	}
+	string name = FirstWord(text);
+	return Directive{.name = name, .rest = TrimSpace(text.tail(name.len()))};
+}
+
+// A file's tokens before preprocessing, and what's known about its guard
+struct CachedFile {
+	string path;
+	int64 mtime = 0;
+	int64 size = 0;
+	TokenBuffer* tokens = nullptr;
+	// Set if the whole file is inside #ifndef X / #define X ... #endif
+	string guard_macro;
+};
+
+// Token streams of files by path, reused while the file's mtime and size
+// are unchanged. Can be shared between preprocessor runs.
+class HeaderCache {
+public:
+	// Throws if the file can't be read
+	const CachedFile* Get(string path) throws(Status) {
+		struct stat st;
+		if(stat(string(path).c_str(), &st) != 0) {
+			throw Status{.message = string("Couldn't stat ") + path};
+		}
+		CachedFile** found = files_.find(path);
+		if(found && (*found)->mtime == int64(st.st_mtime) && (*found)->size == int64(st.st_size)) {
+			++hits_;
+			return *found;
+		}
+
+		int fd = open(string(path).c_str(), O_RDONLY);
+		if(fd < 0) {
+			throw Status{.message = string("Couldn't open ") + path};
+		}
+		char* contents = new char[st.st_size + 1];
+		int64 got = 0;
+		while(got < int64(st.st_size)) {
+			ssize_t n = read(fd, contents + got, st.st_size - got);
+			if(n <= 0) {
+				break;
+			}
+			got += n;
+		}
+		close(fd);
+		contents[got] = 0;
+
+		auto* file = new CachedFile;
+		file->path = path;
+		file->mtime = st.st_mtime;
+		file->size = st.st_size;
+		file->tokens = new TokenBuffer(Scan(string(contents, got)) throws());
+		file->guard_macro = DetectIncludeGuard(*file->tokens);
+		files_.set(path, file);
+		++loads_;
+		return file;
+	}
+
+	// Number of times a file was read and scanned
+	int64 Loads()const {
+		return loads_;
+	}
+	int64 Hits()const {
+		return hits_;
+	}
+
+private:
+	// Guard macro if the file is #ifndef X, #define X, ..., #endif, else ""
+	static string DetectIncludeGuard(const TokenBuffer& tokens) {
+		int64 first = 0;
+		while(first < tokens.len() && tokens.Kind(first) == TokenKind_LineMarker) {
+			++first;
+		}
+		if(first + 1 >= tokens.len() ||
+		   tokens.Kind(first) != TokenKind_Directive ||
+		   tokens.Kind(first+1) != TokenKind_Directive) {
+			return "";
+		}
+		Directive ifndef = SplitDirective(tokens.Text(first));
+		Directive define = SplitDirective(tokens.Text(first+1));
+		string macro = FirstWord(ifndef.rest);
+		if(ifndef.name != "ifndef" || define.name != "define" ||
+		   macro.empty() || FirstWord(define.rest) != macro) {
+			return "";
+		}
+		// The #endif closing the #ifndef must end the file, with only line
+		// markers after it
+		int64 depth = 0;
+		for(int64 i=first;i<tokens.len();++i) {
+			if(tokens.Kind(i) != TokenKind_Directive) {
+				continue;
+			}
+			string name = SplitDirective(tokens.Text(i)).name;
+			if(name == "if" || name == "ifdef" || name == "ifndef") {
+				++depth;
+			} else if(name == "endif") {
+				if(--depth == 0) {
+					for(int64 j=i+1;j<tokens.len();++j) {
+						if(tokens.Kind(j) != TokenKind_LineMarker) {
+							return "";
+						}
+					}
+					return macro;
+				}
+			} else if(depth == 1 && (name == "else" || name == "elif")) {
+				return "";
+			}
+		}
+		return "";
+	}
+
+	hash_map<string, CachedFile*> files_;
+	int64 loads_ = 0;
+	int64 hits_ = 0;
+};
+
+struct PreprocessorOptions {
+	// Searched in order for <> includes, and after the including file's
+	// directory for "" includes
+	vector<string> include_paths;
+	// Shared between runs if set
+	HeaderCache* cache = nullptr;
+};
+
+// Handles #include, #define/#undef, #ifdef/#ifndef/#else/#endif and
+// #pragma once in front of the parser, which pulls tokens straight out of
+// it. Line markers pass through.
+// Only object-like macros are supported.
+class Preprocessor : public TokenSource {
+public:
+	// Main file read through the cache
+	Preprocessor(string path, PreprocessorOptions options)
+	  : options_(options) {
+		if(options_.cache == nullptr) {
+			options_.cache = new HeaderCache;
+		}
+		PushFile(Canonicalize(path)) throws();
+	}
+	// Main file from any source, path is used for relative includes
+	Preprocessor(TokenSource* main, string path, PreprocessorOptions options)
+	  : options_(options) {
+		if(options_.cache == nullptr) {
+			options_.cache = new HeaderCache;
+		}
+		PushFrame(main, path);
+	}
+	Preprocessor(const Preprocessor& other) = delete;
+
+	bool Next(Token* token) throws(Status) override {
+		for(;;) {
+			Token next;
+			if(!expansions_.empty()) {
+				Expansion& expansion = expansions_.back();
+				if(expansion.next >= expansion.macro->body.len()) {
+					expansion.macro->expanding = false;
+					expansions_.pop_back();
+					continue;
+				}
+				next = expansion.macro->body[expansion.next++];
+				next.loc = expansion.loc;
+			} else {
+				if(frames_.empty()) {
+					return false;
+				}
+				Frame& frame = frames_.back();
+				if(!frame.source->Next(&next)) {
+					if(conditions_.len() != frame.conditions_depth) {
+						throw Status{.message = string("Unterminated conditional in ") + frame.path};
+					}
+					delete frame.owned_source;
+					frames_.pop_back();
+					continue;
+				}
+				next.loc.fileno = frame.fileno;
+
+				if(next.kind == TokenKind_Directive) {
+					HandleDirective(next) throws();
+					continue;
+				}
+			}
+
+			if(!Active()) {
+				continue;
+			}
+
+			if(next.kind == TokenKind_Identifier) {
+				if(Macro** found = macros_.find(next.content)) {
+					Macro* macro = *found;
+					if(macro && !macro->expanding) {
+						macro->expanding = true;
+						expansions_.push_back(Expansion{.macro = macro, .next = 0, .loc = next.loc});
+						continue;
+					}
+				}
+			}
+
+			*token = next;
+			return true;
+		}
+	}
+
+	bool IsDefined(string name)const {
+		const Macro* const* found = macros_.find(name);
+		return found && *found;
+	}
+
+	// Path for LocationRef::fileno
+	string GetFilePath(int64 fileno)const {
+		return files_[fileno];
+	}
+
+	// #includes skipped because of an include guard or #pragma once
+	int64 SkippedIncludes()const {
+		return skipped_includes_;
+	}
+
+private:
+	struct Macro {
+		vector<Token> body;
+		// Not re-expanded inside its own expansion
+		bool expanding = false;
+	};
+
+	struct Expansion {
+		Macro* macro;
+		int64 next;
+		LocationRef loc;
+	};
+
+	struct Frame {
+		TokenSource* source;
+		TokenSource* owned_source;
+		string path;
+		int64 fileno;
+		int64 conditions_depth;
+	};
+
+	struct Condition {
+		bool parent_active;
+		// The current branch
+		bool taken;
+		// Any branch so far
+		bool any_taken;
+		bool seen_else;
+	};
+
+	static string Canonicalize(string path) {
+		char resolved[PATH_MAX];
+		if(realpath(string(path).c_str(), resolved) == nullptr) {
+			return path;
+		}
+		return OwnedString(resolved, strlen(resolved));
+	}
+
+	static bool FileExists(string path) {
+		struct stat st;
+		return stat(string(path).c_str(), &st) == 0 && S_ISREG(st.st_mode);
+	}
+
+	bool Active()const {
+		return conditions_.empty() ||
+			(conditions_.back().parent_active && conditions_.back().taken);
+	}
+
+	void PushFrame(TokenSource* source, string path, TokenSource* owned=nullptr) {
+		files_.push_back(path);
+		frames_.push_back(Frame{.source = source,
+								.owned_source = owned,
+								.path = path,
+								.fileno = files_.len() - 1,
+								.conditions_depth = conditions_.len()});
+	}
+
+	void PushFile(string path) throws(Status) {
+		const CachedFile* file = options_.cache->Get(path) throws();
+		auto* source = new TokenBufferSource(*file->tokens);
+		PushFrame(source, path, source);
+	}
+
+	// Canonical path of an include, throws if not found
+	string ResolveInclude(string name, bool quoted, LocationRef loc) throws(Status) {
+		if(quoted) {
+			string candidate = DirName(frames_.back().path) + "/" + name;
+			if(FileExists(candidate)) {
+				return Canonicalize(candidate);
+			}
+		}
+		for(string dir : options_.include_paths) {
+			string candidate = dir + "/" + name;
+			if(FileExists(candidate)) {
+				return Canonicalize(candidate);
+			}
+		}
+		throw Status{.message = string("Couldn't find include ") + name, .loc = loc};
+	}
+
+	void HandleInclude(Directive directive, LocationRef loc) throws(Status) {
+		string rest = directive.rest;
+		if(rest.len() < 2) {
+			throw Status{.message = "Expected file name after #include", .loc = loc};
+		}
+		const char open = rest[0];
+		const char close = open == '"' ? '"' : '>';
+		if(open != '"' && open != '<') {
+			throw Status{.message = string("Expected \" or < after #include: ") + rest, .loc = loc};
+		}
+		int64 end = 1;
+		while(end < rest.len() && rest[end] != close) {
+			++end;
+		}
+		if(end >= rest.len()) {
+			throw Status{.message = string("Unterminated #include name: ") + rest, .loc = loc};
+		}
+		string path = ResolveInclude(rest.substr(1, end - 1), open == '"', loc) throws();
+
+		if(pragma_once_.contains(path)) {
+			++skipped_includes_;
+			return;
+		}
+		const CachedFile* file = options_.cache->Get(path) throws();
+		if(!file->guard_macro.empty() && IsDefined(file->guard_macro)) {
+			++skipped_includes_;
+			return;
+		}
+		auto* source = new TokenBufferSource(*file->tokens);
+		PushFrame(source, path, source);
+	}
+
+	void HandleDefine(Directive directive, LocationRef loc) throws(Status) {
+		string name = FirstWord(directive.rest);
+		if(name.empty()) {
+			throw Status{.message = "Expected macro name after #define", .loc = loc};
+		}
+		string body_text = directive.rest.tail(name.len());
+		if(!body_text.empty() && body_text[0] == '(') {
+			throw Status{.message = string("Function-like macros aren't supported: ") + name, .loc = loc};
+		}
+		auto* macro = new Macro;
+		Lexer lexer(body_text);
+		Token token;
+		while(lexer.Next(&token)) {
+			macro->body.push_back(token);
+		}
+		macros_.set(name, macro);
+	}
+
+	void HandleDirective(Token token) throws(Status) {
+		// A Lexer reading a file descriptor reuses the text, and macros keep
+		// views into it
+		Directive directive = SplitDirective(directives_.Intern(token.content));
+		const string name = directive.name;
+
+		// Conditionals are tracked even when inactive, to match nesting
+		if(name == "ifdef" || name == "ifndef") {
+			bool defined = IsDefined(FirstWord(directive.rest));
+			const bool taken = (name == "ifdef") == defined;
+			conditions_.push_back(Condition{.parent_active = Active(),
+											.taken = taken,
+											.any_taken = taken,
+											.seen_else = false});
+			return;
+		}
+		if(name == "else") {
+			if(conditions_.empty() || conditions_.back().seen_else) {
+				throw Status{.message = "Unexpected #else", .loc = token.loc};
+			}
+			Condition& condition = conditions_.back();
+			condition.taken = !condition.any_taken;
+			condition.any_taken = true;
+			condition.seen_else = true;
+			return;
+		}
+		if(name == "elif") {
+			if(conditions_.empty() || conditions_.back().seen_else) {
+				throw Status{.message = "Unexpected #elif", .loc = token.loc};
+			}
+			Condition& condition = conditions_.back();
+			if(!condition.parent_active || condition.any_taken) {
+				// Skipped without looking at the expression
+				condition.taken = false;
+				return;
+			}
+			throw Status{.message = "#elif isn't supported", .loc = token.loc};
+		}
+		if(name == "endif") {
+			if(conditions_.empty()) {
+				throw Status{.message = "Unexpected #endif", .loc = token.loc};
+			}
+			conditions_.pop_back();
+			return;
+		}
+		if(name == "if") {
+			if(!Active()) {
+				// Only nesting matters
+				conditions_.push_back(Condition{.parent_active = false,
+												.taken = false,
+												.any_taken = false,
+												.seen_else = false});
+				return;
+			}
+			throw Status{.message = "#if isn't supported", .loc = token.loc};
+		}
+
+		if(!Active()) {
+			return;
+		}
+
+		if(name == "include") {
+			HandleInclude(directive, token.loc) throws();
+		} else if(name == "define") {
+			HandleDefine(directive, token.loc) throws();
+		} else if(name == "undef") {
+			macros_.set(FirstWord(directive.rest), nullptr);
+		} else if(name == "pragma") {
+			if(FirstWord(directive.rest) == "once") {
+				pragma_once_.set(frames_.back().path, true);
+			}
+		} else {
+			throw Status{.message = string("Unknown directive #") + name, .loc = token.loc};
+		}
+	}
+
+	PreprocessorOptions options_;
+	buffer<Frame> frames_;
+	buffer<Expansion> expansions_;
+	buffer<Condition> conditions_;
+	// nullptr after #undef
+	hash_map<string, Macro*> macros_;
+	hash_map<string, bool> pragma_once_;
+	buffer<string> files_;
+	StringInterner directives_;
+	int64 skipped_includes_ = 0;
+};
+
+}  // compiler
+}  // stacklang
+
+#endif//PREPROCESSOR_H
@@ -0,0 +1,342 @@
+#include "preprocessor.h"
+#include "parser.h"
+
+#include <cstdio>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+namespace stacklang {
+namespace {
+
+// clang++ -std=c++1z ./preprocessor_test.cc -o /tmp/preprocessor_test && /tmp/preprocessor_test
+
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+void ExpectEq(vector<string> a, vector<string> b) {
+	if(a.len() != b.len()) {
+		fprintf(stderr, "Expect failed! a size %li b size %li\n", a.len(), b.len());
+		return;
+	}
+	for(int64 idx=0;idx<a.len();++idx) {
+		if(a[idx] != b[idx]) {
+			fprintf(stderr, "Expect failed! a[%li] '%s' != b[%li] '%s'\n",
+				idx, a[idx].c_str(),
+				idx, b[idx].c_str());
+		}
+	}
+}
+
+const char* kDir = "/tmp/preprocessor_test";
+
+string WriteFile(const char* name, const char* contents) {
+	mkdir(kDir, 0755);
+	mkdir((string(kDir) + "/sys").c_str(), 0755);
+	string path = string(kDir) + "/" + name;
+	FILE* f = fopen(path.c_str(), "w");
+	fputs(contents, f);
+	fclose(f);
+	return path;
+}
+
+vector<string> Drain(compiler::Preprocessor& preprocessor) throws(Status) {
+	vector<string> ret;
+	compiler::Token token;
+	while(preprocessor.Next(&token) throws()) {
+		ret.push_back(token.content);
+	}
+	return ret;
+}
+
+void TestDefineAndConditionals() {
+	fprintf(stderr, "--- TestDefineAndConditionals ---\n");
+
+	const char* src = R"(
+#define FLAG_FOO
+#define VALUE 42 // comment
+#ifdef FLAG_FOO
+int foo() { return VALUE; }
+#else
+int bar() { return VALUE; }
+#endif//FLAG_FOO
+#undef VALUE
+#ifndef VALUE
+int VALUE;
+#endif
+	)";
+
+	try {
+		compiler::Lexer lexer(src);
+		compiler::Preprocessor preprocessor(&lexer, "main.cc", {});
+		vector<string> ret = Drain(preprocessor) throws();
+		vector<string> ref{"int", "foo", "(", ")", "{", "return", "42", ";", "}",
+				"int", "VALUE", ";"};
+		ExpectEq(ret, ref);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+	}
+}
+
+void TestUnterminatedConditional() {
+	fprintf(stderr, "--- TestUnterminatedConditional ---\n");
+
+	bool threw = false;
+	try {
+		compiler::Lexer lexer("#ifdef FOO\nint x;\n");
+		compiler::Preprocessor preprocessor(&lexer, "main.cc", {});
+		Drain(preprocessor) throws();
+	} catch(Status error) {
+		threw = true;
+	}
+	Expect(threw);
+}
+
+void TestFromFileDescriptor() {
+	fprintf(stderr, "--- TestFromFileDescriptor ---\n");
+
+	// The lexer reuses the text of directives and line markers, which
+	// macros outlive
+	string path = WriteFile("fd_main.cc",
+		"#define VALUE 42\n"
+		"# 2 \"fd_main.cc\"\n"
+		"#define OTHER 7\n"
+		"int x = VALUE + OTHER;\n");
+	try {
+		int fd = open(path.c_str(), O_RDONLY);
+		compiler::Lexer lexer(fd, /*chunk_size=*/4);
+		compiler::Preprocessor preprocessor(&lexer, "fd_main.cc", {});
+		vector<string> ret;
+		compiler::Token token;
+		while(preprocessor.Next(&token) throws()) {
+			if(token.kind != compiler::TokenKind_LineMarker) {
+				ret.push_back(token.content);
+			}
+		}
+		close(fd);
+		vector<string> ref{"int", "x", "=", "42", "+", "7", ";"};
+		ExpectEq(ret, ref);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+	}
+}
+
+// Tokens of src, or the message of the Status it throws
+vector<string> PreprocessSource(const char* src, string* error) {
+	try {
+		compiler::Lexer lexer(src);
+		compiler::Preprocessor preprocessor(&lexer, "main.cc", {});
+		return Drain(preprocessor);
+	} catch(Status status) {
+		*error = status.message;
+		return {};
+	}
+}
+
+void TestElif() {
+	fprintf(stderr, "--- TestElif ---\n");
+
+	// Only #elif branches which would need evaluating are unsupported
+	string error;
+	ExpectEq(PreprocessSource("#ifdef A\nint a;\n#elif B\nint b;\n#endif\nint c;\n", &error),
+			 vector<string>{});
+	Expect(error == "#elif isn't supported");
+
+	error = "";
+	ExpectEq(PreprocessSource("#define A\n#ifdef A\nint a;\n#elif B\nint b;\n#else\nint e;\n#endif\nint c;\n",
+							  &error),
+			 vector<string>{"int", "a", ";", "int", "c", ";"});
+	Expect(error.empty());
+
+	// Nested in a skipped conditional
+	ExpectEq(PreprocessSource("#ifdef A\n#ifdef X\nint x;\n#elif Y\nint y;\n#else\nint z;\n#endif\n"
+							  "#endif\nint c;\n", &error),
+			 vector<string>{"int", "c", ";"});
+	Expect(error.empty());
+}
+
+void TestIncludeGuards() {
+	fprintf(stderr, "--- TestIncludeGuards ---\n");
+
+	WriteFile("guarded.h", R"(
+#ifndef GUARDED_H
+#define GUARDED_H
+int guarded;
+#endif//GUARDED_H
+)");
+	WriteFile("sys/once.h", R"(
+#pragma once
+int once;
+)");
+	string main = WriteFile("main.cc", R"(
+#include "guarded.h"
+#include <once.h>
+#include "guarded.h"
+#include <once.h>
+int main;
+)");
+
+	try {
+		compiler::HeaderCache cache;
+		compiler::PreprocessorOptions options;
+		options.include_paths.push_back(string(kDir) + "/sys");
+		options.cache = &cache;
+		compiler::Preprocessor preprocessor(main, options);
+		vector<string> ret = Drain(preprocessor) throws();
+		vector<string> ref{"int", "guarded", ";", "int", "once", ";", "int", "main", ";"};
+		ExpectEq(ret, ref);
+		ExpectEq(preprocessor.SkippedIncludes(), 2);
+		// Each file read once
+		ExpectEq(cache.Loads(), 3);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+	}
+}
+
+void TestNotIncludeGuards() {
+	fprintf(stderr, "--- TestNotIncludeGuards ---\n");
+
+	// Code after the #endif, even in a conditional, runs on every include
+	string trailing = WriteFile("trailing.h", R"(
+#ifndef TRAILING_H
+#define TRAILING_H
+int trailing;
+#endif
+#ifdef Y
+int y;
+#endif
+)");
+	string undef = WriteFile("undef.h", R"(
+#ifndef UNDEF_H
+#define UNDEF_H
+int undef;
+#endif
+#undef UNDEF_H
+)");
+	string main = WriteFile("not_guarded.cc", R"(
+#define Y
+#include "trailing.h"
+#include "trailing.h"
+#include "undef.h"
+#include "undef.h"
+)");
+
+	try {
+		compiler::HeaderCache cache;
+		compiler::PreprocessorOptions options;
+		options.cache = &cache;
+		Expect(cache.Get(trailing)->guard_macro.empty());
+		Expect(cache.Get(undef)->guard_macro.empty());
+		compiler::Preprocessor preprocessor(main, options);
+		vector<string> ret = Drain(preprocessor) throws();
+		vector<string> ref{"int", "trailing", ";", "int", "y", ";", "int", "y", ";",
+				"int", "undef", ";", "int", "undef", ";"};
+		ExpectEq(ret, ref);
+		ExpectEq(preprocessor.SkippedIncludes(), 0);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+	}
+}
+
+void TestMissingInclude() {
+	fprintf(stderr, "--- TestMissingInclude ---\n");
+
+	string main = WriteFile("missing.cc", "#include <not_there.h>\n");
+	bool threw = false;
+	try {
+		compiler::Preprocessor preprocessor(main, {});
+		Drain(preprocessor) throws();
+	} catch(Status error) {
+		threw = true;
+	}
+	Expect(threw);
+}
+
+void TestCacheInvalidation() {
+	fprintf(stderr, "--- TestCacheInvalidation ---\n");
+
+	string header = WriteFile("cached.h", "int first;\n");
+	string main = WriteFile("cached.cc", "#include \"cached.h\"\n");
+
+	try {
+		compiler::HeaderCache cache;
+		compiler::PreprocessorOptions options;
+		options.cache = &cache;
+		{
+			compiler::Preprocessor preprocessor(main, options);
+			ExpectEq(Drain(preprocessor), vector<string>{"int", "first", ";"});
+		}
+		ExpectEq(cache.Loads(), 2);
+		{
+			// Unchanged files come from the cache
+			compiler::Preprocessor preprocessor(main, options);
+			ExpectEq(Drain(preprocessor), vector<string>{"int", "first", ";"});
+		}
+		ExpectEq(cache.Loads(), 2);
+
+		WriteFile("cached.h", "int second;\n");
+		struct utimbuf times = {.actime = 1, .modtime = 1};
+		utime(header.c_str(), &times);
+		{
+			compiler::Preprocessor preprocessor(main, options);
+			ExpectEq(Drain(preprocessor), vector<string>{"int", "second", ";"});
+		}
+		ExpectEq(cache.Loads(), 3);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+	}
+}
+
+void TestParse() {
+	fprintf(stderr, "--- TestParse ---\n");
+
+	WriteFile("decls.h", R"(
+#pragma once
+#define RESULT 3
+int helper(int x);
+)");
+	string main = WriteFile("parse.cc", R"(
+#include "decls.h"
+int top() {
+	return helper(RESULT);
+}
+)");
+
+	try {
+		compiler::Preprocessor preprocessor(main, {});
+		compiler::Namespace ns = compiler::Parse(preprocessor) throws();
+		ExpectEq(ns.GetDecls().len(), 2);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+	}
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestDefineAndConditionals();
+	stacklang::TestUnterminatedConditional();
+	stacklang::TestFromFileDescriptor();
+	stacklang::TestElif();
+	stacklang::TestIncludeGuards();
+	stacklang::TestNotIncludeGuards();
+	stacklang::TestMissingInclude();
+	stacklang::TestCacheInvalidation();
+	stacklang::TestParse();
+	return 0;
+}
@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z -pthread ./preprocessor_test.cc -o /tmp/preprocessor_test
+/tmp/preprocessor_test
@@ -3,13 +3,27 @@
 
 #include "string.h"
 #include "vector.h"
+#include "buffer.h"
 #include "set.h"
 #include "utils.h"
 #include "tokens.h"
+#include "hash_map.h"
+
+// POSIX
+#include <unistd.h>
 
 namespace stacklang {
 namespace compiler {
 
+bool IsDigit(char c) {
+	return (c >= '0') && (c <= '9');
+}
+
+bool IsLetter(char c) {
+	return ((c >= 'a') && (c <= 'z')) ||
+		   ((c >= 'A') && (c <= 'Z'));
+}
+
 set<char> init_word_chars() {
 	set<char> ret{'_'};
 	for(char c='a';c<='z';++c) {
@@ -34,136 +48,557 @@ set<char> init_special_chars(set<string> special_tokens) {
 	return ret;
 }
 
-void filter_tokens(set<string>& tokens, int64 idx, char c) {
-	set<string> ret;
-	for(string t : tokens) {
-		if(idx >= t.len()) {
-			continue;
+enum char_type {
+	char_type_null=0,
+	char_type_whitespace=1,
+	char_type_word=2,
+	char_type_special=3
+};
+
+struct CharClassTable {
+	char_type types[256] = {};
+
+	CharClassTable() {
+		for(char c : init_word_chars()) {
+			types[(unsigned char)c] = char_type_word;
+		}
+		for(char c : set<char>{' ', '\t', '\n', '\r'}) {
+			types[(unsigned char)c] = char_type_whitespace;
 		}
-		if(t[idx] == c) {
-			ret.add(t);
+		for(char c : init_special_chars(GetAllSpecialTokens())) {
+			types[(unsigned char)c] = char_type_special;
 		}
 	}
-	tokens = ret;
-}
+};
 
-vector<string> Scan(string input) throws (Status) {
-	const set<string> special_tokens = GetAllSpecialTokens();
-	const set<char> special_chars = init_special_chars(special_tokens);
-	const set<char> whitespaces{' ', '\t', '\n', '\r'};
-	const set<char> word_chars = init_word_chars();
+const CharClassTable& GetCharClassTable() {
+	static const CharClassTable table;
+	return table;
+}
 
-	enum char_type {
-		char_type_null=0,
-		char_type_whitespace=1,
-		char_type_word=2,
-		char_type_special=3
-	};
+// Decodes decimal, hex (0x), octal (0) and binary (0b) integer literals,
+// with an optional u/U and l/L/ll/LL suffix in either order.
+// Returns false if malformed or out of range.
+bool DecodeIntLiteral(const char* text, int64 len, int64* value) {
+	int64 base = 10;
+	int64 pos = 0;
+	if(len >= 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+		base = 16;
+		pos = 2;
+	} else if(len >= 2 && text[0] == '0' && (text[1] == 'b' || text[1] == 'B')) {
+		base = 2;
+		pos = 2;
+	} else if(len >= 2 && text[0] == '0' && IsDigit(text[1])) {
+		base = 8;
+		pos = 1;
+	}
 
-	auto classify_char = [special_chars, whitespaces, word_chars](char c) -> char_type {
-		if(special_chars.contains(c)) {
-			return char_type_special;
+	const int64 digits_start = pos;
+	int64 ret = 0;
+	for(;pos < len;++pos) {
+		const char c = text[pos];
+		int64 digit = base;
+		if(IsDigit(c)) {
+			digit = c - '0';
+		} else if(base == 16 && c >= 'a' && c <= 'f') {
+			digit = c - 'a' + 10;
+		} else if(base == 16 && c >= 'A' && c <= 'F') {
+			digit = c - 'A' + 10;
+		} else {
+			break;
+		}
+		if(digit >= base) {
+			return false;
 		}
-		if(whitespaces.contains(c)) {
-			return char_type_whitespace;
+		// int64 is unsigned, so this catches wrap around
+		if(ret > (~int64(0) - digit) / base) {
+			return false;
 		}
-		if(word_chars.contains(c)) {
-			return char_type_word;
+		ret = ret * base + digit;
+	}
+	if(pos == digits_start) {
+		return false;
+	}
+
+	bool seen_unsigned = false;
+	bool seen_long = false;
+	while(pos < len) {
+		const char c = text[pos];
+		if((c == 'u' || c == 'U') && !seen_unsigned) {
+			seen_unsigned = true;
+			++pos;
+		} else if((c == 'l' || c == 'L') && !seen_long) {
+			seen_long = true;
+			++pos;
+			// ll or LL, not mixed case
+			if(pos < len && text[pos] == c) {
+				++pos;
+			}
+		} else {
+			return false;
 		}
-		return char_type_null;
-	};
+	}
+
+	*value = ret;
+	return true;
+}
 
-	vector<string> ret;
+struct Token {
+	TokenKind kind = TokenKind_Null;
+	string content;
+	LocationRef loc;
+	// Decoded value of TokenKind_IntLiteral
+	int64 value = 0;
+};
 
-	set<string> remaining_special_tokens;
-	string current_token = "";
+// Produces tokens on demand
+class TokenSource {
+public:
+	virtual ~TokenSource() {}
+	// Returns false at the end of input
+	virtual bool Next(Token* token) throws(Status) = 0;
+};
 
-	auto complete_token = [&ret, &current_token]() {
-		if(current_token.len()) {
-			ret.push_back(current_token);
-			current_token = "";
+// Owned copies of strings, one per distinct value
+class StringInterner {
+public:
+	string Intern(string s) {
+		if(const string* found = strings_.find(s)) {
+			return *found;
 		}
-	};
+		char* storage = new char[s.len() + 1];
+		memcpy(storage, s.data(), s.len());
+		storage[s.len()] = 0;
+		string copy(storage, s.len());
+		strings_.set(copy, copy);
+		return copy;
+	}
+	int64 size()const {
+		return strings_.size();
+	}
+private:
+	hash_map<string, string> strings_;
+};
 
-	auto read_line_marker = [&input, &ret]() {
-		string token = "";
-		while(!input.empty()) {
-			char next = input[0];
-			input = input.tail(1);
-			if(next == '\n') {
-				break;
-			}
-			token = token + next;
-		}
-		ret.push_back(token);
-	};
+// Pull-based lexer.
+// Token text from an in-memory source is a view into it. When reading from a
+// file descriptor, only a window of the input is kept, and names and
+// literals are interned so they outlive the window. Line markers and
+// directives, which are mostly distinct, are copied to a scratch buffer
+// instead, and their text only lasts until the next token.
+class Lexer : public TokenSource {
+public:
+	// first_lineno is for sources cut out of a larger file
+	Lexer(string source, int64 first_lineno=1)
+	  : chars_(source.data()), end_(source.len()), eof_(true), lineno_(first_lineno) {
+	}
+	Lexer(int fd, int64 chunk_size=64*1024)
+	  : fd_(fd), chunk_size_(chunk_size) {
+		assert(chunk_size_ > 0);
+		chars_ = window_.data();
+	}
+	Lexer(const Lexer& other) = delete;
+
+	bool Next(Token* token) throws(Status) override {
+		const CharClassTable& classes = GetCharClassTable();
 
-	int64 debug_last_len = -1;
-	char_type last_type = char_type_null;
+		for(;;) {
+			if(!Ensure(1)) {
+				return false;
+			}
+			const char next = chars_[pos_];
+			int64 len = 0;
+			TokenKind kind = TokenKind_Null;
 
-	while(!input.empty()) {
-		assert(input.len() != debug_last_len);
-		debug_last_len = input.len();
+			// Line marker or directive, to the end of the line
+			if(next == '#') {
+				bool line_marker = false;
+				bool seen_non_space = false;
+				while(Ensure(len + 1) && chars_[pos_ + len] != '\n') {
+					const char c = chars_[pos_ + len];
+					// Backslash newline continues the directive
+					if(c == '\\' && Ensure(len + 2) && chars_[pos_ + len + 1] == '\n') {
+						len += 2;
+						continue;
+					}
+					if(len > 0 && !seen_non_space && c != ' ' && c != '\t') {
+						seen_non_space = true;
+						line_marker = IsDigit(c);
+					}
+					++len;
+				}
+				Emit(line_marker ? TokenKind_LineMarker : TokenKind_Directive, len, token);
+				// Count continued lines
+				for(int64 i=pos_ - len;i<pos_;++i) {
+					if(chars_[i] == '\n') {
+						++lineno_;
+						line_start_ = base_ + i + 1;
+					}
+				}
+				return true;
+			}
 
-		char next = input[0];
+			// Comments
+			if(next == '/' && Ensure(2) && chars_[pos_ + 1] == '/') {
+				while(Ensure(1) && chars_[pos_] != '\n') {
+					++pos_;
+				}
+				continue;
+			}
+			if(next == '/' && Ensure(2) && chars_[pos_ + 1] == '*') {
+				const LocationRef comment_loc{.fileno = 0, .lineno = lineno_,
+											  .colno = base_ + pos_ - line_start_ + 1};
+				pos_ += 2;
+				while(!(Ensure(2) && chars_[pos_] == '*' && chars_[pos_ + 1] == '/')) {
+					if(!Ensure(1)) {
+						throw Status{.message="Unterminated comment", .loc=comment_loc};
+					}
+					if(chars_[pos_] == '\n') {
+						++lineno_;
+						line_start_ = base_ + pos_ + 1;
+					}
+					++pos_;
+				}
+				pos_ += 2;
+				continue;
+			}
 
-		// Special line marker mode
-		if(next == '#') {
-			read_line_marker();
-			continue;
+			switch(classes.types[(unsigned char)next]) {
+				case char_type_whitespace:
+					++pos_;
+					if(next == '\n') {
+						++lineno_;
+						line_start_ = base_ + pos_;
+					}
+					continue;
+				case char_type_word:
+					len = 1;
+					while(Ensure(len + 1) &&
+						  classes.types[(unsigned char)chars_[pos_ + len]] == char_type_word) {
+						++len;
+					}
+					kind = IsDigit(next) ? TokenKind_IntLiteral
+										 : KeywordKind(chars_ + pos_, len);
+					return Emit(kind, len, token);
+				case char_type_special:
+					// Longest special token is 3 chars
+					Ensure(3);
+					kind = MatchSpecialToken(chars_ + pos_, end_ - pos_, &len);
+					if(kind == TokenKind_Null) {
+						break;
+					}
+					return Emit(kind, len, token);
+				default:
+					break;
+			}
+			throw Status{.message=string("Didn't know what to do with char: ") + next,
+						 .loc=LocationRef{.fileno = 0, .lineno = lineno_,
+										  .colno = base_ + pos_ - line_start_ + 1}};
 		}
+	}
 
-		char_type next_type = classify_char(next);
-		input = input.tail(1);
+	// Offset from the start of the input of the last token returned
+	int64 LastOffset()const {
+		return last_offset_;
+	}
 
-		if(next_type != last_type) {
-			complete_token();
-		}
-		last_type = next_type;
+private:
+	bool Emit(TokenKind kind, int64 len, Token* token) throws(Status) {
+		last_offset_ = base_ + pos_;
+		const LocationRef loc{.fileno = 0, .lineno = lineno_,
+							  .colno = last_offset_ - line_start_ + 1};
+		string text(chars_ + pos_, len);
 
-		if(next_type == char_type_whitespace) {
-			continue;
+		int64 value = 0;
+		if(kind == TokenKind_IntLiteral && !DecodeIntLiteral(chars_ + pos_, len, &value)) {
+			throw Status{.message=string("Invalid integer literal: ") + text, .loc=loc};
 		}
 
-		if(next_type == char_type_word) {
-			current_token = current_token + next;
-			continue;
+		if(fd_ >= 0) {
+			if(kind == TokenKind_LineMarker || kind == TokenKind_Directive) {
+				scratch_.resize(len);
+				memcpy(scratch_.data(), chars_ + pos_, len);
+				text = string(scratch_.data(), len);
+			} else {
+				text = (kind == TokenKind_Identifier ||
+						kind == TokenKind_IntLiteral) ? interner_.Intern(text)
+													  : string(TokenKindSpelling(kind));
+			}
 		}
+		*token = Token{.kind = kind,
+					   .content = text,
+					   .loc = loc,
+					   .value = value};
+		pos_ += len;
+		return true;
+	}
 
-		if(next_type == char_type_special) {
-			if(current_token.empty()) {
-				remaining_special_tokens = special_tokens;
+	// Makes n chars available from pos_, unless the input ends first
+	bool Ensure(int64 n) throws(Status) {
+		if(pos_ + n <= end_) {
+			return true;
+		}
+		if(eof_) {
+			return false;
+		}
+		// Drop consumed chars. The window is empty before the first read.
+		if(end_ > pos_) {
+			memmove(window_.data(), window_.data() + pos_, end_ - pos_);
+		}
+		base_ += pos_;
+		end_ -= pos_;
+		pos_ = 0;
+		while(end_ < n && !eof_) {
+			if(window_.len() < end_ + chunk_size_) {
+				window_.resize(end_ + chunk_size_);
 			}
-			filter_tokens(remaining_special_tokens, current_token.len(), next);
-
-			// Several special tokens one after another
-			if(remaining_special_tokens.size() == 0) {
-				complete_token();
-				// Put it back
-				input = string(next) + input;
-				debug_last_len = 0;
-				continue;
+			ssize_t got = read(fd_, window_.data() + end_, chunk_size_);
+			if(got < 0) {
+				throw Status{.message="Failed to read input"};
 			}
+			if(got == 0) {
+				eof_ = true;
+			}
+			end_ += got;
+		}
+		chars_ = window_.data();
+		return n <= end_;
+	}
 
-			current_token = current_token + next;
+	const char* chars_ = nullptr;
+	// Absolute offset of chars_[0]
+	int64 base_ = 0;
+	int64 pos_ = 0;
+	int64 end_ = 0;
+	bool eof_ = false;
 
-			if(remaining_special_tokens.size() == 1) {
-				assert(current_token == *remaining_special_tokens.begin());
-				complete_token();
+	int fd_ = -1;
+	int64 chunk_size_ = 0;
+	buffer<char> window_;
+	StringInterner interner_;
+	// Text of the last line marker or directive
+	buffer<char> scratch_;
+
+	int64 lineno_ = 1;
+	int64 line_start_ = 0;
+	int64 last_offset_ = 0;
+};
+
+// Struct-of-arrays token storage.
+// Token text isn't copied, it's a view into the source.
+class TokenBuffer {
+public:
+	TokenBuffer(string source) : source_(source) {
+		line_starts_.push_back(0);
+		const char* chars = source.data();
+		for(int64 i=0;i<source.len();++i) {
+			if(chars[i] == '\n') {
+				line_starts_.push_back(i + 1);
 			}
+		}
+	}
+	TokenBuffer(TokenBuffer&& other) = default;
 
-			continue;
+	int64 len()const {
+		return kinds_.len();
+	}
+	bool empty()const {
+		return kinds_.empty();
+	}
+	TokenKind Kind(int64 index)const {
+		return TokenKind(kinds_[index]);
+	}
+	int64 Offset(int64 index)const {
+		return offsets_[index];
+	}
+	int64 Length(int64 index)const {
+		return lengths_[index];
+	}
+	// Decoded value of TokenKind_IntLiteral, 0 for other kinds
+	int64 Value(int64 index)const {
+		return values_[index];
+	}
+	string Text(int64 index)const {
+		return source_.substr(offsets_[index], lengths_[index]);
+	}
+	LocationRef Loc(int64 index)const {
+		// Last line starting at or before the token
+		const int64 offset = offsets_[index];
+		int64 lo = 0;
+		int64 hi = line_starts_.len();
+		while(hi - lo > 1) {
+			int64 mid = (lo + hi) / 2;
+			if(line_starts_[mid] <= offset) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
 		}
+		return LocationRef{.fileno = 0,
+						   .lineno = lo + 1,
+						   .colno = offset - line_starts_[lo] + 1};
+	}
+	string GetSource()const {
+		return source_;
+	}
+
+	void Append(TokenKind kind, int64 offset, int64 length, int64 value=0) {
+		kinds_.push_back((unsigned char)kind);
+		offsets_.push_back(offset);
+		lengths_.push_back(length);
+		values_.push_back(value);
+	}
 
-		//return Status{.message=string("Didn't know what to do with char: ") + next};
-		throw Status{.message=string("Didn't know what to do with char: ") + next};
+	vector<string> Strings()const {
+		vector<string> ret;
+		for(int64 i=0;i<len();++i) {
+			ret.push_back(Text(i));
+		}
+		return ret;
 	}
 
-	complete_token();
+private:
+	string source_;
+	buffer<unsigned char> kinds_;
+	buffer<unsigned int> offsets_;
+	buffer<unsigned int> lengths_;
+	buffer<int64> values_;
+	buffer<int64> line_starts_;
+};
+
+// Replays a TokenBuffer
+class TokenBufferSource : public TokenSource {
+public:
+	TokenBufferSource(const TokenBuffer& tokens) : tokens_(tokens) { }
+	bool Next(Token* token) override {
+		if(next_ >= tokens_.len()) {
+			return false;
+		}
+		*token = Token{.kind = tokens_.Kind(next_),
+					   .content = tokens_.Text(next_),
+					   .loc = tokens_.Loc(next_),
+					   .value = tokens_.Value(next_)};
+		++next_;
+		return true;
+	}
+private:
+	const TokenBuffer& tokens_;
+	int64 next_ = 0;
+};
 
+TokenBuffer Scan(string input) throws (Status) {
+	TokenBuffer ret(input);
+	Lexer lexer(input);
+	Token token;
+	while(lexer.Next(&token)) {
+		ret.Append(token.kind, lexer.LastOffset(), token.content.len(), token.value);
+	}
 	return ret;
 }
 
+// Parser's view of a TokenSource. Skips line markers.
+// Tokens are pulled on demand into a ring buffer. Position() can be saved
+// and passed to Rewind() to backtrack, back to the last Release(), so the
+// ring only holds the region the parser may still backtrack over.
+class TokenStream {
+public:
+	TokenStream(TokenSource* source) : source_(source) {
+		ring_.resize(16);
+	}
+
+	bool empty() {
+		return !Fill(0);
+	}
+	// TokenKind_Null past the end
+	TokenKind Kind(int64 ahead=0) {
+		return Fill(ahead) ? At(pos_ + ahead).kind : TokenKind_Null;
+	}
+	string Text(int64 ahead=0) {
+		return Fill(ahead) ? At(pos_ + ahead).content : string("");
+	}
+	LocationRef Loc(int64 ahead=0) {
+		return Fill(ahead) ? At(pos_ + ahead).loc : LocationRef{};
+	}
+	Token Peek(int64 ahead=0) {
+		return Fill(ahead) ? At(pos_ + ahead) : Token{};
+	}
+	Token Consume() throws(Status) {
+		if(!Fill(0)) {
+			throw Status{.message="No tokens to consume"};
+		}
+		return At(pos_++);
+	}
+
+	int64 Position()const {
+		return pos_;
+	}
+	// Back, or forward to a position that's been buffered
+	void Rewind(int64 position) {
+		assert(position >= base_ && position <= end_);
+		pos_ = position;
+	}
+	// Positions before the current one won't be rewound to
+	void Release() {
+		base_ = pos_;
+	}
+
+	// Most tokens held at once
+	int64 MaxBuffered()const {
+		return max_buffered_;
+	}
+
+private:
+	const Token& At(int64 position)const {
+		return ring_[position & (ring_.len() - 1)];
+	}
+
+	// Pulls until the token ahead of the current one is buffered
+	bool Fill(int64 ahead) throws(Status) {
+		while(pos_ + ahead >= end_) {
+			if(source_done_) {
+				return false;
+			}
+			Token token;
+			do {
+				if(!source_->Next(&token)) {
+					source_done_ = true;
+					return false;
+				}
+			} while(token.kind == TokenKind_LineMarker);
+
+			if(end_ - base_ == ring_.len()) {
+				Grow();
+			}
+			ring_[end_ & (ring_.len() - 1)] = token;
+			++end_;
+			if(end_ - base_ > max_buffered_) {
+				max_buffered_ = end_ - base_;
+			}
+		}
+		return true;
+	}
+
+	void Grow() {
+		buffer<Token> grown;
+		grown.resize(ring_.len() * 2);
+		for(int64 p=base_;p<end_;++p) {
+			grown[p & (grown.len() - 1)] = At(p);
+		}
+		ring_ = std::move(grown);
+	}
+
+	TokenSource* source_;
+	bool source_done_ = false;
+	// Power of two length, indexed by position
+	buffer<Token> ring_;
+	// Oldest position that can be rewound to
+	int64 base_ = 0;
+	// One past the newest buffered position
+	int64 end_ = 0;
+	int64 pos_ = 0;
+	int64 max_buffered_ = 0;
+};
+
 }  // compiler
 }  // stacklang
 
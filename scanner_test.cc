@@ -2,6 +2,9 @@
 
 #include <cstdio>
 
+// POSIX
+#include <fcntl.h>
+
 namespace stacklang {
 namespace {
 
@@ -46,7 +49,7 @@ int add(int x, int y) {
 	)";
 
 	try {
-		vector<string> ret = compiler::Scan(src) throws();
+		vector<string> ret = compiler::Scan(src).Strings() throws();
 
 		vector<string> ref{"int", "add", "(", "int", "x", ",", "int", "y", ")", "{",
 				"return", "x", ">", "y", ";",
@@ -68,7 +71,7 @@ add1<int>(x + y);
 	)";
 
 	try {
-		vector<string> ret = compiler::Scan(src) throws();
+		vector<string> ret = compiler::Scan(src).Strings() throws();
 
 		vector<string> ref{"add1", "<", "int", ">", "(", "x", "+", "y", ")", ";"};
 		ExpectEq(ret, 
@@ -80,6 +83,159 @@ add1<int>(x + y);
 }
 
 
+void TestKinds() {
+	fprintf(stderr, "--- TestKinds ---\n");
+
+	const char* src = R"(
+int add(int x) {
+	return x->y >>= 42;
+}
+	)";
+
+	try {
+		compiler::TokenBuffer ret = compiler::Scan(src) throws();
+
+		vector<compiler::TokenKind> ref{
+			compiler::TokenKind_Int, compiler::TokenKind_Identifier,
+			compiler::TokenKind_LParen, compiler::TokenKind_Int,
+			compiler::TokenKind_Identifier, compiler::TokenKind_RParen,
+			compiler::TokenKind_LBrace, compiler::TokenKind_Return,
+			compiler::TokenKind_Identifier, compiler::TokenKind_Arrow,
+			compiler::TokenKind_Identifier, compiler::TokenKind_GreaterGreaterEqual,
+			compiler::TokenKind_IntLiteral, compiler::TokenKind_Semi,
+			compiler::TokenKind_RBrace};
+		ExpectEq(ret.len(), ref.len());
+		for(int64 i=0;i<ref.len() && i<ret.len();++i) {
+			ExpectEq(ret.Kind(i), ref[i]);
+		}
+		// "42" on line 3
+		ExpectEq(ret.Text(12) == "42", true);
+		ExpectEq(ret.Loc(12).lineno, 3);
+		ExpectEq(ret.Loc(12).colno, 18);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+		exit(1);
+	}
+}
+
+void TestLineMarker() {
+	fprintf(stderr, "--- TestLineMarker ---\n");
+
+	const char* src = R"(
+int add(int x, int y) {
+# 100 foo.c
+	return x >> y;
+} )";
+
+	try {
+		vector<string> ret = compiler::Scan(src).Strings() throws();
+
+		vector<string> ref{"int", "add", "(", "int", "x", ",", "int", "y", ")", "{",
+				"# 100 foo.c",
+				"return", "x", ">>", "y", ";",
+				"}"};
+		ExpectEq(ret, 
+				ref);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+		exit(1);
+	}
+}
+
+void TestLexerFromFile() {
+	fprintf(stderr, "--- TestLexerFromFile ---\n");
+
+	const char* src = R"(
+int add(int x, int yyyyyyyyyyyyyyyy) {
+# 100 foo.c
+	return x >>= yyyyyyyyyyyyyyyy;
+}
+	)";
+
+	const char* path = "/tmp/scanner_test_lexer_input.cc";
+	FILE* f = fopen(path, "w");
+	fputs(src, f);
+	fclose(f);
+
+	try {
+		compiler::TokenBuffer ref = compiler::Scan(src) throws();
+
+		// Chunks smaller than some tokens
+		int fd = open(path, O_RDONLY);
+		compiler::Lexer lexer(fd, /*chunk_size=*/3);
+		compiler::Token token;
+		int64 count = 0;
+		while(lexer.Next(&token)) {
+			if(count < ref.len()) {
+				ExpectEq(token.kind, ref.Kind(count));
+				Expect(token.content == ref.Text(count));
+				ExpectEq(token.loc.lineno, ref.Loc(count).lineno);
+				ExpectEq(token.loc.colno, ref.Loc(count).colno);
+			}
+			++count;
+		}
+		close(fd);
+		ExpectEq(count, ref.len());
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+		exit(1);
+	}
+}
+
+void TestTokenStreamRewind() {
+	fprintf(stderr, "--- TestTokenStreamRewind ---\n");
+
+	compiler::Lexer lexer("a b c d e f g h i j k l m n o p q r s t u v w x y z");
+	compiler::TokenStream tokens(&lexer);
+	Expect(tokens.Text(2) == "c");
+	int64 mark = tokens.Position();
+	for(int64 i=0;i<20;++i) {
+		tokens.Consume();
+	}
+	Expect(tokens.Text() == "u");
+	tokens.Rewind(mark);
+	Expect(tokens.Text() == "a");
+
+	// After release, only lookahead is held
+	tokens.Consume();
+	tokens.Release();
+	while(!tokens.empty()) {
+		tokens.Consume();
+		tokens.Release();
+	}
+	Expect(tokens.MaxBuffered() <= 21);
+	ExpectEq(tokens.Kind(), compiler::TokenKind_Null);
+}
+
+void TestIntLiterals() {
+	fprintf(stderr, "--- TestIntLiterals ---\n");
+
+	const char* src = "42 0x1F 017 0b101 10u 10UL 0xffLLu 0 18446744073709551615";
+	vector<int64> ref{42, 31, 15, 5, 10, 10, 255, 0, 18446744073709551615ul};
+
+	try {
+		compiler::TokenBuffer ret = compiler::Scan(src) throws();
+		ExpectEq(ret.len(), ref.len());
+		for(int64 i=0;i<ref.len() && i<ret.len();++i) {
+			ExpectEq(ret.Kind(i), compiler::TokenKind_IntLiteral);
+			ExpectEq(ret.Value(i), ref[i]);
+		}
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+		exit(1);
+	}
+
+	for(const char* bad : {"5x", "0x", "09", "0b2", "10uu", "10lL", "18446744073709551616"}) {
+		bool threw = false;
+		try {
+			compiler::Scan(bad);
+		} catch(Status error) {
+			threw = true;
+		}
+		Expect(threw);
+	}
+}
+
 #if 0
 void TestSimple2() {
 	fprintf(stderr, "--- TestSimple2 ---\n");
@@ -122,30 +278,40 @@ int add(int x, int y) {
 	}
 }
 
-void TestLineMarker() {
-	fprintf(stderr, "--- TestLineMarker ---\n");
+#endif
 
-	const char* src = R"(
-int add(int x, int y) {
-# 100 foo.c
-	return x >> y;
-} )";
+void TestCommentsAndDirectives() {
+	fprintf(stderr, "--- TestCommentsAndDirectives ---\n");
 
-	status_or<vector<string>> ret = compiler::Scan(src);
+	const char* src = R"(
+#define FOO \
+	1 // not part of it
+# 3 "foo.c"
+int /* a
+b */ x; // trailing
+)";
 
-	if(!ret.ok()) {
-		fprintf(stderr, "failed: %s\n", ret.status().message.c_str());
-		exit(1);
+	try {
+		compiler::TokenBuffer tokens = compiler::Scan(src) throws();
+		ExpectEq(tokens.len(), 5);
+		ExpectEq(tokens.Kind(0), compiler::TokenKind_Directive);
+		Expect(tokens.Text(0) == "#define FOO \\\n\t1 // not part of it");
+		ExpectEq(tokens.Kind(1), compiler::TokenKind_LineMarker);
+		ExpectEq(tokens.Kind(2), compiler::TokenKind_Int);
+		ExpectEq(tokens.Loc(3).lineno, 6);
+		ExpectEq(tokens.Kind(4), compiler::TokenKind_Semi);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
 	}
 
-	vector<string> ref{"int", "add", "(", "int", "x", ",", "int", "y", ")", "{",
-			"# 100 foo.c",
-			"return", "x", ">>", "y", ";",
-			"}"};
-	ExpectEq(ret.value(), 
-			ref);
+	bool threw = false;
+	try {
+		compiler::Scan("int /* x;") throws();
+	} catch(Status error) {
+		threw = true;
+	}
+	Expect(threw);
 }
-#endif
 
 }  // namespace
 }  // namespace stacklang
@@ -153,10 +319,15 @@ int add(int x, int y) {
 int main() {
 	stacklang::TestSimple();
 	stacklang::TestTemplate();
+	stacklang::TestKinds();
+	stacklang::TestLineMarker();
+	stacklang::TestLexerFromFile();
+	stacklang::TestTokenStreamRewind();
+	stacklang::TestIntLiterals();
+	stacklang::TestCommentsAndDirectives();
 #if 0
 	stacklang::TestSimple2();
 	stacklang::TestUnrecognizedSpecial();
-	stacklang::TestLineMarker();
 #endif
 	return 0;
 }
\ No newline at end of file
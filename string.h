@@ -19,6 +19,9 @@ class string {
  		: storage_(literal), 
  		  len_(strlen(literal)) {
  	}
+ 	// View of len chars, which must outlive the string
+ 	string(const char* storage, int64 len) 
+ 		: storage_(storage), len_(len) { }
  	string(char c) {
  		len_ = 1;
  		storage_ = new char(c);
@@ -76,6 +79,10 @@ class string {
  		assert(len_ >= (pos + len));
  		return string(storage_ + pos, len);
  	}
+ 	// Not null terminated
+ 	const char* data()const {
+ 		return storage_;
+ 	}
  	char* c_str() {
  		char* ret = new char[len_+1];
  		memcpy(ret, storage_, len_);
@@ -112,8 +119,6 @@ class string {
  		return iterator(this, len_);
  	}
  private:
- 	string(const char* storage, int64 len) 
- 		: storage_(storage), len_(len) { }
  	const char* storage_ = "";
  	int64 len_ = 0;
 };
@@ -0,0 +1,552 @@
+#ifndef SYSTEM_HEADERS_H
+#define SYSTEM_HEADERS_H
+
+#include "string.h"
+#include "buffer.h"
+#include "hash_map.h"
+#include "utils.h"
+#include "scanner.h"
+#include "parser.h"
+
+namespace stacklang {
+namespace compiler {
+
+// Preprocessed output is mostly system headers, flagged with 3 in their
+// line markers. Skim() only finds the top level declarations in those
+// regions, matching braces rather than lexing, and the parser asks for
+// a declaration's tokens when it's first referenced.
+
+// Whether a line marker like # 12 "file" 1 3 has the given flag
+bool LineMarkerHasFlag(string line, int64 flag) {
+	int64 pos = 1;
+	// Line number
+	while(pos < line.len() && !IsDigit(line[pos])) {
+		++pos;
+	}
+	while(pos < line.len() && IsDigit(line[pos])) {
+		++pos;
+	}
+	// File name
+	while(pos < line.len() && line[pos] != '"') {
+		++pos;
+	}
+	for(++pos;pos < line.len() && line[pos] != '"';++pos) {
+		if(line[pos] == '\\') {
+			++pos;
+		}
+	}
+	// Flags
+	for(++pos;pos < line.len();++pos) {
+		if(IsDigit(line[pos]) && line[pos] - '0' == int(flag) &&
+		   (pos + 1 == line.len() || !IsDigit(line[pos+1]))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Text to lex normally, at the start of a line
+struct SourceRegion {
+	int64 begin;
+	int64 end;
+	int64 lineno;
+};
+
+// A top level declaration found by skimming
+struct SkimmedDecl {
+	string name;
+	// Enclosing namespaces, joined by ::
+	string scope;
+	// scope without inline and unnamed namespaces, which names are found
+	// through
+	string lookup_scope;
+	int64 begin;
+	int64 end;
+	int64 lineno;
+	Decl* parsed = nullptr;
+	// Guards against a declaration referencing itself
+	bool parsing = false;
+};
+
+// Skimmed declarations by qualified name, parsed on request. Unqualified
+// names are looked up in the namespaces of the declaration being parsed,
+// innermost first, so user code only finds global ones.
+class SystemDeclIndex : public ExternalDeclSource {
+public:
+	SystemDeclIndex(string source)
+	  : source_(source), system_(/*name=*/"", /*loc=*/LocationRef{}),
+		empty_(/*name=*/"", /*loc=*/LocationRef{}) {}
+	SystemDeclIndex(const SystemDeclIndex& other) = delete;
+
+	void Add(SkimmedDecl* decl) {
+		decls_.push_back(decl);
+		// The first declaration of a name is the one referenced
+		const string name = Qualify(decl->lookup_scope, decl->name);
+		if(!by_name_.contains(name)) {
+			by_name_.set(name, decl);
+		}
+	}
+
+	int64 len()const {
+		return decls_.len();
+	}
+	const SkimmedDecl* operator[](int64 index)const {
+		return decls_[index];
+	}
+	// By qualified name, like std::size_t, nullptr if not found
+	const SkimmedDecl* Lookup(string name)const {
+		SkimmedDecl* const* found = by_name_.find(name);
+		return found ? *found : nullptr;
+	}
+
+	// name may be qualified
+	Decl* FindDecl(string name) throws(Status) override {
+		SkimmedDecl** found = nullptr;
+		// Namespaces of the declaration being parsed, innermost first
+		for(string scope = scope_;!found && !scope.empty();scope = ParentScope(scope)) {
+			found = by_name_.find(Qualify(scope, name));
+		}
+		if(found == nullptr) {
+			found = by_name_.find(name);
+		}
+		if(found == nullptr) {
+			return nullptr;
+		}
+		SkimmedDecl* skimmed = *found;
+		if(skimmed->parsed || skimmed->parsing) {
+			return skimmed->parsed;
+		}
+
+		skimmed->parsing = true;
+		const string scope = scope_;
+		scope_ = skimmed->lookup_scope;
+		auto parsing_guard = MakeLambdaGuard(
+			[this, skimmed, scope]() {
+				skimmed->parsing = false;
+				scope_ = scope;
+		});
+
+		Lexer lexer(source_.substr(skimmed->begin, skimmed->end - skimmed->begin),
+					skimmed->lineno);
+		TokenStream tokens(&lexer);
+		Context context;
+		// Names are all looked up here, by scope, rather than in system_
+		// which holds every namespace's declarations
+		context.frames.push_back(ContextFrame{.in_namespace = &empty_,
+											  .top_namespace = &empty_});
+		context.external = this;
+		context.arena = &arena_;
+		try {
+			skimmed->parsed = ParseDecl(context, tokens) throws();
+		} catch(Status status) {
+			throw Status{.message = string("Couldn't parse system declaration ") + name +
+									": " + status.message,
+						 .loc = status.loc};
+		}
+		system_.AddDecl(skimmed->parsed);
+		return skimmed->parsed;
+	}
+
+	// Declarations parsed so far
+	const Namespace& Materialized()const {
+		return system_;
+	}
+
+private:
+	static string Qualify(string scope, string name) {
+		return scope.empty() ? name : scope + "::" + name;
+	}
+	// "" for a namespace at the top level
+	static string ParentScope(string scope) {
+		for(int64 i=scope.len()-1;i>0;--i) {
+			if(scope[i] == ':' && scope[i-1] == ':') {
+				return scope.substr(0, i - 1);
+			}
+		}
+		return "";
+	}
+
+	string source_;
+	Arena arena_;
+	buffer<SkimmedDecl*> decls_;
+	hash_map<string, SkimmedDecl*> by_name_;
+	Namespace system_;
+	Namespace empty_;
+	// lookup_scope of the declaration being parsed
+	string scope_ = "";
+};
+
+struct SkimmedSource {
+	string source;
+	// Everything outside system headers, in order
+	buffer<SourceRegion> user_regions;
+	SystemDeclIndex* system_decls;
+	int64 system_bytes = 0;
+};
+
+namespace internal {
+
+// Finds declaration boundaries and names in system header text.
+// Names are a heuristic: the last identifier at the top level before
+// the declarator's parameters, initializer or body, or the (*name) of a
+// function pointer. Typedefs take the last identifier before the ;
+class DeclSkimmer {
+public:
+	DeclSkimmer(string source, SystemDeclIndex* index)
+	  : source_(source), index_(index) {}
+
+	void Word(string word, int64 offset, int64 lineno) {
+		Start(offset, lineno);
+		if(braces_ > 0) {
+			return;
+		}
+		if(parens_ > 0) {
+			if(pointer_declarator_ && parens_ == 1) {
+				name_ = word;
+			}
+			return;
+		}
+		if(words_ == 0) {
+			first_word_ = word;
+		}
+		++words_;
+		if(word == "typedef") {
+			typedef_ = true;
+		} else if(word == "struct" || word == "class" || word == "union" || word == "enum") {
+			needs_semi_ = true;
+		} else if(word == "namespace") {
+			namespace_ = true;
+		} else if(word == "__attribute__" || word == "__asm" || word == "__asm__" ||
+				  word == "throw" || word == "noexcept") {
+			frozen_ = true;
+		} else if(!IsQualifier(word) && !frozen_) {
+			name_ = word;
+		}
+	}
+
+	void Literal(int64 offset, int64 lineno) {
+		Start(offset, lineno);
+		if(braces_ == 0 && parens_ == 0) {
+			++literals_;
+		}
+	}
+
+	// next is the following non-space char, or 0
+	void Punct(char c, char next, int64 offset, int64 lineno) {
+		if(c == ';' && !in_decl_) {
+			return;
+		}
+		if(c == '}' && !in_decl_ && braces_ == 0) {
+			// End of a namespace or extern "C" block
+			if(!scopes_.empty()) {
+				scopes_.pop_back();
+				lookup_scopes_.pop_back();
+			}
+			return;
+		}
+		Start(offset, lineno);
+		const bool top = braces_ == 0 && parens_ == 0;
+		switch(c) {
+			case '(':
+				if(top) {
+					if(next == '*' || next == '&' || next == '^') {
+						pointer_declarator_ = !frozen_;
+					}
+					frozen_ = true;
+				}
+				++parens_;
+				break;
+			case ')':
+				if(parens_ > 0) {
+					--parens_;
+				}
+				if(parens_ == 0) {
+					pointer_declarator_ = false;
+				}
+				break;
+			case '=':
+				if(top) {
+					frozen_ = true;
+					needs_semi_ = true;
+				}
+				break;
+			case '[':
+				if(top) {
+					frozen_ = true;
+				}
+				break;
+			case ':':
+				// Not a qualified name
+				if(top && next != ':' && prev_ != ':') {
+					frozen_ = true;
+				}
+				break;
+			case '{':
+				if(top && IsScopeOpener()) {
+					scopes_.push_back(namespace_ ? name_ : string(""));
+					// Names in inline namespaces are found through the
+					// enclosing one, like those in unnamed namespaces
+					lookup_scopes_.push_back(namespace_ && first_word_ != "inline" ? name_
+																				: string(""));
+					Reset();
+					return;
+				}
+				if(top && !typedef_) {
+					frozen_ = true;
+				}
+				++braces_;
+				break;
+			case '}':
+				if(braces_ > 0) {
+					--braces_;
+				}
+				// Function bodies aren't followed by ;
+				if(braces_ == 0 && parens_ == 0 && !needs_semi_ && !typedef_) {
+					End(offset + 1);
+				}
+				break;
+			case ';':
+				if(top) {
+					End(offset + 1);
+				}
+				break;
+			default:
+				break;
+		}
+		prev_ = c;
+	}
+
+private:
+	static bool IsQualifier(string word) {
+		return word == "extern" || word == "static" || word == "inline" ||
+			word == "const" || word == "volatile" || word == "template" ||
+			word == "typename" || word == "constexpr" || word == "__inline";
+	}
+
+	bool IsScopeOpener()const {
+		if(namespace_) {
+			return first_word_ == "namespace" || first_word_ == "inline";
+		}
+		// extern "C" {
+		return first_word_ == "extern" && words_ == 1 && literals_ == 1;
+	}
+
+	void Start(int64 offset, int64 lineno) {
+		if(!in_decl_) {
+			in_decl_ = true;
+			begin_ = offset;
+			lineno_ = lineno;
+		}
+	}
+
+	void End(int64 end) {
+		if(!name_.empty()) {
+			index_->Add(new SkimmedDecl{.name = name_,
+										.scope = JoinScopes(scopes_),
+										.lookup_scope = JoinScopes(lookup_scopes_),
+										.begin = begin_,
+										.end = end,
+										.lineno = lineno_});
+		}
+		Reset();
+	}
+
+	// Named ones, joined by ::
+	static string JoinScopes(const buffer<string>& scopes) {
+		string scope = "";
+		for(string part : scopes) {
+			if(!part.empty()) {
+				scope = scope.empty() ? part : scope + "::" + part;
+			}
+		}
+		return scope;
+	}
+
+	void Reset() {
+		in_decl_ = false;
+		begin_ = 0;
+		braces_ = 0;
+		parens_ = 0;
+		words_ = 0;
+		literals_ = 0;
+		first_word_ = "";
+		name_ = "";
+		frozen_ = false;
+		typedef_ = false;
+		needs_semi_ = false;
+		namespace_ = false;
+		pointer_declarator_ = false;
+		prev_ = 0;
+	}
+
+	string source_;
+	SystemDeclIndex* index_;
+	buffer<string> scopes_;
+	// Of the same namespaces, see SkimmedDecl::lookup_scope
+	buffer<string> lookup_scopes_;
+
+	bool in_decl_ = false;
+	int64 begin_ = 0;
+	int64 lineno_ = 0;
+	int64 braces_ = 0;
+	int64 parens_ = 0;
+	int64 words_ = 0;
+	int64 literals_ = 0;
+	string first_word_ = "";
+	string name_ = "";
+	bool frozen_ = false;
+	bool typedef_ = false;
+	bool needs_semi_ = false;
+	bool namespace_ = false;
+	bool pointer_declarator_ = false;
+	char prev_ = 0;
+};
+
+}  // internal
+
+// Splits preprocessed source into regions to lex and an index of the
+// declarations in system headers. Doesn't throw; malformed system header
+// text only makes for odd index entries.
+SkimmedSource Skim(string source) {
+	const CharClassTable& classes = GetCharClassTable();
+	const char* chars = source.data();
+	const int64 len = source.len();
+
+	SkimmedSource ret{.source = source,
+					  .system_decls = new SystemDeclIndex(source)};
+	internal::DeclSkimmer skimmer(source, ret.system_decls);
+
+	bool in_system = false;
+	int64 user_begin = 0;
+	int64 user_lineno = 1;
+	int64 system_begin = 0;
+	int64 lineno = 1;
+	int64 pos = 0;
+	while(pos < len) {
+		const char c = chars[pos];
+		if(c == '\n') {
+			++lineno;
+			++pos;
+			continue;
+		}
+
+		if(c == '#' && (pos == 0 || chars[pos-1] == '\n')) {
+			int64 end = pos;
+			while(end < len && chars[end] != '\n') {
+				++end;
+			}
+			string line = source.substr(pos, end - pos);
+			int64 first = pos + 1;
+			while(first < end && (chars[first] == ' ' || chars[first] == '\t')) {
+				++first;
+			}
+			const bool line_marker = first < end && IsDigit(chars[first]);
+			if(line_marker && LineMarkerHasFlag(line, 3) != in_system) {
+				in_system = !in_system;
+				if(in_system) {
+					if(pos > user_begin) {
+						ret.user_regions.push_back(SourceRegion{.begin = user_begin,
+																.end = pos,
+																.lineno = user_lineno});
+					}
+					system_begin = pos;
+				} else {
+					ret.system_bytes += end - system_begin;
+					user_begin = end < len ? end + 1 : len;
+					user_lineno = lineno + 1;
+				}
+			}
+			pos = end;
+			continue;
+		}
+
+		if(!in_system) {
+			++pos;
+			continue;
+		}
+
+		switch(classes.types[(unsigned char)c]) {
+			case char_type_whitespace:
+				++pos;
+				break;
+			case char_type_word: {
+				int64 end = pos + 1;
+				while(end < len && classes.types[(unsigned char)chars[end]] == char_type_word) {
+					++end;
+				}
+				skimmer.Word(source.substr(pos, end - pos), pos, lineno);
+				pos = end;
+				break;
+			}
+			default:
+				if(c == '"' || c == '\'') {
+					skimmer.Literal(pos, lineno);
+					++pos;
+					while(pos < len && chars[pos] != c && chars[pos] != '\n') {
+						pos += chars[pos] == '\\' ? 2 : 1;
+					}
+					++pos;
+					break;
+				}
+				int64 next = pos + 1;
+				while(next < len && (chars[next] == ' ' || chars[next] == '\t')) {
+					++next;
+				}
+				skimmer.Punct(c, next < len ? chars[next] : 0, pos, lineno);
+				++pos;
+				break;
+		}
+	}
+
+	if(in_system) {
+		ret.system_bytes += len - system_begin;
+	} else if(len > user_begin) {
+		ret.user_regions.push_back(SourceRegion{.begin = user_begin,
+												.end = len,
+												.lineno = user_lineno});
+	}
+	return ret;
+}
+
+// Lexes each user region in turn
+class UserRegionSource : public TokenSource {
+public:
+	UserRegionSource(const SkimmedSource& skimmed) : skimmed_(skimmed) {}
+	UserRegionSource(const UserRegionSource& other) = delete;
+	~UserRegionSource() {
+		delete lexer_;
+	}
+
+	bool Next(Token* token) throws(Status) override {
+		while(next_region_ < skimmed_.user_regions.len() || lexer_) {
+			if(lexer_ == nullptr) {
+				const SourceRegion& region = skimmed_.user_regions[next_region_++];
+				lexer_ = new Lexer(skimmed_.source.substr(region.begin, region.end - region.begin),
+								   region.lineno);
+			}
+			if(lexer_->Next(token) throws()) {
+				return true;
+			}
+			delete lexer_;
+			lexer_ = nullptr;
+		}
+		return false;
+	}
+
+private:
+	const SkimmedSource& skimmed_;
+	int64 next_region_ = 0;
+	Lexer* lexer_ = nullptr;
+};
+
+// Parses everything outside system headers, and the system header
+// declarations it references
+Namespace Parse(const SkimmedSource& skimmed) throws(Status) {
+	UserRegionSource source(skimmed);
+	return Parse(source, skimmed.system_decls);
+}
+
+}  // compiler
+}  // stacklang
+
+#endif//SYSTEM_HEADERS_H
@@ -0,0 +1,213 @@
+#include "system_headers.h"
+
+#include <cstdio>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace stacklang {
+namespace {
+
+// clang++ -std=c++1z ./system_headers_test.cc -o /tmp/system_headers_test && /tmp/system_headers_test
+
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+void ExpectEq(string a, string b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! '%s' != '%s'\n",
+			a.c_str(), b.c_str());
+	}
+}
+
+void TestLineMarkerFlags() {
+	fprintf(stderr, "--- TestLineMarkerFlags ---\n");
+	Expect(compiler::LineMarkerHasFlag("# 1 \"/usr/include/stdio.h\" 1 3 4", 3));
+	Expect(compiler::LineMarkerHasFlag("# 1 \"/usr/include/stdio.h\" 3", 3));
+	Expect(!compiler::LineMarkerHasFlag("# 3 \"./preproc.cc\" 2", 3));
+	// Digits in the line number or name aren't flags
+	Expect(!compiler::LineMarkerHasFlag("# 33 \"3\" 1", 3));
+}
+
+void TestSkim() {
+	fprintf(stderr, "--- TestSkim ---\n");
+
+	const char* src = R"(# 1 "main.cc"
+int before;
+# 1 "/usr/include/sys.h" 1 3
+typedef union {
+ char c[128];
+ long long l;
+} mbstate_t;
+typedef int (*handler_t)(int);
+namespace std { inline namespace __1 {
+struct Pair : Base { int first; int second; };
+int inline_def(int x) { if(x) { return 1; } return '}'; }
+} }
+extern "C" {
+int printf(const char * , ...) __attribute__((__format__ (__printf__, 1, 2)));
+extern int errno_value __asm("_errno");
+}
+# 3 "main.cc" 2
+int after;
+)";
+
+	compiler::SkimmedSource skimmed = compiler::Skim(src);
+	const compiler::SystemDeclIndex& index = *skimmed.system_decls;
+	ExpectEq(index.len(), 6);
+	// Names in inline namespaces are found through the enclosing one
+	for(const char* name : {"mbstate_t", "handler_t", "std::Pair", "std::inline_def",
+							"printf", "errno_value"}) {
+		if(index.Lookup(name) == nullptr) {
+			fprintf(stderr, "Expect failed! %s not indexed\n", name);
+		}
+	}
+	Expect(index.Lookup("Pair") == nullptr);
+	const compiler::SkimmedDecl* pair = index.Lookup("std::Pair");
+	if(pair) {
+		ExpectEq(pair->scope, "std::__1");
+		ExpectEq(pair->lineno, 10);
+	}
+	const compiler::SkimmedDecl* printf_decl = index.Lookup("printf");
+	if(printf_decl) {
+		ExpectEq(printf_decl->scope, "");
+	}
+
+	ExpectEq(skimmed.user_regions.len(), 2);
+	try {
+		compiler::UserRegionSource source(skimmed);
+		compiler::TokenStream tokens(&source);
+		vector<compiler::Token> got;
+		while(!tokens.empty()) {
+			got.push_back(tokens.Consume());
+		}
+		ExpectEq(got.len(), 6);
+		if(got.len() == 6) {
+			ExpectEq(got[4].content, "after");
+			// Lines are counted from the start of the file
+			ExpectEq(got[4].loc.lineno, 18);
+		}
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+	}
+}
+
+void TestParseOnReference() {
+	fprintf(stderr, "--- TestParseOnReference ---\n");
+
+	const char* src = R"(# 1 "main.cc"
+# 1 "/usr/include/sys.h" 1 3
+int sys_add(int a, int b) { return a + b; }
+int sys_twice(int a) { return sys_add(a, a); }
+int unused() { return @@@; }
+# 2 "main.cc" 2
+int top() {
+	return sys_twice(3);
+}
+)";
+
+	try {
+		compiler::SkimmedSource skimmed = compiler::Skim(src);
+		compiler::Namespace ns = compiler::Parse(skimmed) throws();
+		ExpectEq(ns.GetDecls().len(), 1);
+		// unused is never lexed
+		ExpectEq(skimmed.system_decls->Materialized().GetDecls().len(), 2);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+	}
+}
+
+void TestQualifiedNames() {
+	fprintf(stderr, "--- TestQualifiedNames ---\n");
+
+	const char* src = R"(# 1 "main.cc"
+# 1 "/usr/include/sys.h" 1 3
+namespace std {
+int add(int a, int b) { return a + b; }
+int twice(int a) { return add(a, a); }
+}
+int add(int a, int b) { return a * b; }
+# 2 "main.cc" 2
+int top() {
+	return add(2, 3) + std::twice(3);
+}
+int other() {
+	return std::add(2, 3);
+}
+)";
+
+	try {
+		compiler::SkimmedSource skimmed = compiler::Skim(src);
+		compiler::Namespace ns = compiler::Parse(skimmed) throws();
+		auto* top = compiler::cast<compiler::FuncDecl>(ns.FindDecl("top"));
+		auto* ret = compiler::cast<compiler::ReturnStmt>(top->GetBody()[0]);
+		auto* plus = compiler::cast<compiler::BinaryOp>(ret->GetValue());
+		// std::add doesn't hide the global add
+		auto* add = compiler::cast<compiler::FuncCall>(plus->GetLeft());
+		ExpectEq(add->GetCallee()->GetRef()->GetLoc().lineno, 7);
+		auto* twice = compiler::cast<compiler::FuncCall>(plus->GetRight());
+		auto* twice_decl = compiler::cast<compiler::FuncDecl>(twice->GetCallee()->GetRef());
+		ExpectEq(twice_decl->GetLoc().lineno, 5);
+		// Inside std, add is std::add
+		auto* twice_ret = compiler::cast<compiler::ReturnStmt>(twice_decl->GetBody()[0]);
+		auto* std_add = compiler::cast<compiler::FuncCall>(twice_ret->GetValue());
+		ExpectEq(std_add->GetCallee()->GetRef()->GetLoc().lineno, 4);
+
+		auto* other = compiler::cast<compiler::FuncDecl>(ns.FindDecl("other"));
+		auto* other_ret = compiler::cast<compiler::ReturnStmt>(other->GetBody()[0]);
+		auto* other_add = compiler::cast<compiler::FuncCall>(other_ret->GetValue());
+		ExpectEq(other_add->GetCallee()->GetRef()->GetLoc().lineno, 4);
+	} catch(Status error) {
+		fprintf(stderr, "failed: %s\n", error.message.c_str());
+	}
+}
+
+void TestPreprocessedFile() {
+	fprintf(stderr, "--- TestPreprocessedFile ---\n");
+
+	int fd = open("preproc.out.cc", O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "failed: couldn't open preproc.out.cc\n");
+		return;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	char* contents = new char[st.st_size];
+	ExpectEq(read(fd, contents, st.st_size), st.st_size);
+	close(fd);
+
+	compiler::SkimmedSource skimmed = compiler::Skim(string(contents, st.st_size));
+	// Nearly everything is system headers
+	Expect(skimmed.system_bytes * 10 > int64(st.st_size) * 9);
+	for(const char* name : {"fprintf", "__darwin_size_t", "FILE", "__mbstate_t",
+							"__sFILEX", "__stderrp"}) {
+		if(skimmed.system_decls->Lookup(name) == nullptr) {
+			fprintf(stderr, "Expect failed! %s not indexed\n", name);
+		}
+	}
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestLineMarkerFlags();
+	stacklang::TestSkim();
+	stacklang::TestParseOnReference();
+	stacklang::TestQualifiedNames();
+	stacklang::TestPreprocessedFile();
+	return 0;
+}
@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z -pthread ./system_headers_test.cc -o /tmp/system_headers_test
+/tmp/system_headers_test
@@ -0,0 +1,123 @@
+#ifndef TEST_PROGRAMS_H
+#define TEST_PROGRAMS_H
+
+#include "types.h"
+
+#include <string>
+
+namespace stacklang {
+namespace testing {
+
+// Programs shared by the tests
+
+// Templates, typedefs, casts, calls and increments, for the AST tests
+const char* kFooProgram = R"(
+template<typename T>
+struct Foo {
+	T a = 3;
+	T b = 1 + a / 2;
+};
+typedef int Integer;
+using Number = Integer;
+template<int N>
+int bar() {
+	return N;
+}
+int sum(int x, int y, int z) {
+	return x + y + z;
+}
+int top(Foo<int> v, Number w) {
+	Foo<int> copy(v);
+	return sum((int)*w, v.a, ++w) * bar<2>() - Foo<int>(1), w++;
+}
+)";
+
+// int top(int x) returning terms copies of term added together, nested on
+// the left
+std::string DeepSum(int64 terms, const char* term = "x") {
+	std::string src = std::string("int top(int x) {\n\treturn ") + term;
+	for(int64 i=1;i<terms;++i) {
+		src += " + ";
+		src += term;
+	}
+	src += ";\n}\n";
+	return src;
+}
+
+// A program of ints whose top gives result when called with 3, or with 3
+// and 4 if it takes two, or throws error if that isn't nullptr
+struct IntProgram {
+	const char* src;
+	int64 result;
+	const char* error = nullptr;
+};
+
+// Run by both the Interpreter and the bytecode VirtualMachine
+const IntProgram kIntPrograms[] = {
+	// From parser_test
+	{"int top(int x, int y) {\n\treturn x + y;\n}\n", 7},
+	{"int top(int x, int y) {\n\treturn 5 * x + y;\n}\n", 19},
+	{"int top(int x, int y) {\n\treturn 5 | x * 3 + y;\n}\n", 13},
+	{"int top(int x, int y) {\n\treturn (x+y)*3;\n}\n", 21},
+	{"int top(int x, int y) {\n\treturn 3 / (x+y);\n}\n", 0},
+	{"int top(int x, int y) {\n\treturn x+y-10;\n}\n", int64(-3)},
+	{"int top(int x, int y) {\n\treturn x = y = -x * 2 - y - 1;\n}\n", int64(-11)},
+	{"int sum(int x, int y, int z) {\n\treturn x + y + z;\n}\n"
+	 "int top(int x, int y) {\n\treturn sum(x, y, 5) * sum(1, 2, 3);\n}\n", 72},
+	{"template <typename T>\nT add1(T x) {\n\treturn x;\n}\n"
+	 "int top(int x, int y) {\n\treturn add1<int>(x + y);\n}\n", 7},
+	{"int top(int x, int y) {\n\tint ret = 0;\n\tret = x + y;\n\treturn ret;\n}\n", 7},
+	{"template<int N>\nint bar() {\n\treturn N;\n}\n"
+	 "int top(int x) {\n\treturn bar<2>() * 10 + bar<1 + 2>();\n}\n", 23},
+	{"typedef int Integer;\nint top(int x, Integer y) {\n\treturn y;\n}\n", 4},
+	{"namespace Space {\nusing Integer = int;\n}\nusing Space::Integer;\n"
+	 "int top(int x, Integer y) {\n\tInteger f = 10;\n\treturn f;\n}\n", 10},
+	{"int top(int x) {\n\treturn 0x10 + x;\n}\n", 19},
+
+	// Operators
+	{"int top(int x, int y) {\n\treturn (x - y) / 2 + (0 - 7) % 3;\n}\n", int64(-1)},
+	{"int top(int x, int y) {\n\treturn (x - y < 0) + (x >= 3) + (x != y) + !y;\n}\n", 3},
+	{"int top(int x, int y) {\n\treturn (-8 >> 1) + (1 << y) + (x ^ y) + ~0;\n}\n", 18},
+	{"int top(int x, int y) {\n\tint a = x++;\n\tint b = ++x;\n"
+	 "\ty -= a;\n\ty *= b;\n\treturn (a, b) * 100 + y + x--;\n}\n", 510},
+	// Short circuits
+	{"int top(int x, int y) {\n\tx && (y = 0);\n\t0 && (x = 0);\n"
+	 "\t1 || (x = 0);\n\treturn x * 10 + y;\n}\n", 30},
+	{"int top(int x, int y) {\n\treturn (int)x + int(y);\n}\n", 7},
+
+	// Recursion
+	{"int fib(int n) {\n\tint r = n;\n"
+	 "\tn > 1 && (r = fib(n - 1) + fib(n - 2));\n\treturn r;\n}\n"
+	 "int top(int x, int y) {\n\treturn fib(x * y + 8);\n}\n", 6765},
+	{"int count(int x, int acc) {\n\tx && (acc = count(x - 1, acc + 1));\n"
+	 "\treturn acc;\n}\n"
+	 "int top(int x, int y) {\n\treturn count(x * 100, y);\n}\n", 304},
+	// Calls in the arguments of calls
+	{"int sum(int x, int y, int z) {\n\treturn x * 100 + y * 10 + z;\n}\n"
+	 "int top(int x, int y) {\n\treturn sum(x, sum(1, y, 2), sum(0, 0, x));\n}\n",
+	 300 + 1420 + 3},
+	// The Recursion parser_test program never stops
+	{"int top(int x) {\n\treturn top(x-1);\n}\n", 0, "Stack overflow calling top"},
+
+	// Template arguments still resolve after a global
+	{"int g = 5;\ntemplate<int N>\nint f(int x) {\n\treturn g + N;\n}\n"
+	 "int top(int x) {\n\treturn f<2>(x);\n}\n", 7},
+
+	// Globals read by functions an initializer calls are set first
+	{"int g = 5;\nint f() {\n\treturn g;\n}\nint h = f();\n"
+	 "int top(int x) {\n\treturn h;\n}\n", 5},
+
+	// Errors
+	{"int top(int x, int y) {\n\treturn x / (y - 4);\n}\n", 0, "Division by zero"},
+	{"int top(int x, int y) {\n\treturn x << 64;\n}\n", 0, "Shift out of range"},
+	{"int top(int x, int y) {\n\treturn *x;\n}\n", 0, "Unary * isn't supported"},
+	{"struct Foo {\n\tint a;\n};\nint top(Foo v, int y) {\n\treturn y;\n}\n", 0,
+	 "Only int values are supported, not Foo"},
+	{"int f(int x);\nint top(int x, int y) {\n\treturn f(x);\n}\n", 0,
+	 "Function f isn't defined"},
+};
+
+}  // namespace testing
+}  // namespace stacklang
+
+#endif//TEST_PROGRAMS_H
@@ -4,10 +4,230 @@
 #include "set.h"
 #include "map.h"
 
+// STL
+#include <initializer_list>
+
 namespace stacklang {
 namespace compiler {
 
+enum TokenKind {
+	TokenKind_Null=0,
+	TokenKind_Identifier,
+	TokenKind_IntLiteral,
+	TokenKind_LineMarker,
+	// Preprocessor directive other than a line marker, such as #include
+	TokenKind_Directive,
+
+	// Keywords
+	TokenKind_Void,
+	TokenKind_Int,
+	TokenKind_Return,
+	TokenKind_Typedef,
+	TokenKind_Template,
+	TokenKind_Typename,
+	TokenKind_Using,
+	TokenKind_Class,
+	TokenKind_Struct,
+	TokenKind_Static,
+	TokenKind_Namespace,
+
+	// Punctuation
+	TokenKind_LParen,
+	TokenKind_RParen,
+	TokenKind_LBrace,
+	TokenKind_RBrace,
+	TokenKind_Comma,
+	TokenKind_Semi,
+	TokenKind_Colon,
+	TokenKind_ColonColon,
+
+	// Operators
+	TokenKind_Star,
+	TokenKind_Slash,
+	TokenKind_Percent,
+	TokenKind_Plus,
+	TokenKind_Minus,
+	TokenKind_LessLess,
+	TokenKind_GreaterGreater,
+	TokenKind_Less,
+	TokenKind_LessEqual,
+	TokenKind_Greater,
+	TokenKind_GreaterEqual,
+	TokenKind_EqualEqual,
+	TokenKind_ExclaimEqual,
+	TokenKind_Amp,
+	TokenKind_Pipe,
+	TokenKind_Caret,
+	TokenKind_AmpAmp,
+	TokenKind_PipePipe,
+	TokenKind_Question,
+	TokenKind_Equal,
+	TokenKind_PlusEqual,
+	TokenKind_MinusEqual,
+	TokenKind_StarEqual,
+	TokenKind_SlashEqual,
+	TokenKind_PercentEqual,
+	TokenKind_AmpEqual,
+	TokenKind_CaretEqual,
+	TokenKind_PipeEqual,
+	TokenKind_GreaterGreaterEqual,
+	TokenKind_LessLessEqual,
+	TokenKind_PlusPlus,
+	TokenKind_MinusMinus,
+	TokenKind_Exclaim,
+	TokenKind_Tilde,
+	TokenKind_Period,
+	TokenKind_Arrow,
+
+	TokenKind_Count
+};
+
+struct TokenSpelling {
+	TokenKind kind;
+	const char* spelling;
+};
 
+// Every token kind with fixed text, keywords first
+const TokenSpelling kTokenSpellings[] = {
+	{TokenKind_Void, "void"},
+	{TokenKind_Int, "int"},
+	{TokenKind_Return, "return"},
+	{TokenKind_Typedef, "typedef"},
+	{TokenKind_Template, "template"},
+	{TokenKind_Typename, "typename"},
+	{TokenKind_Using, "using"},
+	{TokenKind_Class, "class"},
+	{TokenKind_Struct, "struct"},
+	{TokenKind_Static, "static"},
+	{TokenKind_Namespace, "namespace"},
+
+	{TokenKind_LParen, "("},
+	{TokenKind_RParen, ")"},
+	{TokenKind_LBrace, "{"},
+	{TokenKind_RBrace, "}"},
+	{TokenKind_Comma, ","},
+	{TokenKind_Semi, ";"},
+	{TokenKind_Colon, ":"},
+	{TokenKind_ColonColon, "::"},
+
+	{TokenKind_Star, "*"},
+	{TokenKind_Slash, "/"},
+	{TokenKind_Percent, "%"},
+	{TokenKind_Plus, "+"},
+	{TokenKind_Minus, "-"},
+	{TokenKind_LessLess, "<<"},
+	{TokenKind_GreaterGreater, ">>"},
+	{TokenKind_Less, "<"},
+	{TokenKind_LessEqual, "<="},
+	{TokenKind_Greater, ">"},
+	{TokenKind_GreaterEqual, ">="},
+	{TokenKind_EqualEqual, "=="},
+	{TokenKind_ExclaimEqual, "!="},
+	{TokenKind_Amp, "&"},
+	{TokenKind_Pipe, "|"},
+	{TokenKind_Caret, "^"},
+	{TokenKind_AmpAmp, "&&"},
+	{TokenKind_PipePipe, "||"},
+	{TokenKind_Question, "?"},
+	{TokenKind_Equal, "="},
+	{TokenKind_PlusEqual, "+="},
+	{TokenKind_MinusEqual, "-="},
+	{TokenKind_StarEqual, "*="},
+	{TokenKind_SlashEqual, "/="},
+	{TokenKind_PercentEqual, "%="},
+	{TokenKind_AmpEqual, "&="},
+	{TokenKind_CaretEqual, "^="},
+	{TokenKind_PipeEqual, "|="},
+	{TokenKind_GreaterGreaterEqual, ">>="},
+	{TokenKind_LessLessEqual, "<<="},
+	{TokenKind_PlusPlus, "++"},
+	{TokenKind_MinusMinus, "--"},
+	{TokenKind_Exclaim, "!"},
+	{TokenKind_Tilde, "~"},
+	{TokenKind_Period, "."},
+	{TokenKind_Arrow, "->"},
+};
+
+const int64 kNumTokenSpellings = sizeof(kTokenSpellings) / sizeof(kTokenSpellings[0]);
+const int64 kFirstSpecialTokenSpelling = 11;
+
+// Bit set over TokenKind, cheap to copy and test
+class TokenKindSet {
+public:
+	TokenKindSet() {}
+	TokenKindSet(std::initializer_list<TokenKind> kinds) {
+		for(TokenKind kind : kinds) {
+			add(kind);
+		}
+	}
+	void add(TokenKind kind) {
+		bits_[kind / 64] |= (int64(1) << (kind % 64));
+	}
+	void remove(TokenKind kind) {
+		bits_[kind / 64] &= ~(int64(1) << (kind % 64));
+	}
+	bool contains(TokenKind kind)const {
+		return (bits_[kind / 64] >> (kind % 64)) & 1;
+	}
+private:
+	static_assert(TokenKind_Count <= 128, "TokenKindSet too small");
+	int64 bits_[2] = {0, 0};
+};
+
+const char* TokenKindSpelling(TokenKind kind) {
+	switch(kind) {
+		case TokenKind_Null: return "(null)";
+		case TokenKind_Identifier: return "identifier";
+		case TokenKind_IntLiteral: return "integer literal";
+		case TokenKind_LineMarker: return "line marker";
+		case TokenKind_Directive: return "directive";
+		default: break;
+	}
+	for(int64 i=0;i<kNumTokenSpellings;++i) {
+		if(kTokenSpellings[i].kind == kind) {
+			return kTokenSpellings[i].spelling;
+		}
+	}
+	return "(unknown)";
+}
+
+// Returns TokenKind_Identifier if the word isn't a keyword
+TokenKind KeywordKind(const char* word, int64 len) {
+	for(int64 i=0;i<kFirstSpecialTokenSpelling;++i) {
+		const char* spelling = kTokenSpellings[i].spelling;
+		if(strlen(spelling) == len && memcmp(spelling, word, len) == 0) {
+			return kTokenSpellings[i].kind;
+		}
+	}
+	return TokenKind_Identifier;
+}
+
+// Longest special token starting at str, TokenKind_Null if none
+TokenKind MatchSpecialToken(const char* str, int64 avail, int64* matched_len) {
+	TokenKind ret = TokenKind_Null;
+	*matched_len = 0;
+	for(int64 i=kFirstSpecialTokenSpelling;i<kNumTokenSpellings;++i) {
+		const char* spelling = kTokenSpellings[i].spelling;
+		int64 len = strlen(spelling);
+		if(spelling[0] != str[0] || len <= *matched_len || len > avail) {
+			continue;
+		}
+		if(memcmp(spelling, str, len) == 0) {
+			ret = kTokenSpellings[i].kind;
+			*matched_len = len;
+		}
+	}
+	return ret;
+}
+
+TokenKind SpellingToKind(string spelling) {
+	for(int64 i=0;i<kNumTokenSpellings;++i) {
+		if(spelling == kTokenSpellings[i].spelling) {
+			return kTokenSpellings[i].kind;
+		}
+	}
+	return TokenKind_Null;
+}
 
 map<string, int64> GetAllInfixOperatorsWithPrecedence() {
 	int64 next_prec = 1;
@@ -54,6 +274,11 @@ map<string, int64> GetAllUnaryOperatorsWithPrecedence() {
 	return ret;
 }
 
+// Infix operators grouping right to left
+set<string> GetAllRightAssociativeOperators() {
+	return {"?", "=", "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=", ">>=", "<<="};
+}
+
 set<string> GetAllUnaryPostfixOperators() {
 	return {"++", "--", ".", "->"};
 }
@@ -75,6 +300,55 @@ set<string> GetAllSpecialTokens() {
 	return special_tokens;
 }
 
+// Indexed by TokenKind, built once from the string tables above
+struct TokenKindTables {
+	int64 infix_precedence[TokenKind_Count] = {};
+	int64 unary_precedence[TokenKind_Count] = {};
+	bool unary_postfix[TokenKind_Count] = {};
+	bool right_associative[TokenKind_Count] = {};
+
+	TokenKindTables() {
+		for(auto p : GetAllInfixOperatorsWithPrecedence()) {
+			infix_precedence[SpellingToKind(p.key)] = p.value;
+		}
+		for(auto p : GetAllUnaryOperatorsWithPrecedence()) {
+			unary_precedence[SpellingToKind(p.key)] = p.value;
+		}
+		for(string op : GetAllUnaryPostfixOperators()) {
+			unary_postfix[SpellingToKind(op)] = true;
+		}
+		for(string op : GetAllRightAssociativeOperators()) {
+			right_associative[SpellingToKind(op)] = true;
+		}
+	}
+};
+
+const TokenKindTables& GetTokenKindTables() {
+	static const TokenKindTables tables;
+	return tables;
+}
+
+// 0 if not an infix operator
+int64 InfixPrecedence(TokenKind kind) {
+	return GetTokenKindTables().infix_precedence[kind];
+}
+
+bool IsInfixOperator(TokenKind kind) {
+	return InfixPrecedence(kind) != 0;
+}
+
+bool IsUnaryOperator(TokenKind kind) {
+	return GetTokenKindTables().unary_precedence[kind] != 0;
+}
+
+bool IsUnaryPostfixOperator(TokenKind kind) {
+	return GetTokenKindTables().unary_postfix[kind];
+}
+
+bool IsRightAssociative(TokenKind kind) {
+	return GetTokenKindTables().right_associative[kind];
+}
+
 }  // namespace compiler
 }  // namespace stacklang
 
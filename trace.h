@@ -0,0 +1,210 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "types.h"
+
+// STL
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+// Trace statements compile to nothing unless built with -DSTACKLANG_TRACE=1.
+// Compiled in, each is a single level compare until enabled at runtime with
+// SetTraceLevel or the STACKLANG_TRACE environment variable, e.g.
+// STACKLANG_TRACE=expr:2,type:1 or STACKLANG_TRACE=all:1
+#ifndef STACKLANG_TRACE
+#define STACKLANG_TRACE 0
+#endif
+
+namespace stacklang {
+
+enum TraceCategory {
+	TraceCategory_Lookup,
+	TraceCategory_Type,
+	TraceCategory_Decl,
+	TraceCategory_Stmt,
+	TraceCategory_Expr,
+
+	TraceCategory_Count,
+};
+
+enum TraceLevel {
+	TraceLevel_Off,
+	// Failures and decisions
+	TraceLevel_Info,
+	// Every parse step, may dump whole subtrees
+	TraceLevel_Verbose,
+};
+
+const char* TraceCategoryName(TraceCategory category) {
+	static const char* names[TraceCategory_Count] = {
+		"lookup",
+		"type",
+		"decl",
+		"stmt",
+		"expr",
+	};
+	return names[category];
+}
+
+// Collects trace output and writes it in large chunks
+// Safe to write to from several threads.
+class TraceSink {
+public:
+	static const int64 kSize = 64*1024;
+
+	TraceSink(FILE* out = stderr) : out_(out) {}
+	TraceSink(const TraceSink& other) = delete;
+	~TraceSink() {
+		Flush();
+	}
+	TraceSink& operator=(const TraceSink& other) = delete;
+
+	// Flushes what was written so far to the previous output
+	void SetOutput(FILE* out) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		FlushLocked();
+		out_ = out;
+	}
+
+	void Printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		va_list args;
+		va_start(args, format);
+		VPrintf(format, args);
+		va_end(args);
+	}
+
+	void VPrintf(const char* format, va_list args) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		va_list retry;
+		va_copy(retry, args);
+		const int64 avail = kSize - len_;
+		const int written = vsnprintf(data_ + len_, avail, format, args);
+		if(written >= 0 && int64(written) < avail) {
+			len_ += written;
+		} else if(written >= 0) {
+			// Didn't fit, nothing past len_ counts
+			FlushLocked();
+			if(int64(written) < kSize) {
+				len_ = vsnprintf(data_, kSize, format, retry);
+			} else {
+				vfprintf(out_, format, retry);
+			}
+		}
+		va_end(retry);
+	}
+
+	void Flush() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		FlushLocked();
+	}
+
+	// Bytes waiting to be written
+	int64 Pending()const {
+		return len_;
+	}
+
+private:
+	void FlushLocked() {
+		if(len_ > 0) {
+			fwrite(data_, 1, len_, out_);
+			fflush(out_);
+			len_ = 0;
+		}
+	}
+
+	std::mutex mutex_;
+	FILE* out_;
+	char data_[kSize];
+	int64 len_ = 0;
+};
+
+TraceSink& GetTraceSink() {
+	// Flushed on exit by its destructor
+	static TraceSink sink;
+	return sink;
+}
+
+namespace internal {
+
+struct TraceLevels {
+	TraceLevel levels[TraceCategory_Count] = {};
+
+	TraceLevels() {
+		const char* spec = getenv("STACKLANG_TRACE");
+		if(spec != nullptr) {
+			Parse(spec);
+		}
+	}
+
+	// Comma separated category:level pairs, unknown categories are ignored
+	void Parse(const char* spec) {
+		while(*spec) {
+			const char* colon = strchr(spec, ':');
+			if(colon == nullptr) {
+				return;
+			}
+			const int64 name_len = colon - spec;
+			const TraceLevel level = TraceLevel(atoi(colon + 1));
+			for(int64 i=0;i<TraceCategory_Count;++i) {
+				const char* name = TraceCategoryName(TraceCategory(i));
+				const bool all = name_len == 3 && strncmp(spec, "all", 3) == 0;
+				if(all || (strlen(name) == name_len && strncmp(spec, name, name_len) == 0)) {
+					levels[i] = level;
+				}
+			}
+			const char* comma = strchr(colon, ',');
+			if(comma == nullptr) {
+				return;
+			}
+			spec = comma + 1;
+		}
+	}
+};
+
+TraceLevels& GetTraceLevels() {
+	static TraceLevels levels;
+	return levels;
+}
+
+}  // internal
+
+void SetTraceLevel(TraceCategory category, TraceLevel level) {
+	internal::GetTraceLevels().levels[category] = level;
+}
+
+void SetTraceLevels(TraceLevel level) {
+	for(int64 i=0;i<TraceCategory_Count;++i) {
+		SetTraceLevel(TraceCategory(i), level);
+	}
+}
+
+bool TraceEnabled(TraceCategory category, TraceLevel level) {
+	return internal::GetTraceLevels().levels[category] >= level;
+}
+
+};  // stacklang
+
+// TRACE(Expr, Verbose, "ParseExpr %s\n", ...)
+// Arguments are only evaluated when the category is enabled at that level.
+#if STACKLANG_TRACE
+#define TRACE(category, level, ...) \
+	do { \
+		if(::stacklang::TraceEnabled(::stacklang::TraceCategory_##category, \
+									 ::stacklang::TraceLevel_##level)) { \
+			::stacklang::GetTraceSink().Printf(__VA_ARGS__); \
+		} \
+	} while(0)
+#else
+// Still type checked, so disabled traces can't rot
+#define TRACE(category, level, ...) \
+	do { \
+		if(false) { \
+			::stacklang::GetTraceSink().Printf(__VA_ARGS__); \
+		} \
+	} while(0)
+#endif
+
+#endif//TRACE_H
@@ -0,0 +1,117 @@
+#define STACKLANG_TRACE 1
+#include "trace.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %lx != %lx\n",
+			a, b);
+	}
+}
+
+// Contents of a file written by a sink
+int64 ReadAll(FILE* f, char* out, int64 size) {
+	fflush(f);
+	rewind(f);
+	int64 len = fread(out, 1, size - 1, f);
+	out[len] = '\0';
+	return len;
+}
+
+void TestLevels() {
+	fprintf(stderr, "--- TestLevels ---\n");
+	SetTraceLevels(TraceLevel_Off);
+	Expect(!TraceEnabled(TraceCategory_Expr, TraceLevel_Info));
+
+	SetTraceLevel(TraceCategory_Expr, TraceLevel_Info);
+	Expect(TraceEnabled(TraceCategory_Expr, TraceLevel_Info));
+	Expect(!TraceEnabled(TraceCategory_Expr, TraceLevel_Verbose));
+	Expect(!TraceEnabled(TraceCategory_Type, TraceLevel_Info));
+
+	internal::TraceLevels parsed;
+	parsed.Parse("type:2,bogus:1,decl:1");
+	ExpectEq(parsed.levels[TraceCategory_Type], TraceLevel_Verbose);
+	ExpectEq(parsed.levels[TraceCategory_Decl], TraceLevel_Info);
+	ExpectEq(parsed.levels[TraceCategory_Expr], TraceLevel_Off);
+	parsed.Parse("all:1");
+	ExpectEq(parsed.levels[TraceCategory_Lookup], TraceLevel_Info);
+	ExpectEq(parsed.levels[TraceCategory_Type], TraceLevel_Info);
+	SetTraceLevels(TraceLevel_Off);
+}
+
+void TestDisabledArgsNotEvaluated() {
+	fprintf(stderr, "--- TestDisabledArgsNotEvaluated ---\n");
+	SetTraceLevels(TraceLevel_Off);
+	int64 evaluated = 0;
+	TRACE(Expr, Info, "%lu\n", ++evaluated);
+	ExpectEq(evaluated, 0);
+	ExpectEq(GetTraceSink().Pending(), 0);
+
+	SetTraceLevel(TraceCategory_Expr, TraceLevel_Verbose);
+	FILE* f = tmpfile();
+	GetTraceSink().SetOutput(f);
+	TRACE(Expr, Info, "%lu\n", ++evaluated);
+	ExpectEq(evaluated, 1);
+	ExpectEq(GetTraceSink().Pending(), 2);
+	GetTraceSink().Flush();
+	char data[16];
+	ReadAll(f, data, sizeof(data));
+	Expect(strcmp(data, "1\n") == 0);
+	GetTraceSink().SetOutput(stderr);
+	fclose(f);
+	SetTraceLevels(TraceLevel_Off);
+}
+
+void TestSinkBuffers() {
+	fprintf(stderr, "--- TestSinkBuffers ---\n");
+	FILE* f = tmpfile();
+	static char data[4*TraceSink::kSize];
+	{
+		TraceSink sink(f);
+		sink.Printf("%s %d\n", "line", 1);
+		// Nothing written until full or flushed
+		ExpectEq(ReadAll(f, data, sizeof(data)), 0);
+		ExpectEq(sink.Pending(), 7);
+
+		// Filling the buffer writes what came before
+		const int64 kLines = TraceSink::kSize / 10;
+		for(int64 i=0;i<kLines;++i) {
+			sink.Printf("%09lu\n", i);
+		}
+		Expect(ReadAll(f, data, sizeof(data)) > 0);
+		Expect(sink.Pending() < TraceSink::kSize);
+
+		// Longer than the whole buffer goes straight through
+		static char big[TraceSink::kSize + 10];
+		memset(big, 'x', sizeof(big) - 1);
+		big[sizeof(big) - 1] = '\0';
+		sink.Printf("%s", big);
+		ExpectEq(sink.Pending(), 0);
+	}
+	const int64 kLines = TraceSink::kSize / 10;
+	ExpectEq(ReadAll(f, data, sizeof(data)), 7 + kLines * 10 + TraceSink::kSize + 9);
+	Expect(strncmp(data, "line 1\n000000000\n", 17) == 0);
+	fclose(f);
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestLevels();
+	stacklang::TestDisabledArgsNotEvaluated();
+	stacklang::TestSinkBuffers();
+	return 0;
+}
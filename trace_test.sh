@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z  ./trace_test.cc -o /tmp/trace_test
+/tmp/trace_test
@@ -0,0 +1,330 @@
+#ifndef TYPE_CHECK_H
+#define TYPE_CHECK_H
+
+#include "string.h"
+#include "vector.h"
+#include "buffer.h"
+#include "hash_map.h"
+#include "utils.h"
+#include "parser.h"
+#include "ast_visitor.h"
+
+// STL
+#include <assert.h>
+
+namespace stacklang {
+namespace compiler {
+
+namespace internal {
+class TypeChecker;
+}  // internal
+
+// The type of each checked expression, canonical so types compare by
+// pointer. See CanonicalType.
+class ExprTypes {
+public:
+	// nullptr if expr wasn't checked, or is a name which isn't a value, like
+	// a callee
+	Type* Get(Expr* expr)const {
+		Type* const* type = types_.find(expr);
+		return type ? *type : nullptr;
+	}
+	// Expressions with a type
+	int64 size()const {
+		return types_.size();
+	}
+
+private:
+	friend class internal::TypeChecker;
+
+	hash_map<Expr*, Type*> types_;
+};
+
+// For messages
+string TypeName(Type* type) {
+	if(Stmt* decl = TypeAsStmt(type)) {
+		return cast<Decl>(decl)->GetName();
+	}
+	if(auto* ref_type = dyn_cast<DeclRefType>(type)) {
+		return ref_type->GetDeclRef()->GetRef()->GetName();
+	}
+	return type->DebugString(0);
+}
+
+// Only known once template arguments are
+bool IsDependentType(Type* type) {
+	type = CanonicalType(type);
+	return isa<TemplateParam>(type) || isa<UsingDecl>(type);
+}
+
+// The struct a value of type is, or nullptr
+StructDecl* StructOfType(Type* type) {
+	type = CanonicalType(type);
+	if(auto* ref_type = dyn_cast<DeclRefType>(type)) {
+		return dyn_cast<StructDecl>(ref_type->GetDeclRef()->GetRef());
+	}
+	return dyn_cast<StructDecl>(type);
+}
+
+// Whether a value of type from can initialize one of type to
+bool IsAssignableType(Type* to, Type* from) {
+	to = CanonicalType(to);
+	from = CanonicalType(from);
+	if(to == from || IsDependentType(to) || IsDependentType(from)) {
+		return true;
+	}
+	// Specializations are unique, but a template names its own as itself
+	if(isa<DeclRefType>(to) && isa<DeclRefType>(from)) {
+		Instantiation* to_instantiation = cast<DeclRefType>(to)->GetDeclRef()->GetInstantiation();
+		return to_instantiation &&
+			to_instantiation == cast<DeclRefType>(from)->GetDeclRef()->GetInstantiation();
+	}
+	StructDecl* to_struct = StructOfType(to);
+	return to_struct && to_struct == StructOfType(from);
+}
+
+namespace internal {
+
+bool IsArithmeticOp(string op) {
+	return op == "+" || op == "-" || op == "*" || op == "/" || op == "%" ||
+		op == "<<" || op == ">>" || op == "<" || op == "<=" || op == ">" ||
+		op == ">=" || op == "==" || op == "!=" || op == "&" || op == "|" ||
+		op == "^" || op == "&&" || op == "||";
+}
+
+// Type within a use of a template with args, e.g. T in Foo<int> is int
+Type* SubstituteTemplateArgs(Type* type, TemplatedDecl* decl, vector<TemplateArg> args) {
+	auto* param = dyn_cast<TemplateParam>(CanonicalType(type));
+	if(param == nullptr || decl == nullptr) {
+		return type;
+	}
+	vector<TemplateParam*> params = decl->GetTemplateParams();
+	for(int64 i=0;i<params.len() && i<args.len();++i) {
+		if(params[i] == param && args[i].type) {
+			return args[i].type;
+		}
+	}
+	return type;
+}
+
+// Types each expression once its operands are, so checking is one pass
+// over the AST which doesn't recurse
+class TypeChecker : public RecursiveASTVisitor<TypeChecker> {
+public:
+	TypeChecker(ExprTypes* types) : types_(&types->types_) {}
+
+	// Types are where expressions can't be
+	bool VisitType(Type* type) {
+		++skip_;
+		return true;
+	}
+	bool PostVisitType(Type* type) {
+		--skip_;
+		return true;
+	}
+	bool VisitFuncDecl(FuncDecl* func) {
+		funcs_.push_back(func);
+		return true;
+	}
+	bool PostVisitFuncDecl(FuncDecl* func) {
+		funcs_.pop_back();
+		return true;
+	}
+
+	bool PostVisitExpr(Expr* expr) throws(Status) {
+		if(skip_ == 0) {
+			if(Type* type = TypeOf(expr) throws()) {
+				types_->set(expr, CanonicalType(type));
+			}
+		}
+		return true;
+	}
+	bool PostVisitVarDecl(VarDecl* var) throws(Status) {
+		if(skip_ == 0 && var->GetInitType() == VarDeclInitType_Equals) {
+			Expr* init = var->GetInitParams()[0];
+			CheckAssignable(var->GetType(), Operand(init), init,
+							string("Can't initialize ") + var->GetName()) throws();
+		}
+		return true;
+	}
+	bool PostVisitReturnStmt(ReturnStmt* ret) throws(Status) {
+		if(skip_ == 0 && ret->GetValue() && !funcs_.empty()) {
+			CheckAssignable(funcs_.back()->GetReturnType(), Operand(ret->GetValue()),
+							ret->GetValue(), "Can't return") throws();
+		}
+		return true;
+	}
+
+private:
+	// Of a checked operand, which must be a value
+	Type* Operand(Expr* expr) throws(Status) {
+		Type** type = types_->find(expr);
+		if(type == nullptr) {
+			throw Status{.message = string("Not a value: ") + expr->DebugString(0),
+						 .loc = expr->GetLoc()};
+		}
+		return *type;
+	}
+
+	void CheckAssignable(Type* to, Type* from, Expr* expr, string what) throws(Status) {
+		if(!IsAssignableType(to, from)) {
+			throw Status{.message = what + " of type " + TypeName(to) + " from " +
+							TypeName(from),
+						 .loc = expr->GetLoc()};
+		}
+	}
+
+	// Whether type is int or might be
+	bool IsIntegral(Type* type) {
+		return isa<IntType>(type) || IsDependentType(type);
+	}
+
+	Type* TypeOf(Expr* expr) throws(Status) {
+		switch(expr->GetStmtKind()) {
+			case StmtKind_Literal:
+				return cast<Literal>(expr)->GetValue()->GetType();
+			case StmtKind_DeclRef: {
+				Decl* decl = cast<DeclRef>(expr)->GetRef();
+				if(auto* var = dyn_cast<VarDecl>(decl)) {
+					return var->GetType();
+				}
+				auto* param = dyn_cast<TemplateParam>(decl);
+				if(param && param->GetKind() == TemplateParamKind_Int) {
+					return IntType::Get();
+				}
+				// Functions and types aren't values
+				return nullptr;
+			}
+			case StmtKind_MemberExpr:
+				return TypeOfMember(cast<MemberExpr>(expr)) throws();
+			case StmtKind_UnaryOp: {
+				auto* op = cast<UnaryOp>(expr);
+				Type* sub = Operand(op->GetSub()) throws();
+				// There are no pointer types, so * and & leave the type alone
+				if(op->GetOp() == "*" || op->GetOp() == "&") {
+					return sub;
+				}
+				if(!IsIntegral(sub)) {
+					throw Status{.message = string("Invalid operand to unary ") + op->GetOp() +
+									" (" + TypeName(sub) + ")",
+								 .loc = expr->GetLoc()};
+				}
+				return op->GetOp() == "!" ? IntType::Get() : sub;
+			}
+			case StmtKind_CastExpr:
+				Operand(cast<CastExpr>(expr)->GetSub()) throws();
+				return cast<CastExpr>(expr)->GetToType();
+			case StmtKind_ParenExpr:
+				return Operand(cast<ParenExpr>(expr)->GetSub()) throws();
+			case StmtKind_BinaryOp:
+				return TypeOfBinaryOp(cast<BinaryOp>(expr)) throws();
+			case StmtKind_FuncCall:
+				return TypeOfCall(cast<FuncCall>(expr)) throws();
+			case StmtKind_CtorCall: {
+				auto* ctor = cast<CtorCall>(expr);
+				for(Expr* arg : ctor->GetArgs()) {
+					Operand(arg) throws();
+				}
+				return ctor->GetType();
+			}
+			default:
+				assert(false && "Not an Expr");
+				return nullptr;
+		}
+	}
+
+	Type* TypeOfMember(MemberExpr* member) throws(Status) {
+		Type* base = Operand(member->GetBase()) throws();
+		if(IsDependentType(base)) {
+			return base;
+		}
+		StructDecl* struct_decl = StructOfType(base);
+		if(struct_decl == nullptr) {
+			throw Status{.message = string("Member ") + member->GetMemberName() +
+							" of non-struct " + TypeName(base),
+						 .loc = member->GetLoc()};
+		}
+		for(Decl* decl : struct_decl->GetInnerDecls()) {
+			auto* field = dyn_cast<VarDecl>(decl);
+			if(field == nullptr || field->GetName() != member->GetMemberName()) {
+				continue;
+			}
+			vector<TemplateArg> args;
+			if(auto* ref_type = dyn_cast<DeclRefType>(base)) {
+				args = ref_type->GetDeclRef()->GetTemplateArgs();
+			}
+			return SubstituteTemplateArgs(field->GetType(), struct_decl, args);
+		}
+		throw Status{.message = string("No member ") + member->GetMemberName() + " in " +
+						TypeName(base),
+					 .loc = member->GetLoc()};
+	}
+
+	Type* TypeOfBinaryOp(BinaryOp* op) throws(Status) {
+		Type* left = Operand(op->GetLeft()) throws();
+		Type* right = Operand(op->GetRight()) throws();
+		if(op->GetOp() == ",") {
+			return right;
+		}
+		if(IsAssignmentOp(op->GetOp())) {
+			CheckAssignable(left, right, op, "Can't assign to") throws();
+			return left;
+		}
+		if(!IsIntegral(left) || !IsIntegral(right)) {
+			throw Status{.message = string("Invalid operands to binary ") + op->GetOp() +
+							" (" + TypeName(left) + " and " + TypeName(right) + ")",
+						 .loc = op->GetLoc()};
+		}
+		if(IsArithmeticOp(op->GetOp()) && isa<IntType>(left) && isa<IntType>(right)) {
+			return IntType::Get();
+		}
+		return left;
+	}
+
+	Type* TypeOfCall(FuncCall* call) throws(Status) {
+		DeclRef* callee = call->GetCallee();
+		auto* func = cast<FuncDecl>(callee->GetRef());
+		vector<VarDecl*> params = func->GetParameters();
+		vector<Expr*> args = call->GetArgs();
+		for(int64 i=0;i<args.len();++i) {
+			Type* arg = Operand(args[i]) throws();
+			if(i < params.len()) {
+				Type* param = SubstituteTemplateArgs(params[i]->GetType(), func,
+													 callee->GetTemplateArgs());
+				CheckAssignable(param, arg, args[i],
+								string("Can't pass argument ") + params[i]->GetName() +
+								" of " + func->GetName()) throws();
+			}
+		}
+		return SubstituteTemplateArgs(func->GetReturnType(), func, callee->GetTemplateArgs());
+	}
+
+	hash_map<Expr*, Type*>* types_;
+	// Inside a type
+	int64 skip_ = 0;
+	// Innermost last
+	buffer<FuncDecl*> funcs_;
+};
+
+}  // internal
+
+// Types every expression in ns, into types. Throws on operands of the
+// wrong type, unknown members and initializers, arguments or returned
+// values which don't match.
+// int is the only arithmetic type. There are no pointer types yet, so
+// unary * and & keep their operand's type. Types which depend on template
+// arguments are accepted anywhere.
+void CheckTypes(Namespace* ns, ExprTypes* types) throws(Status) {
+	internal::TypeChecker checker(types);
+	checker.TraverseNamespace(ns) throws();
+}
+
+void CheckTypes(FuncDecl* func, ExprTypes* types) throws(Status) {
+	internal::TypeChecker checker(types);
+	checker.TraverseStmt(func) throws();
+}
+
+}  // namespace compiler
+}  // namespace stacklang
+
+#endif//TYPE_CHECK_H
@@ -0,0 +1,183 @@
+#include "type_check.h"
+#include "scanner.h"
+#include "test_programs.h"
+
+#include <cstdio>
+#include <string>
+
+namespace stacklang {
+namespace {
+
+// TODO: Defines
+void Expect(bool stmt) {
+	if(!stmt) {
+		fprintf(stderr, "Expect failed!\n");
+	}
+}
+
+void ExpectEq(int64 a, int64 b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %ld != %ld\n",
+			a, b);
+	}
+}
+
+void ExpectEq(string a, string b) {
+	if(a != b) {
+		fprintf(stderr, "Expect failed! %s != %s\n",
+			a.c_str(), b.c_str());
+	}
+}
+
+const char* kSource = R"(
+typedef int Number;
+template<typename T>
+struct Foo {
+	T a;
+	int b;
+};
+template<int N>
+int bar() {
+	return N;
+}
+template<typename T>
+T first(T x, int y) {
+	return x;
+}
+int sum(int x, Number y, int z) {
+	return x + y + z;
+}
+int top(Foo<int> v, Number w) {
+	Foo<int> copy = Foo<int>(1);
+	int total = (sum((int)*w, v.a, ++w) * bar<2>() - (3), w++);
+	return first<Foo<int> >(copy, !w).b + total;
+}
+)";
+
+compiler::FuncDecl* FindFunc(const compiler::Namespace& ns, string name) {
+	return compiler::cast<compiler::FuncDecl>(ns.FindDecl(name));
+}
+
+void TestTypes() {
+	fprintf(stderr, "--- TestTypes ---\n");
+	compiler::TokenBuffer tokens = compiler::Scan(kSource);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::ExprTypes types;
+	compiler::CheckTypes(&parsed, &types);
+
+	compiler::FuncDecl* top = FindFunc(parsed, "top");
+	compiler::Type* int_type = compiler::IntType::Get();
+	compiler::Type* foo_int = top->GetParameters()[0]->GetType();
+	Expect(compiler::isa<compiler::DeclRefType>(foo_int));
+
+	// Foo<int>(1) is the parameter's type, being the same specialization
+	auto* copy = compiler::cast<compiler::VarDecl>(top->GetBody()[0]);
+	Expect(types.Get(copy->GetInitParams()[0]) == foo_int);
+
+	// Every operand is an int, with Number resolved
+	auto* total = compiler::cast<compiler::VarDecl>(top->GetBody()[1]);
+	Expect(types.Get(total->GetInitParams()[0]) == int_type);
+	auto* comma = compiler::cast<compiler::BinaryOp>(
+		compiler::cast<compiler::ParenExpr>(total->GetInitParams()[0])->GetSub());
+	Expect(types.Get(comma) == int_type);
+	auto* minus = compiler::cast<compiler::BinaryOp>(comma->GetLeft());
+	auto* times = compiler::cast<compiler::BinaryOp>(minus->GetLeft());
+	auto* call = compiler::cast<compiler::FuncCall>(times->GetLeft());
+	Expect(types.Get(call) == int_type);
+	for(compiler::Expr* arg : call->GetArgs()) {
+		Expect(types.Get(arg) == int_type);
+	}
+	// v.a is T in Foo, int in Foo<int>
+	Expect(compiler::isa<compiler::MemberExpr>(call->GetArgs()[1]));
+	Expect(types.Get(times->GetRight()) == int_type);
+	Expect(types.Get(minus->GetRight()) == int_type);
+	// The callee isn't a value
+	Expect(types.Get(call->GetCallee()) == nullptr);
+
+	// first<Foo<int> > returns a Foo<int>, whose b is an int
+	auto* ret = compiler::cast<compiler::ReturnStmt>(top->GetBody()[2]);
+	auto* plus = compiler::cast<compiler::BinaryOp>(ret->GetValue());
+	auto* member = compiler::cast<compiler::MemberExpr>(plus->GetLeft());
+	Expect(types.Get(member->GetBase()) == foo_int);
+	Expect(types.Get(member) == int_type);
+	Expect(types.Get(plus) == int_type);
+
+	// Inside templates types are as declared
+	compiler::FuncDecl* first = FindFunc(parsed, "first");
+	auto* first_ret = compiler::cast<compiler::ReturnStmt>(first->GetBody()[0]);
+	Expect(types.Get(first_ret->GetValue()) == first->GetTemplateParams()[0]);
+	compiler::FuncDecl* bar = FindFunc(parsed, "bar");
+	auto* bar_ret = compiler::cast<compiler::ReturnStmt>(bar->GetBody()[0]);
+	Expect(types.Get(bar_ret->GetValue()) == int_type);
+}
+
+// Message of the Status checking src throws, "" if none
+string CheckError(const char* src) {
+	compiler::TokenBuffer tokens = compiler::Scan(src);
+	compiler::Namespace parsed = compiler::Parse(tokens);
+	compiler::ExprTypes types;
+	try {
+		compiler::CheckTypes(&parsed, &types);
+	} catch(Status status) {
+		return status.message;
+	}
+	return "";
+}
+
+void TestErrors() {
+	fprintf(stderr, "--- TestErrors ---\n");
+	const char* kFoo = "struct Foo {\n\tint a;\n};\n";
+	ExpectEq(CheckError((std::string(kFoo) +
+		"int top(Foo v) {\n\treturn v + 1;\n}\n").c_str()),
+		"Invalid operands to binary + (Foo and int)");
+	ExpectEq(CheckError((std::string(kFoo) +
+		"int top(Foo v) {\n\treturn v.b;\n}\n").c_str()),
+		"No member b in Foo");
+	ExpectEq(CheckError((std::string(kFoo) +
+		"int top(int v) {\n\treturn v.a;\n}\n").c_str()),
+		"Member a of non-struct int");
+	ExpectEq(CheckError((std::string(kFoo) +
+		"int get(Foo v) {\n\treturn v.a;\n}\n"
+		"int top(int v) {\n\treturn get(v);\n}\n").c_str()),
+		"Can't pass argument v of get of type Foo from int");
+	ExpectEq(CheckError((std::string(kFoo) +
+		"int top(Foo v) {\n\tint x = v;\n\treturn x;\n}\n").c_str()),
+		"Can't initialize x of type int from Foo");
+	ExpectEq(CheckError((std::string(kFoo) +
+		"int top(Foo v) {\n\treturn v;\n}\n").c_str()),
+		"Can't return of type int from Foo");
+	ExpectEq(CheckError((std::string(kFoo) +
+		"int top(Foo v) {\n\treturn -v;\n}\n").c_str()),
+		"Invalid operand to unary - (Foo)");
+	ExpectEq(CheckError((std::string(kFoo) +
+		"int top(Foo v, int x) {\n\tx = v;\n\treturn x;\n}\n").c_str()),
+		"Can't assign to of type int from Foo");
+	ExpectEq(CheckError((std::string(kFoo) +
+		"int top(Foo v, int x) {\n\treturn v.a + x;\n}\n").c_str()),
+		"");
+}
+
+void TestDeepExpression() {
+	fprintf(stderr, "--- TestDeepExpression ---\n");
+	const int64 kTerms = 100000;
+	std::string src = testing::DeepSum(kTerms);
+	compiler::TokenBuffer tokens = compiler::Scan(src.c_str());
+	compiler::Namespace parsed = compiler::Parse(tokens);
+
+	compiler::ExprTypes types;
+	compiler::CheckTypes(FindFunc(parsed, "top"), &types);
+	// Terms and additions
+	ExpectEq(types.size(), 2 * kTerms - 1);
+	auto* ret = compiler::cast<compiler::ReturnStmt>(FindFunc(parsed, "top")->GetBody()[0]);
+	Expect(types.Get(ret->GetValue()) == compiler::IntType::Get());
+}
+
+}  // namespace
+}  // namespace stacklang
+
+int main() {
+	stacklang::TestTypes();
+	stacklang::TestErrors();
+	stacklang::TestDeepExpression();
+	return 0;
+}
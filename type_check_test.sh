@@ -0,0 +1,3 @@
+set -e
+clang++ -std=c++1z ./type_check_test.cc -o /tmp/type_check_test
+/tmp/type_check_test